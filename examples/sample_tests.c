@@ -3,7 +3,7 @@
  * Cross-platform (Windows + POSIX)
  *
  * Build:
- *   gcc -std=c99 -o tests sample_tests.c testcracks.c -lm
+ *   gcc -std=c99 -pthread -o tests sample_tests.c testcracks.c -lm
  *   cl /W4 sample_tests.c testcracks.c
  *
  * Run:
@@ -12,11 +12,15 @@
  *   ./tests --test "Math" "addition"     # Run single test
  *   ./tests --match "string"             # Run matching
  *   ./tests --xml results.xml            # JUnit XML output
+ *   ./tests --jobs 4                     # Run suites on 4 threads
+ *   ./tests --no-bench                   # Skip benchmarks
  *   ./tests --list                       # List all tests
  */
 
 #include "testcracks.h"
 
+#include <math.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,6 +35,7 @@
   #define tc_rmdir(p)    _rmdir(p)
 #else
   #include <sys/stat.h>
+  #include <sys/wait.h>
   #include <unistd.h>
   #define tc_getpid()    getpid()
   #define tc_mkdir(p)    mkdir(p, 0755)
@@ -56,6 +61,34 @@ TestResult test_positive_numbers(void* env) {
     return tc_assert_true(5 > 0, "should be positive");
 }
 
+static Test math_tests[] = {
+    {"addition works", test_addition_works},
+    {"string length", test_string_length},
+    {"positive numbers", test_positive_numbers},
+    {0}
+};
+static Suite math_suite = {"Math Tests", math_tests, 0, NULL, NULL};
+TC_REGISTER_SUITE(math_suite)
+
+/* ============================================================
+   REGISTERED TESTS - Added before main; the suite is named "Registered"
+   ============================================================ */
+
+TC_TEST(Registered, sum_of_squares) {
+    (void)env;
+    int sum = 0;
+    for (int i = 1; i <= 3; i++) sum += i * i;
+    return tc_assert_equal_int(14, sum, "1 + 4 + 9");
+}
+
+TC_BENCH(Registered, sum_of_squares_bench) {
+    (void)env;
+    for (uint64_t i = 0; i < iters; i++) {
+        uint64_t sq = i * i;
+        tc_do_not_optimize(sq);
+    }
+}
+
 /* ============================================================
    VALIDATION TESTS - Combining assertions (error accumulation)
    ============================================================ */
@@ -72,6 +105,21 @@ TestResult test_validate_order(void* env) {
     return r;
 }
 
+/* Same accumulation, appended in place */
+TestResult test_validate_in_place(void* env) {
+    (void)env;
+    int total = 100;
+    int item_count = 3;
+    const char* customer = "acme";
+
+    TestResult r = tc_pass();
+    tc_check_greater_int(&r, total, 0, "total positive");
+    tc_check_greater_int(&r, item_count, 0, "has items");
+    if (!tc_check_not_nil(&r, customer, "has customer")) return r;
+    tc_check_equal_str(&r, "acme", customer, "customer name");
+    return r;
+}
+
 /* Short-circuits on first failure */
 TestResult test_dependent_checks(void* env) {
     (void)env;
@@ -189,6 +237,17 @@ TestResult test_floating_point(void* env) {
     return tc_assert_in_delta(pi, calculated, 0.01, "close to pi");
 }
 
+void measure_strlen(void* ctx) {
+    size_t len = strlen((const char*)ctx);
+    tc_do_not_optimize(len);
+}
+
+TestResult test_strlen_latency(void* env) {
+    (void)env;
+    /* Median of 200 timed calls, so one slow run doesn't fail it */
+    return tc_assert_duration_under(measure_strlen, "hello world", TC_US(100), 200);
+}
+
 /* ============================================================
    STRING TESTS
    ============================================================ */
@@ -245,6 +304,191 @@ TestResult test_double_10(void* env)  { (void)env; return tc_assert_equal_int(20
 TestResult test_double_0(void* env)   { (void)env; return tc_assert_equal_int(0,   0 * 2,   "0 * 2 = 0"); }
 TestResult test_double_neg(void* env) { (void)env; return tc_assert_equal_int(-10, -5 * 2,  "-5 * 2 = -10"); }
 
+/* ============================================================
+   ARRAY TESTS - Same reports with SIMD and TC_NO_SIMD
+   `make test` runs these against both builds of testcracks.c
+   ============================================================ */
+
+/* got failed, and its first error reads message / expected / actual */
+static TestResult check_report(TestResult got, const char* message,
+                               const char* expected, const char* actual) {
+    char text[256];
+    TestResult r = tc_pass();
+    if (!tc_check_true(&r, tc_is_fail(got) && got.error_count > 0, "fails"))
+        return r;
+    tc_check_equal_str(&r, message, got.errors[0].message, "message");
+    if (expected) {
+        tc_error_expected(&got.errors[0], text, sizeof(text));
+        tc_check_equal_str(&r, expected, text, "expected window");
+    }
+    if (actual) {
+        tc_error_actual(&got.errors[0], text, sizeof(text));
+        tc_check_equal_str(&r, actual, text, "actual window");
+    }
+    return r;
+}
+
+/* Around and across the 64-byte blocks the kernels compare at once */
+static const size_t odd_lengths[] = {1, 2, 3, 15, 16, 17, 63, 64, 65,
+                                     127, 128, 129, 200};
+#define ODD_LENGTHS (sizeof(odd_lengths) / sizeof(odd_lengths[0]))
+
+TestResult test_bytes_odd_lengths(void* env) {
+    (void)env;
+    unsigned char a[200], b[200];
+    char want[96];
+    size_t i, k;
+    TestResult r = tc_pass();
+    for (i = 0; i < sizeof(a); i++) a[i] = (unsigned char)(i * 7);
+    for (k = 0; k < ODD_LENGTHS && !tc_is_fail(r); k++) {
+        size_t n = odd_lengths[k];
+        memcpy(b, a, n);
+        r = tc_combine(r, tc_assert_equal_bytes(a, b, n, "equal"));
+        b[n - 1] ^= 1;
+        snprintf(want, sizeof(want),
+                 "last: 1 of %zu bytes differ, first at index %zu", n, n - 1);
+        r = tc_combine(r, check_report(tc_assert_equal_bytes(a, b, n, "last"),
+                                       want, NULL, NULL));
+        b[n - 1] ^= 1;
+        b[0] ^= 1;
+        snprintf(want, sizeof(want),
+                 "first: 1 of %zu bytes differ, first at index 0", n);
+        r = tc_combine(r, check_report(tc_assert_equal_bytes(a, b, n, "first"),
+                                       want, NULL, NULL));
+    }
+    return r;
+}
+
+TestResult test_ints_odd_lengths(void* env) {
+    (void)env;
+    int a[200], b[200];
+    char want[96];
+    size_t i, k;
+    TestResult r = tc_pass();
+    for (i = 0; i < 200; i++) a[i] = (int)i - 100;
+    for (k = 0; k < ODD_LENGTHS && !tc_is_fail(r); k++) {
+        size_t n = odd_lengths[k];
+        memcpy(b, a, n * sizeof(int));
+        r = tc_combine(r, tc_assert_equal_array_int(a, b, n, "equal"));
+        r = tc_combine(r, tc_assert_sorted_int(a, n, "sorted"));
+        b[0] = 1000;
+        b[n - 1] = -1000;
+        snprintf(want, sizeof(want),
+                 "ends: %d of %zu elements differ, first at index 0",
+                 n > 1 ? 2 : 1, n);
+        r = tc_combine(r, check_report(
+                              tc_assert_equal_array_int(a, b, n, "ends"),
+                              want, NULL, NULL));
+        if (n > 1) {
+            snprintf(want, sizeof(want),
+                     "order: 1 of %zu elements out of order, first at index %zu",
+                     n, n - 1);
+            memcpy(b, a, n * sizeof(int));
+            b[n - 1] = -1000;
+            r = tc_combine(r, check_report(tc_assert_sorted_int(b, n, "order"),
+                                           want, NULL, NULL));
+        }
+    }
+    return r;
+}
+
+TestResult test_doubles_odd_lengths(void* env) {
+    (void)env;
+    double a[129], b[129];
+    char want[96];
+    size_t i, k;
+    TestResult r = tc_pass();
+    for (i = 0; i < 129; i++) a[i] = (double)i / 8.0;
+    for (k = 0; k < ODD_LENGTHS && odd_lengths[k] <= 129 && !tc_is_fail(r); k++) {
+        size_t n = odd_lengths[k];
+        for (i = 0; i < n; i++) b[i] = a[i] + 1e-9;
+        r = tc_combine(r, tc_assert_equal_array_double(a, b, n, 1e-6, "close"));
+        b[n - 1] += 1.0;
+        snprintf(want, sizeof(want),
+                 "last: 1 of %zu elements differ, first at index %zu", n, n - 1);
+        r = tc_combine(r, check_report(
+                              tc_assert_equal_array_double(a, b, n, 1e-6, "last"),
+                              want, NULL, NULL));
+    }
+    return r;
+}
+
+TestResult test_double_specials(void* env) {
+    (void)env;
+    const double zeros[] = {0.0, -0.0, INFINITY, -INFINITY, 1.0};
+    const double signs[] = {-0.0, 0.0, INFINITY, -INFINITY, 1.0};
+    const double nans[] = {1.0, NAN, 2.0};
+    const double flips[] = {INFINITY, 1.0, INFINITY};
+    const double maxes[] = {-INFINITY, 1.0, 1.7976931348623157e308};
+    TestResult r = tc_pass();
+
+    /* -0 equals +0, and an infinity equals itself */
+    r = tc_combine(r, tc_assert_equal_array_double(zeros, signs, 5, 0.0, "zeros"));
+    r = tc_combine(r, tc_assert_equal_array_double_ulps(zeros, signs, 5, 0, "ulps"));
+    /* NaN never matches, not even itself */
+    r = tc_combine(r, check_report(
+                          tc_assert_equal_array_double(nans, nans, 3, 1.0, "nan"),
+                          "nan: 1 of 3 elements differ, first at index 1",
+                          NULL, NULL));
+    r = tc_combine(r, check_report(
+                          tc_assert_equal_array_double_ulps(nans, nans, 3, 4, "nan"),
+                          "nan: 1 of 3 elements differ, first at index 1",
+                          NULL, NULL));
+    /* No delta bridges infinities of either sign */
+    r = tc_combine(r, check_report(
+                          tc_assert_equal_array_double(flips, maxes, 3, 1e308,
+                                                       "inf"),
+                          "inf: 2 of 3 elements differ, first at index 0",
+                          NULL, NULL));
+    /* Sorted: NaN compares as in order, -0 and +0 as equal */
+    r = tc_combine(r, tc_assert_sorted_double(nans, 3, "nan in order"));
+    r = tc_combine(r, tc_assert_sorted_double(signs, 2, "zeros in order"));
+    r = tc_combine(r, check_report(tc_assert_sorted_double(flips, 3, "inf"),
+                                   "inf: 1 of 3 elements out of order, "
+                                   "first at index 1",
+                                   NULL, NULL));
+    return r;
+}
+
+/* The window shows the elements around the first mismatch */
+TestResult test_report_windows(void* env) {
+    (void)env;
+    unsigned char a[40], b[40];
+    int x[40], y[40];
+    size_t i;
+    TestResult r = tc_pass();
+    for (i = 0; i < 40; i++) {
+        a[i] = b[i] = (unsigned char)i;
+        x[i] = y[i] = (int)i;
+    }
+
+    b[0] = 0xff;
+    r = tc_combine(r, check_report(tc_assert_equal_bytes(a, b, 40, "start"),
+        "start: 1 of 40 bytes differ, first at index 0",
+        "0: [00] 01 02 03 04 05 06 07 08 09 0a 0b 0c 0d 0e 0f ...",
+        "0: [ff] 01 02 03 04 05 06 07 08 09 0a 0b 0c 0d 0e 0f ..."));
+    b[0] = 0;
+    b[39] = 0xff;
+    r = tc_combine(r, check_report(tc_assert_equal_bytes(a, b, 40, "end"),
+        "end: 1 of 40 bytes differ, first at index 39",
+        "32: 20 21 22 23 24 25 26 [27]",
+        "32: 20 21 22 23 24 25 26 [ff]"));
+
+    y[0] = -1;
+    r = tc_combine(r, check_report(tc_assert_equal_array_int(x, y, 40, "start"),
+        "start: 1 of 40 elements differ, first at index 0",
+        "0: [0] 1 2 3 4 5 6 7 ...",
+        "0: [-1] 1 2 3 4 5 6 7 ..."));
+    y[0] = 0;
+    y[38] = -1;
+    y[39] = -2;
+    r = tc_combine(r, check_report(tc_assert_equal_array_int(x, y, 40, "end"),
+        "end: 2 of 40 elements differ, first at index 38",
+        "35: 35 36 37 [38] [39]",
+        "35: 35 36 37 [-1] [-2]"));
+    return r;
+}
+
 /* ============================================================
    FILE TESTS - Cross-platform setup/teardown
    ============================================================ */
@@ -348,93 +592,2378 @@ TestResult test_can_append_file(void* env) {
 }
 
 /* ============================================================
-   MAIN
+   BENCHMARKS
+   Body runs the operation `iters` times; the runner handles timing.
    ============================================================ */
 
-int main(int argc, char** argv) {
+void bench_string_length(void* env, uint64_t iters) {
+    (void)env;
+    const char* text = "the quick brown fox jumps over the lazy dog";
+    for (uint64_t i = 0; i < iters; i++) {
+        size_t len = strlen(text);
+        tc_do_not_optimize(len);
+        tc_clobber();
+    }
+}
 
-    Suite math_suite = tc_suite("Math Tests", (Test[]){
-        {"addition works", test_addition_works},
-        {"string length", test_string_length},
-        {"positive numbers", test_positive_numbers},
-        {0}
-    });
+/* ============================================================
+   COUNTER TESTS - Hardware counters, and runs without them
+   ============================================================ */
 
-    Suite validation_suite = tc_suite("Validation Tests", (Test[]){
-        {"validate order (accumulate)", test_validate_order},
-        {"dependent checks (short-circuit)", test_dependent_checks},
-        /* Uncomment to see failure output:
-        {"intentional failure", test_intentional_failure},
-        {"multiple failures", test_multiple_failures},
-        */
-        {0}
-    });
+TestResult test_perf_counters_unavailable(void* env) {
+    (void)env;
+    Test t = tc_test("counted", test_addition_works);
+    int ret = tc_set_perf_counters(1);
+    TestResult got = tc_run_test(&t, NULL);
+    int counted = got.metrics && (got.metrics->present & TC_METRIC_PERF);
+    TestResult r = tc_pass();
+    tc_set_perf_counters(0);
+#ifdef TC_NO_PERF
+    tc_check_equal_int(&r, -1, ret, "TC_NO_PERF leaves counters off");
+#endif
+    tc_check_true(&r, tc_is_pass(got), "test still runs");
+    tc_check_equal_int(&r, ret == 0, counted, "counted only when on");
+    got = tc_run_test(&t, NULL);
+    tc_check_true(&r, !got.metrics || !(got.metrics->present & TC_METRIC_PERF),
+                  "no counters once off");
+    return r;
+}
 
-    Suite skip_suite = tc_suite("Skip Tests", (Test[]){
-        {"posix only", test_posix_only},
-        {"windows only", test_windows_only},
-        {"skip in CI", test_skip_in_ci},
-        tc_skip_test("not implemented", "waiting for feature X"),
-        {0}
-    });
+/* ============================================================
+   ALLOC TESTS - Counted with TC_ALLOC_COUNT, or through tc_note_alloc
+   ============================================================ */
 
-    Suite collection_suite = tc_suite("Collection Tests", (Test[]){
-        {"contains and length", test_collection_contains},
-        {"empty collection", test_empty_collection},
-        {0}
-    });
+static void sum_no_alloc(void* ctx) {
+    int* n = (int*)ctx;
+    *n += 1;
+}
 
-    Suite numeric_suite = tc_suite("Numeric Tests", (Test[]){
-        {"comparisons", test_numeric_comparisons},
-        {"floating point delta", test_floating_point},
-        {0}
-    });
+static void malloc_once(void* ctx) {
+    void* volatile p = malloc(*(size_t*)ctx);
+    free(p);
+}
 
-    Suite string_suite = tc_suite("String Tests", (Test[]){
-        {"equality", test_string_equality},
-        {"not equal", test_string_not_equal},
-        {0}
-    });
+/* A pool allocator reporting two blocks and one release */
+static void pool_twice(void* ctx) {
+    (void)ctx;
+    tc_note_alloc(32);
+    tc_note_alloc(32);
+    tc_note_free(32);
+}
 
-    Suite nil_suite = tc_suite("Nil/Pointer Tests", (Test[]){
-        {"nil checking", test_nil_checking},
-        {"pointer equality", test_pointer_equality},
-        {0}
-    });
+/* Runs before pool_twice hooks this thread, so only TC_ALLOC_COUNT counts */
+TestResult test_allocs_interposed(void* env) {
+    (void)env;
+    int n = 0;
+    size_t size = 64;
+    TestResult r = tc_pass();
+    TestResult none = tc_assert_no_alloc(sum_no_alloc, &n);
+    TestResult one = tc_assert_no_alloc(malloc_once, &size);
+#ifdef TC_ALLOC_COUNT
+    tc_check_true(&r, tc_is_pass(none), "no allocation passes");
+    if (tc_check_true(&r, tc_is_fail(one), "malloc in the callback fails"))
+        tc_check_equal_str(&r, "callback made 1 allocations (64 bytes)",
+                           one.errors[0].message, "allocation counted");
+    tc_check_true(&r, tc_is_pass(tc_assert_max_allocs(malloc_once, &size, 1)),
+                  "one allocation is within one");
+#else
+    if (tc_check_true(&r, tc_is_skip(none) && tc_is_skip(one),
+                      "skips when allocations are not counted"))
+        tc_check_true(&r, none.error_count > 0 &&
+                          strstr(none.errors[0].message, "not counted") != NULL,
+                      "skip explained");
+#endif
+    tc_check_equal_int(&r, 1, n, "callback ran");
+    return r;
+}
 
-    Suite data_suite = tc_suite("Data-Driven Tests", (Test[]){
-        {"2 * 2 = 4", test_double_2},
-        {"5 * 2 = 10", test_double_5},
-        {"10 * 2 = 20", test_double_10},
-        {"0 * 2 = 0", test_double_0},
-        {"-5 * 2 = -10", test_double_neg},
-        {0}
-    });
+TestResult test_allocs_noted(void* env) {
+    (void)env;
+    TestResult r = tc_pass();
+    TestResult over = tc_pass();
+    tc_check_true(&r, tc_is_pass(tc_assert_max_allocs(pool_twice, NULL, 2)),
+                  "two noted blocks are within two");
+    tc_check_false(&r, tc_check_max_allocs(&over, pool_twice, NULL, 1),
+                   "two noted blocks exceed one");
+    if (tc_check_true(&r, tc_is_fail(over), "over the limit fails"))
+        tc_check_equal_str(&r, "callback made 2 allocations (64 bytes)",
+                           over.errors[0].message, "noted blocks counted");
+    tc_check_true(&r, tc_is_fail(tc_assert_no_alloc(pool_twice, NULL)),
+                  "noted blocks are allocations");
+    return r;
+}
 
-    Suite file_suite = tc_suite_with("File Operations",
-        file_tests_setup,
-        file_tests_teardown,
-        (Test[]){
-            {"can create file", test_can_create_file},
-            {"can read file", test_can_read_file},
-            {"can append file", test_can_append_file},
-            tc_skip_test("performance test", "too slow for regular runs"),
-            {0}
-        }
-    );
+/* ============================================================
+   ENV RESET TESTS - Each test sees the env setup left, in every mode
+   ============================================================ */
 
-    Suite* all_suites[] = {
-        &math_suite,
-        &validation_suite,
-        &skip_suite,
-        &collection_suite,
-        &numeric_suite,
-        &string_suite,
-        &nil_suite,
-        &data_suite,
-        &file_suite,
-        NULL
-    };
+typedef struct {
+    int balance;
+    int entries[4];
+} Ledger;
+
+int ledger_setup(void** env) {
+    Ledger* l = (Ledger*)calloc(1, sizeof(Ledger));
+    if (!l) return -1;
+    l->balance = 100;
+    *env = l;
+    return 0;
+}
+
+void ledger_teardown(void* env) {
+    free(env);
+}
+
+static int ledger_save(void* env, void** snapshot) {
+    Ledger* copy = (Ledger*)malloc(sizeof(Ledger));
+    if (!copy) return -1;
+    *copy = *(Ledger*)env;
+    *snapshot = copy;
+    return 0;
+}
+
+static void ledger_restore(void* env, const void* snapshot) {
+    *(Ledger*)env = *(const Ledger*)snapshot;
+}
+
+static void ledger_discard(void* snapshot) {
+    free(snapshot);
+}
+
+static const EnvSnapshot ledger_snapshot = {
+    ledger_save, ledger_restore, ledger_discard};
+
+/* Lacks restore, so its suite fails before setup */
+static const EnvSnapshot ledger_unrestorable = {ledger_save, NULL, NULL};
+
+TestResult test_ledger_spend(void* env) {
+    Ledger* l = (Ledger*)env;
+    l->balance -= 30;
+    l->entries[0] = -30;
+    return tc_pass();
+}
+
+TestResult test_ledger_untouched(void* env) {
+    Ledger* l = (Ledger*)env;
+    TestResult r = tc_pass();
+    tc_check_equal_int(&r, 100, l->balance, "balance as after setup");
+    tc_check_equal_int(&r, 0, l->entries[0], "no entry left behind");
+    return r;
+}
+
+/* ============================================================
+   FIXTURE TESTS - Session fixtures built once, suite fixtures per suite
+   ============================================================ */
+
+static int clock_value = 1, config_value = 2;
+static int clock_setups, config_setups;
+
+int clock_fixture_setup(void** value) {
+    clock_setups++;
+    printf("  [fixture] clock up\n");
+    *value = &clock_value;
+    return 0;
+}
+
+void clock_fixture_teardown(void* value) {
+    (void)value;
+    printf("  [fixture] clock down\n");
+}
+
+/* Requires clock, so finds it already up */
+int config_fixture_setup(void** value) {
+    config_setups++;
+    printf("  [fixture] config up\n");
+    *value = &config_value;
+    return tc_fixture("clock") == &clock_value ? 0 : 1;
+}
+
+void config_fixture_teardown(void* value) {
+    (void)value;
+    printf("  [fixture] config down%s\n",
+           tc_fixture("clock") ? "" : " without clock");
+}
+
+int scratch_fixture_setup(void** value) {
+    *value = calloc(1, sizeof(int));
+    return *value && tc_fixture("config") == &config_value ? 0 : 1;
+}
+
+void scratch_fixture_teardown(void* value) {
+    free(value);
+}
+
+int broken_fixture_setup(void** value) {
+    (void)value;
+    printf("  [fixture] broken up\n");
+    return 3;
+}
+
+static const Fixture clock_fixture = {
+    "clock", clock_fixture_setup, clock_fixture_teardown, TC_FIXTURE_SESSION,
+    NULL};
+static const Fixture config_fixture = {
+    "config", config_fixture_setup, config_fixture_teardown,
+    TC_FIXTURE_SESSION, "clock"};
+static const Fixture scratch_fixture = {
+    "scratch", scratch_fixture_setup, scratch_fixture_teardown,
+    TC_FIXTURE_SUITE, "config"};
+static const Fixture broken_fixture = {
+    "broken", broken_fixture_setup, NULL, TC_FIXTURE_SESSION, NULL};
+
+/* Each suite listing scratch gets its own, and shares one config */
+TestResult test_fixture_values(void* env) {
+    (void)env;
+    int* scratch = (int*)tc_fixture("scratch");
+    TestResult r = tc_pass();
+    if (!tc_check_not_nil(&r, scratch, "suite fixture")) return r;
+    tc_check_equal_int(&r, 0, (*scratch)++, "fresh for this suite");
+    tc_check_true(&r, tc_fixture("config") == &config_value, "required fixture");
+    tc_check_true(&r, tc_fixture("clock") == &clock_value,
+                  "fixture it requires in turn");
+    tc_check_equal_int(&r, 1, config_setups, "config set up once");
+    tc_check_equal_int(&r, 1, clock_setups, "clock set up once");
+    tc_check_nil(&r, tc_fixture("broken"), "unlisted fixture");
+    return r;
+}
+
+TestResult test_fixture_unlisted(void* env) {
+    (void)env;
+    TestResult r = tc_pass();
+    tc_check_nil(&r, tc_fixture("clock"), "session fixture not listed");
+    tc_check_nil(&r, tc_fixture("scratch"), "suite fixture not listed");
+    tc_check_nil(&r, tc_fixture("nonexistent"), "unknown fixture");
+    return r;
+}
+
+/* ============================================================
+   PROPERTY TESTS - Cases built from seeded draws, shrunk on failure
+   ============================================================ */
+
+static void* gen_small_int(TestGen* g) {
+    int* x = (int*)tc_alloc(sizeof(int));
+    *x = tc_gen_int(g, -1000, 1000);
+    return x;
+}
+
+TestResult prop_abs_not_negative(void* env, void* value) {
+    (void)env;
+    int x = *(int*)value;
+    return tc_assert_greater_or_equal_int(x < 0 ? -x : x, 0, "abs >= 0");
+}
+
+TestResult prop_skip_all(void* env, void* value) {
+    (void)env;
+    (void)value;
+    return tc_skip("discarded");
+}
+
+/* A case the property skips is discarded; it is neither run nor failed */
+TestResult test_property_skips(void* env) {
+    (void)env;
+    Test skips = tc_property("skips all", gen_small_int, prop_skip_all, 50);
+    Test holds = tc_property("abs", gen_small_int, prop_abs_not_negative, 50);
+    TestResult r = tc_assert_true(tc_is_pass(tc_run_test(&skips, NULL)),
+                                  "all discarded still passes");
+    return tc_combine(r, tc_assert_true(tc_is_pass(tc_run_test(&holds, NULL)),
+                                        "holding property passes"));
+}
+
+TestResult test_property_without_gen(void* env) {
+    (void)env;
+    Test t = tc_property("no gen", NULL, prop_skip_all, 10);
+    return check_report(tc_run_test(&t, NULL),
+                        "property test needs a gen and a prop "
+                        "(tc_property got NULL)",
+                        NULL, NULL);
+}
+
+/* ============================================================
+   DEMOS - Failing suites the CLI tests run with TC_SAMPLE_DEMOS set to
+   a directory holding the vector files
+   ============================================================ */
+
+static void* gen_int_pair(TestGen* g) {
+    int* xy = (int*)tc_alloc(2 * sizeof(int));
+    xy[0] = tc_gen_int(g, 0, 1000);
+    xy[1] = tc_gen_int(g, 0, 1000);
+    return xy;
+}
+
+/* Fails from 50 on; shrinks to 50 or -50 */
+TestResult prop_below_50(void* env, void* value) {
+    (void)env;
+    int x = *(int*)value;
+    return tc_assert_less_int(x < 0 ? -x : x, 50, "abs below 50");
+}
+
+/* Even cases are discarded, so no counterexample is even */
+TestResult prop_odd_below_10(void* env, void* value) {
+    (void)env;
+    int x = *(int*)value;
+    TestResult r = tc_skip_if(x % 2 == 0, "even");
+    if (tc_is_skip(r)) return r;
+    return tc_assert_less_int(x, 10, "odd below 10");
+}
+
+TestResult prop_sum_below_100(void* env, void* value) {
+    (void)env;
+    int* xy = (int*)value;
+    return tc_assert_less_int(xy[0] + xy[1], 100, "sum below 100");
+}
+
+/* The record "bad" fails; no record keeps its line ending */
+TestResult vec_not_bad(void* env, const TestVector* v) {
+    (void)env;
+    TestResult r = tc_pass();
+    tc_check_true(&r, !memchr(v->data, '\n', v->size) &&
+                      !memchr(v->data, '\r', v->size), "no line ending");
+    tc_check_true(&r, v->size != 3 || memcmp(v->data, "bad", 3) != 0,
+                  "record is not 'bad'");
+    return r;
+}
+
+/* Run only under --isolate or --isolate-suite, which contain the crash */
+TestResult demo_segfault(void* env) {
+    (void)env;
+    raise(SIGSEGV);
+    return tc_pass();
+}
+
+TestResult demo_abort(void* env) {
+    (void)env;
+    abort();
+}
+
+int demo_crash_setup(void** env) {
+    (void)env;
+    abort();
+}
+
+void demo_crash_teardown(void* env) {
+    (void)env;
+    raise(SIGSEGV);
+}
+
+TestResult demo_fails_twice(void* env) {
+    (void)env;
+    TestResult r = tc_pass();
+    tc_check_equal_int(&r, 1, 2, "first check");
+    tc_check_equal_int(&r, 3, 4, "second check");
+    return r;
+}
+
+/* Shows whether --fail-fast or --max-failures cancelled the run */
+void demo_cancel_teardown(void* env) {
+    printf("  [teardown] cancelled: %d\n", tc_cancelled(env));
+}
+
+int demo_late_setup(void** env) {
+    (void)env;
+    printf("  [setup] late suite\n");
+    return 0;
+}
+
+/* Never returns; run with a timeout */
+TestResult demo_hang(void* env) {
+    (void)env;
+    for (;;) {
+#ifdef _WIN32
+        Sleep(1000);
+#else
+        sleep(1);
+#endif
+    }
+}
+
+int demo_hang_setup(void** env) {
+    demo_hang(env);
+    return 0;
+}
+
+void demo_hang_teardown(void* env) {
+    demo_hang(env);
+}
+
+/* ============================================================
+   CLI TESTS - Rerun this binary and inspect what it did (POSIX)
+   ============================================================ */
+
+static const char* sample_self; /* argv[0] */
+
+typedef struct {
+    char dir[256];
+    char out[16384]; /* output of the last run_self */
+} CliEnv;
+
+static CliEnv cli_env;
+
+#ifndef _WIN32
+/* Single-quote s for the shell into buf */
+static const char* sh_quote(char* buf, size_t cap, const char* s) {
+    size_t n = 0;
+    buf[n++] = '\'';
+    for (; *s && n + 5 < cap; s++) {
+        if (*s == '\'') {
+            memcpy(buf + n, "'\\''", 4);
+            n += 4;
+        } else {
+            buf[n++] = *s;
+        }
+    }
+    buf[n++] = '\'';
+    buf[n] = '\0';
+    return buf;
+}
+
+/* Run exe with args (already quoted), output in e->out; exit status */
+static int run_exe(CliEnv* e, const char* exe, const char* args) {
+    char cmd[2048], quoted[512];
+    size_t n = 0, got;
+    FILE* p;
+    int status;
+
+    snprintf(cmd, sizeof(cmd), "TC_SAMPLE_DEMOS=%s %s %s 2>&1",
+             sh_quote(quoted, sizeof(quoted), e->dir), exe, args);
+    p = popen(cmd, "r");
+    if (!p) return -1;
+    while (n + 1 < sizeof(e->out) &&
+           (got = fread(e->out + n, 1, sizeof(e->out) - 1 - n, p)) > 0)
+        n += got;
+    e->out[n] = '\0';
+    status = pclose(p);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static int run_self(CliEnv* e, const char* args) {
+    char quoted[512];
+    return run_exe(e, sh_quote(quoted, sizeof(quoted), sample_self), args);
+}
+
+/* Whole file into buf, NUL-terminated; bytes read or -1 */
+static long read_file(const char* path, char* buf, size_t cap) {
+    FILE* f = fopen(path, "rb");
+    size_t n;
+    if (!f) return -1;
+    n = fread(buf, 1, cap - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return (long)n;
+}
+
+/* Write n bytes of data to name in e->dir */
+static int write_demo_file(CliEnv* e, const char* name, const char* data,
+                           size_t n) {
+    char path[512];
+    FILE* f;
+    snprintf(path, sizeof(path), "%s/%s", e->dir, name);
+    f = fopen(path, "wb");
+    if (!f) return -1;
+    fwrite(data, 1, n, f);
+    return fclose(f);
+}
+
+static int copy_file(const char* from, const char* to) {
+    char buf[65536];
+    size_t n;
+    FILE* in = fopen(from, "rb");
+    FILE* out = in ? fopen(to, "wb") : NULL;
+    if (!out) {
+        if (in) fclose(in);
+        return -1;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        fwrite(buf, 1, n, out);
+    fclose(in);
+    return fclose(out) == 0 ? chmod(to, 0755) : -1;
+}
+#endif
+
+int cli_tests_setup(void** env) {
+#ifndef _WIN32
+    snprintf(cli_env.dir, sizeof(cli_env.dir), "/tmp/testcracks_cli_%d",
+             tc_getpid());
+    if (tc_mkdir(cli_env.dir) != 0) return -1;
+#endif
+    *env = &cli_env;
+    return 0;
+}
+
+void cli_tests_teardown(void* env) {
+#ifndef _WIN32
+    CliEnv* e = (CliEnv*)env;
+    char cmd[600], quoted[512];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s",
+             sh_quote(quoted, sizeof(quoted), e->dir));
+    if (system(cmd) != 0) printf("  [teardown] Could not remove %s\n", e->dir);
+#else
+    (void)env;
+#endif
+}
+
+#ifndef _WIN32
+/* Record Math Tests with exe into map; checks the map names them */
+static TestResult check_impact_run(CliEnv* e, const char* exe,
+                                   const char* flags, const char* map) {
+    char args[1024], quoted[512], text[16384];
+    TestResult r = tc_pass();
+
+    snprintf(args, sizeof(args), "%s --impact %s --suite 'Math Tests'", flags,
+             sh_quote(quoted, sizeof(quoted), map));
+    tc_check_equal_int(&r, 0, run_exe(e, exe, args), "run passes");
+    if (strstr(e->out, "Built without TC_IMPACT"))
+        return tc_skip("built without TC_IMPACT");
+    if (!tc_check_true(&r, read_file(map, text, sizeof(text)) > 0,
+                       "map written"))
+        return r;
+    tc_check_true(&r, strncmp(text, "testcracks-impact 1\n", 20) == 0,
+                  "map header");
+    tc_check_true(&r, strstr(text, "T Math Tests\taddition works\t") != NULL,
+                  "test recorded");
+    tc_check_true(&r, strstr(text, "sample_tests.c\n") != NULL,
+                  "source file resolved");
+    return r;
+}
+#endif
+
+TestResult test_impact_records(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char map[512], quoted[512];
+    snprintf(map, sizeof(map), "%s/impact", e->dir);
+    return check_impact_run(e, sh_quote(quoted, sizeof(quoted), sample_self),
+                            "", map);
+#endif
+}
+
+TestResult test_impact_records_isolated(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char map[512], quoted[512];
+    TestResult r;
+    snprintf(map, sizeof(map), "%s/impact-isolate", e->dir);
+    r = check_impact_run(e, sh_quote(quoted, sizeof(quoted), sample_self),
+                         "--isolate", map);
+    if (tc_is_fail(r) || tc_is_skip(r)) return r;
+    snprintf(map, sizeof(map), "%s/impact-isolate-suite", e->dir);
+    return check_impact_run(e, quoted, "--isolate-suite", map);
+#endif
+}
+
+/* addr2line gets the binary's path as an argument, not through a shell */
+TestResult test_impact_quoted_path(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char exe[512], map[512], quoted[512];
+    snprintf(exe, sizeof(exe), "%s/it's \"quoted\"", e->dir);
+    snprintf(map, sizeof(map), "%s/impact-quoted", e->dir);
+    if (copy_file(sample_self, exe) != 0)
+        return tc_fail("could not copy the test binary");
+    return check_impact_run(e, sh_quote(quoted, sizeof(quoted), exe), "",
+                            map);
+#endif
+}
+
+#ifndef _WIN32
+/* Copy of this binary at dir/name, quoted for the shell into exe */
+static int copy_self(CliEnv* e, const char* name, char* exe, size_t cap) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", e->dir, name);
+    if (copy_file(sample_self, path) != 0) return -1;
+    sh_quote(exe, cap, path);
+    return 0;
+}
+
+static int append_byte(const char* exe_unquoted) {
+    FILE* f = fopen(exe_unquoted, "ab");
+    if (!f) return -1;
+    fputc(0, f);
+    return fclose(f);
+}
+#endif
+
+TestResult test_cache_hits(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char exe[512], args[600];
+    TestResult r = tc_pass();
+    if (copy_self(e, "cache-hits", exe, sizeof(exe)) != 0)
+        return tc_fail("could not copy the test binary");
+    snprintf(args, sizeof(args), "--cache '%s/cache-hits.d' --suite 'Math Tests'",
+             e->dir);
+
+    tc_check_equal_int(&r, 0, run_exe(e, exe, args), "first run passes");
+    tc_check_true(&r, strstr(e->out, "cached") == NULL, "first run misses");
+    tc_check_equal_int(&r, 0, run_exe(e, exe, args), "second run passes");
+    tc_check_true(&r, strstr(e->out, "(3 cached)") != NULL, "second run hits");
+    return r;
+#endif
+}
+
+/* Any rebuild changes the binary's hash, which drops the whole cache */
+TestResult test_cache_binary_change(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char exe[512], path[512], args[600];
+    TestResult r = tc_pass();
+    if (copy_self(e, "cache-rebuilt", exe, sizeof(exe)) != 0)
+        return tc_fail("could not copy the test binary");
+    snprintf(path, sizeof(path), "%s/cache-rebuilt", e->dir);
+    snprintf(args, sizeof(args),
+             "--cache '%s/cache-rebuilt.d' --suite 'Math Tests'", e->dir);
+
+    tc_check_equal_int(&r, 0, run_exe(e, exe, args), "first run passes");
+    if (!tc_check_equal_int(&r, 0, append_byte(path), "binary changed"))
+        return r;
+    tc_check_equal_int(&r, 0, run_exe(e, exe, args), "rebuilt run passes");
+    tc_check_true(&r, strstr(e->out, "cached") == NULL, "rebuilt run misses");
+    tc_check_equal_int(&r, 0, run_exe(e, exe, args), "next run passes");
+    tc_check_true(&r, strstr(e->out, "(3 cached)") != NULL,
+                  "next run hits again");
+    return r;
+#endif
+}
+
+#ifndef _WIN32
+/* Counterexample reported for test in out, into buf; 0 if there is one */
+static int counterexample(const char* out, const char* test, char* buf,
+                          size_t cap) {
+    const char* at = strstr(out, test);
+    size_t n;
+    if (!at || !(at = strstr(at, "counterexample (shrunk "))) return -1;
+    if (!(at = strstr(at, "): "))) return -1;
+    at += 3;
+    n = strcspn(at, "\n");
+    if (n >= cap) n = cap - 1;
+    memcpy(buf, at, n);
+    buf[n] = '\0';
+    return 0;
+}
+
+/* The lines property failures print, in report order */
+static void property_lines(const char* out, char* buf, size_t cap) {
+    size_t used = 0;
+    const char* line = out;
+    buf[0] = '\0';
+    while (*line) {
+        size_t n = strcspn(line, "\n");
+        char one[512];
+        snprintf(one, sizeof(one), "%.*s", (int)n, line);
+        if ((strstr(one, "property failed") || strstr(one, "counterexample")) &&
+            used + n + 2 < cap) {
+            memcpy(buf + used, line, n);
+            used += n;
+            buf[used++] = '\n';
+            buf[used] = '\0';
+        }
+        line += n;
+        if (*line) line++;
+    }
+}
+#endif
+
+TestResult test_property_shrinks(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char got[64];
+    int a = 0, b = 0;
+    TestResult r = tc_pass();
+    tc_check_equal_int(&r, 1, run_self(e, "--seed 7 --suite 'Property Demos'"),
+                       "demos fail");
+    if (!tc_check_equal_int(&r, 0, counterexample(e->out, "abs below 50", got,
+                                                  sizeof(got)),
+                            "abs counterexample shown"))
+        return r;
+    tc_check_true(&r, strcmp(got, "50") == 0 || strcmp(got, "-50") == 0,
+                  "abs shrinks to the boundary");
+    if (!tc_check_equal_int(&r, 0, counterexample(e->out, "sum below 100", got,
+                                                  sizeof(got)),
+                            "sum counterexample shown"))
+        return r;
+    tc_check_equal_int(&r, 2, sscanf(got, "%d, %d", &a, &b), "two draws");
+    tc_check_equal_int(&r, 100, a + b, "sum shrinks to the boundary");
+    return r;
+#endif
+}
+
+TestResult test_property_seed_replays(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    static char first[4096], second[4096];
+    const char* seeds[] = {"7", "12345", "0xdeadbeef"};
+    char args[128], replay[64];
+    TestResult r = tc_pass();
+    size_t i;
+    for (i = 0; i < sizeof(seeds) / sizeof(seeds[0]); i++) {
+        snprintf(args, sizeof(args), "--seed %s --suite 'Property Demos'",
+                 seeds[i]);
+        run_self(e, args);
+        property_lines(e->out, first, sizeof(first));
+        run_self(e, args);
+        property_lines(e->out, second, sizeof(second));
+        tc_check_true(&r, first[0] != '\0', "failures reported");
+        tc_check_equal_str(&r, first, second, "same counterexamples");
+        snprintf(replay, sizeof(replay), "replay with --seed %llu",
+                 strtoull(seeds[i], NULL, 0));
+        tc_check_true(&r, strstr(first, replay) != NULL, "seed printed");
+    }
+    return r;
+#endif
+}
+
+/* Each case comes from the test's own stream, whatever thread runs it */
+TestResult test_property_jobs(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    static char serial[4096], parallel[4096];
+    TestResult r = tc_pass();
+    run_self(e, "--seed 99 --jobs 1 --suite 'Property Demos'");
+    property_lines(e->out, serial, sizeof(serial));
+    run_self(e, "--seed 99 --jobs 4 --suite 'Property Demos'");
+    property_lines(e->out, parallel, sizeof(parallel));
+    tc_check_true(&r, serial[0] != '\0', "failures reported");
+    tc_check_equal_str(&r, serial, parallel, "--jobs 4 matches --jobs 1");
+    run_self(e, "--seed 99 --isolate --suite 'Property Demos'");
+    property_lines(e->out, parallel, sizeof(parallel));
+    tc_check_equal_str(&r, serial, parallel, "--isolate matches too");
+    return r;
+#endif
+}
+
+TestResult test_property_skips_discarded(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char args[128], got[64];
+    TestResult r = tc_pass();
+    int seed;
+    for (seed = 1; seed <= 5; seed++) {
+        int x = 0;
+        snprintf(args, sizeof(args), "--seed %d --suite 'Property Demos'", seed);
+        run_self(e, args);
+        if (!tc_check_equal_int(&r, 0, counterexample(e->out, "odd below 10", got,
+                                                      sizeof(got)),
+                                "counterexample shown"))
+            return r;
+        tc_check_equal_int(&r, 1, sscanf(got, "%d", &x), "one draw");
+        tc_check_true(&r, x % 2 != 0 && x >= 10, "odd and failing");
+    }
+    return r;
+#endif
+}
+
+/* Blank lines, CRLF and a last line without \n: lines[0..3] */
+static const char demo_lines[] = "a\r\n\nb\n\r\nbad\nc";
+/* abc, an empty record, bad: sized[0..2] */
+static const char demo_sized[] = "\3\0\0\0abc\0\0\0\0\3\0\0\0bad";
+
+static int write_demo_vectors(CliEnv* e) {
+    if (write_demo_file(e, "lines.txt", demo_lines, sizeof(demo_lines) - 1))
+        return -1;
+    return write_demo_file(e, "sized.bin", demo_sized, sizeof(demo_sized) - 1);
+}
+
+TestResult test_vectors_one_case_per_record(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    TestResult r = tc_pass();
+    if (!tc_check_equal_int(&r, 0, write_demo_vectors(e), "vectors written"))
+        return r;
+    tc_check_equal_int(&r, 0, run_self(e, "--suite 'Vector Demos' --list"),
+                       "--list exits 0");
+    tc_check_true(&r, strstr(e->out, "- lines[3]\n") != NULL,
+                  "four lines listed");
+    tc_check_true(&r, strstr(e->out, "- lines[4]") == NULL,
+                  "blank lines are not records");
+    tc_check_true(&r, strstr(e->out, "- sized[2]\n") != NULL &&
+                      strstr(e->out, "- sized[3]") == NULL,
+                  "three sized records listed");
+    tc_check_equal_int(&r, 1, run_self(e, "--suite 'Vector Demos'"),
+                       "run fails");
+    tc_check_true(&r, strstr(e->out, "5/7 passed, 2 failed") != NULL,
+                  "only the 'bad' records fail");
+    return r;
+#endif
+}
+
+TestResult test_vectors_truncated(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    static const char cut[] = "\3\0\0\0abc\12\0\0\0bad";
+    TestResult r = tc_pass();
+    if (!tc_check_equal_int(&r, 0, write_demo_vectors(e), "vectors written") ||
+        !tc_check_equal_int(&r, 0, write_demo_file(e, "sized.bin", cut,
+                                                   sizeof(cut) - 1),
+                            "truncated file written"))
+        return r;
+    tc_check_equal_int(&r, 1, run_self(e, "--test 'Vector Demos' sized"),
+                       "run fails");
+    tc_check_true(&r, strstr(e->out, "sized.bin' end inside a record") != NULL,
+                  "reason reported");
+    tc_check_true(&r, strstr(e->out, "0/1 passed, 1 failed") != NULL,
+                  "one test, not one per record");
+    return r;
+#endif
+}
+
+TestResult test_vectors_select_cases(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    static char first[sizeof(cli_env.out)];
+    TestResult r = tc_pass();
+    int k;
+    if (!tc_check_equal_int(&r, 0, write_demo_vectors(e), "vectors written"))
+        return r;
+    tc_check_equal_int(&r, 1, run_self(e, "--suite 'Vector Demos' "
+                                          "--match 'lines[2]'"),
+                       "the 'bad' line fails");
+    tc_check_true(&r, strstr(e->out, "0/1 passed, 1 failed") != NULL,
+                  "--match runs one case");
+    tc_check_equal_int(&r, 0, run_self(e, "--suite 'Vector Demos' "
+                                          "--match 'lines[3]'"),
+                       "the last line passes");
+
+    /* The shards list every case exactly once between them */
+    run_self(e, "--suite 'Vector Demos' --list --shard 1/2");
+    snprintf(first, sizeof(first), "%s", e->out);
+    run_self(e, "--suite 'Vector Demos' --list --shard 2/2");
+    for (k = 0; k < 7; k++) {
+        char name[32];
+        int in_first, in_second;
+        snprintf(name, sizeof(name), "- %s[%d]\n", k < 4 ? "lines" : "sized",
+                 k < 4 ? k : k - 4);
+        in_first = strstr(first, name) != NULL;
+        in_second = strstr(e->out, name) != NULL;
+        tc_check_equal_int(&r, 1, in_first + in_second, name);
+    }
+    return r;
+#endif
+}
+
+/* Math Tests into e->dir/perf.xml and perf.ndjson, read back into xml */
+static int run_perf_reports(CliEnv* e, const char* extra, char* xml,
+                            size_t cap) {
+    char args[1536], q_xml[512], q_json[512], path[512];
+    int ret;
+    long n;
+    snprintf(path, sizeof(path), "%s/perf.xml", e->dir);
+    sh_quote(q_xml, sizeof(q_xml), path);
+    snprintf(path, sizeof(path), "%s/perf.ndjson", e->dir);
+    sh_quote(q_json, sizeof(q_json), path);
+    snprintf(args, sizeof(args), "--suite 'Math Tests' %s --xml %s --ndjson %s",
+             extra, q_xml, q_json);
+    ret = run_self(e, args);
+    snprintf(path, sizeof(path), "%s/perf.xml", e->dir);
+    n = read_file(path, xml, cap / 2);
+    snprintf(path, sizeof(path), "%s/perf.ndjson", e->dir);
+    if (n < 0 || read_file(path, xml + n, cap - (size_t)n) < 0) return -1;
+    return ret;
+}
+
+TestResult test_perf_counters_absent(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    static char reports[65536];
+    TestResult r = tc_pass();
+    tc_check_equal_int(&r, 0, run_perf_reports(e, "", reports, sizeof(reports)),
+                       "run without counters");
+    tc_check_true(&r, strstr(reports, "cycles") == NULL &&
+                      strstr(reports, "ipc") == NULL,
+                  "no counter fields when off");
+    tc_check_equal_int(&r, 0, run_perf_reports(e, "--perf-counters", reports,
+                                               sizeof(reports)),
+                       "run with --perf-counters");
+    if (strstr(e->out, "Hardware counters are unavailable")) {
+        tc_check_true(&r, strstr(reports, "cycles") == NULL &&
+                          strstr(reports, "ipc") == NULL,
+                      "no counter fields when unavailable");
+    } else {
+        tc_check_true(&r, strstr(reports, "cycles") != NULL,
+                      "counter fields when available");
+    }
+    return r;
+#endif
+}
+
+#ifndef _WIN32
+/* Skip one JSON value at *p; 0 if it is well formed */
+static int json_value(const char** p) {
+    const char* s = *p + strspn(*p, " \t\r\n");
+    if (*s == '{' || *s == '[') {
+        char close = *s == '{' ? '}' : ']';
+        s += 1 + strspn(s + 1, " \t\r\n");
+        while (*s != close) {
+            if (close == '}') {
+                if (*s != '"' || json_value(&s) != 0) return -1;
+                s += strspn(s, " \t\r\n");
+                if (*s++ != ':') return -1;
+            }
+            if (json_value(&s) != 0) return -1;
+            s += strspn(s, " \t\r\n");
+            if (*s == ',') s++;
+            else if (*s != close) return -1;
+        }
+        s++;
+    } else if (*s == '"') {
+        for (s++; *s != '"'; s++) {
+            if (*s == '\0' || (unsigned char)*s < 0x20) return -1;
+            if (*s == '\\' && *++s == '\0') return -1;
+        }
+        s++;
+    } else if (strncmp(s, "true", 4) == 0 || strncmp(s, "null", 4) == 0) {
+        s += 4;
+    } else if (strncmp(s, "false", 5) == 0) {
+        s += 5;
+    } else {
+        char* end;
+        strtod(s, &end);
+        if (end == s) return -1;
+        s = end;
+    }
+    *p = s;
+    return 0;
+}
+
+static int json_valid(const char* s) {
+    return json_value(&s) == 0 && s[strspn(s, " \t\r\n")] == '\0';
+}
+
+/* Tags in s nest and close, one root element; enough for our own JUnit */
+static int xml_valid(const char* s) {
+    const char* open[32];
+    size_t len[32];
+    int depth = 0, roots = 0;
+    while ((s = strchr(s, '<')) != NULL) {
+        const char* name;
+        size_t n;
+        if (strncmp(s, "<?", 2) == 0) {
+            if ((s = strstr(s, "?>")) == NULL) return 0;
+            continue;
+        }
+        if (strncmp(s, "<!--", 4) == 0) {
+            if ((s = strstr(s, "-->")) == NULL) return 0;
+            continue;
+        }
+        name = s + 1 + (s[1] == '/');
+        n = strcspn(name, " \t\r\n/>");
+        if (n == 0) return 0;
+        for (s = name + n; *s && *s != '>'; s++)
+            if (*s == '"' && (s = strchr(s + 1, '"')) == NULL) return 0;
+        if (*s != '>') return 0;
+        if (name[-1] == '/') {
+            if (depth == 0 || len[depth - 1] != n ||
+                strncmp(open[depth - 1], name, n) != 0)
+                return 0;
+            depth--;
+        } else if (s[-1] != '/') {
+            if (depth == 32) return 0;
+            roots += depth == 0;
+            open[depth] = name;
+            len[depth++] = n;
+        } else {
+            roots += depth == 0;
+        }
+    }
+    return depth == 0 && roots == 1;
+}
+
+/* Every span's "tid" is below tracks */
+static int trace_tids_below(const char* trace, int tracks) {
+    const char* at = trace;
+    while ((at = strstr(at, "\"tid\":")) != NULL) {
+        at += 6;
+        if (atoi(at) < 0 || atoi(at) >= tracks) return 0;
+    }
+    return 1;
+}
+
+static int count_of(const char* s, const char* what) {
+    int n = 0;
+    while ((s = strstr(s, what)) != NULL) {
+        n++;
+        s += strlen(what);
+    }
+    return n;
+}
+
+/* Trace a multi-suite run with extra args into trace; -1 if unreadable */
+static long run_traced(CliEnv* e, const char* extra, char* trace, size_t cap) {
+    char args[1024], path[512], quoted[512];
+    snprintf(path, sizeof(path), "%s/trace.json", e->dir);
+    snprintf(args, sizeof(args), "%s --exclude 'CLI Tests/*' "
+             "--exclude 'Benchmarks/*' --exclude '*Demos/*' --trace %s", extra,
+             sh_quote(quoted, sizeof(quoted), path));
+    run_self(e, args);
+    return read_file(path, trace, cap);
+}
+#endif
+
+TestResult test_trace_isolated(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    static char trace[262144];
+    TestResult r = tc_pass();
+
+    if (!tc_check_true(&r, run_traced(e, "--jobs 3 --isolate", trace,
+                                      sizeof(trace)) > 0,
+                       "trace written"))
+        return r;
+    tc_check_true(&r, json_valid(trace), "--isolate trace is valid JSON");
+    tc_check_equal_int(&r, 3, count_of(trace, "\"thread_name\""),
+                       "one track per worker");
+    tc_check_true(&r, trace_tids_below(trace, 3), "spans on those tracks");
+    tc_check_true(&r, strstr(trace, "{\"name\":\"addition works\","
+                                    "\"cat\":\"test\"") != NULL,
+                  "isolated test spans kept");
+
+    if (!tc_check_true(&r, run_traced(e, "--jobs 2 --isolate-suite", trace,
+                                      sizeof(trace)) > 0,
+                       "trace written"))
+        return r;
+    tc_check_true(&r, json_valid(trace), "--isolate-suite trace is valid JSON");
+    tc_check_equal_int(&r, 2, count_of(trace, "\"thread_name\""),
+                       "one track per worker");
+    tc_check_true(&r, trace_tids_below(trace, 2), "spans on those tracks");
+    tc_check_true(&r, strstr(trace, "{\"name\":\"can read file\","
+                                    "\"cat\":\"test\"") != NULL,
+                  "suite child test spans kept");
+    tc_check_true(&r, strstr(trace, "\"cat\":\"setup\"") != NULL &&
+                      strstr(trace, "\"cat\":\"teardown\"") != NULL,
+                  "suite child setup and teardown spans kept");
+    return r;
+#endif
+}
+
+/* Pretty-printed, keys reordered, samples far below any real run */
+static const char fast_baseline[] =
+    "{\n"
+    "  \"benchmarks\": [\n"
+    "    {\n"
+    "      \"sample_ns\": [\n"
+    "        0.001, 0.001, 0.001, 0.001, 0.001,\n"
+    "        0.001, 0.001, 0.001, 0.001, 0.001\n"
+    "      ],\n"
+    "      \"name\": \"strlen 43 bytes\",\n"
+    "      \"extra\": {\"nested\": [1, \"\\u00e9\"]},\n"
+    "      \"suite\": \"Benchmarks\"\n"
+    "    }\n"
+    "  ]\n"
+    "}\n";
+
+TestResult test_bench_baseline_format(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char args[1024], path[512], quoted[512];
+    TestResult r = tc_pass();
+
+    snprintf(path, sizeof(path), "%s/baseline.json", e->dir);
+    sh_quote(quoted, sizeof(quoted), path);
+    snprintf(args, sizeof(args), "--bench --suite Benchmarks --bench-compare %s",
+             quoted);
+    if (!tc_check_equal_int(&r, 0, write_demo_file(e, "baseline.json",
+                                                   fast_baseline,
+                                                   sizeof(fast_baseline) - 1),
+                            "baseline written"))
+        return r;
+    tc_check_equal_int(&r, 1, run_self(e, args), "reformatted baseline gates");
+    tc_check_true(&r, strstr(e->out, "benchmark regression") != NULL,
+                  "regression reported");
+
+    write_demo_file(e, "baseline.json", "{\"benchmarks\": []}", 18);
+    tc_check_equal_int(&r, 1, run_self(e, args), "empty baseline rejected");
+    tc_check_true(&r, strstr(e->out, "holds no benchmarks") != NULL,
+                  "empty baseline explained");
+
+    write_demo_file(e, "baseline.json", "[{\"suite\": ", 11);
+    tc_check_equal_int(&r, 1, run_self(e, args), "broken baseline rejected");
+
+    tc_check_equal_int(&r, 1, run_self(e, "--bench --threshold 5x"),
+                       "--threshold 5x rejected");
+    tc_check_true(&r, strstr(e->out, "--threshold expects a percentage") != NULL,
+                  "--threshold explained");
+    return r;
+#endif
+}
+
+TestResult test_isolate_crashes(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    const char* modes[] = {"--isolate", "--isolate-suite", "--isolate -j 2"};
+    char args[128];
+    TestResult r = tc_pass();
+    size_t i;
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        snprintf(args, sizeof(args), "%s --suite 'Crash Demos'", modes[i]);
+        tc_check_equal_int(&r, 1, run_self(e, args), modes[i]);
+        tc_check_equal_int(&r, 2, count_of(e->out, "test process crashed"),
+                           "both crashes reported");
+        tc_check_true(&r, strstr(e->out, "killed by signal 11") != NULL &&
+                          strstr(e->out, "killed by signal 6") != NULL,
+                      "signals named");
+        tc_check_true(&r, strstr(e->out, "1/3 passed, 2 failed") != NULL,
+                      "the next test still runs");
+    }
+    return r;
+#endif
+}
+
+TestResult test_isolate_stage_crashes(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char args[1024], path[512], quoted[512], xml[8192];
+    TestResult r = tc_pass();
+
+    tc_check_equal_int(&r, 1, run_self(e, "--isolate-suite "
+                                          "--suite 'Crash Setup Demos'"),
+                       "setup crash fails the run");
+    tc_check_equal_int(&r, 2, count_of(e->out, "setup crashed"),
+                       "every test fails with the setup");
+    tc_check_true(&r, strstr(e->out, "0/2 passed, 2 failed") != NULL,
+                  "setup crash summary");
+
+    snprintf(path, sizeof(path), "%s/teardown.xml", e->dir);
+    snprintf(args, sizeof(args), "--isolate-suite --suite 'Crash Teardown "
+             "Demos' --xml %s", sh_quote(quoted, sizeof(quoted), path));
+    tc_check_equal_int(&r, 1, run_self(e, args), "teardown crash fails the run");
+    tc_check_true(&r, strstr(e->out, "teardown crashed") != NULL,
+                  "teardown crash reported");
+    tc_check_true(&r, strstr(e->out, "1/2 passed, 0 failed, 0 skipped, "
+                                     "1 errored") != NULL,
+                  "teardown crash is a suite error");
+    if (!tc_check_true(&r, read_file(path, xml, sizeof(xml)) > 0, "xml written"))
+        return r;
+    tc_check_true(&r, strstr(xml, "name=\"(teardown)\"") != NULL,
+                  "(teardown) testcase in the XML");
+    return r;
+#endif
+}
+
+TestResult test_hang_timeout(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char args[1024], xml_path[512], tap_path[512], quoted[2][512];
+    char xml[8192], tap[8192];
+    TestResult r = tc_pass();
+
+    snprintf(xml_path, sizeof(xml_path), "%s/hang.xml", e->dir);
+    snprintf(tap_path, sizeof(tap_path), "%s/hang.tap", e->dir);
+    snprintf(args, sizeof(args), "--timeout 100ms --suite 'Hang Demos' "
+             "--xml %s --tap %s", sh_quote(quoted[0], sizeof(quoted[0]), xml_path),
+             sh_quote(quoted[1], sizeof(quoted[1]), tap_path));
+    tc_check_equal_int(&r, 1, run_self(e, args), "watchdog fails the run");
+    tc_check_true(&r, strstr(e->out, "Test 'hangs' hangs past its 100.00ms "
+                                     "timeout") != NULL,
+                  "watchdog names the test");
+    tc_check_equal_int(&r, 1, count_of(e->out, "test timed out"),
+                       "the hung test timed out");
+    tc_check_true(&r, strstr(e->out, "1/3 passed, 1 failed, 1 skipped "
+                                     "(1 not run)") != NULL,
+                  "the rest is not run");
+    tc_check_true(&r, strstr(e->out, "=== Hang Demos (0.00ms) ===") == NULL,
+                  "flushed suite is timed");
+    if (tc_check_true(&r, read_file(xml_path, xml, sizeof(xml)) > 0,
+                      "xml written")) {
+        tc_check_true(&r, xml_valid(xml), "xml is well-formed");
+        tc_check_true(&r, strstr(xml, "<testsuites tests=\"3\" failures=\"1\"")
+                          != NULL,
+                      "xml totals patched");
+        tc_check_true(&r, strstr(xml, "not_run") != NULL,
+                      "not-run test marked in the xml");
+    }
+    if (tc_check_true(&r, read_file(tap_path, tap, sizeof(tap)) > 0,
+                      "tap written")) {
+        tc_check_true(&r, strstr(tap, "\n1..3\n") != NULL, "tap plan");
+        tc_check_equal_int(&r, 3, count_of(tap, "ok "), "every point written");
+        tc_check_equal_int(&r, 1, count_of(tap, "not ok "), "one failing point");
+    }
+
+    tc_check_equal_int(&r, 1, run_self(e, "--suite 'Own Timeout Demos'"),
+                       "per-test timeout_ns fails the run");
+    tc_check_true(&r, strstr(e->out, "past its 100.00ms timeout") != NULL,
+                  "timeout_ns is the limit");
+    return r;
+#endif
+}
+
+TestResult test_hang_stage_timeout(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    const char* modes[] = {"", "--isolate-suite"};
+    char args[256];
+    TestResult r = tc_pass();
+    size_t i;
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        snprintf(args, sizeof(args), "%s --timeout 100ms "
+                 "--suite 'Hang Setup Demos'", modes[i]);
+        tc_check_equal_int(&r, 1, run_self(e, args), "setup hang fails the run");
+        tc_check_true(&r, strstr(e->out, "setup timed out") != NULL,
+                      "setup timeout reported");
+        tc_check_true(&r, strstr(e->out, "0/1 passed, 1 failed") != NULL,
+                      "its test fails");
+
+        snprintf(args, sizeof(args), "%s --timeout 100ms "
+                 "--suite 'Hang Teardown Demos'", modes[i]);
+        tc_check_equal_int(&r, 1, run_self(e, args),
+                           "teardown hang fails the run");
+        tc_check_true(&r, strstr(e->out, "teardown timed out") != NULL,
+                      "teardown timeout reported");
+        tc_check_true(&r, strstr(e->out, "1/2 passed, 0 failed, 0 skipped, "
+                                         "1 errored") != NULL,
+                      "teardown timeout is a suite error");
+    }
+    return r;
+#endif
+}
+
+TestResult test_isolate_hang_killed(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    TestResult r = tc_pass();
+    uint64_t start = tc_now_ns();
+    tc_check_equal_int(&r, 1, run_self(e, "--isolate --timeout 100ms "
+                                          "--suite 'Hang Demos'"),
+                       "killed child fails the run");
+    tc_check_true(&r, tc_now_ns() - start < TC_MS(5000),
+                  "child killed at its limit");
+    tc_check_equal_int(&r, 1, count_of(e->out, "test timed out"),
+                       "the hung test timed out");
+    tc_check_true(&r, strstr(e->out, "2/3 passed, 1 failed") != NULL,
+                  "the next test still runs");
+    return r;
+#endif
+}
+
+TestResult test_env_reset_isolated(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    TestResult r = tc_pass();
+    tc_check_equal_int(&r, 0, run_self(e, "--isolate-suite "
+                                          "--include 'Env * Tests/*'"),
+                       "every mode resets env in a suite's child");
+    tc_check_true(&r, strstr(e->out, "12/12 passed") != NULL,
+                  "all three suites ran");
+    return r;
+#endif
+}
+
+TestResult test_env_snapshot_rejected(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    const char* modes[] = {"", "--isolate-suite"};
+    char args[128];
+    TestResult r = tc_pass();
+    size_t i;
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        snprintf(args, sizeof(args), "%s --suite 'Bad Snapshot Demos'",
+                 modes[i]);
+        tc_check_equal_int(&r, 1, run_self(e, args), "suite fails");
+        tc_check_true(&r, strstr(e->out, "Suite 'Bad Snapshot Demos' has an "
+                                         "EnvSnapshot without restore") != NULL,
+                      "missing hook named");
+        tc_check_true(&r, strstr(e->out, "0/4 passed") != NULL,
+                      "no test runs");
+    }
+    return r;
+#endif
+}
+
+/* at is found in s, and before is found before it */
+static int found_after(const char* s, const char* before, const char* at) {
+    const char* b = strstr(s, before);
+    const char* a = strstr(s, at);
+    return b && a && b < a;
+}
+
+TestResult test_fixtures_shared(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    TestResult r = tc_pass();
+    tc_check_equal_int(&r, 0, run_self(e, "-j 4 --include '*Fixture Tests/*' "
+                                          "--include 'Unfixtured Tests/*'"),
+                       "fixture suites pass in parallel");
+    tc_check_true(&r, strstr(e->out, "3/3 passed") != NULL,
+                  "every fixture suite ran");
+    tc_check_equal_int(&r, 1, count_of(e->out, "[fixture] clock up"),
+                       "one session clock for all workers");
+    tc_check_equal_int(&r, 1, count_of(e->out, "[fixture] config up"),
+                       "one session config for all workers");
+    tc_check_true(&r, found_after(e->out, "clock up", "config up"),
+                  "required fixture set up first");
+    tc_check_true(&r, found_after(e->out, "config down\n", "clock down"),
+                  "required fixture torn down after");
+
+    tc_check_equal_int(&r, 0, run_self(e, "--suite 'Math Tests'"),
+                       "unselected fixtures");
+    tc_check_equal_int(&r, 0, count_of(e->out, "[fixture]"),
+                       "fixtures of unselected suites are not built");
+    return r;
+#endif
+}
+
+TestResult test_fixture_setup_fails(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    TestResult r = tc_pass();
+    tc_check_equal_int(&r, 1, run_self(e, "-j 2 "
+                                          "--include '*Broken Fixture Demos/*'"),
+                       "failed fixture fails the run");
+    tc_check_equal_int(&r, 1, count_of(e->out, "[fixture] broken up"),
+                       "failed session fixture is not retried");
+    tc_check_equal_int(&r, 2, count_of(e->out, "Error: Fixture 'broken' for "
+                                                "suite"),
+                       "each suite names the fixture");
+    tc_check_true(&r, strstr(e->out, "0/2 passed, 0 failed, 0 skipped, "
+                                     "2 errored") != NULL,
+                  "every suite that needs it fails its setup");
+    return r;
+#endif
+}
+
+TestResult test_allocs_reported(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char args[1024], path[512], quoted[512], xml[8192];
+    TestResult r = tc_pass();
+
+    snprintf(path, sizeof(path), "%s/allocs.xml", e->dir);
+    snprintf(args, sizeof(args), "--allocs --suite 'Alloc Tests' --xml %s",
+             sh_quote(quoted, sizeof(quoted), path));
+    tc_check_equal_int(&r, 0, run_self(e, args), "--allocs run passes");
+    tc_check_true(&r, strstr(e->out, "6 allocs, 192B, peak 128B)") != NULL,
+                  "noted blocks shown");
+#ifdef TC_ALLOC_COUNT
+    tc_check_true(&r, strstr(e->out, "2 allocs, 128B, peak ") != NULL,
+                  "interposed mallocs shown");
+#else
+    tc_check_equal_int(&r, 1, count_of(e->out, " allocs, "),
+                       "uncounted tests show no allocs");
+#endif
+    if (tc_check_true(&r, read_file(path, xml, sizeof(xml)) > 0, "xml written"))
+        tc_check_true(&r, strstr(xml, "<property name=\"allocs\" value=\"6\"/>"
+                                      "<property name=\"frees\" value=\"3\"/>")
+                          != NULL,
+                      "counts in the xml");
+
+    tc_check_equal_int(&r, 0, run_self(e, "--suite 'Alloc Tests'"),
+                       "run without --allocs");
+    tc_check_equal_int(&r, 0, count_of(e->out, " allocs, "),
+                       "no counts without --allocs");
+    return r;
+#endif
+}
+
+/* Run Math Tests and Report Demos with a stream reporter to name in e->dir */
+static long run_streamed(CliEnv* e, const char* flag, const char* name,
+                         char* buf, size_t cap) {
+    char args[1024], path[512], quoted[512];
+    snprintf(path, sizeof(path), "%s/%s", e->dir, name);
+    snprintf(args, sizeof(args), "--include 'Math Tests/*' "
+             "--include 'Report Demos/*' %s %s", flag,
+             sh_quote(quoted, sizeof(quoted), path));
+    if (run_self(e, args) != 1) return -1;
+    return read_file(path, buf, cap);
+}
+
+static uint32_t le32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+TestResult test_tap_stream(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char tap[8192];
+    TestResult r = tc_pass();
+    if (!tc_check_true(&r, run_streamed(e, "--tap", "run.tap",
+                                        tap, sizeof(tap)) > 0, "tap written"))
+        return r;
+    tc_check_true(&r, strncmp(tap, "TAP version 13\n1..6\n", 20) == 0,
+                  "version and plan first");
+    tc_check_equal_int(&r, 6, count_of(tap, "\nok ") + count_of(tap, "\nnot ok "),
+                       "one point per planned test");
+    tc_check_true(&r, strstr(tap, "\nok 6 - ") != NULL &&
+                      strstr(tap, "\nok 7 - ") == NULL, "points numbered");
+    tc_check_true(&r, strstr(tap, "\nnot ok 5 - Report Demos: fails \\#1\n"
+                                  "  ---\n  duration_ms: ") != NULL,
+                  "failing point opens a YAML block");
+    tc_check_true(&r, strstr(tap, "first check") != NULL &&
+                      strstr(tap, "second check") != NULL,
+                  "every failure in the block");
+    tc_check_equal_int(&r, 1, count_of(tap, "\n  ...\n"),
+                       "the block is closed");
+    tc_check_true(&r, strstr(tap, "\nok 6 - Report Demos: skips # SKIP "
+                                  "needs C:\\\\tmp \\#2\n") != NULL,
+                  "skip reason escaped and cut at its newline");
+    tc_check_true(&r, strstr(tap, "hidden") == NULL, "no second reason line");
+    return r;
+#endif
+}
+
+TestResult test_ndjson_stream(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char out[8192];
+    char* line;
+    int lines = 0, valid = 0;
+    TestResult r = tc_pass();
+    if (!tc_check_true(&r, run_streamed(e, "--ndjson", "run.ndjson",
+                                        out, sizeof(out)) > 0,
+                       "ndjson written"))
+        return r;
+    tc_check_true(&r, strncmp(out, "{\"event\":\"run_start\",\"suites\":2,"
+                                   "\"tests\":6}\n", 42) == 0,
+                  "run start first");
+    tc_check_equal_int(&r, 6, count_of(out, "\"event\":\"test\""),
+                       "one object per test");
+    tc_check_equal_int(&r, 1, count_of(out, "\"status\":\"fail\""),
+                       "failing test");
+    tc_check_true(&r, strstr(out, "\"reason\":\"needs C:\\\\tmp "
+                                  "#2\\u000ahidden\"") != NULL,
+                  "skip reason escaped whole");
+    tc_check_true(&r, strstr(out, "{\"event\":\"run_end\",\"passed\":4,"
+                                  "\"failed\":1,\"skipped\":1,") != NULL,
+                  "run end totals");
+    for (line = strtok(out, "\n"); line; line = strtok(NULL, "\n")) {
+        lines++;
+        valid += json_valid(line);
+    }
+    tc_check_equal_int(&r, 12, lines, "one line per event");
+    tc_check_equal_int(&r, lines, valid, "every line is JSON");
+    return r;
+#endif
+}
+
+TestResult test_binary_stream(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char buf[8192];
+    const unsigned char* p = (const unsigned char*)buf;
+    int types[6] = {0}, last = 0;
+    long n, at = 4;
+    TestResult r = tc_pass();
+    n = run_streamed(e, "--binary", "run.bin", buf, sizeof(buf));
+    if (!tc_check_true(&r, n > 4 && memcmp(buf, "TCR1", 4) == 0,
+                       "stream starts with TCR1"))
+        return r;
+    tc_check_equal_int(&r, 1, p[8], "run start first");
+    tc_check_true(&r, le32(p + 9) == 2 && le32(p + 13) == 6,
+                  "run start counts suites and tests");
+    while (at + 5 <= n) {
+        uint32_t len = le32(p + at);
+        if (len == 0 || at + 4 + (long)len > n) break;
+        last = p[at + 4];
+        if (last >= 1 && last <= 5) types[last]++;
+        at += 4 + (long)len;
+    }
+    tc_check_true(&r, at == n, "records frame the whole stream");
+    tc_check_equal_int(&r, 5, last, "run end last");
+    tc_check_true(&r, types[1] == 1 && types[2] == 2 && types[3] == 6 &&
+                      types[4] == 2 && types[5] == 1,
+                  "one record per event");
+    return r;
+#endif
+}
+
+/* Tests --list shows for filters, as "a,b,", tags cut; "error" if it fails */
+static const char* listed(CliEnv* e, const char* filters, char* names,
+                          size_t cap) {
+    char args[512];
+    const char *line, *tags;
+    size_t n = 0;
+    snprintf(args, sizeof(args), "--list %s", filters);
+    if (run_self(e, args) != 0) return "error";
+    names[0] = '\0';
+    for (line = e->out; line && *line; line = strchr(line, '\n')) {
+        size_t len;
+        if (*line == '\n') line++;
+        if (strncmp(line, "  - ", 4) != 0) continue;
+        len = strcspn(line + 4, "\n");
+        tags = strstr(line + 4, " {");
+        if (tags && tags < line + 4 + len) len = (size_t)(tags - line - 4);
+        if (n + len + 2 > cap) break;
+        memcpy(names + n, line + 4, len);
+        n += len;
+        names[n++] = ',';
+        names[n] = '\0';
+    }
+    return names;
+}
+
+TestResult test_select_globs(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char got[512];
+    TestResult r = tc_pass();
+    tc_check_equal_str(&r, "read,fetch,parse,[y],y,[x,",
+                       listed(e, "--include 'Select Demos/*'", got, sizeof(got)),
+                       "suite glob");
+    tc_check_equal_str(&r, "read,parse,[y],y,[x,",
+                       listed(e, "--include 'Select Demos/*' --exclude '*/f*'",
+                              got, sizeof(got)),
+                       "exclude wins over include");
+    tc_check_equal_str(&r, "read,parse,",
+                       listed(e, "--include 'Select Demos/?ead' "
+                                 "--include 'Select Demos/p*'", got, sizeof(got)),
+                       "any include selects");
+    tc_check_equal_str(&r, "read,parse,",
+                       listed(e, "--include 'Select Demos/[p-r]*'", got,
+                              sizeof(got)),
+                       "class range");
+    tc_check_equal_str(&r, "fetch,[y],y,[x,",
+                       listed(e, "--include 'Select Demos/[!p-r]*'", got,
+                              sizeof(got)),
+                       "negated class");
+    tc_check_equal_str(&r, "y,",
+                       listed(e, "--include 'Select Demos/[y]'", got, sizeof(got)),
+                       "a class that does not match fails closed");
+    tc_check_equal_str(&r, "[x,",
+                       listed(e, "--include 'Select Demos/[x'", got, sizeof(got)),
+                       "an unterminated class is literal");
+    tc_check_equal_str(&r, "",
+                       listed(e, "--include 'Nothing/*'", got, sizeof(got)),
+                       "an empty selection lists nothing");
+    return r;
+#endif
+}
+
+TestResult test_select_regex(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char got[512];
+    TestResult r = tc_pass();
+    tc_check_equal_str(&r, "read,fetch,",
+                       listed(e, "--include 're:^Select Demos/(read|fetch)$'",
+                              got, sizeof(got)),
+                       "regex include");
+    tc_check_equal_str(&r, "fetch,[y],y,[x,",
+                       listed(e, "--include 're:^Select Demos/' "
+                                 "--exclude 're:(read|parse)$'", got,
+                              sizeof(got)),
+                       "regex exclude");
+    tc_check_equal_str(&r, "[y],",
+                       listed(e, "--include 're:^Select Demos/\\[y\\]$'", got,
+                              sizeof(got)),
+                       "escaped bracket");
+    tc_check_equal_str(&r, "error",
+                       listed(e, "--include 're:('", got, sizeof(got)),
+                       "invalid regex rejected");
+    return r;
+#endif
+}
+
+TestResult test_select_tags(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    const char* cases[][2] = {
+        {"--tags fast", "read,parse,"},
+        {"--tags '!fast'", "fetch,[y],y,[x,"},
+        {"--tags 'fast & io'", "read,"},
+        {"--tags 'io | net'", "read,fetch,"},
+        {"--tags '(io | net) & !slow'", "read,"},
+        {"--tags 'select & !(fast | net)'", "[y],y,[x,"},
+        {"--tags fast --tags io", "read,"},
+        {"--tags 'fast &'", "error"},
+        {"--tags '(fast'", "error"},
+    };
+    char args[256], got[512];
+    TestResult r = tc_pass();
+    size_t i;
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        snprintf(args, sizeof(args), "--include 'Select Demos/*' %s",
+                 cases[i][0]);
+        tc_check_equal_str(&r, cases[i][1],
+                           listed(e, args, got, sizeof(got)), cases[i][0]);
+    }
+    return r;
+#endif
+}
+
+#define SHARD_PICK "--include 'Math Tests/*' --include 'Select Demos/*'"
+
+TestResult test_shards_partition(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    char all[512], shard[3][512], args[256], token[128];
+    const char* name;
+    TestResult r = tc_pass();
+    int i;
+
+    tc_check_equal_int(&r, 9, count_of(listed(e, SHARD_PICK, all, sizeof(all)),
+                                       ","),
+                       "whole selection listed");
+    for (i = 0; i < 3; i++) {
+        snprintf(args, sizeof(args), SHARD_PICK " --shard %d/3", i + 1);
+        listed(e, args, shard[i], sizeof(shard[i]));
+    }
+    for (name = all; *name; name += strcspn(name, ",") + 1) {
+        int owners = 0;
+        snprintf(token, sizeof(token), ",%.*s,", (int)strcspn(name, ","),
+                 name);
+        for (i = 0; i < 3; i++) {
+            char wrapped[520];
+            snprintf(wrapped, sizeof(wrapped), ",%s", shard[i]);
+            owners += strstr(wrapped, token) != NULL;
+        }
+        tc_check_equal_int(&r, 1, owners, token);
+    }
+    tc_check_equal_int(&r, count_of(all, ","),
+                       count_of(shard[0], ",") + count_of(shard[1], ",") +
+                           count_of(shard[2], ","),
+                       "shards add up to the selection");
+    return r;
+#endif
+}
+
+TestResult test_shard_timings(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    const char* timings =
+        "<testsuites><testsuite name=\"Select Demos\">"
+        "<testcase name=\"read\" time=\"10\"/>"
+        "<testcase name=\"fetch\" time=\"1\"/>"
+        "<testcase name=\"parse\" time=\"1\"/>"
+        "<testcase name=\"[y]\" time=\"1\"/>"
+        "<testcase name=\"y\" time=\"1\"/>"
+        "<testcase name=\"[x\" time=\"1\"/>"
+        "</testsuite></testsuites>\n";
+    char path[512], quoted[512], args[1024], got[512];
+    TestResult r = tc_pass();
+
+    write_demo_file(e, "timings.xml", timings, strlen(timings));
+    snprintf(path, sizeof(path), "%s/timings.xml", e->dir);
+    sh_quote(quoted, sizeof(quoted), path);
+    snprintf(args, sizeof(args), "--include 'Select Demos/*' --shard 1/2 "
+             "--shard-timings %s", quoted);
+    tc_check_equal_str(&r, "read,", listed(e, args, got, sizeof(got)),
+                       "the long test has a shard to itself");
+    snprintf(args, sizeof(args), "--include 'Select Demos/*' --shard 2/2 "
+             "--shard-timings %s", quoted);
+    tc_check_equal_str(&r, "fetch,parse,[y],y,[x,",
+                       listed(e, args, got, sizeof(got)),
+                       "the short tests share the other");
+    return r;
+#endif
+}
+
+TestResult test_shard_number(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    const char* bad[] = {"1/2x", "0/2", "3/2", "1/", "/2", "+1/2", " 1/2",
+                         "1/-2", "1", "1/2/3", "99999999999/99999999999"};
+    char args[128], quoted[64];
+    TestResult r = tc_pass();
+    size_t i;
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        snprintf(args, sizeof(args), "--list --shard %s",
+                 sh_quote(quoted, sizeof(quoted), bad[i]));
+        tc_check_equal_int(&r, 1, run_self(e, args), bad[i]);
+        tc_check_true(&r, strstr(e->out, "--shard expects I/N") != NULL,
+                      "error explained");
+    }
+    tc_check_equal_int(&r, 0, run_self(e, "--list --shard 2/2"), "2/2 accepted");
+    return r;
+#endif
+}
+
+TestResult test_fail_fast(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    static const struct {
+        const char* flag;
+        const char* summary;
+        int not_run; /* the rest of the run; 0 if never stopped */
+    } cases[] = {
+        {"--fail-fast", "1/6 passed, 1 failed, 4 skipped (4 not run)", 4},
+        {"--max-failures 2", "1/6 passed, 2 failed, 3 skipped (3 not run)", 3},
+        {"--max-failures 3", "1/6 passed, 3 failed, 2 skipped (2 not run)", 2},
+        {"--max-failures 0", "3/6 passed, 3 failed, 0 skipped", 0},
+    };
+    char args[256], teardown[64];
+    TestResult r = tc_pass();
+    size_t i;
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        snprintf(args, sizeof(args), "%s --include 'Fail Fast*'",
+                 cases[i].flag);
+        tc_check_equal_int(&r, 1, run_self(e, args), cases[i].flag);
+        tc_check_true(&r, strstr(e->out, cases[i].summary) != NULL,
+                      cases[i].summary);
+        tc_check_equal_int(&r, cases[i].not_run,
+                           count_of(e->out, "not run: the run was stopped"),
+                           "later tests not run");
+        snprintf(teardown, sizeof(teardown), "[teardown] cancelled: %d",
+                 cases[i].not_run > 0);
+        tc_check_true(&r, strstr(e->out, teardown) != NULL,
+                      "tc_cancelled in the teardown");
+        tc_check_equal_int(&r, cases[i].not_run == 0,
+                           strstr(e->out, "[setup] late suite") != NULL,
+                           "later suite set up only if not stopped");
+    }
+    return r;
+#endif
+}
+
+/* Drop ANSI color sequences from s in place */
+static char* strip_colors(char* s) {
+    char *from = s, *to = s;
+    while (*from) {
+        if (*from == '\033' && from[1] == '[') {
+            from += 2 + strspn(from + 2, "0123456789;");
+            if (*from) from++;
+        } else {
+            *to++ = *from++;
+        }
+    }
+    *to = '\0';
+    return s;
+}
+
+#define MODE_PICK "--include 'Math Tests/*' --include 'Report Demos/*'"
+
+TestResult test_output_modes(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    const char* summary = "4/6 passed, 1 failed, 1 skipped, 0 errored";
+    TestResult r = tc_pass();
+
+    tc_check_equal_int(&r, 1, run_self(e, "--quiet " MODE_PICK), "--quiet");
+    strip_colors(e->out);
+    tc_check_true(&r, strstr(e->out, summary) != NULL, "--quiet summary");
+    tc_check_true(&r, strstr(e->out, "===") == NULL &&
+                      strstr(e->out, "fails #1") == NULL,
+                  "--quiet prints only the summary");
+
+    tc_check_equal_int(&r, 1, run_self(e, "--failures-only " MODE_PICK),
+                       "--failures-only");
+    strip_colors(e->out);
+    tc_check_true(&r, strstr(e->out, summary) != NULL,
+                  "--failures-only summary");
+    tc_check_true(&r, strstr(e->out, "=== Report Demos") != NULL &&
+                      strstr(e->out, "✗ fails #1") != NULL &&
+                      strstr(e->out, "first check") != NULL,
+                  "failing suite and test shown");
+    tc_check_true(&r, strstr(e->out, "=== Math Tests") == NULL &&
+                      strstr(e->out, "✓") == NULL &&
+                      strstr(e->out, "skips") == NULL,
+                  "passing suites and tests left out");
+
+    tc_check_equal_int(&r, 1, run_self(e, "--dots " MODE_PICK
+                                          " --include 'Broken Fixture Demos/*'"),
+                       "--dots");
+    strip_colors(e->out);
+    tc_check_true(&r, strncmp(e->out, "....Fs", 6) == 0,
+                  "one character per test");
+    tc_check_true(&r, strstr(e->out, "\nE\n") != NULL, "E for a failed setup");
+    tc_check_true(&r, strstr(e->out, "=== Report Demos") != NULL &&
+                      strstr(e->out, "first check") != NULL &&
+                      strstr(e->out, "=== Math Tests") == NULL,
+                  "failing suites shown after the run");
+    tc_check_true(&r, strstr(e->out, "4/7 passed, 1 failed, 1 skipped, "
+                                     "1 errored") != NULL,
+                  "--dots summary");
+    return r;
+#endif
+}
+
+/* The block of suite between its header and the blank line after it */
+static int suite_block(const char* out, const char* suite, char* block,
+                       size_t cap) {
+    char header[128];
+    const char *at, *end;
+    snprintf(header, sizeof(header), "=== %s (", suite);
+    if ((at = strstr(out, header)) == NULL) return 0;
+    end = strstr(at, "\n\n");
+    if (!end) end = at + strlen(at);
+    if ((size_t)(end - at) >= cap) return 0;
+    memcpy(block, at, (size_t)(end - at));
+    block[end - at] = '\0';
+    return 1;
+}
+
+TestResult test_parallel_output(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    static const struct {
+        const char* suite;
+        int tests;
+    } suites[] = {
+        {"Math Tests", 3}, {"Select Demos", 6}, {"Array Tests", 5},
+        {"Env Copy Tests", 4}, {"Env Snapshot Tests", 4},
+    };
+    char block[4096];
+    TestResult r = tc_pass();
+    size_t i;
+    tc_check_equal_int(&r, 0, run_self(e, "-j 4 --include 'Math Tests/*' "
+                                          "--include 'Select Demos/*' "
+                                          "--include 'Array Tests/*' "
+                                          "--include 'Env Copy Tests/*' "
+                                          "--include 'Env Snapshot Tests/*'"),
+                       "parallel run passes");
+    strip_colors(e->out);
+    for (i = 0; i < sizeof(suites) / sizeof(suites[0]); i++) {
+        if (!tc_check_true(&r, suite_block(e->out, suites[i].suite, block,
+                                           sizeof(block)),
+                           suites[i].suite))
+            continue;
+        tc_check_equal_int(&r, suites[i].tests, count_of(block, "\n  ✓ "),
+                           "its tests, and only those, in its block");
+        tc_check_equal_int(&r, 0, count_of(block, "\n==="),
+                           "no other suite inside");
+    }
+    return r;
+#endif
+}
+
+/* Counts of the console summary: passed, tests, failed, skipped, errored */
+static int summary_counts(const char* out, int c[5]) {
+    const char* line = strstr(out, " passed, ");
+    const char* err;
+    if (!line) return 0;
+    while (line > out && line[-1] != '\n') line--;
+    if (sscanf(line, "%d/%d passed, %d failed, %d skipped",
+                        &c[0], &c[1], &c[2], &c[3]) != 4)
+        return 0;
+    err = strstr(line, " errored");
+    while (err && err > line && err[-1] >= '0' && err[-1] <= '9') err--;
+    return err && sscanf(err, "%d errored", &c[4]) == 1;
+}
+
+TestResult test_xml_streamed(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    const char* modes[] = {"", "-j 3"};
+    char args[1024], path[512], quoted[512], xml[16384];
+    int sum[5], root[4];
+    TestResult r = tc_pass();
+    size_t i;
+
+    snprintf(path, sizeof(path), "%s/streamed.xml", e->dir);
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        snprintf(args, sizeof(args), "%s --include 'Math Tests/*' "
+                 "--include 'Skip Tests/*' --include 'Property Demos/*' "
+                 "--include 'Broken Fixture Demos/*' --xml %s", modes[i],
+                 sh_quote(quoted, sizeof(quoted), path));
+        tc_check_equal_int(&r, 1, run_self(e, args), "failing run");
+        if (!tc_check_true(&r, summary_counts(e->out, sum), "console summary") ||
+            !tc_check_true(&r, read_file(path, xml, sizeof(xml)) > 0,
+                           "xml written"))
+            return r;
+        tc_check_true(&r, xml_valid(xml), "xml is well-formed");
+        tc_check_true(&r, strstr(xml, "</testsuites>\n") != NULL &&
+                          strstr(xml, "</testsuites>\n")[14] == '\0',
+                      "document closed at the end");
+        if (!tc_check_equal_int(&r, 4, sscanf(strstr(xml, "<testsuites "),
+                                "<testsuites tests=\"%d\" failures=\"%d\" "
+                                "errors=\"%d\" skipped=\"%d\"",
+                                &root[0], &root[1], &root[2], &root[3]),
+                                "root totals"))
+            return r;
+        tc_check_equal_int(&r, sum[1], root[0], "root tests patched");
+        tc_check_equal_int(&r, sum[2], root[1], "root failures patched");
+        tc_check_equal_int(&r, sum[4], root[2], "root errors patched");
+        tc_check_equal_int(&r, sum[3], root[3], "root skipped patched");
+        tc_check_true(&r, strstr(xml, "<testcase name=\"(setup)\"") != NULL &&
+                          strstr(xml, "<error message=\"Setup failed "
+                                      "(returned 3)\" type=\"SuiteError\">")
+                              != NULL,
+                      "failed setup is an error testcase");
+    }
+    return r;
+#endif
+}
+
+TestResult test_max_failures_number(void* env) {
+#ifdef _WIN32
+    (void)env;
+    return tc_skip("POSIX only test");
+#else
+    CliEnv* e = (CliEnv*)env;
+    const char* bad[] = {"abc", "3x", "-1", ""};
+    char args[128];
+    TestResult r = tc_pass();
+    size_t i;
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        snprintf(args, sizeof(args), "--max-failures '%s' --list", bad[i]);
+        tc_check_equal_int(&r, 1, run_self(e, args), bad[i]);
+        tc_check_true(&r, strstr(e->out, "--max-failures expects a number") != NULL,
+                      "says why");
+    }
+    tc_check_equal_int(&r, 0, run_self(e, "--max-failures 2 --list"),
+                       "a number is accepted");
+    return r;
+#endif
+}
+
+/* ============================================================
+   MAIN
+   ============================================================ */
+
+int main(int argc, char** argv) {
+    sample_self = argv[0];
+
+    Suite validation_suite = tc_suite("Validation Tests", (Test[]){
+        {"validate order (accumulate)", test_validate_order},
+        {"validate order (in place)", test_validate_in_place},
+        {"dependent checks (short-circuit)", test_dependent_checks},
+        /* Uncomment to see failure output:
+        {"intentional failure", test_intentional_failure},
+        {"multiple failures", test_multiple_failures},
+        */
+        {0}
+    });
+
+    Suite skip_suite = tc_suite("Skip Tests", (Test[]){
+        {"posix only", test_posix_only},
+        {"windows only", test_windows_only},
+        {"skip in CI", test_skip_in_ci},
+        tc_skip_test("not implemented", "waiting for feature X"),
+        {0}
+    });
+
+    Suite collection_suite = tc_suite("Collection Tests", (Test[]){
+        {"contains and length", test_collection_contains},
+        {"empty collection", test_empty_collection},
+        {0}
+    });
+
+    Suite numeric_suite = tc_suite("Numeric Tests", (Test[]){
+        {"comparisons", test_numeric_comparisons},
+        {"floating point delta", test_floating_point},
+        {"strlen latency", test_strlen_latency, .budget_ns = TC_MS(100)},
+        {0}
+    });
+
+    Suite string_suite = tc_suite("String Tests", (Test[]){
+        {"equality", test_string_equality},
+        {"not equal", test_string_not_equal},
+        {0}
+    });
+
+    Suite nil_suite = tc_suite("Nil/Pointer Tests", (Test[]){
+        {"nil checking", test_nil_checking},
+        {"pointer equality", test_pointer_equality},
+        {0}
+    });
+
+    Suite data_suite = tc_suite("Data-Driven Tests", (Test[]){
+        {"2 * 2 = 4", test_double_2},
+        {"5 * 2 = 10", test_double_5},
+        {"10 * 2 = 20", test_double_10},
+        {"0 * 2 = 0", test_double_0},
+        {"-5 * 2 = -10", test_double_neg},
+        {0}
+    });
+
+    Suite array_suite = tc_suite("Array Tests", (Test[]){
+        {"bytes at odd lengths", test_bytes_odd_lengths},
+        {"ints at odd lengths", test_ints_odd_lengths},
+        {"doubles at odd lengths", test_doubles_odd_lengths},
+        {"NaN, signed zeros and infinities", test_double_specials},
+        {"report windows at both ends", test_report_windows},
+        {0}
+    });
+
+    Suite file_suite = tc_suite_with("File Operations",
+        file_tests_setup,
+        file_tests_teardown,
+        (Test[]){
+            {"can create file", test_can_create_file},
+            {"can read file", test_can_read_file},
+            {"can append file", test_can_append_file},
+            tc_skip_test("performance test", "too slow for regular runs"),
+            {0}
+        }
+    );
+
+    Suite bench_suite = tc_suite("Benchmarks", (Test[]){
+        tc_bench("strlen 43 bytes", bench_string_length),
+        {0}
+    });
+
+    Suite cli_suite = tc_suite_with("CLI Tests",
+        cli_tests_setup,
+        cli_tests_teardown,
+        (Test[]){
+            {"impact records tests", test_impact_records},
+            {"impact records isolated tests", test_impact_records_isolated},
+            {"impact with a quoted binary path", test_impact_quoted_path},
+            {"cache hits on a second run", test_cache_hits},
+            {"cache misses after the binary changes", test_cache_binary_change},
+            {"--max-failures takes only a number", test_max_failures_number},
+            {"failing property shrinks", test_property_shrinks},
+            {"--seed replays the counterexample", test_property_seed_replays},
+            {"properties do not depend on --jobs", test_property_jobs},
+            {"skipped cases are not counterexamples", test_property_skips_discarded},
+            {"vector files make one case per record", test_vectors_one_case_per_record},
+            {"truncated sized vectors fail the test", test_vectors_truncated},
+            {"vector cases are selected by name", test_vectors_select_cases},
+            {"perf counters leave no fields when off", test_perf_counters_absent},
+            {"trace keeps the spans of isolated children", test_trace_isolated},
+            {"bench baselines load in any JSON layout", test_bench_baseline_format},
+            {"isolated crashes fail one test each", test_isolate_crashes},
+            {"isolated setup and teardown crashes", test_isolate_stage_crashes},
+            {"a hang times out and stops the run", test_hang_timeout},
+            {"setup and teardown hangs time out", test_hang_stage_timeout},
+            {"an isolated hang is killed", test_isolate_hang_killed},
+            {"env resets under --isolate-suite", test_env_reset_isolated},
+            {"a snapshot without restore is rejected", test_env_snapshot_rejected},
+            {"session fixtures are shared across workers", test_fixtures_shared},
+            {"a failed fixture fails its suites", test_fixture_setup_fails},
+            {"--allocs reports counts", test_allocs_reported},
+            {"streamed xml is a whole document", test_xml_streamed},
+            {"tap plans, numbers and escapes points", test_tap_stream},
+            {"ndjson writes one object per event", test_ndjson_stream},
+            {"binary records frame the stream", test_binary_stream},
+            {"globs select suite/test", test_select_globs},
+            {"re: patterns select suite/test", test_select_regex},
+            {"tag expressions select tests", test_select_tags},
+            {"hash shards split the selection", test_shards_partition},
+            {"--shard-timings balances shards", test_shard_timings},
+            {"--shard takes only I/N", test_shard_number},
+            {"--fail-fast and --max-failures stop the run", test_fail_fast},
+            {"--quiet, --failures-only and --dots", test_output_modes},
+            {"parallel suites print whole blocks", test_parallel_output},
+            {0}
+        }
+    );
+
+    Suite counter_suite = tc_suite("Counter Tests", (Test[]){
+        {"perf counters report when unavailable", test_perf_counters_unavailable},
+        {0}
+    });
+
+    Suite alloc_suite = tc_suite("Alloc Tests", (Test[]){
+        {"allocs are counted when interposed", test_allocs_interposed},
+        {"allocs noted by a custom allocator", test_allocs_noted},
+        {0}
+    });
+
+    /* The same tests reset by copy, by snapshot hooks and by forking */
+    Test ledger_tests[] = {
+        {"spends", test_ledger_spend},
+        {"sees the setup state", test_ledger_untouched},
+        {"spends again", test_ledger_spend},
+        {"sees the setup state again", test_ledger_untouched},
+        {0}
+    };
+    Suite env_copy_suite = tc_suite_with("Env Copy Tests", ledger_setup,
+                                         ledger_teardown, ledger_tests);
+    env_copy_suite.flags |= TC_SUITE_RESET_ENV;
+    env_copy_suite.env_size = sizeof(Ledger);
+    Suite env_snapshot_suite = tc_suite_with("Env Snapshot Tests",
+                                             ledger_setup, ledger_teardown,
+                                             ledger_tests);
+    env_snapshot_suite.flags |= TC_SUITE_RESET_ENV;
+    env_snapshot_suite.snapshot = &ledger_snapshot;
+    Suite env_fork_suite = tc_suite_with("Env Fork Tests", ledger_setup,
+                                         ledger_teardown, ledger_tests);
+    env_fork_suite.flags |= TC_SUITE_RESET_ENV;
+
+    Suite fixture_suite = tc_suite("Fixture Tests", (Test[]){
+        {"values of listed fixtures", test_fixture_values},
+        {0}
+    });
+    fixture_suite.fixtures = "scratch";
+    Suite more_fixture_suite = tc_suite("More Fixture Tests", (Test[]){
+        {"values of listed fixtures", test_fixture_values},
+        {0}
+    });
+    more_fixture_suite.fixtures = "scratch, config";
+    Suite unfixtured_suite = tc_suite("Unfixtured Tests", (Test[]){
+        {"no fixture outside suites listing it", test_fixture_unlisted},
+        {0}
+    });
+
+    Suite property_suite = tc_suite("Property Tests", (Test[]){
+        {"skipped cases are discarded", test_property_skips},
+        {"missing generator is reported", test_property_without_gen},
+        {0}
+    });
+
+    Suite property_demos = tc_suite("Property Demos", (Test[]){
+        tc_property("abs below 50", gen_small_int, prop_below_50, 200),
+        tc_property("odd below 10", gen_small_int, prop_odd_below_10, 200),
+        tc_property("sum below 100", gen_int_pair, prop_sum_below_100, 200),
+        {0}
+    });
+
+    static char lines_path[512], sized_path[512];
+    const char* demo_dir = getenv("TC_SAMPLE_DEMOS");
+    if (demo_dir) {
+        snprintf(lines_path, sizeof(lines_path), "%s/lines.txt", demo_dir);
+        snprintf(sized_path, sizeof(sized_path), "%s/sized.bin", demo_dir);
+    }
+    Suite vector_demos = tc_suite("Vector Demos", (Test[]){
+        tc_vectors("lines", lines_path, TC_VECTORS_LINES, vec_not_bad),
+        tc_vectors("sized", sized_path, TC_VECTORS_SIZED, vec_not_bad),
+        {0}
+    });
+
+    Suite report_demos = tc_suite("Report Demos", (Test[]){
+        {"passes", test_addition_works},
+        {"fails #1", demo_fails_twice},
+        tc_skip_test("skips", "needs C:\\tmp #2\nhidden"),
+        {0}
+    });
+
+    Suite select_demos = tc_suite("Select Demos", (Test[]){
+        {"read", test_addition_works, .tags = "fast io"},
+        {"fetch", test_addition_works, .tags = "net slow"},
+        {"parse", test_addition_works, .tags = "fast"},
+        {"[y]", test_addition_works},
+        {"y", test_addition_works},
+        {"[x", test_addition_works},
+        {0}
+    });
+    select_demos.tags = "select";
+
+    Suite fail_fast_demos = tc_suite_with("Fail Fast Demos", NULL,
+        demo_cancel_teardown, (Test[]){
+            {"passes", test_addition_works},
+            {"fails", demo_fails_twice},
+            {"fails again", demo_fails_twice},
+            {"fails a third time", demo_fails_twice},
+            {"passes last", test_string_length},
+            {0}
+        }
+    );
+
+    Suite fail_fast_late_demos = tc_suite_with("Fail Fast Late Demos",
+        demo_late_setup, NULL, (Test[]){
+            {"runs late", test_addition_works},
+            {0}
+        }
+    );
+
+    Suite crash_demos = tc_suite("Crash Demos", (Test[]){
+        {"segfaults", demo_segfault},
+        {"aborts", demo_abort},
+        {"runs after the crashes", test_addition_works},
+        {0}
+    });
+
+    Suite crash_setup_demos = tc_suite_with("Crash Setup Demos",
+        demo_crash_setup, NULL, (Test[]){
+            {"needs setup", test_addition_works},
+            {"needs setup too", test_string_length},
+            {0}
+        }
+    );
+
+    Suite crash_teardown_demos = tc_suite_with("Crash Teardown Demos",
+        NULL, demo_crash_teardown, (Test[]){
+            {"passes before teardown", test_addition_works},
+            {0}
+        }
+    );
+
+    Suite hang_demos = tc_suite("Hang Demos", (Test[]){
+        {"passes first", test_addition_works},
+        {"hangs", demo_hang},
+        {"runs after the hang", test_string_length},
+        {0}
+    });
+
+    Suite own_timeout_demos = tc_suite("Own Timeout Demos", (Test[]){
+        {"hangs past its own limit", demo_hang, .timeout_ns = TC_MS(100)},
+        {0}
+    });
+
+    Suite hang_setup_demos = tc_suite_with("Hang Setup Demos",
+        demo_hang_setup, NULL, (Test[]){
+            {"needs setup", test_addition_works},
+            {0}
+        }
+    );
+
+    Suite hang_teardown_demos = tc_suite_with("Hang Teardown Demos",
+        NULL, demo_hang_teardown, (Test[]){
+            {"passes before teardown", test_addition_works},
+            {0}
+        }
+    );
+
+    Suite bad_snapshot_demos = tc_suite_with("Bad Snapshot Demos",
+                                             ledger_setup, ledger_teardown,
+                                             ledger_tests);
+    bad_snapshot_demos.flags |= TC_SUITE_RESET_ENV;
+    bad_snapshot_demos.snapshot = &ledger_unrestorable;
+
+    Suite broken_fixture_demos = tc_suite("Broken Fixture Demos", (Test[]){
+        {"needs the fixture", test_addition_works},
+        {0}
+    });
+    broken_fixture_demos.fixtures = "broken";
+    Suite more_broken_fixture_demos = tc_suite("More Broken Fixture Demos",
+                                               (Test[]){
+        {"needs the fixture too", test_addition_works},
+        {0}
+    });
+    more_broken_fixture_demos.fixtures = "broken";
+
+    /* After Math Tests and Registered, which are added before main */
+    Suite* all_suites[] = {
+        &validation_suite,
+        &skip_suite,
+        &collection_suite,
+        &numeric_suite,
+        &string_suite,
+        &nil_suite,
+        &data_suite,
+        &array_suite,
+        &counter_suite,
+        &alloc_suite,
+        &env_copy_suite,
+        &env_snapshot_suite,
+        &env_fork_suite,
+        &fixture_suite,
+        &more_fixture_suite,
+        &unfixtured_suite,
+        &property_suite,
+        &file_suite,
+        &bench_suite,
+        &cli_suite,
+        /* The demos, from here on, run only for the CLI tests */
+        &property_demos,
+        &vector_demos,
+        &report_demos,
+        &select_demos,
+        &fail_fast_demos,
+        &fail_fast_late_demos,
+        &crash_demos,
+        &crash_setup_demos,
+        &crash_teardown_demos,
+        &hang_demos,
+        &own_timeout_demos,
+        &hang_setup_demos,
+        &hang_teardown_demos,
+        &bad_snapshot_demos,
+        &broken_fixture_demos,
+        &more_broken_fixture_demos,
+        NULL
+    };
+    property_demos.flags |= TC_SUITE_SHARED_ENV; /* run on several threads */
+    for (size_t i = 0; !demo_dir && all_suites[i]; i++) {
+        if (all_suites[i] == &property_demos) all_suites[i] = NULL;
+    }
+
+    tc_register_fixture(&clock_fixture);
+    tc_register_fixture(&config_fixture);
+    tc_register_fixture(&scratch_fixture);
+    tc_register_fixture(&broken_fixture);
 
-    return tc_main(argc, argv, all_suites);
+    for (size_t i = 0; all_suites[i]; i++) tc_register_suite(all_suites[i]);
+    return tc_main(argc, argv, NULL);
 }
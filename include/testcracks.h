@@ -9,9 +9,22 @@
  *   #include "testcracks.h"
  *   Link with testcracks.c
  *
- * OPTIONAL DEFINES (before including):
- *   TC_NO_GETTIMEOFDAY   - Use clock() instead of gettimeofday()
+ * OPTIONAL DEFINES (when compiling testcracks.c, e.g. -DTC_NO_COLORS):
+ *   TC_NO_GETTIMEOFDAY   - No OS clock; time with clock() or tc_set_clock()
+ *   TC_CLOCK_TSC         - Time with the x86 TSC (needs an invariant TSC)
  *   TC_NO_COLORS         - Disable ANSI color output
+ *   TC_STATIC_MESSAGES   - Assertion messages are string literals; store
+ *                          the pointer instead of copying the text
+ *   TC_NO_THREADS        - No thread support; --jobs runs sequentially
+ *   TC_NO_FORK           - No process isolation; --isolate runs in-process
+ *   TC_NO_REGEX          - No <regex.h>; "re:" filter patterns are rejected
+ *   TC_IMPACT            - Record per-test coverage for --impact (Linux,
+ *                          GCC/Clang; code under test built with
+ *                          -finstrument-functions)
+ *   TC_ALLOC_COUNT       - Count heap allocations per test (glibc)
+ *   TC_NO_SIMD           - Compare arrays with scalar code, not SSE2/NEON
+ *   TC_NO_PERF           - No <linux/perf_event.h>; --perf-counters is a
+ *                          no-op
  *
  * COMPATIBILITY:
  *   C: C99 or later
@@ -23,6 +36,7 @@
 #define TESTCRACKS_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 /* ============================================================
    PLATFORM DETECTION
@@ -50,10 +64,12 @@ extern "C" {
 #define TC_MAX_ERRORS 50
 #endif
 
+/* No longer limits messages; kept so existing code using it still builds */
 #ifndef TC_MAX_MSG_LEN
 #define TC_MAX_MSG_LEN 512
 #endif
 
+/* No longer limits suites or tests; kept so existing code still builds */
 #ifndef TC_MAX_TESTS_PER_SUITE
 #define TC_MAX_TESTS_PER_SUITE 256
 #endif
@@ -62,23 +78,168 @@ extern "C" {
 #define TC_MAX_SUITES 64
 #endif
 
+#ifndef TC_MAX_REPORTERS
+#define TC_MAX_REPORTERS 8
+#endif
+
+/* Benchmarks: samples taken, target length of one sample, warmup time */
+#ifndef TC_BENCH_SAMPLES
+#define TC_BENCH_SAMPLES 30
+#endif
+
+#ifndef TC_BENCH_SAMPLE_NS
+#define TC_BENCH_SAMPLE_NS 1000000
+#endif
+
+#ifndef TC_BENCH_WARMUP_NS
+#define TC_BENCH_WARMUP_NS 10000000
+#endif
+
+/* Significance level for baseline regressions */
+#ifndef TC_BENCH_ALPHA
+#define TC_BENCH_ALPHA 0.01
+#endif
+
+/* Cases a property test checks unless it sets runs */
+#ifndef TC_PROPERTY_RUNS
+#define TC_PROPERTY_RUNS 100
+#endif
+
 /* ============================================================
    CORE TYPES
    ============================================================ */
 
 typedef enum { TC_PASS, TC_FAIL, TC_SKIP } ResultTag;
 
+/*
+ * Failures record raw operands and are only turned into text when printed
+ * or written to XML. `op` says how the operands are phrased; `kind` says
+ * which member of TestValue they use. Use tc_error_expected() and
+ * tc_error_actual() to render them.
+ *
+ * expected and actual used to be char arrays holding that text. Code
+ * that read them as strings no longer compiles: call the two functions
+ * above instead.
+ */
+typedef enum {
+  TC_OP_NONE,         /* message only */
+  TC_OP_TEXT,         /* expected/actual given as text */
+  TC_OP_EQ,           /* "x" */
+  TC_OP_NE,           /* "not x" */
+  TC_OP_GT,           /* "> x" */
+  TC_OP_GE,           /* ">= x" */
+  TC_OP_LT,           /* "< x" */
+  TC_OP_LE,           /* "<= x" */
+  TC_OP_IN_DELTA,     /* "x +/- aux" */
+  TC_OP_NIL,          /* "NULL" */
+  TC_OP_NOT_NIL,      /* "non-NULL" */
+  TC_OP_EMPTY,        /* "empty" */
+  TC_OP_NOT_EMPTY,    /* "non-empty" */
+  TC_OP_LEN,          /* "length x" */
+  TC_OP_CONTAINS,     /* "contains x" */
+  TC_OP_NOT_CONTAINS  /* "not contains x", found at index aux */
+} ErrorOp;
+
+typedef enum {
+  TC_VAL_NONE,
+  TC_VAL_STR,
+  TC_VAL_LONG,
+  TC_VAL_SIZE,
+  TC_VAL_DOUBLE,
+  TC_VAL_PTR,
+  TC_VAL_NS /* uint64_t nanoseconds, printed as a duration */
+} ValueKind;
+
+typedef union {
+  const char *s;
+  long l;
+  size_t z;
+  double d;
+  const void *p;
+  uint64_t ns;
+} TestValue;
+
 typedef struct {
-  char message[TC_MAX_MSG_LEN];
-  char expected[TC_MAX_MSG_LEN];
-  char actual[TC_MAX_MSG_LEN];
+  const char *message;
+  ErrorOp op;
+  ValueKind kind;
+  TestValue expected;
+  TestValue actual;
+  TestValue aux;
 } TestError;
 
+/* Benchmark statistics; all times are per operation */
+typedef struct {
+  uint64_t iterations; /* operations per sample */
+  int sample_count;
+  double min_ns;
+  double median_ns;
+  double mean_ns;
+  double p99_ns;
+  double stddev_ns;
+  double ops_per_sec;
+  const double *samples; /* per-sample ns/op, ascending */
+  int has_baseline;      /* set when compared with a saved run */
+  double baseline_median_ns;
+  double p_value; /* one-sided Mann-Whitney U; small means slower */
+} BenchStats;
+
+/* Measurement bits present in TestMetrics */
+#define TC_METRIC_BENCH 0x1u
+#define TC_METRIC_CACHED 0x2u  /* a pass from an earlier run (--cache) */
+#define TC_METRIC_NOT_RUN 0x4u /* a skip: the run was cancelled first */
+#define TC_METRIC_ALLOC 0x8u   /* heap use (--allocs) */
+#define TC_METRIC_PERF 0x10u   /* hardware counters (--perf-counters) */
+
+/* Heap use of one test, counted on the thread that ran it */
+typedef struct {
+  uint64_t allocs; /* malloc, calloc, realloc and aligned allocations */
+  uint64_t frees;
+  uint64_t bytes;      /* requested in total */
+  uint64_t peak_bytes; /* most held at once beyond what the test began with */
+} AllocStats;
+
+/* Counters present in PerfStats; a CPU or VM may lack some of them */
+#define TC_PERF_CYCLES 0x1u
+#define TC_PERF_INSTRUCTIONS 0x2u
+#define TC_PERF_L1D_MISSES 0x4u /* L1 data cache read misses */
+#define TC_PERF_LLC_MISSES 0x8u /* last-level cache misses */
+#define TC_PERF_BRANCH_MISSES 0x10u
+
+/*
+ * Hardware counters of one test, counted in user space on the thread
+ * that ran it. A benchmark's counters cover only its measured samples,
+ * which ran bench.iterations * bench.sample_count operations.
+ */
+typedef struct {
+  unsigned present;
+  uint64_t cycles;
+  uint64_t instructions;
+  uint64_t l1d_misses;
+  uint64_t llc_misses;
+  uint64_t branch_misses;
+  double ipc; /* instructions per cycle; 0 unless both are present */
+} PerfStats;
+
+/* Measurements the runner attaches to a result; NULL for plain tests */
+typedef struct {
+  unsigned present;
+  BenchStats bench;
+  AllocStats alloc;
+  PerfStats perf;
+} TestMetrics;
+
+/*
+ * Results are small values. Passing results carry no error storage at all;
+ * failing results point into a growable side store owned by the framework.
+ * `errors` stays valid until the next tc_run_all() / tc_main() run starts.
+ */
 typedef struct {
   ResultTag tag;
-  TestError errors[TC_MAX_ERRORS];
   int error_count;
-  double elapsed_ms;
+  uint64_t elapsed_ns;
+  TestError *errors;
+  TestMetrics *metrics;
 } TestResult;
 
 /*
@@ -98,18 +259,120 @@ typedef int (*SetupFn)(void **env);
  */
 typedef void (*TeardownFn)(void *env);
 
+/*
+ * Benchmark body: perform the measured operation `iters` times.
+ * The runner picks iters so one sample lasts about TC_BENCH_SAMPLE_NS.
+ */
+typedef void (*BenchFn)(void *env, uint64_t iters);
+
+/* Plain callback, e.g. the code timed by tc_assert_duration_under */
+typedef void (*CallbackFn)(void *ctx);
+
+/*
+ * Property test parts (see tc_property). A generator builds one case
+ * from tc_gen_* draws and returns it, allocated with tc_alloc; the
+ * property checks that case.
+ */
+typedef struct TestGen TestGen;
+typedef void *(*GenFn)(TestGen *g);
+typedef TestResult (*PropFn)(void *env, void *value);
+
+/*
+ * One record of a test vector file (see tc_vectors). data points into
+ * the read-only mapping of the file and is not NUL-terminated.
+ */
+typedef struct {
+  const void *data;
+  size_t size;
+  size_t index; /* record number in the file, from 0 */
+} TestVector;
+
+typedef TestResult (*VectorFn)(void *env, const TestVector *v);
+
+/*
+ * Record layouts of a test vector file. LINES ends each record with
+ * "\n" or "\r\n" (neither is part of it) and skips blank lines; SIZED
+ * puts each record's size before it, 4 bytes little-endian.
+ */
+typedef enum { TC_VECTORS_LINES, TC_VECTORS_SIZED } VectorFormat;
+
+/* Durations in nanoseconds, for budgets and duration assertions */
+#define TC_US(n) ((uint64_t)(n) * 1000u)
+#define TC_MS(n) ((uint64_t)(n) * 1000000u)
+
+/* Test flags */
+#define TC_TEST_READ_ONLY 0x1u /* only reads env; may run concurrently */
+
+/*
+ * A test has fn, or bench for a benchmark; neither means skipped.
+ * budget_ns (0: the suite's, if any) fails a test that runs longer.
+ * tags is a space- or comma-separated list, e.g. "fast network"; a
+ * test also carries its suite's tags. inputs lists, the same way, the
+ * files a test reads; --cache reruns the test when one of them changes.
+ * timeout_ns (0: tc_set_timeout's) stops a test that hangs.
+ * gen, prop and runs make a property test; build it with tc_property.
+ * vectors, vector_fn and vector_format make a test vector test; build
+ * it with tc_vectors. vector is the record a case runs on.
+ */
 typedef struct {
   const char *name;
   TestFn fn;
   const char *skip_reason;
+  unsigned flags;
+  BenchFn bench;
+  uint64_t budget_ns;
+  const char *tags;
+  const char *inputs;
+  uint64_t timeout_ns;
+  GenFn gen;
+  PropFn prop;
+  int runs; /* cases checked (0: TC_PROPERTY_RUNS) */
+  const char *vectors; /* path of the test vector file */
+  VectorFn vector_fn;
+  VectorFormat vector_format;
+  const TestVector *vector; /* set on the cases tc_main expands */
 } Test;
 
+/* Suite flags */
+#define TC_SUITE_SERIAL 0x1u     /* never run alongside other suites */
+#define TC_SUITE_SHARED_ENV 0x2u /* every test only reads env */
+#define TC_SUITE_RESET_ENV 0x4u  /* env is as after setup for each test */
+
+/*
+ * How a TC_SUITE_RESET_ENV suite puts env back between tests. save
+ * copies env into *snapshot right after setup (nonzero fails the suite
+ * like setup), restore makes env equal to it again, and discard frees
+ * it before teardown. save and restore are required: without either
+ * the suite fails before setup.
+ */
+typedef struct {
+  int (*save)(void *env, void **snapshot);
+  void (*restore)(void *env, const void *snapshot);
+  void (*discard)(void *snapshot);
+} EnvSnapshot;
+
+/*
+ * A suite refers to its tests rather than holding them; the array must
+ * outlive every run of the suite.
+ *
+ * TC_SUITE_RESET_ENV restores env before every test that follows one
+ * that may have changed it: with snapshot if set, else by copying back
+ * env_size bytes saved after setup, else by running each test in a
+ * fresh child forked after setup (POSIX), else by running teardown and
+ * setup again.
+ */
 typedef struct {
   const char *name;
-  Test tests[TC_MAX_TESTS_PER_SUITE];
+  Test *tests;
   int test_count;
   SetupFn setup;
   TeardownFn teardown;
+  unsigned flags;
+  uint64_t budget_ns;   /* default budget for the suite's tests */
+  const char *tags;     /* added to every test's tags */
+  const char *fixtures; /* named fixtures it uses, like tags */
+  size_t env_size;      /* flat env for TC_SUITE_RESET_ENV to copy */
+  const EnvSnapshot *snapshot;
 } Suite;
 
 typedef struct {
@@ -118,6 +381,8 @@ typedef struct {
   int skipped;
   int errored;
   double total_ms;
+  int cached;  /* passes taken from the result cache, counted in passed */
+  int not_run; /* tests a cancelled run never started, counted in skipped */
 } RunSummary;
 
 /* ============================================================
@@ -228,6 +493,146 @@ TestResult tc_assert_contains_int(int elem, const int *arr, int len,
 TestResult tc_assert_not_contains_int(int elem, const int *arr, int len,
                                       const char *msg);
 
+/* ============================================================
+   ASSERTIONS - ARRAYS AND BUFFERS
+   One pass over len elements, however large. A failure reports how
+   many elements differ (or are out of order), the first index, and
+   the elements around it. Doubles match within delta, or within
+   max_ulps representable values for the _ulps variant; NaN never
+   matches. Sorted means non-decreasing.
+   ============================================================ */
+
+TestResult tc_assert_equal_bytes(const void *expected, const void *actual,
+                                 size_t len, const char *msg);
+TestResult tc_assert_equal_array_int(const int *expected, const int *actual,
+                                     size_t len, const char *msg);
+TestResult tc_assert_equal_array_long(const long *expected, const long *actual,
+                                      size_t len, const char *msg);
+TestResult tc_assert_equal_array_double(const double *expected,
+                                        const double *actual, size_t len,
+                                        double delta, const char *msg);
+TestResult tc_assert_equal_array_double_ulps(const double *expected,
+                                             const double *actual, size_t len,
+                                             uint64_t max_ulps,
+                                             const char *msg);
+TestResult tc_assert_sorted_int(const int *arr, size_t len, const char *msg);
+TestResult tc_assert_sorted_long(const long *arr, size_t len, const char *msg);
+TestResult tc_assert_sorted_double(const double *arr, size_t len,
+                                   const char *msg);
+
+/* ============================================================
+   ASSERTIONS - DURATION
+   fn(ctx) is timed `iters` times; the median (or the given percentile)
+   must not exceed ns, scaled by tc_set_budget_scale().
+   ============================================================ */
+
+TestResult tc_assert_duration_under(CallbackFn fn, void *ctx, uint64_t ns,
+                                    int iters);
+TestResult tc_assert_duration_percentile_under(CallbackFn fn, void *ctx,
+                                               uint64_t ns, int iters,
+                                               double percentile);
+
+/* ============================================================
+   ASSERTIONS - ALLOCATION
+   fn(ctx) is called once and may allocate from the heap at most n
+   times (never, for no_alloc). They skip when allocations cannot be
+   counted; see tc_note_alloc.
+   ============================================================ */
+
+TestResult tc_assert_no_alloc(CallbackFn fn, void *ctx);
+TestResult tc_assert_max_allocs(CallbackFn fn, void *ctx, uint64_t n);
+
+/* ============================================================
+   ACCUMULATION
+   In-place counterparts of tc_combine chains. Each tc_check_* appends
+   its failure to *acc and returns 1 if the check passed, 0 otherwise.
+   Once *acc is a SKIP, further checks are not evaluated.
+   ============================================================ */
+
+int tc_check_into(TestResult *acc, TestResult r);
+int tc_check_skip_if(TestResult *acc, int cond, const char *reason);
+int tc_check_skip_unless(TestResult *acc, int cond, const char *reason);
+
+int tc_check_true(TestResult *acc, int cond, const char *msg);
+int tc_check_false(TestResult *acc, int cond, const char *msg);
+int tc_check_equal_int(TestResult *acc, int expected, int actual,
+                       const char *msg);
+int tc_check_not_equal_int(TestResult *acc, int unexpected, int actual,
+                           const char *msg);
+int tc_check_equal_long(TestResult *acc, long expected, long actual,
+                        const char *msg);
+int tc_check_not_equal_long(TestResult *acc, long unexpected, long actual,
+                            const char *msg);
+int tc_check_equal_size(TestResult *acc, size_t expected, size_t actual,
+                        const char *msg);
+int tc_check_not_equal_size(TestResult *acc, size_t unexpected, size_t actual,
+                            const char *msg);
+int tc_check_equal_double(TestResult *acc, double expected, double actual,
+                          const char *msg);
+int tc_check_not_equal_double(TestResult *acc, double unexpected, double actual,
+                              const char *msg);
+int tc_check_equal_str(TestResult *acc, const char *expected,
+                       const char *actual, const char *msg);
+int tc_check_not_equal_str(TestResult *acc, const char *unexpected,
+                           const char *actual, const char *msg);
+int tc_check_equal_ptr(TestResult *acc, const void *expected,
+                       const void *actual, const char *msg);
+int tc_check_not_equal_ptr(TestResult *acc, const void *unexpected,
+                           const void *actual, const char *msg);
+int tc_check_nil(TestResult *acc, const void *ptr, const char *msg);
+int tc_check_not_nil(TestResult *acc, const void *ptr, const char *msg);
+int tc_check_greater_int(TestResult *acc, int actual, int than,
+                         const char *msg);
+int tc_check_greater_or_equal_int(TestResult *acc, int actual, int than,
+                                  const char *msg);
+int tc_check_less_int(TestResult *acc, int actual, int than, const char *msg);
+int tc_check_less_or_equal_int(TestResult *acc, int actual, int than,
+                               const char *msg);
+int tc_check_greater_double(TestResult *acc, double actual, double than,
+                            const char *msg);
+int tc_check_greater_or_equal_double(TestResult *acc, double actual,
+                                     double than, const char *msg);
+int tc_check_less_double(TestResult *acc, double actual, double than,
+                         const char *msg);
+int tc_check_less_or_equal_double(TestResult *acc, double actual, double than,
+                                  const char *msg);
+int tc_check_in_delta(TestResult *acc, double expected, double actual,
+                      double delta, const char *msg);
+int tc_check_empty_int(TestResult *acc, const int *arr, int len,
+                       const char *msg);
+int tc_check_not_empty_int(TestResult *acc, const int *arr, int len,
+                           const char *msg);
+int tc_check_len(TestResult *acc, int expected, int actual, const char *msg);
+int tc_check_contains_int(TestResult *acc, int elem, const int *arr, int len,
+                          const char *msg);
+int tc_check_not_contains_int(TestResult *acc, int elem, const int *arr,
+                              int len, const char *msg);
+int tc_check_equal_bytes(TestResult *acc, const void *expected,
+                         const void *actual, size_t len, const char *msg);
+int tc_check_equal_array_int(TestResult *acc, const int *expected,
+                             const int *actual, size_t len, const char *msg);
+int tc_check_equal_array_long(TestResult *acc, const long *expected,
+                              const long *actual, size_t len, const char *msg);
+int tc_check_equal_array_double(TestResult *acc, const double *expected,
+                                const double *actual, size_t len, double delta,
+                                const char *msg);
+int tc_check_equal_array_double_ulps(TestResult *acc, const double *expected,
+                                     const double *actual, size_t len,
+                                     uint64_t max_ulps, const char *msg);
+int tc_check_sorted_int(TestResult *acc, const int *arr, size_t len,
+                        const char *msg);
+int tc_check_sorted_long(TestResult *acc, const long *arr, size_t len,
+                         const char *msg);
+int tc_check_sorted_double(TestResult *acc, const double *arr, size_t len,
+                           const char *msg);
+int tc_check_duration_under(TestResult *acc, CallbackFn fn, void *ctx,
+                            uint64_t ns, int iters);
+int tc_check_duration_percentile_under(TestResult *acc, CallbackFn fn,
+                                       void *ctx, uint64_t ns, int iters,
+                                       double percentile);
+int tc_check_no_alloc(TestResult *acc, CallbackFn fn, void *ctx);
+int tc_check_max_allocs(TestResult *acc, CallbackFn fn, void *ctx, uint64_t n);
+
 /* ============================================================
    SUITE CONSTRUCTION
    ============================================================ */
@@ -235,7 +640,230 @@ TestResult tc_assert_not_contains_int(int elem, const int *arr, int len,
 Suite tc_suite(const char *name, Test *tests);
 Suite tc_suite_with(const char *name, SetupFn setup, TeardownFn teardown,
                     Test *tests);
+Test tc_test(const char *name, TestFn fn);
 Test tc_skip_test(const char *name, const char *reason);
+Test tc_bench(const char *name, BenchFn fn);
+Test tc_property(const char *name, GenFn gen, PropFn prop, int runs);
+Test tc_vectors(const char *name, const char *path, VectorFormat format,
+                VectorFn fn);
+
+/* ============================================================
+   PROPERTY TESTS
+   A property test checks prop against runs cases that gen builds from
+   a seeded pseudo-random stream. A failing case is shrunk by replaying
+   gen with smaller draws while prop still fails; the smallest case and
+   the seed to replay it with are reported. Each draw shrinks toward the
+   value noted, so generators built from draws shrink too.
+   ============================================================ */
+
+uint64_t tc_gen_choice(TestGen *g, uint64_t n); /* below n (0: any); 0 */
+int tc_gen_int(TestGen *g, int lo, int hi);     /* the one nearest 0 */
+double tc_gen_double(TestGen *g, double lo, double hi); /* nearest 0 */
+char *tc_gen_string(TestGen *g, size_t max_len);        /* "" */
+int *tc_gen_array_int(TestGen *g, size_t max_len, int lo, int hi,
+                      size_t *len); /* empty */
+double *tc_gen_array_double(TestGen *g, size_t max_len, double lo, double hi,
+                            size_t *len); /* empty */
+
+/* ============================================================
+   TEST VECTORS
+   tc_vectors(name, path, format, fn) runs fn once per record of the
+   file at path, which is mapped into memory rather than read. tc_main
+   turns it into one case per record, named "name[index]", before
+   filtering, so --match, --shard and --jobs treat every record as a
+   test of its own; cases are cached on the file's contents. Run by
+   tc_run_suite or tc_run_all instead, it is one test that stops at the
+   first failing record. A file that cannot be mapped fails the test.
+   ============================================================ */
+
+/* ============================================================
+   REGISTRY
+   ============================================================ */
+
+/*
+ * Suites run by tc_main(argc, argv, NULL), in registration order.
+ * tc_register_suite adds a suite the caller keeps alive; a test_count of
+ * 0 is filled in by counting up to the {0} entry. tc_register_test
+ * appends to a registry-owned suite, created on first use of its name.
+ * Register at startup, before any run.
+ */
+int tc_register_suite(Suite *suite);
+int tc_register_test(const char *suite_name, Test test);
+Suite **tc_registered_suites(void); /* NULL-terminated */
+
+/*
+ * Registration at load time, before main (C++, GCC, Clang, MSVC):
+ *
+ *   TC_TEST(Math, addition) { return tc_assert_equal_int(4, 2 + 2, "sum"); }
+ *   TC_BENCH(Math, multiply) { while (iters--) ... }
+ *   static Suite files = {"Files", file_tests, 0, setup, teardown};
+ *   TC_REGISTER_SUITE(files)
+ *
+ * Suite and test names are the identifiers. TC_TEST bodies get
+ * `void *env`; TC_BENCH bodies get `void *env, uint64_t iters`.
+ */
+#if defined(__cplusplus)
+#define TC__CONSTRUCTOR(f)                                                     \
+  static void f(void);                                                         \
+  static const int f##_init = (f(), 0);                                        \
+  static void f(void)
+#elif defined(__GNUC__) || defined(__clang__)
+#define TC__CONSTRUCTOR(f)                                                     \
+  static void f(void) __attribute__((constructor));                            \
+  static void f(void)
+#elif defined(_MSC_VER)
+#pragma section(".CRT$XCU", read)
+#ifdef _WIN64
+#define TC__SYMBOL_PREFIX ""
+#else
+#define TC__SYMBOL_PREFIX "_"
+#endif
+#define TC__CONSTRUCTOR(f)                                                     \
+  static void f(void);                                                         \
+  __declspec(allocate(".CRT$XCU")) void (*f##_init)(void) = f;                 \
+  __pragma(comment(linker, "/include:" TC__SYMBOL_PREFIX #f "_init"))          \
+  static void f(void)
+#endif
+
+#ifdef TC__CONSTRUCTOR
+#define TC_TEST(suite, name)                                                   \
+  static TestResult tc__test_##suite##_##name(void *env);                      \
+  TC__CONSTRUCTOR(tc__reg_##suite##_##name) {                                  \
+    tc_register_test(#suite, tc_test(#name, tc__test_##suite##_##name));       \
+  }                                                                            \
+  static TestResult tc__test_##suite##_##name(void *env)
+
+#define TC_BENCH(suite, name)                                                  \
+  static void tc__bench_##suite##_##name(void *env, uint64_t iters);           \
+  TC__CONSTRUCTOR(tc__reg_##suite##_##name) {                                  \
+    tc_register_test(#suite, tc_bench(#name, tc__bench_##suite##_##name));     \
+  }                                                                            \
+  static void tc__bench_##suite##_##name(void *env, uint64_t iters)
+
+#define TC_REGISTER_SUITE(var)                                                 \
+  TC__CONSTRUCTOR(tc__reg_suite_##var) { tc_register_suite(&(var)); }
+#endif
+
+/* ============================================================
+   FIXTURES
+   ============================================================ */
+
+typedef enum {
+  TC_FIXTURE_SESSION, /* one instance shared by the whole run */
+  TC_FIXTURE_SUITE    /* a fresh instance for each suite */
+} FixtureScope;
+
+/*
+ * A named resource for the suites that list it in Suite.fixtures. It is
+ * set up, after the fixtures it requires, when the first such suite
+ * starts, and torn down once the last suite of the run that needs it
+ * has finished. Suites running in parallel wait for and share one
+ * session instance. setup and teardown work as for suites; a failed
+ * setup fails every suite that needs the fixture.
+ */
+typedef struct {
+  const char *name;
+  SetupFn setup;
+  TeardownFn teardown;
+  FixtureScope scope;
+  const char *requires; /* fixtures set up first, like tags */
+} Fixture;
+
+/* Copies the definition (not its strings); register before any run */
+int tc_register_fixture(const Fixture *fixture);
+
+/*
+ * Value of a fixture the running suite uses, directly or through one it
+ * lists. Works in the suite's setup, tests and teardown, and in the
+ * setup and teardown of fixtures that require it; NULL elsewhere.
+ */
+void *tc_fixture(const char *name);
+
+#ifdef TC__CONSTRUCTOR
+#define TC_REGISTER_FIXTURE(var)                                               \
+  TC__CONSTRUCTOR(tc__reg_fixture_##var) { tc_register_fixture(&(var)); }
+#endif
+
+/* ============================================================
+   BENCHMARKS
+   ============================================================ */
+
+/*
+ * Keep the compiler from deleting work whose result is unused: `x` (an
+ * lvalue) is treated as read, and memory as clobbered.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define tc_do_not_optimize(x) __asm__ __volatile__("" : : "r"(&(x)) : "memory")
+#define tc_clobber() __asm__ __volatile__("" : : : "memory")
+#else
+void tc__escape(const volatile void *p);
+#define tc_do_not_optimize(x) tc__escape(&(x))
+#define tc_clobber() tc__escape(NULL)
+#endif
+
+/*
+ * Compare later runs with a file from tc_write_bench_json (NULL: stop).
+ * A benchmark fails when its median is more than threshold_pct above the
+ * baseline's and a Mann-Whitney U test finds the slowdown significant.
+ * Returns -1 if the file cannot be read, is not a saved run or holds no
+ * benchmarks.
+ */
+int tc_set_bench_baseline(const char *filename, double threshold_pct);
+
+/* ============================================================
+   TIMING
+   ============================================================ */
+
+/* Monotonic clock in nanoseconds; the origin is arbitrary */
+typedef uint64_t (*ClockFn)(void);
+
+uint64_t tc_now_ns(void);
+
+/* Replace the platform clock, e.g. with a hardware timer on embedded */
+void tc_set_clock(ClockFn now_ns);
+
+/* ============================================================
+   TEST MEMORY
+   ============================================================ */
+
+/*
+ * Scratch memory from the calling thread's bump arena, aligned to 16
+ * bytes; NULL if out of memory. Everything a test allocates is released
+ * at once when it returns; outside a test it lasts until the next run.
+ * Not for assertion messages under TC_STATIC_MESSAGES.
+ */
+void *tc_alloc(size_t size);
+char *tc_strdup(const char *s);
+
+/*
+ * Memory that lives as long as the running suite's env and is released
+ * after its teardown; NULL outside a suite. Tests sharing an env may
+ * call it concurrently. Session fixtures, which outlive the suite that
+ * builds them, should not use it.
+ */
+void *tc_suite_alloc(size_t size);
+
+/*
+ * Heap allocations are counted per thread while a test runs, so tests
+ * on other workers never mix in. Building testcracks.c with
+ * TC_ALLOC_COUNT interposes malloc, calloc, realloc, reallocarray, free,
+ * valloc, pvalloc and the aligned allocators (glibc; not with
+ * sanitizers). Elsewhere, or for a custom allocator, report them with
+ * these hooks.
+ */
+void tc_note_alloc(size_t size);
+void tc_note_free(size_t size);
+
+/* Attach AllocStats to every test result (--allocs) */
+void tc_set_alloc_report(int on);
+
+/*
+ * Attach PerfStats to every test result (--perf-counters). Each worker
+ * thread opens one perf_event_open group (Linux) and reads it around
+ * each test. Returns -1, leaving counters off, when none can be opened:
+ * other systems, TC_NO_PERF, no PMU, or perf_event_paranoid too high.
+ */
+int tc_set_perf_counters(int on);
 
 /* ============================================================
    RUNNERS
@@ -244,6 +872,71 @@ Test tc_skip_test(const char *name, const char *reason);
 TestResult tc_run_test(Test *test, void *env);
 RunSummary tc_run_suite(Suite *suite);
 RunSummary tc_run_all(Suite **suites);
+
+/*
+ * Run suites on a work-stealing pool of `jobs` threads (<= 0: one per CPU).
+ * A suite's setup and teardown run on one worker. Consecutive tests that
+ * are TC_TEST_READ_ONLY (or in a TC_SUITE_SHARED_ENV suite) are fanned out
+ * across the pool between them; all others run on the suite's worker.
+ * Suites flagged TC_SUITE_SERIAL, and suites with benchmarks, run
+ * afterwards on the calling thread.
+ */
+RunSummary tc_run_all_parallel(Suite **suites, int jobs);
+
+/*
+ * Process isolation (POSIX; elsewhere tests run in-process with a warning).
+ * TC_ISOLATE_TEST runs tests in a forked child after the suite's setup,
+ * replacing the child whenever one dies; TC_ISOLATE_SUITE forks once per
+ * suite for setup, tests and teardown. A crash fails only the test that
+ * was running, with the signal or exit status as its actual value.
+ */
+typedef enum {
+  TC_ISOLATE_NONE,
+  TC_ISOLATE_TEST,
+  TC_ISOLATE_SUITE
+} IsolationMode;
+
+void tc_set_isolation(IsolationMode mode);
+
+/* Multiply every time budget and duration limit, e.g. 2.0 on slow CI */
+void tc_set_budget_scale(double scale);
+
+/*
+ * Default limit for tests without their own timeout_ns (0: none), and
+ * for suite setup and teardown. An isolated test that overruns is
+ * killed and fails. In-process, a
+ * test that overruns fails when it returns; if it is still running a
+ * second later, a watchdog thread reports the unfinished suites (tests
+ * not run yet as not run) and ends the process with status 1.
+ */
+void tc_set_timeout(uint64_t ns);
+
+/*
+ * Seed for property tests; each test mixes in its name. Unset, a run
+ * picks one from the clock and reports it with any failing property.
+ */
+void tc_set_seed(uint64_t seed);
+
+/*
+ * Cancel the run once n tests have failed (0, the default: never).
+ * Tests not yet started are reported as not run; suites not yet started
+ * skip setup and teardown, while a suite already set up tears down.
+ */
+void tc_set_max_failures(int n);
+
+/*
+ * Nonzero once the run is cancelled, so long tests can stop early.
+ * env is the test's environment; the flag is shared by the whole run.
+ */
+int tc_cancelled(void *env);
+
+/*
+ * Identify the build for --cache instead of hashing the test binary,
+ * e.g. a commit hash plus build flags. NULL goes back to hashing.
+ */
+void tc_set_build_id(const char *id);
+
+/* CLI entry point; suites NULL runs the registry */
 int tc_main(int argc, char **argv, Suite **suites);
 
 /* ============================================================
@@ -253,6 +946,79 @@ int tc_main(int argc, char **argv, Suite **suites);
 void tc_print_result(const char *name, TestResult *result);
 int tc_print_summary(RunSummary summary);
 
+/*
+ * Console detail for the runners. Each suite's block is rendered into
+ * one buffer and written at once, so parallel suites never interleave.
+ * TC_OUTPUT_DOTS prints one character per test (. F s E) and the
+ * failing suites after the run; TC_OUTPUT_QUIET leaves only the summary.
+ */
+typedef enum {
+  TC_OUTPUT_NORMAL,
+  TC_OUTPUT_FAILURES_ONLY,
+  TC_OUTPUT_DOTS,
+  TC_OUTPUT_QUIET
+} OutputMode;
+
+void tc_set_output_mode(OutputMode mode);
+
+/*
+ * Render one side of an error into buf (snprintf semantics: returns the
+ * full length, truncates to size). Empty for errors without operands.
+ */
+int tc_error_expected(const TestError *e, char *buf, size_t size);
+int tc_error_actual(const TestError *e, char *buf, size_t size);
+
+/* ============================================================
+   REPORTERS
+   ============================================================ */
+
+/*
+ * Result stream hooks; any may be NULL. Hooks are called under one lock,
+ * never concurrently. A suite's on_test_end calls come together, after
+ * its budgets and baselines are judged, right before its on_suite_end.
+ * When setup fails, on_suite_end gets NULL results and the setup status.
+ * A teardown that crashes under --isolate-suite counts once in the
+ * summary's errored.
+ * tc_run_suite reports suite events only.
+ */
+typedef struct {
+  void *ctx;
+  void (*on_run_start)(void *ctx, Suite **suites);
+  void (*on_suite_start)(void *ctx, const Suite *suite);
+  void (*on_test_end)(void *ctx, const Suite *suite, const Test *test,
+                      const TestResult *result);
+  void (*on_suite_end)(void *ctx, const Suite *suite,
+                       const TestResult *results, int setup_status,
+                       RunSummary summary);
+  void (*on_run_end)(void *ctx, RunSummary summary);
+  void (*close)(void *ctx);
+} Reporter;
+
+/* Copies the vtable; -1 once TC_MAX_REPORTERS are registered */
+int tc_add_reporter(const Reporter *reporter);
+/* Calls every close hook and unregisters all reporters */
+void tc_clear_reporters(void);
+
+/*
+ * Built-in reporters writing to a file, "-" for stdout. NDJSON writes one
+ * object per event; TAP writes version 13 with YAML diagnostics.
+ *
+ * The binary stream is "TCR1" and then records, each a u32 payload length
+ * followed by a u8 type and its fields. Integers are little-endian and
+ * strings are a u32 length plus bytes. Suite ids count from 0 in
+ * suite-start order.
+ *   1 run start    u32 suites, u32 tests
+ *   2 suite start  u32 id, str name
+ *   3 test         u32 id, u32 index, u8 tag, u64 elapsed ns, str name,
+ *                  u32 errors, per error: str message, expected, actual
+ *   4 suite end    u32 id, i32 setup status, u32 passed, failed,
+ *                  skipped, errored, u64 elapsed ns
+ *   5 run end      u32 passed, failed, skipped, errored, u64 elapsed ns
+ */
+int tc_add_ndjson_reporter(const char *filename);
+int tc_add_tap_reporter(const char *filename);
+int tc_add_binary_reporter(const char *filename);
+
 /* ============================================================
    JUNIT XML OUTPUT
    ============================================================ */
@@ -260,6 +1026,26 @@ int tc_print_summary(RunSummary summary);
 int tc_write_junit_xml(const char *filename, Suite **suites,
                        RunSummary summary);
 
+/* ============================================================
+   BENCHMARK OUTPUT
+   ============================================================ */
+
+/* One JSON object per benchmark of the last run, samples included */
+int tc_write_bench_json(const char *filename, Suite **suites);
+
+/* ============================================================
+   TRACE OUTPUT
+   ============================================================ */
+
+/*
+ * Record spans for the run, each suite and each setup, test and
+ * teardown (--trace). tc_write_trace then writes those of the last run
+ * as Chrome trace-event JSON, one track per worker thread, for
+ * chrome://tracing or ui.perfetto.dev.
+ */
+void tc_set_trace(int on);
+int tc_write_trace(const char *filename);
+
 #ifdef __cplusplus
 }
 #endif
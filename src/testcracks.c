@@ -1,50 +1,895 @@
+/* Impact recording resolves addresses with dladdr() */
+#if defined(TC_IMPACT) && defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+/* syscall() opens hardware counters for --perf-counters */
+#if defined(__linux__) && !defined(TC_NO_PERF) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+/* POSIX interfaces (threads, sysconf) are used under -std=c99 */
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+#if defined(__APPLE__) && !defined(_DARWIN_C_SOURCE)
+#define _DARWIN_C_SOURCE
+#endif
+
 #include "testcracks.h"
 #include <math.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#ifndef TC_NO_GETTIMEOFDAY
+#include <time.h>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif !defined(TC_NO_THREADS)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#elif !defined(_WIN32) && !defined(TC_NO_GETTIMEOFDAY) &&                     \
+    !defined(CLOCK_MONOTONIC)
 #include <sys/time.h>
+#endif
+
+#if defined(TC_CLOCK_TSC) &&                                                   \
+    (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||            \
+     defined(_M_IX86))
+#define TC__HAVE_TSC
+#if defined(_MSC_VER)
+#include <intrin.h>
 #else
-#include <time.h>
+#include <x86intrin.h>
+#endif
+#endif
+
+#if !defined(TC_NO_SIMD) &&                                                   \
+    (defined(__SSE2__) || defined(_M_X64) ||                                   \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define TC__HAVE_SSE2
+#include <emmintrin.h>
+#elif !defined(TC_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+#define TC__HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#endif
+
+#if !defined(_WIN32) && (defined(__unix__) || defined(__APPLE__))
+#define TC__HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if !defined(_WIN32) && !defined(TC_NO_REGEX) &&                              \
+    (defined(__unix__) || defined(__APPLE__))
+#define TC__HAVE_REGEX
+#include <regex.h>
+#endif
+
+#if defined(TC_IMPACT) && defined(__linux__) &&                                \
+    (defined(__GNUC__) || defined(__clang__))
+#define TC__HAVE_IMPACT
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#if defined(TC_ALLOC_COUNT) && defined(__GLIBC__)
+#define TC__HAVE_ALLOC_HOOK
+#include <errno.h>
+#include <malloc.h>
+#endif
+
+#if defined(__linux__) && !defined(TC_NO_PERF)
+#define TC__HAVE_PERF
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if !defined(_WIN32) && !defined(TC_NO_FORK) &&                               \
+    (defined(__unix__) || defined(__APPLE__))
+#define TC__HAVE_FORK
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #endif
 
 /* ============================================================
-   INTERNAL HELPERS
+   CLOCK
+   Monotonic nanoseconds: QueryPerformanceCounter on Windows,
+   mach_absolute_time on macOS, clock_gettime(CLOCK_MONOTONIC_RAW) on
+   Linux/BSD, clock() under TC_NO_GETTIMEOFDAY. TC_CLOCK_TSC reads the x86
+   time-stamp counter, calibrated once against the OS clock. A hook set
+   with tc_set_clock() replaces all of them.
    ============================================================ */
 
-static double tc__get_time_ms(void) {
-#ifndef TC_NO_GETTIMEOFDAY
+static ClockFn tc__clock_hook;
+static int tc__clock_ready;
+
+#if defined(_WIN32)
+static LARGE_INTEGER tc__qpc_freq;
+#elif defined(__APPLE__)
+static mach_timebase_info_data_t tc__timebase;
+#endif
+
+#ifdef TC__HAVE_TSC
+static uint64_t tc__tsc_base;
+static uint64_t tc__tsc_ns_base;
+static double tc__tsc_ns_per_tick;
+#endif
+
+static uint64_t tc__os_now_ns(void) {
+#if defined(_WIN32)
+  LARGE_INTEGER now;
+  uint64_t freq = (uint64_t)tc__qpc_freq.QuadPart;
+  QueryPerformanceCounter(&now);
+  /* Split so the multiplication cannot overflow */
+  return (uint64_t)now.QuadPart / freq * 1000000000u +
+         (uint64_t)now.QuadPart % freq * 1000000000u / freq;
+#elif defined(__APPLE__)
+  return mach_absolute_time() * tc__timebase.numer / tc__timebase.denom;
+#elif defined(TC_NO_GETTIMEOFDAY)
+  return (uint64_t)((double)clock() * 1e9 / CLOCKS_PER_SEC);
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+#ifdef CLOCK_MONOTONIC_RAW
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
   struct timeval tv;
   gettimeofday(&tv, NULL);
-  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+  return (uint64_t)tv.tv_sec * 1000000000u + (uint64_t)tv.tv_usec * 1000u;
+#endif
+}
+
+/* Called before any worker starts; later calls are no-ops */
+static void tc__clock_init(void) {
+  if (tc__clock_ready)
+    return;
+#if defined(_WIN32)
+  QueryPerformanceFrequency(&tc__qpc_freq);
+#elif defined(__APPLE__)
+  mach_timebase_info(&tc__timebase);
+#endif
+#ifdef TC__HAVE_TSC
+  {
+    uint64_t ns0 = tc__os_now_ns(), ns1;
+    uint64_t tsc0 = __rdtsc(), tsc1;
+    do {
+      ns1 = tc__os_now_ns();
+    } while (ns1 - ns0 < 10000000u);
+    tsc1 = __rdtsc();
+    tc__tsc_ns_per_tick = (double)(ns1 - ns0) / (double)(tsc1 - tsc0);
+    tc__tsc_base = tsc1;
+    tc__tsc_ns_base = ns1;
+  }
+#endif
+  tc__clock_ready = 1;
+}
+
+void tc_set_clock(ClockFn now_ns) { tc__clock_hook = now_ns; }
+
+uint64_t tc_now_ns(void) {
+  if (tc__clock_hook)
+    return tc__clock_hook();
+  if (!tc__clock_ready)
+    tc__clock_init();
+#ifdef TC__HAVE_TSC
+  return tc__tsc_ns_base +
+         (uint64_t)((double)(__rdtsc() - tc__tsc_base) * tc__tsc_ns_per_tick);
 #else
-  return (double)clock() / CLOCKS_PER_SEC * 1000.0;
+  return tc__os_now_ns();
 #endif
 }
 
-static void tc__safe_copy(char *dst, const char *src, size_t max) {
+static double tc__ms_since(uint64_t start_ns) {
+  return (double)(tc_now_ns() - start_ns) / 1e6;
+}
+
+/* Pick the unit so that sub-millisecond tests don't all print as 0.00ms */
+static void tc__format_ns(char *buf, size_t size, uint64_t ns) {
+  if (ns < 1000u)
+    snprintf(buf, size, "%uns", (unsigned)ns);
+  else if (ns < 1000000u)
+    snprintf(buf, size, "%.2fus", (double)ns / 1e3);
+  else
+    snprintf(buf, size, "%.2fms", (double)ns / 1e6);
+}
+
+/* Fractional durations, for per-operation benchmark figures */
+static void tc__format_ns_f(char *buf, size_t size, double ns) {
+  if (ns < 1e3)
+    snprintf(buf, size, "%.2fns", ns);
+  else if (ns < 1e6)
+    snprintf(buf, size, "%.2fus", ns / 1e3);
+  else if (ns < 1e9)
+    snprintf(buf, size, "%.2fms", ns / 1e6);
+  else
+    snprintf(buf, size, "%.2fs", ns / 1e9);
+}
+
+static void tc__format_bytes(char *buf, size_t size, uint64_t n) {
+  if (n < 1024u)
+    snprintf(buf, size, "%uB", (unsigned)n);
+  else if (n < 1024u * 1024u)
+    snprintf(buf, size, "%.1fKB", (double)n / 1024.0);
+  else if (n < 1024u * 1024u * 1024u)
+    snprintf(buf, size, "%.1fMB", (double)n / (1024.0 * 1024.0));
+  else
+    snprintf(buf, size, "%.1fGB", (double)n / (1024.0 * 1024.0 * 1024.0));
+}
+
+/* ============================================================
+   BUFFERS
+   ============================================================ */
+
+/* Growable byte buffer; data is NULL until the first append */
+typedef struct {
+  char *data;
   size_t len;
-  if (!src) {
-    dst[0] = '\0';
+  size_t cap;
+} tc__Buf;
+
+static int tc__buf_reserve(tc__Buf *b, size_t extra) {
+  if (b->len + extra > b->cap) {
+    size_t cap = b->cap ? b->cap : 256;
+    char *grown;
+    while (cap < b->len + extra)
+      cap *= 2;
+    grown = (char *)realloc(b->data, cap);
+    if (!grown)
+      return -1;
+    b->data = grown;
+    b->cap = cap;
+  }
+  return 0;
+}
+
+static int tc__buf_append(tc__Buf *b, const void *src, size_t len) {
+  if (tc__buf_reserve(b, len) != 0)
+    return -1;
+  memcpy(b->data + b->len, src, len);
+  b->len += len;
+  return 0;
+}
+
+static int tc__buf_puts(tc__Buf *b, const char *s) {
+  return tc__buf_append(b, s, strlen(s));
+}
+
+static int tc__buf_printf(tc__Buf *b, const char *fmt, ...) {
+  char small[256];
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(small, sizeof(small), fmt, ap);
+  va_end(ap);
+  if (len < 0)
+    return -1;
+  if ((size_t)len < sizeof(small))
+    return tc__buf_append(b, small, (size_t)len);
+
+  /* Too long for the stack copy: format straight into the buffer */
+  if (tc__buf_reserve(b, (size_t)len + 1) != 0)
+    return -1;
+  va_start(ap, fmt);
+  vsnprintf(b->data + b->len, (size_t)len + 1, fmt, ap);
+  va_end(ap);
+  b->len += (size_t)len;
+  return 0;
+}
+
+/* Append src as a quoted JSON string */
+static void tc__buf_json(tc__Buf *b, const char *src) {
+  tc__buf_puts(b, "\"");
+  for (; src && *src != '\0'; src++) {
+    unsigned char c = (unsigned char)*src;
+    if (c == '"' || c == '\\')
+      tc__buf_printf(b, "\\%c", c);
+    else if (c < 0x20)
+      tc__buf_printf(b, "\\u%04x", c);
+    else
+      tc__buf_append(b, src, 1);
+  }
+  tc__buf_puts(b, "\"");
+}
+
+static void tc__buf_free(tc__Buf *b) {
+  free(b->data);
+  b->data = NULL;
+  b->len = 0;
+  b->cap = 0;
+}
+
+/* Read a whole stream into a NUL-terminated buffer */
+static char *tc__slurp(FILE *f) {
+  tc__Buf b = {0};
+  char chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    if (tc__buf_append(&b, chunk, n) != 0) {
+      tc__buf_free(&b);
+      return NULL;
+    }
+  }
+  if (tc__buf_append(&b, "", 1) != 0) {
+    tc__buf_free(&b);
+    return NULL;
+  }
+  return b.data;
+}
+
+/* ============================================================
+   THREADS
+   Thin mutex/condvar/thread layer over pthreads or Win32.
+   TC_NO_THREADS turns it into no-ops and runs everything inline.
+   ============================================================ */
+
+#if defined(TC_NO_THREADS)
+
+typedef int tc__mutex;
+typedef int tc__cond;
+typedef int tc__thread;
+#define TC__MUTEX_INIT 0
+#define TC__TLS
+
+static void tc__mutex_init(tc__mutex *m) { *m = 0; }
+static void tc__mutex_lock(tc__mutex *m) { (void)m; }
+static void tc__mutex_unlock(tc__mutex *m) { (void)m; }
+static void tc__cond_init(tc__cond *c) { *c = 0; }
+static void tc__cond_wait(tc__cond *c, tc__mutex *m) {
+  (void)c;
+  (void)m;
+}
+static void tc__cond_broadcast(tc__cond *c) { (void)c; }
+static int tc__thread_start(tc__thread *t, void (*fn)(void *), void *arg) {
+  (void)t;
+  fn(arg);
+  return 0;
+}
+static void tc__thread_join(tc__thread t) { (void)t; }
+static int tc__cpu_count(void) { return 1; }
+
+#else
+
+typedef struct {
+  void (*fn)(void *);
+  void *arg;
+} tc__ThreadStart;
+
+#if defined(_WIN32)
+
+typedef SRWLOCK tc__mutex;
+typedef CONDITION_VARIABLE tc__cond;
+typedef HANDLE tc__thread;
+#define TC__MUTEX_INIT SRWLOCK_INIT
+
+#if defined(_MSC_VER)
+#define TC__TLS __declspec(thread)
+#else
+#define TC__TLS __thread
+#endif
+
+static void tc__mutex_init(tc__mutex *m) { InitializeSRWLock(m); }
+static void tc__mutex_lock(tc__mutex *m) { AcquireSRWLockExclusive(m); }
+static void tc__mutex_unlock(tc__mutex *m) { ReleaseSRWLockExclusive(m); }
+static void tc__cond_init(tc__cond *c) { InitializeConditionVariable(c); }
+static void tc__cond_wait(tc__cond *c, tc__mutex *m) {
+  SleepConditionVariableSRW(c, m, INFINITE, 0);
+}
+static void tc__cond_broadcast(tc__cond *c) { WakeAllConditionVariable(c); }
+
+static DWORD WINAPI tc__thread_main(LPVOID p) {
+  tc__ThreadStart start = *(tc__ThreadStart *)p;
+  free(p);
+  start.fn(start.arg);
+  return 0;
+}
+
+static int tc__thread_start(tc__thread *t, void (*fn)(void *), void *arg) {
+  tc__ThreadStart *start = (tc__ThreadStart *)malloc(sizeof(*start));
+  if (!start)
+    return -1;
+  start->fn = fn;
+  start->arg = arg;
+  *t = CreateThread(NULL, 0, tc__thread_main, start, 0, NULL);
+  if (!*t) {
+    free(start);
+    return -1;
+  }
+  return 0;
+}
+
+static void tc__thread_join(tc__thread t) {
+  WaitForSingleObject(t, INFINITE);
+  CloseHandle(t);
+}
+
+static void tc__sleep_ns(uint64_t ns) { Sleep((DWORD)(ns / 1000000u)); }
+
+static int tc__cpu_count(void) {
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+#else
+
+typedef pthread_mutex_t tc__mutex;
+typedef pthread_cond_t tc__cond;
+typedef pthread_t tc__thread;
+#define TC__MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define TC__TLS __thread
+
+static void tc__mutex_init(tc__mutex *m) { pthread_mutex_init(m, NULL); }
+static void tc__mutex_lock(tc__mutex *m) { pthread_mutex_lock(m); }
+static void tc__mutex_unlock(tc__mutex *m) { pthread_mutex_unlock(m); }
+static void tc__cond_init(tc__cond *c) { pthread_cond_init(c, NULL); }
+static void tc__cond_wait(tc__cond *c, tc__mutex *m) {
+  pthread_cond_wait(c, m);
+}
+static void tc__cond_broadcast(tc__cond *c) { pthread_cond_broadcast(c); }
+
+static void *tc__thread_main(void *p) {
+  tc__ThreadStart start = *(tc__ThreadStart *)p;
+  free(p);
+  start.fn(start.arg);
+  return NULL;
+}
+
+static int tc__thread_start(tc__thread *t, void (*fn)(void *), void *arg) {
+  tc__ThreadStart *start = (tc__ThreadStart *)malloc(sizeof(*start));
+  if (!start)
+    return -1;
+  start->fn = fn;
+  start->arg = arg;
+  if (pthread_create(t, NULL, tc__thread_main, start) != 0) {
+    free(start);
+    return -1;
+  }
+  return 0;
+}
+
+static void tc__thread_join(tc__thread t) { pthread_join(t, NULL); }
+
+static void tc__sleep_ns(uint64_t ns) {
+  struct timespec ts;
+  ts.tv_sec = (time_t)(ns / 1000000000u);
+  ts.tv_nsec = (long)(ns % 1000000000u);
+  while (nanosleep(&ts, &ts) != 0)
+    ;
+}
+
+static int tc__cpu_count(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+#endif
+#endif
+
+/* ============================================================
+   ALLOCATION COUNT
+   Per-thread heap counters, see ALLOCATION COUNTING. The stores below
+   switch them off while growing, so a test is not charged for the
+   framework recording its failures.
+   ============================================================ */
+
+typedef struct {
+  int on;
+  int hooked; /* tc_note_alloc/free was called on this thread */
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t bytes;
+  long long live; /* may drop below 0 freeing older blocks */
+  long long peak;
+} tc__AllocCount;
+
+/* malloc runs before dynamic TLS can be set up, and must not recurse */
+#if defined(TC__HAVE_ALLOC_HOOK) && !defined(TC_NO_THREADS)
+static TC__TLS __attribute__((tls_model("initial-exec")))
+tc__AllocCount tc__tls_alloc;
+#else
+static TC__TLS tc__AllocCount tc__tls_alloc;
+#endif
+
+/* ============================================================
+   ERROR STORE
+   Chunked bump allocators holding TestError records and the text
+   they reference out of line. Chunks never move, so TestResult.errors
+   stays valid; a mark/reset pair reclaims everything a test allocated
+   but threw away.
+   ============================================================ */
+
+#define TC__ALIGN 16
+#define TC__ROUND_UP(n) (((n) + (TC__ALIGN - 1)) & ~(size_t)(TC__ALIGN - 1))
+#define TC__CHUNK_MIN (64 * 1024)
+
+typedef struct tc__Chunk {
+  struct tc__Chunk *next;
+  size_t size;
+  size_t used;
+} tc__Chunk;
+
+typedef struct {
+  tc__Chunk *head;
+  tc__Chunk *cur;
+} tc__Arena;
+
+typedef struct {
+  tc__Chunk *chunk;
+  size_t used;
+} tc__ArenaMark;
+
+#define TC__CHUNK_HDR TC__ROUND_UP(sizeof(tc__Chunk))
+#define TC__CHUNK_DATA(c) ((char *)(c) + TC__CHUNK_HDR)
+
+/* A timed span of the run for --trace, see TRACING */
+typedef struct {
+  const char *name;
+  const char *suite; /* of a test span; NULL otherwise */
+  uint64_t start_ns;
+  uint64_t dur_ns;
+  int kind;
+  int tag; /* ResultTag of a test span */
+} tc__Span;
+
+/*
+ * Each thread appends to its own store: worker threads get one for the
+ * duration of a parallel run, everything else uses the main store.
+ */
+typedef struct {
+  tc__Arena errors;
+  tc__Arena text;
+  tc__Arena scratch; /* tc_alloc */
+  tc__Span *spans;
+  int span_count;
+  int span_cap;
+} tc__Store;
+
+static tc__Store tc__main_store;
+static TC__TLS tc__Store *tc__tls_store;
+
+static tc__Store *tc__cur_store(void) {
+  return tc__tls_store ? tc__tls_store : &tc__main_store;
+}
+
+#define TC__ERRORS (&tc__cur_store()->errors)
+#define TC__TEXT (&tc__cur_store()->text)
+#define TC__SCRATCH (&tc__cur_store()->scratch)
+
+static void *tc__arena_alloc(tc__Arena *a, size_t size) {
+  tc__Chunk *c = a->cur;
+  size = TC__ROUND_UP(size);
+
+  if (c && c->size - c->used >= size) {
+    void *p = TC__CHUNK_DATA(c) + c->used;
+    c->used += size;
+    return p;
+  }
+
+  /* Reuse the chunk after the current one if it is large enough */
+  if (c && c->next && c->next->size >= size) {
+    c = c->next;
+    c->used = size;
+    a->cur = c;
+    return TC__CHUNK_DATA(c);
+  }
+
+  {
+    size_t cap = c ? c->size * 2 : TC__CHUNK_MIN;
+    int counting = tc__tls_alloc.on;
+    tc__Chunk *n;
+    if (cap < size)
+      cap = size;
+    tc__tls_alloc.on = 0;
+    n = (tc__Chunk *)malloc(TC__CHUNK_HDR + cap);
+    tc__tls_alloc.on = counting;
+    if (!n)
+      return NULL;
+    n->size = cap;
+    n->used = size;
+    if (c) {
+      n->next = c->next;
+      c->next = n;
+    } else {
+      n->next = NULL;
+      a->head = n;
+    }
+    a->cur = n;
+    return TC__CHUNK_DATA(n);
+  }
+}
+
+static char *tc__arena_top(tc__Arena *a) {
+  return a->cur ? TC__CHUNK_DATA(a->cur) + a->cur->used : NULL;
+}
+
+/* Grow the most recent allocation in place; fails if it is not on top */
+static int tc__arena_extend(tc__Arena *a, void *end, size_t extra) {
+  tc__Chunk *c = a->cur;
+  extra = TC__ROUND_UP(extra);
+  if (!c || (char *)end != tc__arena_top(a) || c->size - c->used < extra)
+    return 0;
+  c->used += extra;
+  return 1;
+}
+
+static tc__ArenaMark tc__arena_mark(tc__Arena *a) {
+  tc__ArenaMark m;
+  m.chunk = a->cur;
+  m.used = a->cur ? a->cur->used : 0;
+  return m;
+}
+
+static void tc__arena_free(tc__Arena *a) {
+  tc__Chunk *c = a->head;
+  while (c) {
+    tc__Chunk *next = c->next;
+    free(c);
+    c = next;
+  }
+  a->head = NULL;
+  a->cur = NULL;
+}
+
+static void tc__arena_clear(tc__Arena *a) {
+  a->cur = a->head;
+  if (a->cur)
+    a->cur->used = 0;
+}
+
+static void tc__arena_reset(tc__Arena *a, tc__ArenaMark m) {
+  if (!m.chunk) {
+    tc__arena_clear(a);
     return;
   }
-  len = strlen(src);
-  if (len >= max)
-    len = max - 1;
-  memcpy(dst, src, len);
-  dst[len] = '\0';
+  a->cur = m.chunk;
+  a->cur->used = m.used;
+}
+
+/* Was ptr handed out after mark m? */
+static int tc__arena_since(tc__Arena *a, tc__ArenaMark m, const void *ptr) {
+  tc__Chunk *c = m.chunk ? m.chunk : a->head;
+  size_t from = m.chunk ? m.used : 0;
+  const char *p = (const char *)ptr;
+
+  for (; c; c = c->next) {
+    if (p >= TC__CHUNK_DATA(c) + from && p < TC__CHUNK_DATA(c) + c->used)
+      return 1;
+    if (c == a->cur)
+      break;
+    from = 0;
+  }
+  return 0;
+}
+
+/*
+ * Release everything allocated since m except the `size` bytes at ptr,
+ * which are moved down to the mark. Returns the new location.
+ */
+static void *tc__arena_keep(tc__Arena *a, tc__ArenaMark m, void *ptr,
+                            size_t size) {
+  void *dst;
+  if (!tc__arena_since(a, m, ptr)) {
+    tc__arena_reset(a, m);
+    return ptr;
+  }
+  tc__arena_reset(a, m);
+  dst = tc__arena_alloc(a, size);
+  if (dst != ptr)
+    memmove(dst, ptr, size);
+  return dst;
+}
+
+/*
+ * Return a run of count + extra records starting with the errors in errs.
+ * Extends in place when errs is the newest run in the store.
+ */
+static TestError *tc__errors_grow(TestError *errs, int count, int extra) {
+  TestError *run;
+  if (errs && tc__arena_extend(TC__ERRORS, errs + count,
+                               (size_t)extra * sizeof(TestError)))
+    return errs;
+  run = (TestError *)tc__arena_alloc(TC__ERRORS, (size_t)(count + extra) *
+                                                      sizeof(TestError));
+  if (run && count > 0)
+    memcpy(run, errs, (size_t)count * sizeof(TestError));
+  return run;
+}
+
+static const char *tc__store_text(const char *src) {
+  size_t len;
+  char *copy;
+  if (!src)
+    return NULL;
+  len = strlen(src) + 1;
+  copy = (char *)tc__arena_alloc(TC__TEXT, len);
+  if (!copy)
+    return "(out of memory)";
+  memcpy(copy, src, len);
+  return copy;
+}
+
+static const char *tc__store_printf(const char *fmt, ...) {
+  va_list ap;
+  int len;
+  char *copy;
+
+  va_start(ap, fmt);
+  len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  if (len < 0)
+    return "";
+  copy = (char *)tc__arena_alloc(TC__TEXT, (size_t)len + 1);
+  if (!copy)
+    return "(out of memory)";
+  va_start(ap, fmt);
+  vsnprintf(copy, (size_t)len + 1, fmt, ap);
+  va_end(ap);
+  return copy;
+}
+
+#ifdef TC_STATIC_MESSAGES
+#define TC__MESSAGE(m) (m)
+#else
+#define TC__MESSAGE(m) tc__store_text(m)
+#endif
+
+/* Append a blank error record; NULL once TC_MAX_ERRORS is reached */
+static TestError *tc__push_error(TestResult *r, const char *msg, ErrorOp op,
+                                 ValueKind kind) {
+  TestError *run;
+  TestError *e;
+  if (r->error_count >= TC_MAX_ERRORS)
+    return NULL;
+  run = tc__errors_grow(r->errors, r->error_count, 1);
+  if (!run)
+    return NULL;
+  r->errors = run;
+  e = &run[r->error_count++];
+  memset(e, 0, sizeof(*e));
+  e->message = TC__MESSAGE(msg);
+  e->op = op;
+  e->kind = kind;
+  return e;
+}
+
+/* Text operands whose pointers have static storage inside the library */
+static void tc__append_literal(TestResult *r, const char *msg,
+                               const char *expected, const char *actual) {
+  TestError *e = tc__push_error(r, msg, TC_OP_TEXT, TC_VAL_STR);
+  if (e) {
+    e->expected.s = expected;
+    e->actual.s = actual;
+  }
 }
 
 static void tc__append_error(TestResult *r, const char *msg,
                              const char *expected, const char *actual) {
-  if (r->error_count < TC_MAX_ERRORS) {
-    tc__safe_copy(r->errors[r->error_count].message, msg, TC_MAX_MSG_LEN);
-    tc__safe_copy(r->errors[r->error_count].expected, expected, TC_MAX_MSG_LEN);
-    tc__safe_copy(r->errors[r->error_count].actual, actual, TC_MAX_MSG_LEN);
-    r->error_count++;
+  TestError *e;
+  if ((!expected || !expected[0]) && (!actual || !actual[0])) {
+    tc__push_error(r, msg, TC_OP_NONE, TC_VAL_NONE);
+    return;
+  }
+  e = tc__push_error(r, msg, TC_OP_TEXT, TC_VAL_STR);
+  if (e) {
+    e->expected.s = tc__store_text(expected ? expected : "");
+    e->actual.s = tc__store_text(actual ? actual : "");
+  }
+}
+
+static int tc__text_since(tc__ArenaMark m, const char *s) {
+  return s && tc__arena_since(TC__TEXT, m, s);
+}
+
+static size_t tc__text_need(tc__ArenaMark m, const char *s) {
+  return tc__text_since(m, s) ? strlen(s) + 1 : 0;
+}
+
+static const char *tc__text_move(tc__ArenaMark m, const char *s, char **cursor) {
+  size_t len;
+  const char *dst = *cursor;
+  if (!tc__text_since(m, s))
+    return s;
+  len = strlen(s) + 1;
+  memcpy(*cursor, s, len);
+  *cursor += len;
+  return dst;
+}
+
+static const char *tc__text_rebase(const char *s, const char *stage,
+                                   size_t need, const char *block) {
+  if (!s || s < stage || s >= stage + need)
+    return s;
+  return block ? block + (s - stage) : "(out of memory)";
+}
+
+/*
+ * After a test returns, keep only the errors (and their text) it returned.
+ * Surviving text is staged through a temporary buffer so both stores can
+ * be rewound to where they stood before the test ran.
+ */
+static void tc__keep_errors(TestResult *r, tc__ArenaMark err_mark,
+                            tc__ArenaMark text_mark) {
+  size_t need = 0;
+  char *stage = NULL;
+  int i;
+
+  if (r->error_count == 0) {
+    tc__arena_reset(TC__ERRORS, err_mark);
+    tc__arena_reset(TC__TEXT, text_mark);
+    return;
+  }
+
+  for (i = 0; i < r->error_count; i++) {
+    TestError *e = &r->errors[i];
+    need += tc__text_need(text_mark, e->message);
+    if (e->kind == TC_VAL_STR) {
+      need += tc__text_need(text_mark, e->expected.s);
+      need += tc__text_need(text_mark, e->actual.s);
+    }
+  }
+
+  if (need > 0)
+    stage = (char *)malloc(need);
+
+  if (need == 0 || stage) {
+    char *cursor = stage;
+    char *block;
+    for (i = 0; i < r->error_count; i++) {
+      TestError *e = &r->errors[i];
+      e->message = tc__text_move(text_mark, e->message, &cursor);
+      if (e->kind == TC_VAL_STR) {
+        e->expected.s = tc__text_move(text_mark, e->expected.s, &cursor);
+        e->actual.s = tc__text_move(text_mark, e->actual.s, &cursor);
+      }
+    }
+    tc__arena_reset(TC__TEXT, text_mark);
+    if (need > 0) {
+      block = (char *)tc__arena_alloc(TC__TEXT, need);
+      if (block)
+        memcpy(block, stage, need);
+      /* Repoint from the staging buffer into the store */
+      for (i = 0; i < r->error_count; i++) {
+        TestError *e = &r->errors[i];
+        e->message = tc__text_rebase(e->message, stage, need, block);
+        if (e->kind == TC_VAL_STR) {
+          e->expected.s = tc__text_rebase(e->expected.s, stage, need, block);
+          e->actual.s = tc__text_rebase(e->actual.s, stage, need, block);
+        }
+      }
+      free(stage);
+    }
   }
+
+  r->errors = (TestError *)tc__arena_keep(TC__ERRORS, err_mark, r->errors,
+                                          (size_t)r->error_count *
+                                              sizeof(TestError));
 }
 
 #ifdef TC_NO_COLORS
@@ -65,36 +910,46 @@ static void tc__append_error(TestResult *r, const char *msg,
 
 TestResult tc_pass(void) {
   TestResult r;
-  memset(&r, 0, sizeof(r));
   r.tag = TC_PASS;
+  r.error_count = 0;
+  r.elapsed_ns = 0;
+  r.errors = NULL;
+  r.metrics = NULL;
   return r;
 }
 
 TestResult tc_fail(const char *msg) {
-  TestResult r;
-  memset(&r, 0, sizeof(r));
+  TestResult r = tc_pass();
   r.tag = TC_FAIL;
-  tc__append_error(&r, msg, "", "");
+  tc__push_error(&r, msg, TC_OP_NONE, TC_VAL_NONE);
   return r;
 }
 
 TestResult tc_fail_with(const char *msg, const char *expected,
                         const char *actual) {
-  TestResult r;
-  memset(&r, 0, sizeof(r));
+  TestResult r = tc_pass();
   r.tag = TC_FAIL;
   tc__append_error(&r, msg, expected, actual);
   return r;
 }
 
 TestResult tc_skip(const char *reason) {
-  TestResult r;
-  memset(&r, 0, sizeof(r));
+  TestResult r = tc_pass();
   r.tag = TC_SKIP;
-  tc__append_error(&r, reason, "", "");
+  tc__push_error(&r, reason, TC_OP_NONE, TC_VAL_NONE);
   return r;
 }
 
+/* Metrics live in the text store, like error text, until the next run */
+static TestMetrics *tc__attach_metrics(TestResult *r) {
+  if (!r->metrics) {
+    r->metrics = (TestMetrics *)tc__arena_alloc(TC__TEXT, sizeof(TestMetrics));
+    if (r->metrics)
+      memset(r->metrics, 0, sizeof(TestMetrics));
+  }
+  return r->metrics;
+}
+
 /* ============================================================
    RESULT PREDICATES
    ============================================================ */
@@ -108,8 +963,8 @@ int tc_is_skip(TestResult r) { return r.tag == TC_SKIP; }
    ============================================================ */
 
 TestResult tc_combine(TestResult a, TestResult b) {
-  int i;
   TestResult r;
+  int take;
 
   if (a.tag == TC_SKIP)
     return a;
@@ -118,367 +973,1160 @@ TestResult tc_combine(TestResult a, TestResult b) {
   if (a.tag == TC_PASS && b.tag == TC_PASS)
     return a;
 
-  memset(&r, 0, sizeof(r));
+  r = tc_pass();
   r.tag = TC_FAIL;
 
-  for (i = 0; i < a.error_count && r.error_count < TC_MAX_ERRORS; i++) {
-    r.errors[r.error_count] = a.errors[i];
-    r.error_count++;
+  if (b.error_count == 0 || a.error_count >= TC_MAX_ERRORS) {
+    r.errors = a.errors;
+    r.error_count = a.error_count;
+    return r;
   }
-  for (i = 0; i < b.error_count && r.error_count < TC_MAX_ERRORS; i++) {
-    r.errors[r.error_count] = b.errors[i];
-    r.error_count++;
+  if (a.error_count == 0) {
+    r.errors = b.errors;
+    r.error_count = b.error_count;
+    return r;
   }
 
-  return r;
-}
+  take = b.error_count;
+  if (a.error_count + take > TC_MAX_ERRORS)
+    take = TC_MAX_ERRORS - a.error_count;
 
-/* ============================================================
-   SKIP GUARDS
-   ============================================================ */
+  /* Chains like r = tc_combine(r, tc_assert_...) leave b right after a */
+  if (a.errors + a.error_count == b.errors) {
+    r.errors = a.errors;
+    r.error_count = a.error_count + take;
+    return r;
+  }
 
-TestResult tc_skip_if(int cond, const char *reason) {
-  return cond ? tc_skip(reason) : tc_pass();
+  r.errors = tc__errors_grow(a.errors, a.error_count, take);
+  if (!r.errors) {
+    r.errors = a.errors;
+    r.error_count = a.error_count;
+    return r;
+  }
+  memcpy(r.errors + a.error_count, b.errors, (size_t)take * sizeof(TestError));
+  r.error_count = a.error_count + take;
+  return r;
 }
 
-TestResult tc_skip_unless(int cond, const char *reason) {
-  return cond ? tc_pass() : tc_skip(reason);
+/*
+ * Record a failure directly in the accumulator. Each returns 0 so checks
+ * can `return tc__fail_*(...)` on their failure path. Operands are stored
+ * raw and formatted only when the error is printed.
+ */
+static int tc__fail_literal(TestResult *acc, const char *msg,
+                            const char *expected, const char *actual) {
+  acc->tag = TC_FAIL;
+  tc__append_literal(acc, msg, expected, actual);
+  return 0;
 }
 
-/* ============================================================
-   ASSERTIONS - BOOLEAN
-   ============================================================ */
-
-TestResult tc_assert_true(int cond, const char *msg) {
-  if (cond)
-    return tc_pass();
-  return tc_fail_with(msg, "true", "false");
+static int tc__fail_long(TestResult *acc, const char *msg, ErrorOp op,
+                         long expected, long actual) {
+  TestError *e;
+  acc->tag = TC_FAIL;
+  e = tc__push_error(acc, msg, op, TC_VAL_LONG);
+  if (e) {
+    e->expected.l = expected;
+    e->actual.l = actual;
+  }
+  return 0;
 }
 
-TestResult tc_assert_false(int cond, const char *msg) {
+static int tc__fail_size(TestResult *acc, const char *msg, ErrorOp op,
+                         size_t expected, size_t actual) {
+  TestError *e;
+  acc->tag = TC_FAIL;
+  e = tc__push_error(acc, msg, op, TC_VAL_SIZE);
+  if (e) {
+    e->expected.z = expected;
+    e->actual.z = actual;
+  }
+  return 0;
+}
+
+static int tc__fail_double(TestResult *acc, const char *msg, ErrorOp op,
+                           double expected, double actual) {
+  TestError *e;
+  acc->tag = TC_FAIL;
+  e = tc__push_error(acc, msg, op, TC_VAL_DOUBLE);
+  if (e) {
+    e->expected.d = expected;
+    e->actual.d = actual;
+  }
+  return 0;
+}
+
+static int tc__fail_ptr(TestResult *acc, const char *msg, ErrorOp op,
+                        const void *expected, const void *actual) {
+  TestError *e;
+  acc->tag = TC_FAIL;
+  e = tc__push_error(acc, msg, op, TC_VAL_PTR);
+  if (e) {
+    e->expected.p = expected;
+    e->actual.p = actual;
+  }
+  return 0;
+}
+
+/* String operands are copied; NULL is kept and rendered as (null) */
+static int tc__fail_str(TestResult *acc, const char *msg, ErrorOp op,
+                        const char *expected, const char *actual) {
+  TestError *e;
+  acc->tag = TC_FAIL;
+  e = tc__push_error(acc, msg, op, TC_VAL_STR);
+  if (e) {
+    e->expected.s = tc__store_text(expected);
+    e->actual.s = tc__store_text(actual);
+  }
+  return 0;
+}
+
+/* ============================================================
+   ACCUMULATION
+   ============================================================ */
+
+int tc_check_into(TestResult *acc, TestResult r) {
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (r.tag == TC_PASS)
+    return 1;
+  *acc = tc_combine(*acc, r);
+  return 0;
+}
+
+int tc_check_skip_if(TestResult *acc, int cond, const char *reason) {
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (!cond)
-    return tc_pass();
-  return tc_fail_with(msg, "false", "true");
+    return 1;
+  *acc = tc_skip(reason);
+  return 0;
+}
+
+int tc_check_skip_unless(TestResult *acc, int cond, const char *reason) {
+  return tc_check_skip_if(acc, !cond, reason);
+}
+
+/* ============================================================
+   SKIP GUARDS
+   ============================================================ */
+
+TestResult tc_skip_if(int cond, const char *reason) {
+  return cond ? tc_skip(reason) : tc_pass();
+}
+
+TestResult tc_skip_unless(int cond, const char *reason) {
+  return cond ? tc_pass() : tc_skip(reason);
+}
+
+/* ============================================================
+   ASSERTIONS - BOOLEAN
+   ============================================================ */
+
+int tc_check_true(TestResult *acc, int cond, const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (cond)
+    return 1;
+  return tc__fail_literal(acc, msg, "true", "false");
+}
+
+TestResult tc_assert_true(int cond, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_true(&r, cond, msg);
+  return r;
+}
+
+int tc_check_false(TestResult *acc, int cond, const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (!cond)
+    return 1;
+  return tc__fail_literal(acc, msg, "false", "true");
+}
+
+TestResult tc_assert_false(int cond, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_false(&r, cond, msg);
+  return r;
 }
 
 /* ============================================================
    ASSERTIONS - EQUALITY (int)
    ============================================================ */
 
-TestResult tc_assert_equal_int(int expected, int actual, const char *msg) {
-  char exp[32], act[32];
+int tc_check_equal_int(TestResult *acc, int expected, int actual,
+                       const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (expected == actual)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "%d", expected);
-  snprintf(act, sizeof(act), "%d", actual);
-  return tc_fail_with(msg, exp, act);
+    return 1;
+  return tc__fail_long(acc, msg, TC_OP_EQ, expected, actual);
+}
+
+TestResult tc_assert_equal_int(int expected, int actual, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_equal_int(&r, expected, actual, msg);
+  return r;
+}
+
+int tc_check_not_equal_int(TestResult *acc, int unexpected, int actual,
+                           const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (unexpected != actual)
+    return 1;
+  return tc__fail_long(acc, msg, TC_OP_NE, unexpected, actual);
 }
 
 TestResult tc_assert_not_equal_int(int unexpected, int actual,
                                    const char *msg) {
-  char exp[32], act[32];
-  if (unexpected != actual)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "not %d", unexpected);
-  snprintf(act, sizeof(act), "%d", actual);
-  return tc_fail_with(msg, exp, act);
+  TestResult r = tc_pass();
+  tc_check_not_equal_int(&r, unexpected, actual, msg);
+  return r;
 }
 
 /* ============================================================
    ASSERTIONS - EQUALITY (long)
    ============================================================ */
 
-TestResult tc_assert_equal_long(long expected, long actual, const char *msg) {
-  char exp[32], act[32];
+int tc_check_equal_long(TestResult *acc, long expected, long actual,
+                        const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (expected == actual)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "%ld", expected);
-  snprintf(act, sizeof(act), "%ld", actual);
-  return tc_fail_with(msg, exp, act);
+    return 1;
+  return tc__fail_long(acc, msg, TC_OP_EQ, expected, actual);
+}
+
+TestResult tc_assert_equal_long(long expected, long actual, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_equal_long(&r, expected, actual, msg);
+  return r;
+}
+
+int tc_check_not_equal_long(TestResult *acc, long unexpected, long actual,
+                            const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (unexpected != actual)
+    return 1;
+  return tc__fail_long(acc, msg, TC_OP_NE, unexpected, actual);
 }
 
 TestResult tc_assert_not_equal_long(long unexpected, long actual,
                                     const char *msg) {
-  char exp[32], act[32];
-  if (unexpected != actual)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "not %ld", unexpected);
-  snprintf(act, sizeof(act), "%ld", actual);
-  return tc_fail_with(msg, exp, act);
+  TestResult r = tc_pass();
+  tc_check_not_equal_long(&r, unexpected, actual, msg);
+  return r;
 }
 
 /* ============================================================
    ASSERTIONS - EQUALITY (size_t)
    ============================================================ */
 
+int tc_check_equal_size(TestResult *acc, size_t expected, size_t actual,
+                        const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (expected == actual)
+    return 1;
+  return tc__fail_size(acc, msg, TC_OP_EQ, expected, actual);
+}
+
 TestResult tc_assert_equal_size(size_t expected, size_t actual,
                                 const char *msg) {
-  char exp[32], act[32];
-  if (expected == actual)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "%zu", expected);
-  snprintf(act, sizeof(act), "%zu", actual);
-  return tc_fail_with(msg, exp, act);
+  TestResult r = tc_pass();
+  tc_check_equal_size(&r, expected, actual, msg);
+  return r;
+}
+
+int tc_check_not_equal_size(TestResult *acc, size_t unexpected, size_t actual,
+                            const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (unexpected != actual)
+    return 1;
+  return tc__fail_size(acc, msg, TC_OP_NE, unexpected, actual);
 }
 
 TestResult tc_assert_not_equal_size(size_t unexpected, size_t actual,
                                     const char *msg) {
-  char exp[32], act[32];
-  if (unexpected != actual)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "not %zu", unexpected);
-  snprintf(act, sizeof(act), "%zu", actual);
-  return tc_fail_with(msg, exp, act);
+  TestResult r = tc_pass();
+  tc_check_not_equal_size(&r, unexpected, actual, msg);
+  return r;
 }
 
 /* ============================================================
    ASSERTIONS - EQUALITY (double)
    ============================================================ */
 
+int tc_check_equal_double(TestResult *acc, double expected, double actual,
+                          const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (expected == actual)
+    return 1;
+  return tc__fail_double(acc, msg, TC_OP_EQ, expected, actual);
+}
+
 TestResult tc_assert_equal_double(double expected, double actual,
                                   const char *msg) {
-  char exp[32], act[32];
-  if (expected == actual)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "%g", expected);
-  snprintf(act, sizeof(act), "%g", actual);
-  return tc_fail_with(msg, exp, act);
+  TestResult r = tc_pass();
+  tc_check_equal_double(&r, expected, actual, msg);
+  return r;
+}
+
+int tc_check_not_equal_double(TestResult *acc, double unexpected, double actual,
+                              const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (unexpected != actual)
+    return 1;
+  return tc__fail_double(acc, msg, TC_OP_NE, unexpected, actual);
 }
 
 TestResult tc_assert_not_equal_double(double unexpected, double actual,
                                       const char *msg) {
-  char exp[32], act[32];
-  if (unexpected != actual)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "not %g", unexpected);
-  snprintf(act, sizeof(act), "%g", actual);
-  return tc_fail_with(msg, exp, act);
+  TestResult r = tc_pass();
+  tc_check_not_equal_double(&r, unexpected, actual, msg);
+  return r;
 }
 
 /* ============================================================
    ASSERTIONS - EQUALITY (string)
    ============================================================ */
 
-TestResult tc_assert_equal_str(const char *expected, const char *actual,
-                               const char *msg) {
-  const char *exp_str = expected ? expected : "(null)";
-  const char *act_str = actual ? actual : "(null)";
+int tc_check_equal_str(TestResult *acc, const char *expected,
+                       const char *actual, const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (expected == NULL && actual == NULL)
-    return tc_pass();
+    return 1;
   if (expected == NULL || actual == NULL) {
-    return tc_fail_with(msg, exp_str, act_str);
+    return tc__fail_str(acc, msg, TC_OP_EQ, expected, actual);
   }
   if (strcmp(expected, actual) == 0)
-    return tc_pass();
-  return tc_fail_with(msg, exp_str, act_str);
+    return 1;
+  return tc__fail_str(acc, msg, TC_OP_EQ, expected, actual);
 }
 
-TestResult tc_assert_not_equal_str(const char *unexpected, const char *actual,
-                                   const char *msg) {
-  char exp[TC_MAX_MSG_LEN];
-  const char *act_str = actual ? actual : "(null)";
+TestResult tc_assert_equal_str(const char *expected, const char *actual,
+                               const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_equal_str(&r, expected, actual, msg);
+  return r;
+}
+
+int tc_check_not_equal_str(TestResult *acc, const char *unexpected,
+                           const char *actual, const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (unexpected == NULL && actual == NULL) {
-    snprintf(exp, sizeof(exp), "not (null)");
-    return tc_fail_with(msg, exp, act_str);
+    return tc__fail_str(acc, msg, TC_OP_NE, NULL, NULL);
   }
   if (unexpected == NULL || actual == NULL)
-    return tc_pass();
+    return 1;
   if (strcmp(unexpected, actual) != 0)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "not \"%s\"", unexpected);
-  return tc_fail_with(msg, exp, act_str);
+    return 1;
+  return tc__fail_str(acc, msg, TC_OP_NE, unexpected, actual);
+}
+
+TestResult tc_assert_not_equal_str(const char *unexpected, const char *actual,
+                                   const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_not_equal_str(&r, unexpected, actual, msg);
+  return r;
 }
 
 /* ============================================================
    ASSERTIONS - EQUALITY (pointer)
    ============================================================ */
 
+int tc_check_equal_ptr(TestResult *acc, const void *expected,
+                       const void *actual, const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (expected == actual)
+    return 1;
+  return tc__fail_ptr(acc, msg, TC_OP_EQ, expected, actual);
+}
+
 TestResult tc_assert_equal_ptr(const void *expected, const void *actual,
                                const char *msg) {
-  char exp[32], act[32];
-  if (expected == actual)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "%p", expected);
-  snprintf(act, sizeof(act), "%p", actual);
-  return tc_fail_with(msg, exp, act);
+  TestResult r = tc_pass();
+  tc_check_equal_ptr(&r, expected, actual, msg);
+  return r;
+}
+
+int tc_check_not_equal_ptr(TestResult *acc, const void *unexpected,
+                           const void *actual, const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (unexpected != actual)
+    return 1;
+  return tc__fail_ptr(acc, msg, TC_OP_NE, unexpected, actual);
 }
 
 TestResult tc_assert_not_equal_ptr(const void *unexpected, const void *actual,
                                    const char *msg) {
-  char exp[32], act[32];
-  if (unexpected != actual)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "not %p", unexpected);
-  snprintf(act, sizeof(act), "%p", actual);
-  return tc_fail_with(msg, exp, act);
+  TestResult r = tc_pass();
+  tc_check_not_equal_ptr(&r, unexpected, actual, msg);
+  return r;
 }
 
 /* ============================================================
    ASSERTIONS - NIL/NULL
    ============================================================ */
 
-TestResult tc_assert_nil(const void *ptr, const char *msg) {
-  char act[32];
+int tc_check_nil(TestResult *acc, const void *ptr, const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (ptr == NULL)
-    return tc_pass();
-  snprintf(act, sizeof(act), "%p", ptr);
-  return tc_fail_with(msg, "NULL", act);
+    return 1;
+  return tc__fail_ptr(acc, msg, TC_OP_NIL, NULL, ptr);
 }
 
-TestResult tc_assert_not_nil(const void *ptr, const char *msg) {
+TestResult tc_assert_nil(const void *ptr, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_nil(&r, ptr, msg);
+  return r;
+}
+
+int tc_check_not_nil(TestResult *acc, const void *ptr, const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (ptr != NULL)
-    return tc_pass();
-  return tc_fail_with(msg, "non-NULL", "NULL");
+    return 1;
+  return tc__fail_ptr(acc, msg, TC_OP_NOT_NIL, NULL, ptr);
+}
+
+TestResult tc_assert_not_nil(const void *ptr, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_not_nil(&r, ptr, msg);
+  return r;
 }
 
 /* ============================================================
    ASSERTIONS - NUMERIC COMPARISONS (int)
    ============================================================ */
 
-TestResult tc_assert_greater_int(int actual, int than, const char *msg) {
-  char exp[32], act[32];
+int tc_check_greater_int(TestResult *acc, int actual, int than,
+                         const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (actual > than)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "> %d", than);
-  snprintf(act, sizeof(act), "%d", actual);
-  return tc_fail_with(msg, exp, act);
+    return 1;
+  return tc__fail_long(acc, msg, TC_OP_GT, than, actual);
+}
+
+TestResult tc_assert_greater_int(int actual, int than, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_greater_int(&r, actual, than, msg);
+  return r;
+}
+
+int tc_check_greater_or_equal_int(TestResult *acc, int actual, int than,
+                                  const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (actual >= than)
+    return 1;
+  return tc__fail_long(acc, msg, TC_OP_GE, than, actual);
 }
 
 TestResult tc_assert_greater_or_equal_int(int actual, int than,
                                           const char *msg) {
-  char exp[32], act[32];
-  if (actual >= than)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), ">= %d", than);
-  snprintf(act, sizeof(act), "%d", actual);
-  return tc_fail_with(msg, exp, act);
+  TestResult r = tc_pass();
+  tc_check_greater_or_equal_int(&r, actual, than, msg);
+  return r;
 }
 
-TestResult tc_assert_less_int(int actual, int than, const char *msg) {
-  char exp[32], act[32];
+int tc_check_less_int(TestResult *acc, int actual, int than, const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (actual < than)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "< %d", than);
-  snprintf(act, sizeof(act), "%d", actual);
-  return tc_fail_with(msg, exp, act);
+    return 1;
+  return tc__fail_long(acc, msg, TC_OP_LT, than, actual);
 }
 
-TestResult tc_assert_less_or_equal_int(int actual, int than, const char *msg) {
-  char exp[32], act[32];
+TestResult tc_assert_less_int(int actual, int than, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_less_int(&r, actual, than, msg);
+  return r;
+}
+
+int tc_check_less_or_equal_int(TestResult *acc, int actual, int than,
+                               const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (actual <= than)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "<= %d", than);
-  snprintf(act, sizeof(act), "%d", actual);
-  return tc_fail_with(msg, exp, act);
+    return 1;
+  return tc__fail_long(acc, msg, TC_OP_LE, than, actual);
+}
+
+TestResult tc_assert_less_or_equal_int(int actual, int than, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_less_or_equal_int(&r, actual, than, msg);
+  return r;
 }
 
 /* ============================================================
    ASSERTIONS - NUMERIC COMPARISONS (double)
    ============================================================ */
 
+int tc_check_greater_double(TestResult *acc, double actual, double than,
+                            const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (actual > than)
+    return 1;
+  return tc__fail_double(acc, msg, TC_OP_GT, than, actual);
+}
+
 TestResult tc_assert_greater_double(double actual, double than,
                                     const char *msg) {
-  char exp[32], act[32];
-  if (actual > than)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "> %g", than);
-  snprintf(act, sizeof(act), "%g", actual);
-  return tc_fail_with(msg, exp, act);
+  TestResult r = tc_pass();
+  tc_check_greater_double(&r, actual, than, msg);
+  return r;
+}
+
+int tc_check_greater_or_equal_double(TestResult *acc, double actual,
+                                     double than, const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (actual >= than)
+    return 1;
+  return tc__fail_double(acc, msg, TC_OP_GE, than, actual);
 }
 
 TestResult tc_assert_greater_or_equal_double(double actual, double than,
                                              const char *msg) {
-  char exp[32], act[32];
-  if (actual >= than)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), ">= %g", than);
-  snprintf(act, sizeof(act), "%g", actual);
-  return tc_fail_with(msg, exp, act);
+  TestResult r = tc_pass();
+  tc_check_greater_or_equal_double(&r, actual, than, msg);
+  return r;
 }
 
-TestResult tc_assert_less_double(double actual, double than, const char *msg) {
-  char exp[32], act[32];
+int tc_check_less_double(TestResult *acc, double actual, double than,
+                         const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (actual < than)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "< %g", than);
-  snprintf(act, sizeof(act), "%g", actual);
-  return tc_fail_with(msg, exp, act);
+    return 1;
+  return tc__fail_double(acc, msg, TC_OP_LT, than, actual);
 }
 
-TestResult tc_assert_less_or_equal_double(double actual, double than,
-                                          const char *msg) {
-  char exp[32], act[32];
+TestResult tc_assert_less_double(double actual, double than, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_less_double(&r, actual, than, msg);
+  return r;
+}
+
+int tc_check_less_or_equal_double(TestResult *acc, double actual, double than,
+                                  const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (actual <= than)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "<= %g", than);
-  snprintf(act, sizeof(act), "%g", actual);
-  return tc_fail_with(msg, exp, act);
+    return 1;
+  return tc__fail_double(acc, msg, TC_OP_LE, than, actual);
 }
 
-TestResult tc_assert_in_delta(double expected, double actual, double delta,
-                              const char *msg) {
-  char exp[64], act[64];
-  double diff = fabs(expected - actual);
-  if (diff <= delta)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "%g +/- %g", expected, delta);
-  snprintf(act, sizeof(act), "%g (diff: %g)", actual, diff);
-  return tc_fail_with(msg, exp, act);
+TestResult tc_assert_less_or_equal_double(double actual, double than,
+                                          const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_less_or_equal_double(&r, actual, than, msg);
+  return r;
+}
+
+int tc_check_in_delta(TestResult *acc, double expected, double actual,
+                      double delta, const char *msg) {
+  TestError *e;
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (fabs(expected - actual) <= delta)
+    return 1;
+  acc->tag = TC_FAIL;
+  e = tc__push_error(acc, msg, TC_OP_IN_DELTA, TC_VAL_DOUBLE);
+  if (e) {
+    e->expected.d = expected;
+    e->actual.d = actual;
+    e->aux.d = delta;
+  }
+  return 0;
+}
+
+TestResult tc_assert_in_delta(double expected, double actual, double delta,
+                              const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_in_delta(&r, expected, actual, delta, msg);
+  return r;
 }
 
 /* ============================================================
    ASSERTIONS - COLLECTIONS (int arrays)
    ============================================================ */
 
-TestResult tc_assert_empty_int(const int *arr, int len, const char *msg) {
-  char act[32];
+int tc_check_empty_int(TestResult *acc, const int *arr, int len,
+                       const char *msg) {
   (void)arr;
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (len == 0)
-    return tc_pass();
-  snprintf(act, sizeof(act), "%d elements", len);
-  return tc_fail_with(msg, "empty", act);
+    return 1;
+  return tc__fail_long(acc, msg, TC_OP_EMPTY, 0, len);
 }
 
-TestResult tc_assert_not_empty_int(const int *arr, int len, const char *msg) {
+TestResult tc_assert_empty_int(const int *arr, int len, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_empty_int(&r, arr, len, msg);
+  return r;
+}
+
+int tc_check_not_empty_int(TestResult *acc, const int *arr, int len,
+                           const char *msg) {
   (void)arr;
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (len > 0)
-    return tc_pass();
-  return tc_fail_with(msg, "non-empty", "0 elements");
+    return 1;
+  return tc__fail_long(acc, msg, TC_OP_NOT_EMPTY, 0, len);
 }
 
-TestResult tc_assert_len(int expected, int actual, const char *msg) {
-  char exp[32], act[32];
+TestResult tc_assert_not_empty_int(const int *arr, int len, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_not_empty_int(&r, arr, len, msg);
+  return r;
+}
+
+int tc_check_len(TestResult *acc, int expected, int actual, const char *msg) {
+  if (acc->tag == TC_SKIP)
+    return 0;
   if (expected == actual)
-    return tc_pass();
-  snprintf(exp, sizeof(exp), "length %d", expected);
-  snprintf(act, sizeof(act), "length %d", actual);
-  return tc_fail_with(msg, exp, act);
+    return 1;
+  return tc__fail_long(acc, msg, TC_OP_LEN, expected, actual);
 }
 
-TestResult tc_assert_contains_int(int elem, const int *arr, int len,
-                                  const char *msg) {
-  char exp[32];
+TestResult tc_assert_len(int expected, int actual, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_len(&r, expected, actual, msg);
+  return r;
+}
+
+int tc_check_contains_int(TestResult *acc, int elem, const int *arr, int len,
+                          const char *msg) {
   int i;
+  if (acc->tag == TC_SKIP)
+    return 0;
   for (i = 0; i < len; i++) {
     if (arr[i] == elem)
-      return tc_pass();
+      return 1;
   }
-  snprintf(exp, sizeof(exp), "contains %d", elem);
-  return tc_fail_with(msg, exp, "not found");
+  return tc__fail_long(acc, msg, TC_OP_CONTAINS, elem, 0);
 }
 
-TestResult tc_assert_not_contains_int(int elem, const int *arr, int len,
-                                      const char *msg) {
-  char exp[32], act[64];
+TestResult tc_assert_contains_int(int elem, const int *arr, int len,
+                                  const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_contains_int(&r, elem, arr, len, msg);
+  return r;
+}
+
+int tc_check_not_contains_int(TestResult *acc, int elem, const int *arr,
+                              int len, const char *msg) {
+  TestError *e;
   int i;
+  if (acc->tag == TC_SKIP)
+    return 0;
   for (i = 0; i < len; i++) {
     if (arr[i] == elem) {
-      snprintf(exp, sizeof(exp), "not contains %d", elem);
-      snprintf(act, sizeof(act), "found at index %d", i);
-      return tc_fail_with(msg, exp, act);
+      acc->tag = TC_FAIL;
+      e = tc__push_error(acc, msg, TC_OP_NOT_CONTAINS, TC_VAL_LONG);
+      if (e) {
+        e->expected.l = elem;
+        e->actual.l = arr[i];
+        e->aux.l = i;
+      }
+      return 0;
+    }
+  }
+  return 1;
+}
+
+TestResult tc_assert_not_contains_int(int elem, const int *arr, int len,
+                                      const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_not_contains_int(&r, elem, arr, len, msg);
+  return r;
+}
+
+/* ============================================================
+   ASSERTIONS - ARRAYS AND BUFFERS
+   A check is one pass: a kernel skips the run of elements that match,
+   a block at a time with SSE2 or NEON where available, and stops at
+   the block holding a mismatch. A scalar loop finds and counts it and
+   the scan resumes after it, so data that matches never leaves the
+   kernel.
+   ============================================================ */
+
+typedef enum {
+  TC__ELEM_BYTE,
+  TC__ELEM_INT,
+  TC__ELEM_LONG,
+  TC__ELEM_DOUBLE
+} tc__ElemKind;
+
+/* How elements compare and print */
+typedef struct {
+  tc__ElemKind kind;
+  size_t width;
+  double delta;  /* doubles, unless by_ulps */
+  uint64_t ulps; /* doubles, when by_ulps */
+  int by_ulps;
+} tc__ArraySpec;
+
+#define TC__WINDOW 16 /* most elements shown around a failure */
+
+static tc__ArraySpec tc__array_spec(tc__ElemKind kind, size_t width) {
+  tc__ArraySpec s;
+  memset(&s, 0, sizeof(s));
+  s.kind = kind;
+  s.width = width;
+  return s;
+}
+
+/* Representable doubles between x and y, neither of them NaN */
+static uint64_t tc__ulps_between(double x, double y) {
+  int64_t ix, iy;
+  if (x == y)
+    return 0;
+  memcpy(&ix, &x, sizeof(ix));
+  memcpy(&iy, &y, sizeof(iy));
+  /* Fold sign-magnitude onto one line so neighbours differ by 1 */
+  if (ix < 0)
+    ix = INT64_MIN - ix;
+  if (iy < 0)
+    iy = INT64_MIN - iy;
+  return ix > iy ? (uint64_t)ix - (uint64_t)iy : (uint64_t)iy - (uint64_t)ix;
+}
+
+static int tc__doubles_match(const tc__ArraySpec *s, double x, double y) {
+  if (s->by_ulps)
+    return x == x && y == y && tc__ulps_between(x, y) <= s->ulps;
+  return x == y || fabs(x - y) <= s->delta;
+}
+
+static int tc__elems_match(const tc__ArraySpec *s, const void *x,
+                           const void *y, size_t i) {
+  if (s->kind == TC__ELEM_DOUBLE)
+    return tc__doubles_match(s, ((const double *)x)[i],
+                             ((const double *)y)[i]);
+  return memcmp((const char *)x + i * s->width,
+                (const char *)y + i * s->width, s->width) == 0;
+}
+
+/* Leading bytes of a and b that are equal, in whole 64-byte blocks */
+static size_t tc__same_blocks(const unsigned char *a, const unsigned char *b,
+                              size_t n) {
+  size_t i = 0;
+#if defined(TC__HAVE_SSE2)
+  for (; i + 64 <= n; i += 64) {
+    __m128i m0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                _mm_loadu_si128((const __m128i *)(b + i)));
+    __m128i m1 =
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 16)),
+                       _mm_loadu_si128((const __m128i *)(b + i + 16)));
+    __m128i m2 =
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 32)),
+                       _mm_loadu_si128((const __m128i *)(b + i + 32)));
+    __m128i m3 =
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 48)),
+                       _mm_loadu_si128((const __m128i *)(b + i + 48)));
+    __m128i all = _mm_and_si128(_mm_and_si128(m0, m1), _mm_and_si128(m2, m3));
+    if (_mm_movemask_epi8(all) != 0xffff)
+      break;
+  }
+#elif defined(TC__HAVE_NEON)
+  for (; i + 64 <= n; i += 64) {
+    uint8x16_t m0 = vceqq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+    uint8x16_t m1 = vceqq_u8(vld1q_u8(a + i + 16), vld1q_u8(b + i + 16));
+    uint8x16_t m2 = vceqq_u8(vld1q_u8(a + i + 32), vld1q_u8(b + i + 32));
+    uint8x16_t m3 = vceqq_u8(vld1q_u8(a + i + 48), vld1q_u8(b + i + 48));
+    if (vminvq_u8(vandq_u8(vandq_u8(m0, m1), vandq_u8(m2, m3))) != 0xff)
+      break;
+  }
+#else
+  while (i + 64 <= n && memcmp(a + i, b + i, 64) == 0)
+    i += 64;
+#endif
+  return i;
+}
+
+/* Leading doubles of x and y within delta, two at a time */
+static size_t tc__close_pairs(const double *x, const double *y, size_t n,
+                              double delta) {
+  size_t i = 0;
+#if defined(TC__HAVE_SSE2)
+  __m128d d = _mm_set1_pd(delta);
+  __m128d sign = _mm_set1_pd(-0.0);
+  for (; i + 2 <= n; i += 2) {
+    __m128d a = _mm_loadu_pd(x + i);
+    __m128d b = _mm_loadu_pd(y + i);
+    __m128d diff = _mm_andnot_pd(sign, _mm_sub_pd(a, b));
+    if (_mm_movemask_pd(_mm_or_pd(_mm_cmpeq_pd(a, b),
+                                  _mm_cmple_pd(diff, d))) != 3)
+      break;
+  }
+#elif defined(TC__HAVE_NEON)
+  float64x2_t d = vdupq_n_f64(delta);
+  for (; i + 2 <= n; i += 2) {
+    float64x2_t a = vld1q_f64(x + i);
+    float64x2_t b = vld1q_f64(y + i);
+    uint64x2_t ok = vorrq_u64(vceqq_f64(a, b), vcleq_f64(vabdq_f64(a, b), d));
+    if (vminvq_u32(vreinterpretq_u32_u64(ok)) != 0xffffffffu)
+      break;
+  }
+#else
+  (void)x;
+  (void)y;
+  (void)n;
+  (void)delta;
+#endif
+  return i;
+}
+
+/* Leading elements of x and y that match */
+static size_t tc__match_run(const tc__ArraySpec *s, const void *x,
+                            const void *y, size_t n) {
+  size_t i = 0;
+  if (s->kind != TC__ELEM_DOUBLE)
+    i = tc__same_blocks((const unsigned char *)x, (const unsigned char *)y,
+                        n * s->width) /
+        s->width;
+  else if (!s->by_ulps)
+    i = tc__close_pairs((const double *)x, (const double *)y, n, s->delta);
+  while (i < n && tc__elems_match(s, x, y, i))
+    i++;
+  return i;
+}
+
+/* v[i] is below v[i - 1] */
+static int tc__descends(tc__ElemKind kind, const void *v, size_t i) {
+  switch (kind) {
+  case TC__ELEM_INT:
+    return ((const int *)v)[i - 1] > ((const int *)v)[i];
+  case TC__ELEM_LONG:
+    return ((const long *)v)[i - 1] > ((const long *)v)[i];
+  case TC__ELEM_DOUBLE:
+    return ((const double *)v)[i - 1] > ((const double *)v)[i];
+  default:
+    return ((const unsigned char *)v)[i - 1] > ((const unsigned char *)v)[i];
+  }
+}
+
+/*
+ * Leading elements of v none of which is below the one before it; the
+ * first always counts. NaN compares as in order.
+ */
+static size_t tc__sorted_run(tc__ElemKind kind, const void *v, size_t n) {
+  size_t i = 1;
+  if (n == 0)
+    return 0;
+  switch (kind) {
+  case TC__ELEM_INT: {
+    const int *x = (const int *)v;
+#if defined(TC__HAVE_SSE2)
+    for (; i + 4 <= n; i += 4) {
+      __m128i prev = _mm_loadu_si128((const __m128i *)(x + i - 1));
+      __m128i cur = _mm_loadu_si128((const __m128i *)(x + i));
+      if (_mm_movemask_epi8(_mm_cmpgt_epi32(prev, cur)) != 0)
+        break;
+    }
+#elif defined(TC__HAVE_NEON)
+    for (; i + 4 <= n; i += 4) {
+      if (vmaxvq_u32(vcgtq_s32(vld1q_s32(x + i - 1), vld1q_s32(x + i))) != 0)
+        break;
+    }
+#endif
+    while (i < n && x[i - 1] <= x[i])
+      i++;
+    return i;
+  }
+  case TC__ELEM_DOUBLE: {
+    const double *x = (const double *)v;
+#if defined(TC__HAVE_SSE2)
+    for (; i + 2 <= n; i += 2) {
+      if (_mm_movemask_pd(_mm_cmpgt_pd(_mm_loadu_pd(x + i - 1),
+                                       _mm_loadu_pd(x + i))) != 0)
+        break;
+    }
+#elif defined(TC__HAVE_NEON)
+    for (; i + 2 <= n; i += 2) {
+      uint64x2_t gt = vcgtq_f64(vld1q_f64(x + i - 1), vld1q_f64(x + i));
+      if (vmaxvq_u32(vreinterpretq_u32_u64(gt)) != 0)
+        break;
     }
+#endif
+    while (i < n && !(x[i - 1] > x[i]))
+      i++;
+    return i;
+  }
+  default:
+    while (i < n && !tc__descends(kind, v, i))
+      i++;
+    return i;
+  }
+}
+
+static void tc__format_elem(const tc__ArraySpec *s, const void *v, size_t i,
+                            char *buf, size_t size) {
+  switch (s->kind) {
+  case TC__ELEM_BYTE:
+    snprintf(buf, size, "%02x", ((const unsigned char *)v)[i]);
+    break;
+  case TC__ELEM_INT:
+    snprintf(buf, size, "%d", ((const int *)v)[i]);
+    break;
+  case TC__ELEM_LONG:
+    snprintf(buf, size, "%ld", ((const long *)v)[i]);
+    break;
+  default:
+    snprintf(buf, size, "%.17g", ((const double *)v)[i]);
+    break;
+  }
+}
+
+/* The elements shown around index first: a 16-byte row, or 8 elements */
+static void tc__window_bounds(const tc__ArraySpec *s, size_t first, size_t len,
+                              size_t *start, size_t *end) {
+  size_t span = s->kind == TC__ELEM_BYTE ? 16 : 8;
+  if (s->kind == TC__ELEM_BYTE)
+    *start = first - first % 16;
+  else
+    *start = first > 3 ? first - 3 : 0;
+  *end = len - *start > span ? *start + span : len;
+}
+
+/* "start: v v [v] v ..." with the marked elements in brackets */
+static void tc__format_window(const tc__ArraySpec *s, const void *v,
+                              size_t len, size_t start, size_t end,
+                              const unsigned char *marked, char *buf,
+                              size_t size) {
+  char item[32];
+  size_t at;
+  size_t i;
+  int n;
+
+  n = snprintf(buf, size, "%zu:", start);
+  at = n > 0 ? (size_t)n : 0;
+  for (i = start; i < end && at < size; i++) {
+    tc__format_elem(s, v, i, item, sizeof(item));
+    n = snprintf(buf + at, size - at, marked[i - start] ? " [%s]" : " %s",
+                 item);
+    at += n > 0 ? (size_t)n : 0;
+  }
+  if (end < len && at < size)
+    snprintf(buf + at, size - at, " ...");
+}
+
+static int tc__fail_arrays(TestResult *acc, const char *msg,
+                           const tc__ArraySpec *s, const void *expected,
+                           const void *actual, size_t len, size_t first,
+                           size_t bad) {
+  char want[256], got[256];
+  unsigned char marked[TC__WINDOW];
+  size_t start, end, i;
+  TestError *e;
+
+  tc__window_bounds(s, first, len, &start, &end);
+  for (i = start; i < end; i++)
+    marked[i - start] = !tc__elems_match(s, expected, actual, i);
+  tc__format_window(s, expected, len, start, end, marked, want, sizeof(want));
+  tc__format_window(s, actual, len, start, end, marked, got, sizeof(got));
+
+  acc->tag = TC_FAIL;
+  e = tc__push_error(acc, NULL, TC_OP_TEXT, TC_VAL_STR);
+  if (e) {
+    e->message = tc__store_printf(
+        "%s%s%zu of %zu %s differ, first at index %zu", msg ? msg : "",
+        msg ? ": " : "", bad, len,
+        s->kind == TC__ELEM_BYTE ? "bytes" : "elements", first);
+    e->expected.s = tc__store_text(want);
+    e->actual.s = tc__store_text(got);
+  }
+  return 0;
+}
+
+static int tc__check_arrays(TestResult *acc, const tc__ArraySpec *s,
+                            const void *expected, const void *actual,
+                            size_t len, const char *msg) {
+  size_t i = 0;
+  size_t first = 0;
+  size_t bad = 0;
+  if (acc->tag == TC_SKIP)
+    return 0;
+  while (i < len) {
+    i += tc__match_run(s, (const char *)expected + i * s->width,
+                       (const char *)actual + i * s->width, len - i);
+    if (i == len)
+      break;
+    if (bad++ == 0)
+      first = i;
+    i++;
+  }
+  if (bad == 0)
+    return 1;
+  return tc__fail_arrays(acc, msg, s, expected, actual, len, first, bad);
+}
+
+static int tc__check_sorted(TestResult *acc, const tc__ArraySpec *s,
+                            const void *arr, size_t len, const char *msg) {
+  char got[256];
+  unsigned char marked[TC__WINDOW];
+  size_t i = 0;
+  size_t first = 0;
+  size_t bad = 0;
+  size_t start, end;
+  TestError *e;
+
+  if (acc->tag == TC_SKIP)
+    return 0;
+  while (i < len) {
+    /* The element that broke the order starts the next run */
+    i += tc__sorted_run(s->kind, (const char *)arr + i * s->width, len - i);
+    if (i == len)
+      break;
+    if (bad++ == 0)
+      first = i;
+  }
+  if (bad == 0)
+    return 1;
+
+  tc__window_bounds(s, first, len, &start, &end);
+  for (i = start; i < end; i++)
+    marked[i - start] = i > 0 && tc__descends(s->kind, arr, i);
+  tc__format_window(s, arr, len, start, end, marked, got, sizeof(got));
+  acc->tag = TC_FAIL;
+  e = tc__push_error(acc, NULL, TC_OP_TEXT, TC_VAL_STR);
+  if (e) {
+    e->message = tc__store_printf(
+        "%s%s%zu of %zu elements out of order, first at index %zu",
+        msg ? msg : "", msg ? ": " : "", bad, len, first);
+    e->expected.s = "non-decreasing";
+    e->actual.s = tc__store_text(got);
   }
-  return tc_pass();
+  return 0;
+}
+
+int tc_check_equal_bytes(TestResult *acc, const void *expected,
+                         const void *actual, size_t len, const char *msg) {
+  tc__ArraySpec s = tc__array_spec(TC__ELEM_BYTE, 1);
+  return tc__check_arrays(acc, &s, expected, actual, len, msg);
+}
+
+TestResult tc_assert_equal_bytes(const void *expected, const void *actual,
+                                 size_t len, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_equal_bytes(&r, expected, actual, len, msg);
+  return r;
+}
+
+int tc_check_equal_array_int(TestResult *acc, const int *expected,
+                             const int *actual, size_t len, const char *msg) {
+  tc__ArraySpec s = tc__array_spec(TC__ELEM_INT, sizeof(int));
+  return tc__check_arrays(acc, &s, expected, actual, len, msg);
+}
+
+TestResult tc_assert_equal_array_int(const int *expected, const int *actual,
+                                     size_t len, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_equal_array_int(&r, expected, actual, len, msg);
+  return r;
+}
+
+int tc_check_equal_array_long(TestResult *acc, const long *expected,
+                              const long *actual, size_t len,
+                              const char *msg) {
+  tc__ArraySpec s = tc__array_spec(TC__ELEM_LONG, sizeof(long));
+  return tc__check_arrays(acc, &s, expected, actual, len, msg);
+}
+
+TestResult tc_assert_equal_array_long(const long *expected, const long *actual,
+                                      size_t len, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_equal_array_long(&r, expected, actual, len, msg);
+  return r;
+}
+
+int tc_check_equal_array_double(TestResult *acc, const double *expected,
+                                const double *actual, size_t len, double delta,
+                                const char *msg) {
+  tc__ArraySpec s = tc__array_spec(TC__ELEM_DOUBLE, sizeof(double));
+  s.delta = delta;
+  return tc__check_arrays(acc, &s, expected, actual, len, msg);
+}
+
+TestResult tc_assert_equal_array_double(const double *expected,
+                                        const double *actual, size_t len,
+                                        double delta, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_equal_array_double(&r, expected, actual, len, delta, msg);
+  return r;
+}
+
+int tc_check_equal_array_double_ulps(TestResult *acc, const double *expected,
+                                     const double *actual, size_t len,
+                                     uint64_t max_ulps, const char *msg) {
+  tc__ArraySpec s = tc__array_spec(TC__ELEM_DOUBLE, sizeof(double));
+  s.by_ulps = 1;
+  s.ulps = max_ulps;
+  return tc__check_arrays(acc, &s, expected, actual, len, msg);
+}
+
+TestResult tc_assert_equal_array_double_ulps(const double *expected,
+                                             const double *actual, size_t len,
+                                             uint64_t max_ulps,
+                                             const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_equal_array_double_ulps(&r, expected, actual, len, max_ulps, msg);
+  return r;
+}
+
+int tc_check_sorted_int(TestResult *acc, const int *arr, size_t len,
+                        const char *msg) {
+  tc__ArraySpec s = tc__array_spec(TC__ELEM_INT, sizeof(int));
+  return tc__check_sorted(acc, &s, arr, len, msg);
+}
+
+TestResult tc_assert_sorted_int(const int *arr, size_t len, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_sorted_int(&r, arr, len, msg);
+  return r;
+}
+
+int tc_check_sorted_long(TestResult *acc, const long *arr, size_t len,
+                         const char *msg) {
+  tc__ArraySpec s = tc__array_spec(TC__ELEM_LONG, sizeof(long));
+  return tc__check_sorted(acc, &s, arr, len, msg);
+}
+
+TestResult tc_assert_sorted_long(const long *arr, size_t len, const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_sorted_long(&r, arr, len, msg);
+  return r;
+}
+
+int tc_check_sorted_double(TestResult *acc, const double *arr, size_t len,
+                           const char *msg) {
+  tc__ArraySpec s = tc__array_spec(TC__ELEM_DOUBLE, sizeof(double));
+  return tc__check_sorted(acc, &s, arr, len, msg);
+}
+
+TestResult tc_assert_sorted_double(const double *arr, size_t len,
+                                   const char *msg) {
+  TestResult r = tc_pass();
+  tc_check_sorted_double(&r, arr, len, msg);
+  return r;
 }
 
 /* ============================================================
@@ -492,22 +2140,26 @@ Suite tc_suite(const char *name, Test *tests) {
 Suite tc_suite_with(const char *name, SetupFn setup, TeardownFn teardown,
                     Test *tests) {
   Suite s;
-  int i = 0;
 
   memset(&s, 0, sizeof(s));
   s.name = name;
   s.setup = setup;
   s.teardown = teardown;
-
-  while (tests[i].name != NULL && i < TC_MAX_TESTS_PER_SUITE) {
-    s.tests[i] = tests[i];
-    i++;
-  }
-  s.test_count = i;
+  s.tests = tests;
+  while (tests && tests[s.test_count].name != NULL)
+    s.test_count++;
 
   return s;
 }
 
+Test tc_test(const char *name, TestFn fn) {
+  Test t;
+  memset(&t, 0, sizeof(t));
+  t.name = name;
+  t.fn = fn;
+  return t;
+}
+
 Test tc_skip_test(const char *name, const char *reason) {
   Test t;
   memset(&t, 0, sizeof(t));
@@ -517,322 +2169,8120 @@ Test tc_skip_test(const char *name, const char *reason) {
   return t;
 }
 
+Test tc_bench(const char *name, BenchFn fn) {
+  Test t;
+  memset(&t, 0, sizeof(t));
+  t.name = name;
+  t.bench = fn;
+  return t;
+}
+
+/*
+ * fn of a property test, so it is listed, run and cached like others.
+ * tc_run_test runs gen and prop instead, so this only runs without them.
+ */
+static TestResult tc__property_fn(void *env) {
+  (void)env;
+  return tc_fail("property test needs a gen and a prop (tc_property got "
+                 "NULL)");
+}
+
+Test tc_property(const char *name, GenFn gen, PropFn prop, int runs) {
+  Test t;
+  memset(&t, 0, sizeof(t));
+  t.name = name;
+  t.fn = tc__property_fn;
+  t.gen = gen;
+  t.prop = prop;
+  t.runs = runs;
+  return t;
+}
+
+/* fn of a test vector test; the records run through tc_run_test */
+static TestResult tc__vectors_fn(void *env) {
+  (void)env;
+  return tc_fail("test vector tests run through tc_run_test");
+}
+
+Test tc_vectors(const char *name, const char *path, VectorFormat format,
+                VectorFn fn) {
+  Test t;
+  memset(&t, 0, sizeof(t));
+  t.name = name;
+  t.fn = tc__vectors_fn;
+  t.inputs = path;
+  t.vectors = path;
+  t.vector_fn = fn;
+  t.vector_format = format;
+  return t;
+}
+
 /* ============================================================
-   RUNNERS
+   REGISTRY
+   Pointers to suites in registration order, kept NULL-terminated.
+   Suites built up by tc_register_test are owned here and grow their
+   test arrays as tests arrive.
    ============================================================ */
 
-TestResult tc_run_test(Test *test, void *env) {
-  TestResult r;
-  double start;
+typedef struct {
+  Suite suite;
+  int cap;
+} tc__OwnedSuite;
+
+static Suite **tc__registry;
+static int tc__registry_count;
+static int tc__registry_cap;
+
+static tc__OwnedSuite **tc__owned;
+static int tc__owned_count;
+static int tc__owned_cap;
+
+/* items, grown to hold `need` elements of `size`; NULL if out of memory */
+static void *tc__grow(void *items, int *cap, int need, size_t size) {
+  int grown_cap = *cap ? *cap : 16;
+  void *grown;
+  if (items && need <= *cap)
+    return items;
+  while (grown_cap < need)
+    grown_cap *= 2;
+  grown = realloc(items, (size_t)grown_cap * size);
+  if (grown)
+    *cap = grown_cap;
+  return grown;
+}
 
-  if (test->fn == NULL) {
-    return tc_skip(test->skip_reason ? test->skip_reason : "skipped");
+int tc_register_suite(Suite *suite) {
+  Suite **grown = (Suite **)tc__grow(tc__registry, &tc__registry_cap,
+                                     tc__registry_count + 2, sizeof(Suite *));
+  if (!grown)
+    return -1;
+  tc__registry = grown;
+  if (suite->test_count == 0) {
+    while (suite->tests && suite->tests[suite->test_count].name != NULL)
+      suite->test_count++;
+  }
+  tc__registry[tc__registry_count++] = suite;
+  tc__registry[tc__registry_count] = NULL;
+  return 0;
+}
+
+int tc_register_test(const char *suite_name, Test test) {
+  tc__OwnedSuite *owned = NULL;
+  Test *tests;
+  int i;
+
+  for (i = 0; i < tc__owned_count; i++) {
+    if (strcmp(tc__owned[i]->suite.name, suite_name) == 0) {
+      owned = tc__owned[i];
+      break;
+    }
+  }
+  if (!owned) {
+    tc__OwnedSuite **grown = (tc__OwnedSuite **)tc__grow(
+        tc__owned, &tc__owned_cap, tc__owned_count + 1,
+        sizeof(tc__OwnedSuite *));
+    if (!grown)
+      return -1;
+    tc__owned = grown;
+    owned = (tc__OwnedSuite *)calloc(1, sizeof(tc__OwnedSuite));
+    if (!owned)
+      return -1;
+    owned->suite.name = suite_name;
+    if (tc_register_suite(&owned->suite) != 0) {
+      free(owned);
+      return -1;
+    }
+    tc__owned[tc__owned_count++] = owned;
   }
 
-  start = tc__get_time_ms();
-  r = test->fn(env);
-  r.elapsed_ms = tc__get_time_ms() - start;
+  tests = (Test *)tc__grow(owned->suite.tests, &owned->cap,
+                           owned->suite.test_count + 1, sizeof(Test));
+  if (!tests)
+    return -1;
+  owned->suite.tests = tests;
+  owned->suite.tests[owned->suite.test_count++] = test;
+  return 0;
+}
 
-  return r;
+Suite **tc_registered_suites(void) {
+  static Suite *empty[1];
+  return tc__registry ? tc__registry : empty;
 }
 
-void tc_print_result(const char *name, TestResult *result) {
-  const char *icon;
-  const char *color;
+/* ============================================================
+   FIXTURES
+   Named resources shared by the suites that list them. A session
+   fixture is built once, by the first suite that needs it, under its
+   own lock so concurrent suites wait for that instance; each suite of
+   the run planned to need it holds a count, and the last to finish
+   tears it down. Suite fixtures are built for each suite. Either way
+   a fixture's requirements are set up before it and torn down after.
+   ============================================================ */
+
+#define TC__FIXTURE_IDLE 0
+#define TC__FIXTURE_READY 1
+#define TC__FIXTURE_FAILED 2
+
+typedef struct {
+  Fixture def;
+  tc__mutex lock; /* held while building, so slots never move */
+  int state;
+  int status; /* what a failed setup returned */
+  void *value;
+  int pending;         /* suites left in the run that need it */
+  unsigned long built; /* build order, for the teardown at run end */
+} tc__FixtureSlot;
+
+/* Fixtures one suite needs, in setup order, with suite-scope values */
+typedef struct {
+  int *order;
+  void **values;
+  int count;
+  int acquired; /* entries set up so far, visible to tc_fixture */
+} tc__FixtureSet;
+
+static tc__FixtureSlot **tc__fixtures;
+static int tc__fixture_count;
+static int tc__fixture_cap;
+static unsigned long tc__fixture_builds;
+static tc__mutex tc__fixture_lock = TC__MUTEX_INIT; /* pending, builds */
+
+/* Fixtures of the suite running on this thread */
+static TC__TLS tc__FixtureSet *tc__tls_fixtures;
+
+static int tc__fixture_find(const char *name, size_t len) {
   int i;
+  for (i = 0; i < tc__fixture_count; i++) {
+    const char *n = tc__fixtures[i]->def.name;
+    if (strlen(n) == len && memcmp(n, name, len) == 0)
+      return i;
+  }
+  return -1;
+}
 
-  switch (result->tag) {
-  case TC_PASS:
-    icon = "\xe2\x9c\x93";
-    color = TC__GREEN;
-    break; /* ✓ */
-  case TC_FAIL:
-    icon = "\xe2\x9c\x97";
-    color = TC__RED;
-    break; /* ✗ */
-  case TC_SKIP:
-    icon = "\xe2\x97\x8b";
-    color = TC__YELLOW;
-    break; /* ○ */
+int tc_register_fixture(const Fixture *fixture) {
+  tc__FixtureSlot **grown;
+  tc__FixtureSlot *slot;
+
+  if (!fixture || !fixture->name ||
+      tc__fixture_find(fixture->name, strlen(fixture->name)) >= 0)
+    return -1;
+  grown = (tc__FixtureSlot **)tc__grow(tc__fixtures, &tc__fixture_cap,
+                                       tc__fixture_count + 1,
+                                       sizeof(tc__FixtureSlot *));
+  if (!grown)
+    return -1;
+  tc__fixtures = grown;
+  slot = (tc__FixtureSlot *)calloc(1, sizeof(tc__FixtureSlot));
+  if (!slot)
+    return -1;
+  slot->def = *fixture;
+  tc__mutex_init(&slot->lock);
+  tc__fixtures[tc__fixture_count++] = slot;
+  return 0;
+}
+
+void *tc_fixture(const char *name) {
+  tc__FixtureSet *set = tc__tls_fixtures;
+  int i;
+  for (i = 0; set && name && i < set->acquired; i++) {
+    tc__FixtureSlot *f = tc__fixtures[set->order[i]];
+    if (strcmp(f->def.name, name) == 0)
+      return f->def.scope == TC_FIXTURE_SUITE ? set->values[i] : f->value;
+  }
+  return NULL;
+}
+
+/*
+ * Append the fixtures named in `names` to set->order, each after the
+ * ones it requires. user names who asks, for messages; session is set
+ * when that is a session fixture, which cannot use suite fixtures.
+ * marks: 0 not seen, 1 being added, 2 added.
+ */
+static int tc__fixture_add(tc__FixtureSet *set, char *marks,
+                           const char *names, const char *user, int session,
+                           int quiet) {
+  const char *p = names;
+
+  while (p && *p) {
+    size_t len = strcspn(p, " ,");
+    int idx = len > 0 ? tc__fixture_find(p, len) : -1;
+    tc__FixtureSlot *f = idx >= 0 ? tc__fixtures[idx] : NULL;
+
+    if (len > 0 && !f) {
+      if (!quiet)
+        fprintf(stderr, "Error: '%s' needs unknown fixture '%.*s'\n", user,
+                (int)len, p);
+      return -1;
+    }
+    if (f && session && f->def.scope == TC_FIXTURE_SUITE) {
+      if (!quiet)
+        fprintf(stderr,
+                "Error: Session fixture '%s' requires suite fixture '%s'\n",
+                user, f->def.name);
+      return -1;
+    }
+    if (f && marks[idx] == 1) {
+      if (!quiet)
+        fprintf(stderr, "Error: Fixture '%s' requires itself\n",
+                f->def.name);
+      return -1;
+    }
+    if (f && marks[idx] == 0) {
+      marks[idx] = 1;
+      if (tc__fixture_add(set, marks, f->def.requires, f->def.name,
+                          f->def.scope == TC_FIXTURE_SESSION, quiet) != 0)
+        return -1;
+      marks[idx] = 2;
+      set->order[set->count++] = idx;
+    }
+    p += len;
+    p += strspn(p, " ,");
+  }
+  return 0;
+}
+
+static void tc__fixture_set_free(tc__FixtureSet *set) {
+  free(set->order);
+  free((void *)set->values);
+  memset(set, 0, sizeof(*set));
+}
+
+/* Resolve `names` for user, as tc__fixture_add; -1 if it cannot */
+static int tc__fixture_set_resolve(tc__FixtureSet *set, const char *names,
+                                   const char *user, int session, int quiet) {
+  char *marks;
+  int ret;
+
+  memset(set, 0, sizeof(*set));
+  if (!names || !*names)
+    return 0;
+  set->order = (int *)malloc((size_t)(tc__fixture_count + 1) * sizeof(int));
+  set->values =
+      (void **)calloc((size_t)(tc__fixture_count + 1), sizeof(void *));
+  marks = (char *)calloc((size_t)(tc__fixture_count + 1), 1);
+  if (!set->order || !set->values || !marks) {
+    if (!quiet)
+      fprintf(stderr, "Error: Out of memory resolving fixtures of '%s'\n",
+              user);
+    ret = -1;
+  } else {
+    ret = tc__fixture_add(set, marks, names, user, session, quiet);
+  }
+  free(marks);
+  if (ret != 0)
+    tc__fixture_set_free(set);
+  return ret;
+}
+
+/* Resolve what suite needs; -1 (reported unless quiet) if it cannot */
+static int tc__fixture_set_init(tc__FixtureSet *set, const Suite *suite,
+                                int quiet) {
+  return tc__fixture_set_resolve(set, suite->fixtures, suite->name, 0, quiet);
+}
+
+/* Count, for each session fixture, the suites of a run that need it */
+static void tc__fixtures_plan(Suite **suites) {
+  int i, j;
+  tc__mutex_lock(&tc__fixture_lock);
+  for (i = 0; i < tc__fixture_count; i++)
+    tc__fixtures[i]->pending = 0;
+  for (i = 0; tc__fixture_count > 0 && suites[i] != NULL; i++) {
+    tc__FixtureSet set;
+    if (tc__fixture_set_init(&set, suites[i], 1) != 0)
+      continue;
+    for (j = 0; j < set.count; j++) {
+      tc__FixtureSlot *f = tc__fixtures[set.order[j]];
+      if (f->def.scope == TC_FIXTURE_SESSION)
+        f->pending++;
+    }
+    tc__fixture_set_free(&set);
+  }
+  tc__mutex_unlock(&tc__fixture_lock);
+}
+
+/* Set up what suite needs; nonzero (a setup status) if any of it failed */
+static int tc__fixtures_acquire(const Suite *suite, tc__FixtureSet *set) {
+  int i;
+
+  if (tc__fixture_set_init(set, suite, 0) != 0)
+    return -1;
+  for (i = 0; i < set->count; i++) {
+    tc__FixtureSlot *f = tc__fixtures[set->order[i]];
+    int ret;
+
+    if (f->def.scope == TC_FIXTURE_SUITE) {
+      ret = f->def.setup ? f->def.setup(&set->values[i]) : 0;
+    } else {
+      tc__mutex_lock(&f->lock);
+      if (f->state == TC__FIXTURE_IDLE) {
+        f->value = NULL;
+        f->status = f->def.setup ? f->def.setup(&f->value) : 0;
+        f->state = f->status == 0 ? TC__FIXTURE_READY : TC__FIXTURE_FAILED;
+        tc__mutex_lock(&tc__fixture_lock);
+        f->built = ++tc__fixture_builds;
+        tc__mutex_unlock(&tc__fixture_lock);
+      }
+      ret = f->status;
+      tc__mutex_unlock(&f->lock);
+    }
+    if (ret != 0) {
+      fprintf(stderr, "Error: Fixture '%s' for suite '%s' failed "
+                      "(returned %d)\n",
+              f->def.name, suite->name, ret);
+      return ret;
+    }
+    set->acquired = i + 1;
+  }
+  return 0;
+}
+
+/* Tear down session fixture f; tc_fixture sees what it requires */
+static void tc__fixture_teardown(tc__FixtureSlot *f) {
+  tc__FixtureSet needs, *saved = tc__tls_fixtures;
+
+  tc__mutex_lock(&f->lock);
+  if (f->state == TC__FIXTURE_READY && f->def.teardown) {
+    /* Built before f, so still up: the run ends them newest first */
+    tc__fixture_set_resolve(&needs, f->def.requires, f->def.name, 1, 1);
+    needs.acquired = needs.count;
+    tc__tls_fixtures = &needs;
+    f->def.teardown(f->value);
+    tc__tls_fixtures = saved;
+    tc__fixture_set_free(&needs);
+  }
+  f->state = TC__FIXTURE_IDLE;
+  f->value = NULL;
+  tc__mutex_unlock(&f->lock);
+}
+
+/*
+ * In reverse setup order, tear down the suite's own instances and drop
+ * its session counts. Each teardown still sees what it required. A
+ * suite that set nothing up (cached, not run) still drops its counts.
+ */
+static void tc__fixtures_release(tc__FixtureSet *set) {
+  int held = set->acquired;
+  int i;
+
+  for (i = set->count - 1; i >= 0; i--) {
+    tc__FixtureSlot *f = tc__fixtures[set->order[i]];
+    int last;
+
+    if (set->acquired > i)
+      set->acquired = i;
+    if (f->def.scope == TC_FIXTURE_SUITE) {
+      if (i < held && f->def.teardown)
+        f->def.teardown(set->values[i]);
+      continue;
+    }
+    tc__mutex_lock(&tc__fixture_lock);
+    last = f->pending > 0 && --f->pending == 0;
+    tc__mutex_unlock(&tc__fixture_lock);
+    if (last)
+      tc__fixture_teardown(f);
+  }
+  tc__fixture_set_free(set);
+}
+
+/* Tear down session fixtures still alive at run end, newest first */
+static void tc__fixtures_finish(void) {
+  for (;;) {
+    tc__FixtureSlot *newest = NULL;
+    int i;
+    for (i = 0; i < tc__fixture_count; i++) {
+      tc__FixtureSlot *f = tc__fixtures[i];
+      if (f->state == TC__FIXTURE_FAILED)
+        f->state = TC__FIXTURE_IDLE;
+      if (f->state == TC__FIXTURE_READY &&
+          (!newest || f->built > newest->built))
+        newest = f;
+    }
+    if (!newest)
+      return;
+    tc__fixture_teardown(newest);
+  }
+}
+
+/* ============================================================
+   HARDWARE COUNTERS
+   With --perf-counters each thread opens one perf_event_open group on
+   first use. The first event that opens leads it and the others the
+   CPU has join, so a single read() returns all of them. A test's counts
+   are the difference of two reads, scaled up when the kernel had the
+   group multiplexed off the PMU part of the time. Counters do not
+   follow fork, so a child process opens a group of its own.
+   ============================================================ */
+
+#define TC__PERF_EVENTS 5
+
+static int tc__perf_on;
+
+typedef struct {
+  unsigned present;
+  uint64_t value[TC__PERF_EVENTS];
+  uint64_t enabled;
+  uint64_t running;
+} tc__PerfRead;
+
+/* Counts of one scope, which may be entered several times */
+typedef struct {
+  int on;
+  tc__PerfRead start;
+  tc__PerfRead sum;
+} tc__PerfScope;
+
+#ifdef TC__HAVE_PERF
+typedef struct {
+  int state; /* 0: not opened, 1: open, -1: nothing could be opened */
+  long pid;  /* process that opened it */
+  int count;
+  int fd[TC__PERF_EVENTS];    /* fd[0] leads */
+  int event[TC__PERF_EVENTS]; /* tc__perf_events index of each member */
+  int error;
+} tc__PerfGroup;
+
+static TC__TLS tc__PerfGroup tc__tls_perf;
+static int tc__perf_errno; /* why the probing thread opened nothing */
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} tc__perf_events[TC__PERF_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}};
+
+static int tc__perf_event_open(int event, int group) {
+  struct perf_event_attr attr;
+  unsigned long flags = 0;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = tc__perf_events[event].type;
+  attr.config = tc__perf_events[event].config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+#ifdef PERF_FLAG_FD_CLOEXEC
+  flags = PERF_FLAG_FD_CLOEXEC;
+#endif
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, flags);
+}
+
+static void tc__perf_close(void) {
+  tc__PerfGroup *g = &tc__tls_perf;
+  while (g->count > 0)
+    close(g->fd[--g->count]);
+  g->state = 0;
+}
+
+/* The calling thread's group, opened on first use; NULL without one */
+static tc__PerfGroup *tc__perf_group(void) {
+  tc__PerfGroup *g = &tc__tls_perf;
+  int i, fd;
+
+  if (g->state != 0 && g->pid != (long)getpid())
+    tc__perf_close(); /* inherited from the parent; counts nothing here */
+  if (g->state != 0)
+    return g->state > 0 ? g : NULL;
+
+  g->pid = (long)getpid();
+  g->error = 0;
+  for (i = 0; i < TC__PERF_EVENTS; i++) {
+    fd = tc__perf_event_open(i, g->count > 0 ? g->fd[0] : -1);
+    if (fd < 0) {
+      if (g->count == 0 && g->error == 0)
+        g->error = errno;
+      continue;
+    }
+    g->fd[g->count] = fd;
+    g->event[g->count] = i;
+    g->count++;
+  }
+  g->state = g->count > 0 ? 1 : -1;
+  return g->state > 0 ? g : NULL;
+}
+
+static int tc__perf_read(tc__PerfRead *out) {
+  tc__PerfGroup *g = tc__perf_group();
+  uint64_t data[3 + TC__PERF_EVENTS];
+  size_t size;
+  int i;
+
+  if (!g)
+    return -1;
+  size = (size_t)(3 + g->count) * sizeof(uint64_t);
+  if (read(g->fd[0], data, size) != (ssize_t)size ||
+      data[0] != (uint64_t)g->count)
+    return -1;
+  memset(out, 0, sizeof(*out));
+  out->enabled = data[1];
+  out->running = data[2];
+  for (i = 0; i < g->count; i++) {
+    out->value[g->event[i]] = data[3 + i];
+    out->present |= 1u << g->event[i];
+  }
+  return 0;
+}
+#else
+static void tc__perf_close(void) {}
+
+static int tc__perf_read(tc__PerfRead *out) {
+  (void)out;
+  return -1;
+}
+#endif
+
+int tc_set_perf_counters(int on) {
+  tc__perf_on = 0;
+  if (!on)
+    return 0;
+#ifdef TC__HAVE_PERF
+  if (tc__perf_group()) {
+    tc__perf_on = 1;
+    return 0;
+  }
+  tc__perf_errno = tc__tls_perf.error;
+#endif
+  return -1;
+}
+
+/* Why tc_set_perf_counters failed, for the --perf-counters note */
+static const char *tc__perf_why(void) {
+#ifdef TC__HAVE_PERF
+  switch (tc__perf_errno) {
+  case ENOENT:
+  case ENODEV:
+  case EOPNOTSUPP:
+    return "no hardware counters on this CPU or VM";
+  case EACCES:
+  case EPERM:
+    return "not permitted; see kernel.perf_event_paranoid";
+  case ENOSYS:
+    return "perf_event_open is not available";
   default:
-    icon = "?";
-    color = "";
-    break;
+    return strerror(tc__perf_errno);
+  }
+#else
+  return "they need Linux perf events";
+#endif
+}
+
+static void tc__perf_begin(tc__PerfScope *s) {
+  s->on = tc__perf_on && tc__perf_read(&s->start) == 0;
+}
+
+/* Add the counts since tc__perf_begin to the scope's sum */
+static void tc__perf_end(tc__PerfScope *s) {
+  tc__PerfRead now;
+  int i;
+
+  if (!s->on || tc__perf_read(&now) != 0)
+    return;
+  for (i = 0; i < TC__PERF_EVENTS; i++)
+    s->sum.value[i] += now.value[i] - s->start.value[i];
+  s->sum.enabled += now.enabled - s->start.enabled;
+  s->sum.running += now.running - s->start.running;
+  s->sum.present |= now.present;
+  s->on = 0;
+}
+
+/* Report keys of the TC_PERF_* bits, lowest first */
+static const char *const tc__perf_keys[TC__PERF_EVENTS] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+
+static uint64_t tc__perf_count(const PerfStats *p, int bit) {
+  const uint64_t counts[TC__PERF_EVENTS] = {p->cycles, p->instructions,
+                                            p->l1d_misses, p->llc_misses,
+                                            p->branch_misses};
+  return counts[bit];
+}
+
+static void tc__perf_attach(TestResult *r, const tc__PerfScope *s) {
+  const tc__PerfRead *c = &s->sum;
+  double scale;
+  TestMetrics *m;
+  PerfStats *p;
+
+  if (!c->present || c->running == 0)
+    return;
+  m = tc__attach_metrics(r);
+  if (!m)
+    return;
+  scale = c->running < c->enabled ? (double)c->enabled / (double)c->running
+                                  : 1.0;
+  p = &m->perf;
+  m->present |= TC_METRIC_PERF;
+  p->present = c->present;
+  p->cycles = (uint64_t)((double)c->value[0] * scale);
+  p->instructions = (uint64_t)((double)c->value[1] * scale);
+  p->l1d_misses = (uint64_t)((double)c->value[2] * scale);
+  p->llc_misses = (uint64_t)((double)c->value[3] * scale);
+  p->branch_misses = (uint64_t)((double)c->value[4] * scale);
+  p->ipc = (c->present & TC_PERF_CYCLES) &&
+                   (c->present & TC_PERF_INSTRUCTIONS) && p->cycles > 0
+               ? (double)p->instructions / (double)p->cycles
+               : 0.0;
+}
+
+/* ============================================================
+   BENCHMARKS
+   Iterations are calibrated until one sample lasts TC_BENCH_SAMPLE_NS,
+   the body is warmed up for TC_BENCH_WARMUP_NS, then TC_BENCH_SAMPLES
+   samples are timed and reduced to per-operation statistics.
+   ============================================================ */
+
+#define TC__BENCH_MAX_ITERS ((uint64_t)1 << 40)
+
+#if !defined(__GNUC__) && !defined(__clang__)
+static const volatile void *volatile tc__escape_sink;
+
+void tc__escape(const volatile void *p) { tc__escape_sink = p; }
+#endif
+
+static uint64_t tc__bench_sample(BenchFn fn, void *env, uint64_t iters) {
+  uint64_t start = tc_now_ns();
+  fn(env, iters);
+  return tc_now_ns() - start;
+}
+
+static int tc__double_cmp(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static double tc__median(const double *sorted, int n) {
+  return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+}
+
+/* Nearest-rank percentile (0-100) of n ascending samples */
+static double tc__percentile(const double *sorted, int n, double pct) {
+  int rank = (int)ceil(pct / 100.0 * n);
+  if (rank < 1)
+    rank = 1;
+  if (rank > n)
+    rank = n;
+  return sorted[rank - 1];
+}
+
+static void tc__bench_stats(BenchStats *st, double *samples, int n) {
+  double sum = 0, var = 0;
+  int i;
+
+  qsort(samples, (size_t)n, sizeof(double), tc__double_cmp);
+  for (i = 0; i < n; i++)
+    sum += samples[i];
+  st->sample_count = n;
+  st->min_ns = samples[0];
+  st->median_ns = tc__median(samples, n);
+  st->mean_ns = sum / n;
+  st->p99_ns = tc__percentile(samples, n, 99.0);
+  for (i = 0; i < n; i++)
+    var += (samples[i] - st->mean_ns) * (samples[i] - st->mean_ns);
+  st->stddev_ns = n > 1 ? sqrt(var / (n - 1)) : 0.0;
+  st->ops_per_sec = st->mean_ns > 0 ? 1e9 / st->mean_ns : 0.0;
+  st->samples = samples;
+}
+
+static TestResult tc__run_bench(Test *test, void *env) {
+  TestResult r = tc_pass();
+  tc__ArenaMark err_mark = tc__arena_mark(TC__ERRORS);
+  tc__ArenaMark text_mark = tc__arena_mark(TC__TEXT);
+  uint64_t start = tc_now_ns();
+  uint64_t iters = 1, t, deadline;
+  double *samples;
+  TestMetrics *m;
+  tc__PerfScope perf;
+  int i;
+
+  samples = (double *)malloc(TC_BENCH_SAMPLES * sizeof(double));
+  if (!samples)
+    return tc_fail("out of memory collecting benchmark samples");
+
+  for (;;) {
+    t = tc__bench_sample(test->bench, env, iters);
+    if (t >= TC_BENCH_SAMPLE_NS || iters >= TC__BENCH_MAX_ITERS)
+      break;
+    if (t < TC_BENCH_SAMPLE_NS / 100)
+      iters *= 10;
+    else
+      iters = (uint64_t)((double)iters * TC_BENCH_SAMPLE_NS / (double)t *
+                         1.1) +
+              1;
+  }
+
+  deadline = tc_now_ns() + TC_BENCH_WARMUP_NS;
+  while (tc_now_ns() < deadline)
+    tc__bench_sample(test->bench, env, iters);
+
+  /* Counters cover the samples, not calibration or warm-up */
+  memset(&perf, 0, sizeof(perf));
+  for (i = 0; i < TC_BENCH_SAMPLES; i++) {
+    tc__perf_begin(&perf);
+    t = tc__bench_sample(test->bench, env, iters);
+    tc__perf_end(&perf);
+    samples[i] = (double)t / (double)iters;
+  }
+
+  /* Whatever the body left in the stores is not part of the result */
+  tc__arena_reset(TC__ERRORS, err_mark);
+  tc__arena_reset(TC__TEXT, text_mark);
+
+  m = tc__attach_metrics(&r);
+  if (m) {
+    double *kept = (double *)tc__arena_alloc(TC__TEXT, TC_BENCH_SAMPLES *
+                                                           sizeof(double));
+    if (kept) {
+      memcpy(kept, samples, TC_BENCH_SAMPLES * sizeof(double));
+      m->present |= TC_METRIC_BENCH;
+      m->bench.iterations = iters;
+      tc__bench_stats(&m->bench, kept, TC_BENCH_SAMPLES);
+    }
+  }
+  tc__perf_attach(&r, &perf);
+  free(samples);
+
+  r.elapsed_ns = tc_now_ns() - start;
+  return r;
+}
+
+/*
+ * Baseline comparison. A saved run (tc_write_bench_json) is loaded before
+ * the run; each benchmark's samples are then tested against the saved ones
+ * with a one-sided Mann-Whitney U test. A benchmark regresses when its
+ * median grew by more than the threshold and the shift is significant.
+ */
+
+typedef struct {
+  char *suite;
+  char *name;
+  double *samples;
+  int count;
+} tc__Baseline;
+
+static tc__Baseline *tc__baselines;
+static int tc__baseline_count;
+static double tc__bench_threshold = 5.0;
+
+static void tc__baseline_free(tc__Baseline *b) {
+  free(b->suite);
+  free(b->name);
+  free(b->samples);
+  memset(b, 0, sizeof(*b));
+}
+
+static void tc__baselines_free(void) {
+  int i;
+  for (i = 0; i < tc__baseline_count; i++)
+    tc__baseline_free(&tc__baselines[i]);
+  free(tc__baselines);
+  tc__baselines = NULL;
+  tc__baseline_count = 0;
+}
+
+/*
+ * The baseline is read with a small JSON tokenizer, so a file that was
+ * reformatted (pretty-printed, or by jq -c) loads the same. Of the root
+ * object only "benchmarks" is read, and of each entry only "suite",
+ * "name" and "sample_ns"; every other value is skipped.
+ */
+
+static const char *tc__json_ws(const char *p) {
+  while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+    p++;
+  return p;
+}
+
+static int tc__json_hex4(const char *p, unsigned long *v) {
+  int k;
+  *v = 0;
+  for (k = 0; k < 4; k++) {
+    int c = (unsigned char)p[k];
+    int d = c >= '0' && c <= '9'   ? c - '0'
+            : c >= 'a' && c <= 'f' ? c - 'a' + 10
+            : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                   : -1;
+    if (d < 0)
+      return -1;
+    *v = *v << 4 | (unsigned long)d;
+  }
+  return 0;
+}
+
+/* Encode code point cp as UTF-8 at w; returns the end */
+static char *tc__utf8_put(char *w, unsigned long cp) {
+  if (cp < 0x80) {
+    *w++ = (char)cp;
+  } else if (cp < 0x800) {
+    *w++ = (char)(0xc0 | cp >> 6);
+    *w++ = (char)(0x80 | (cp & 0x3f));
+  } else if (cp < 0x10000) {
+    *w++ = (char)(0xe0 | cp >> 12);
+    *w++ = (char)(0x80 | (cp >> 6 & 0x3f));
+    *w++ = (char)(0x80 | (cp & 0x3f));
+  } else {
+    *w++ = (char)(0xf0 | cp >> 18);
+    *w++ = (char)(0x80 | (cp >> 12 & 0x3f));
+    *w++ = (char)(0x80 | (cp >> 6 & 0x3f));
+    *w++ = (char)(0x80 | (cp & 0x3f));
+  }
+  return w;
+}
+
+/* The string at *p, decoded into malloc'd *out unless out is NULL */
+static int tc__json_str(const char **p, char **out) {
+  const char *s = tc__json_ws(*p);
+  char *w = NULL;
+
+  if (*s++ != '"')
+    return -1;
+  if (out) {
+    /* No escape decodes to more bytes than it takes */
+    *out = w = (char *)malloc(strlen(s) + 1);
+    if (!w)
+      return -1;
+  }
+  for (; *s != '"'; s++) {
+    unsigned long cp = (unsigned char)*s;
+    if (cp == '\0' || cp < 0x20)
+      goto bad;
+    if (cp == '\\') {
+      switch (*++s) {
+      case 'b':
+        cp = '\b';
+        break;
+      case 'f':
+        cp = '\f';
+        break;
+      case 'n':
+        cp = '\n';
+        break;
+      case 'r':
+        cp = '\r';
+        break;
+      case 't':
+        cp = '\t';
+        break;
+      case '"':
+      case '\\':
+      case '/':
+        cp = (unsigned char)*s;
+        break;
+      case 'u': {
+        unsigned long lo;
+        if (tc__json_hex4(s + 1, &cp) != 0)
+          goto bad;
+        s += 4;
+        if (cp >= 0xd800 && cp < 0xdc00 && s[1] == '\\' && s[2] == 'u' &&
+            tc__json_hex4(s + 3, &lo) == 0 && lo >= 0xdc00 && lo < 0xe000) {
+          cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+          s += 6;
+        }
+        break;
+      }
+      default:
+        goto bad;
+      }
+      if (w)
+        w = tc__utf8_put(w, cp);
+    } else if (w) {
+      *w++ = (char)cp;
+    }
+  }
+  if (w)
+    *w = '\0';
+  *p = s + 1;
+  return 0;
+
+bad:
+  if (out) {
+    free(*out);
+    *out = NULL;
+  }
+  return -1;
+}
+
+/*
+ * Step through the object or array opened at *p: call with first set
+ * right after '{' or '[', then after each value. Returns 1 with *p at
+ * the next value (its key, malloc'd, in *key for an object), 0 past the
+ * closing bracket and -1 if the text is malformed.
+ */
+static int tc__json_next(const char **p, char close, int first, char **key) {
+  const char *s = tc__json_ws(*p);
+  if (*s == close) {
+    *p = s + 1;
+    return 0;
+  }
+  if (!first && *s++ != ',')
+    return -1;
+  if (close == '}') {
+    if (tc__json_str(&s, key) != 0)
+      return -1;
+    s = tc__json_ws(s);
+    if (*s++ != ':') {
+      free(*key);
+      *key = NULL;
+      return -1;
+    }
+  }
+  *p = s;
+  return 1;
+}
+
+/* Skip the value at *p, nested at most 64 deep */
+static int tc__json_skip(const char **p, int depth) {
+  const char *s = tc__json_ws(*p);
+  char *end;
+  int more, first = 1;
+
+  if (*s == '"')
+    return tc__json_str(p, NULL);
+  if (*s == '{' || *s == '[') {
+    char close = *s == '{' ? '}' : ']';
+    char *key = NULL;
+    if (depth >= 64)
+      return -1;
+    s++;
+    while ((more = tc__json_next(&s, close, first, &key)) == 1) {
+      free(key);
+      key = NULL;
+      if (tc__json_skip(&s, depth + 1) != 0)
+        return -1;
+      first = 0;
+    }
+    *p = s;
+    return more;
+  }
+  if (strncmp(s, "true", 4) == 0 || strncmp(s, "null", 4) == 0) {
+    *p = s + 4;
+    return 0;
+  }
+  if (strncmp(s, "false", 5) == 0) {
+    *p = s + 5;
+    return 0;
+  }
+  strtod(s, &end);
+  if (end == s)
+    return -1;
+  *p = end;
+  return 0;
+}
+
+/* The numbers of the array at *p, appended to b->samples */
+static int tc__baseline_samples(tc__Baseline *b, const char **p) {
+  const char *s = tc__json_ws(*p);
+  int cap = b->count, more, first = 1;
+
+  if (*s++ != '[')
+    return -1;
+  while ((more = tc__json_next(&s, ']', first, NULL)) == 1) {
+    char *end;
+    double v = strtod(tc__json_ws(s), &end);
+    double *grown;
+    if (end == tc__json_ws(s))
+      return -1;
+    grown = (double *)tc__grow(b->samples, &cap, b->count + 1,
+                               sizeof(double));
+    if (!grown)
+      return -1;
+    b->samples = grown;
+    b->samples[b->count++] = v;
+    s = end;
+    first = 0;
+  }
+  *p = s;
+  return more;
+}
+
+/* One entry of "benchmarks"; b is empty unless it has all three keys */
+static int tc__baseline_entry(tc__Baseline *b, const char **p) {
+  const char *s = tc__json_ws(*p);
+  char *key = NULL;
+  int more, first = 1, ret = 0;
+
+  memset(b, 0, sizeof(*b));
+  if (*s != '{')
+    return tc__json_skip(p, 1);
+  s++;
+  while (ret == 0 && (more = tc__json_next(&s, '}', first, &key)) == 1) {
+    if (strcmp(key, "suite") == 0 && !b->suite)
+      ret = tc__json_str(&s, &b->suite);
+    else if (strcmp(key, "name") == 0 && !b->name)
+      ret = tc__json_str(&s, &b->name);
+    else if (strcmp(key, "sample_ns") == 0 && !b->samples)
+      ret = tc__baseline_samples(b, &s);
+    else
+      ret = tc__json_skip(&s, 2);
+    free(key);
+    key = NULL;
+    first = 0;
+  }
+  if (ret != 0 || more != 0) {
+    tc__baseline_free(b);
+    return -1;
+  }
+  if (!b->suite || !b->name || b->count == 0)
+    tc__baseline_free(b);
+  *p = s;
+  return 0;
+}
+
+/* Load the "benchmarks" of a saved run; -1 if text is not one */
+static int tc__baselines_parse(const char *text) {
+  const char *s = tc__json_ws(text);
+  char *key = NULL;
+  int cap = 0, more, first = 1, ret = 0, found = 0;
+
+  if (*s++ != '{')
+    return -1;
+  while (ret == 0 && (more = tc__json_next(&s, '}', first, &key)) == 1) {
+    int in_first = 1, in_more;
+    first = 0;
+    if (strcmp(key, "benchmarks") != 0 || found ||
+        *tc__json_ws(s) != '[') {
+      ret = tc__json_skip(&s, 1);
+      free(key);
+      key = NULL;
+      continue;
+    }
+    free(key);
+    key = NULL;
+    found = 1;
+    s = tc__json_ws(s) + 1;
+    while (ret == 0 && (in_more = tc__json_next(&s, ']', in_first, NULL)) ==
+                           1) {
+      tc__Baseline b, *grown;
+      in_first = 0;
+      ret = tc__baseline_entry(&b, &s);
+      if (ret != 0 || !b.suite)
+        continue;
+      grown = (tc__Baseline *)tc__grow(tc__baselines, &cap,
+                                       tc__baseline_count + 1,
+                                       sizeof(tc__Baseline));
+      if (!grown) {
+        tc__baseline_free(&b);
+        ret = -1;
+        continue;
+      }
+      tc__baselines = grown;
+      tc__baselines[tc__baseline_count++] = b;
+    }
+    if (ret == 0 && in_more != 0)
+      ret = -1;
+  }
+  if (ret != 0 || more != 0 || !found || *tc__json_ws(s) != '\0')
+    return -1;
+  return 0;
+}
+
+int tc_set_bench_baseline(const char *filename, double threshold_pct) {
+  FILE *f;
+  char *text;
+  int ret;
+
+  tc__baselines_free();
+  tc__bench_threshold = threshold_pct;
+  if (!filename)
+    return 0;
+
+  f = fopen(filename, "rb");
+  if (!f) {
+    fprintf(stderr, "Error: Cannot open benchmark baseline '%s'\n", filename);
+    return -1;
+  }
+  text = tc__slurp(f);
+  fclose(f);
+  if (!text) {
+    fprintf(stderr, "Error: Cannot read benchmark baseline '%s'\n", filename);
+    return -1;
+  }
+  ret = tc__baselines_parse(text);
+  free(text);
+
+  /* A gate that compares nothing would pass every benchmark */
+  if (ret != 0)
+    fprintf(stderr, "Error: Benchmark baseline '%s' is not a saved run\n",
+            filename);
+  else if (tc__baseline_count == 0)
+    fprintf(stderr, "Error: Benchmark baseline '%s' holds no benchmarks\n",
+            filename);
+  if (ret != 0 || tc__baseline_count == 0) {
+    tc__baselines_free();
+    return -1;
+  }
+  return 0;
+}
+
+static const tc__Baseline *tc__baseline_find(const char *suite,
+                                             const char *name) {
+  int i;
+  for (i = 0; i < tc__baseline_count; i++)
+    if (strcmp(tc__baselines[i].suite, suite ? suite : "") == 0 &&
+        strcmp(tc__baselines[i].name, name ? name : "") == 0)
+      return &tc__baselines[i];
+  return NULL;
+}
+
+typedef struct {
+  double value;
+  int current; /* 1 if from the new run */
+} tc__Ranked;
+
+static int tc__ranked_cmp(const void *a, const void *b) {
+  return tc__double_cmp(&((const tc__Ranked *)a)->value,
+                        &((const tc__Ranked *)b)->value);
+}
+
+/*
+ * One-sided Mann-Whitney U: the p-value that `cur` is not slower than
+ * `base`, from the normal approximation with tie correction.
+ */
+static double tc__mann_whitney(const double *base, int n1, const double *cur,
+                               int n2) {
+  int n = n1 + n2;
+  tc__Ranked *all = (tc__Ranked *)malloc((size_t)n * sizeof(tc__Ranked));
+  double rank_sum = 0, ties = 0, u, mean, var, z;
+  int i, j;
+
+  if (!all)
+    return 1.0;
+  for (i = 0; i < n1; i++) {
+    all[i].value = base[i];
+    all[i].current = 0;
+  }
+  for (i = 0; i < n2; i++) {
+    all[n1 + i].value = cur[i];
+    all[n1 + i].current = 1;
   }
+  qsort(all, (size_t)n, sizeof(tc__Ranked), tc__ranked_cmp);
+
+  for (i = 0; i < n; i = j) {
+    double t, rank;
+    for (j = i + 1; j < n && all[j].value == all[i].value; j++)
+      ;
+    t = j - i;
+    rank = (i + 1 + j) / 2.0;
+    ties += t * t * t - t;
+    while (i < j)
+      if (all[i++].current)
+        rank_sum += rank;
+  }
+  free(all);
+
+  u = rank_sum - n2 * (n2 + 1) / 2.0;
+  mean = n1 * (double)n2 / 2.0;
+  var = n1 * (double)n2 / 12.0 * ((n + 1) - ties / ((double)n * (n - 1)));
+  if (var <= 0)
+    return 1.0;
+  z = (u - mean - 0.5) / sqrt(var);
+  return 0.5 * erfc(z / sqrt(2.0));
+}
+
+/* Compare a finished benchmark with the baseline; fail it on regression */
+static void tc__bench_judge(const Suite *suite, const Test *test,
+                            TestResult *r) {
+  const tc__Baseline *base;
+  BenchStats *st;
+  double *sorted;
+  double base_median, limit, change;
+  char expected[160], actual[160];
+  char fmt_limit[32], fmt_base[32], fmt_cur[32];
+
+  if (!r->metrics || !(r->metrics->present & TC_METRIC_BENCH) ||
+      r->tag != TC_PASS)
+    return;
+  base = tc__baseline_find(suite->name, test->name);
+  if (!base) {
+    fprintf(stderr, "Note: Benchmark '%s/%s' has no baseline entry; not "
+                    "compared\n",
+            suite->name, test->name);
+    return;
+  }
+
+  st = &r->metrics->bench;
+  sorted = (double *)malloc((size_t)base->count * sizeof(double));
+  if (!sorted)
+    return;
+  memcpy(sorted, base->samples, (size_t)base->count * sizeof(double));
+  qsort(sorted, (size_t)base->count, sizeof(double), tc__double_cmp);
+  base_median = tc__median(sorted, base->count);
+  free(sorted);
+
+  st->has_baseline = 1;
+  st->baseline_median_ns = base_median;
+  st->p_value =
+      tc__mann_whitney(base->samples, base->count, st->samples,
+                       st->sample_count);
+
+  limit = base_median * (1.0 + tc__bench_threshold / 100.0);
+  if (st->median_ns <= limit || st->p_value >= TC_BENCH_ALPHA)
+    return;
+
+  change = base_median > 0 ? (st->median_ns / base_median - 1.0) * 100.0 : 0;
+  tc__format_ns_f(fmt_limit, sizeof(fmt_limit), limit);
+  tc__format_ns_f(fmt_base, sizeof(fmt_base), base_median);
+  tc__format_ns_f(fmt_cur, sizeof(fmt_cur), st->median_ns);
+  snprintf(expected, sizeof(expected), "median <= %s (baseline %s +%g%%)",
+           fmt_limit, fmt_base, tc__bench_threshold);
+  snprintf(actual, sizeof(actual), "median %s (%+.1f%%, p=%.2g)", fmt_cur,
+           change, st->p_value);
+  r->tag = TC_FAIL;
+  tc__append_error(r, "benchmark regression", expected, actual);
+}
+
+/* ============================================================
+   TIME BUDGETS AND DURATION ASSERTIONS
+   ============================================================ */
+
+static double tc__budget_scale = 1.0;
+
+void tc_set_budget_scale(double scale) {
+  tc__budget_scale = scale > 0 ? scale : 1.0;
+}
+
+static uint64_t tc__scaled_ns(uint64_t ns) {
+  return (uint64_t)((double)ns * tc__budget_scale);
+}
+
+static void tc__fail_duration(TestResult *acc, const char *msg, uint64_t limit,
+                              uint64_t actual) {
+  TestError *e;
+  acc->tag = TC_FAIL;
+  e = tc__push_error(acc, NULL, TC_OP_LE, TC_VAL_NS);
+  if (e) {
+    e->message = tc__store_text(msg);
+    e->expected.ns = limit;
+    e->actual.ns = actual;
+  }
+}
+
+/* Fail a finished test that ran past its own or its suite's budget */
+static void tc__budget_judge(const Suite *suite, const Test *test,
+                             TestResult *r) {
+  uint64_t budget = test->budget_ns ? test->budget_ns : suite->budget_ns;
+  uint64_t limit;
+  if (budget == 0 || test->bench || r->tag == TC_SKIP)
+    return;
+  limit = tc__scaled_ns(budget);
+  if (r->elapsed_ns > limit)
+    tc__fail_duration(r, "time budget exceeded", limit, r->elapsed_ns);
+}
+
+int tc_check_duration_percentile_under(TestResult *acc, CallbackFn fn,
+                                       void *ctx, uint64_t ns, int iters,
+                                       double percentile) {
+  double *times;
+  double observed;
+  uint64_t limit = tc__scaled_ns(ns);
+  char msg[64];
+  int i;
+
+  if (acc->tag == TC_SKIP)
+    return 0;
+  if (iters < 1)
+    iters = 1;
+  times = (double *)malloc((size_t)iters * sizeof(double));
+  if (!times) {
+    acc->tag = TC_FAIL;
+    tc__push_error(acc, "out of memory timing callback", TC_OP_NONE,
+                   TC_VAL_NONE);
+    return 0;
+  }
+
+  for (i = 0; i < iters; i++) {
+    uint64_t start = tc_now_ns();
+    fn(ctx);
+    times[i] = (double)(tc_now_ns() - start);
+  }
+  qsort(times, (size_t)iters, sizeof(double), tc__double_cmp);
+  observed = percentile == 50.0 ? tc__median(times, iters)
+                                : tc__percentile(times, iters, percentile);
+  free(times);
+
+  if (observed <= (double)limit)
+    return 1;
+  if (percentile == 50.0)
+    snprintf(msg, sizeof(msg), "median of %d runs over limit", iters);
+  else
+    snprintf(msg, sizeof(msg), "p%g of %d runs over limit", percentile, iters);
+  tc__fail_duration(acc, msg, limit, (uint64_t)observed);
+  return 0;
+}
+
+TestResult tc_assert_duration_percentile_under(CallbackFn fn, void *ctx,
+                                               uint64_t ns, int iters,
+                                               double percentile) {
+  TestResult r = tc_pass();
+  tc_check_duration_percentile_under(&r, fn, ctx, ns, iters, percentile);
+  return r;
+}
+
+int tc_check_duration_under(TestResult *acc, CallbackFn fn, void *ctx,
+                            uint64_t ns, int iters) {
+  return tc_check_duration_percentile_under(acc, fn, ctx, ns, iters, 50.0);
+}
+
+TestResult tc_assert_duration_under(CallbackFn fn, void *ctx, uint64_t ns,
+                                    int iters) {
+  return tc_assert_duration_percentile_under(fn, ctx, ns, iters, 50.0);
+}
+
+/* ============================================================
+   ALLOCATION COUNTING
+   Each thread counts the heap calls made while it is inside a counted
+   scope: a test, or the callback of an allocation assertion. Scopes
+   nest, and an inner count is folded into the one around it. With
+   TC_ALLOC_COUNT on glibc the allocator is interposed and forwards to
+   the __libc_* entry points; live bytes go by malloc_usable_size so
+   frees match allocations.
+   ============================================================ */
+
+static int tc__alloc_report;
+
+void tc_set_alloc_report(int on) { tc__alloc_report = on; }
+
+static void tc__alloc_add(size_t requested, size_t size) {
+  tc__AllocCount *c = &tc__tls_alloc;
+  c->allocs++;
+  c->bytes += requested;
+  c->live += (long long)size;
+  if (c->live > c->peak)
+    c->peak = c->live;
+}
+
+static void tc__alloc_sub(size_t size) {
+  tc__AllocCount *c = &tc__tls_alloc;
+  c->frees++;
+  c->live -= (long long)size;
+}
+
+void tc_note_alloc(size_t size) {
+  tc__tls_alloc.hooked = 1;
+  if (tc__tls_alloc.on)
+    tc__alloc_add(size, size);
+}
+
+void tc_note_free(size_t size) {
+  tc__tls_alloc.hooked = 1;
+  if (tc__tls_alloc.on)
+    tc__alloc_sub(size);
+}
+
+/* Start a counted scope; *outer keeps the scope around it */
+static void tc__alloc_begin(tc__AllocCount *outer) {
+  tc__AllocCount *c = &tc__tls_alloc;
+  *outer = *c;
+  c->allocs = 0;
+  c->frees = 0;
+  c->bytes = 0;
+  c->live = 0;
+  c->peak = 0;
+  c->on = 1;
+}
+
+/* End it, fold it into the outer scope and return what it counted */
+static tc__AllocCount tc__alloc_end(const tc__AllocCount *outer) {
+  tc__AllocCount *c = &tc__tls_alloc;
+  tc__AllocCount got = *c;
+  *c = *outer;
+  c->hooked |= got.hooked;
+  if (c->on) {
+    c->allocs += got.allocs;
+    c->frees += got.frees;
+    c->bytes += got.bytes;
+    if (c->live + got.peak > c->peak)
+      c->peak = c->live + got.peak;
+    c->live += got.live;
+  }
+  return got;
+}
+
+/* Whether a count of zero means no allocation rather than no counting */
+static int tc__alloc_counted(void) {
+#ifdef TC__HAVE_ALLOC_HOOK
+  return 1;
+#else
+  return tc__tls_alloc.hooked;
+#endif
+}
+
+static void tc__alloc_attach(TestResult *r, const tc__AllocCount *got) {
+  TestMetrics *m;
+  if (!tc__alloc_report || !tc__alloc_counted())
+    return;
+  m = tc__attach_metrics(r);
+  if (!m)
+    return;
+  m->present |= TC_METRIC_ALLOC;
+  m->alloc.allocs = got->allocs;
+  m->alloc.frees = got->frees;
+  m->alloc.bytes = got->bytes;
+  m->alloc.peak_bytes = got->peak > 0 ? (uint64_t)got->peak : 0;
+}
+
+int tc_check_max_allocs(TestResult *acc, CallbackFn fn, void *ctx,
+                        uint64_t n) {
+  tc__AllocCount outer, got;
+  char msg[96];
+  TestError *e;
+
+  if (acc->tag == TC_SKIP)
+    return 0;
+  tc__alloc_begin(&outer);
+  fn(ctx);
+  got = tc__alloc_end(&outer);
+
+  if (got.allocs <= n && tc__alloc_counted())
+    return 1;
+  if (got.allocs <= n) {
+    tc_check_skip_if(acc, 1, "allocations are not counted (TC_ALLOC_COUNT)");
+    return 0;
+  }
+  snprintf(msg, sizeof(msg), "callback made %llu allocations (%llu bytes)",
+           (unsigned long long)got.allocs, (unsigned long long)got.bytes);
+  acc->tag = TC_FAIL;
+  e = tc__push_error(acc, NULL, TC_OP_LE, TC_VAL_SIZE);
+  if (e) {
+    e->message = tc__store_text(msg);
+    e->expected.z = (size_t)n;
+    e->actual.z = (size_t)got.allocs;
+  }
+  return 0;
+}
+
+int tc_check_no_alloc(TestResult *acc, CallbackFn fn, void *ctx) {
+  return tc_check_max_allocs(acc, fn, ctx, 0);
+}
+
+TestResult tc_assert_max_allocs(CallbackFn fn, void *ctx, uint64_t n) {
+  TestResult r = tc_pass();
+  tc_check_max_allocs(&r, fn, ctx, n);
+  return r;
+}
+
+TestResult tc_assert_no_alloc(CallbackFn fn, void *ctx) {
+  return tc_assert_max_allocs(fn, ctx, 0);
+}
+
+#ifdef TC__HAVE_ALLOC_HOOK
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+extern void __libc_free(void *ptr);
+
+/* glibc declares these nothrow, which C++ needs repeated */
+#ifdef __cplusplus
+#define TC__NOTHROW __THROW
+extern "C" {
+#else
+#define TC__NOTHROW
+#endif
+
+void *malloc(size_t size) TC__NOTHROW {
+  void *p = __libc_malloc(size);
+  if (p && tc__tls_alloc.on)
+    tc__alloc_add(size, malloc_usable_size(p));
+  return p;
+}
+
+void *calloc(size_t count, size_t size) TC__NOTHROW {
+  void *p = __libc_calloc(count, size);
+  if (p && tc__tls_alloc.on)
+    tc__alloc_add(count * size, malloc_usable_size(p));
+  return p;
+}
+
+void *realloc(void *ptr, size_t size) TC__NOTHROW {
+  size_t was = ptr && tc__tls_alloc.on ? malloc_usable_size(ptr) : 0;
+  void *p = __libc_realloc(ptr, size);
+  if (tc__tls_alloc.on) {
+    if (ptr && (p || size == 0))
+      tc__alloc_sub(was);
+    if (p)
+      tc__alloc_add(size, malloc_usable_size(p));
+  }
+  return p;
+}
+
+void *reallocarray(void *ptr, size_t count, size_t size) TC__NOTHROW {
+  if (size != 0 && count > (size_t)-1 / size) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return realloc(ptr, count * size);
+}
+
+void free(void *ptr) TC__NOTHROW {
+  if (ptr && tc__tls_alloc.on)
+    tc__alloc_sub(malloc_usable_size(ptr));
+  __libc_free(ptr);
+}
+
+void *memalign(size_t align, size_t size) TC__NOTHROW {
+  void *p = __libc_memalign(align, size);
+  if (p && tc__tls_alloc.on)
+    tc__alloc_add(size, malloc_usable_size(p));
+  return p;
+}
+
+void *aligned_alloc(size_t align, size_t size) TC__NOTHROW {
+  return memalign(align, size);
+}
+
+void *valloc(size_t size) TC__NOTHROW {
+  void *p = __libc_valloc(size);
+  if (p && tc__tls_alloc.on)
+    tc__alloc_add(size, malloc_usable_size(p));
+  return p;
+}
+
+void *pvalloc(size_t size) TC__NOTHROW {
+  void *p = __libc_pvalloc(size);
+  if (p && tc__tls_alloc.on)
+    tc__alloc_add(size, malloc_usable_size(p));
+  return p;
+}
+
+int posix_memalign(void **out, size_t align, size_t size) TC__NOTHROW {
+  void *p;
+  if (align < sizeof(void *) || (align & (align - 1)) != 0)
+    return EINVAL;
+  p = memalign(align, size);
+  if (!p)
+    return ENOMEM;
+  *out = p;
+  return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/* ============================================================
+   IMPACT RECORDING
+   With TC_IMPACT (Linux, GCC/Clang), code built with
+   -finstrument-functions reports every function entered. While a test,
+   setup or teardown runs, its thread collects the entry addresses in a
+   set; the set is then filed under the test or suite it belongs to, and
+   turned into source files when the impact map is saved.
+   ============================================================ */
+
+#ifdef TC__HAVE_IMPACT
+
+#define TC__NO_INSTRUMENT __attribute__((no_instrument_function))
+
+typedef struct {
+  void **slots; /* open addressing; NULL marks a free slot */
+  size_t cap;   /* power of two */
+  size_t count;
+} tc__AddrSet;
+
+typedef struct {
+  const void *owner; /* Test or Suite */
+  void **addrs;
+  size_t count;
+} tc__Coverage;
+
+static int tc__impact_on;
+static TC__TLS tc__AddrSet tc__tls_addrs;
+static TC__TLS int tc__tls_recording;
+static tc__Coverage *tc__coverage;
+static int tc__coverage_count;
+static int tc__coverage_cap;
+static tc__mutex tc__coverage_lock = TC__MUTEX_INIT;
+
+TC__NO_INSTRUMENT static int tc__addr_add(tc__AddrSet *set, void *addr) {
+  size_t i, mask;
+
+  if ((set->count + 1) * 2 > set->cap) {
+    tc__AddrSet grown;
+    grown.cap = set->cap ? set->cap * 2 : 1024;
+    grown.count = 0;
+    grown.slots = (void **)calloc(grown.cap, sizeof(void *));
+    if (!grown.slots)
+      return -1;
+    for (i = 0; i < set->cap; i++)
+      if (set->slots[i])
+        tc__addr_add(&grown, set->slots[i]);
+    free(set->slots);
+    *set = grown;
+  }
+
+  mask = set->cap - 1;
+  for (i = ((size_t)addr >> 4) & mask; set->slots[i]; i = (i + 1) & mask)
+    if (set->slots[i] == addr)
+      return 0;
+  set->slots[i] = addr;
+  set->count++;
+  return 0;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void __cyg_profile_func_enter(void *fn, void *site) TC__NO_INSTRUMENT;
+void __cyg_profile_func_exit(void *fn, void *site) TC__NO_INSTRUMENT;
+
+void __cyg_profile_func_enter(void *fn, void *site) {
+  (void)site;
+  if (tc__tls_recording)
+    tc__addr_add(&tc__tls_addrs, fn);
+}
+
+void __cyg_profile_func_exit(void *fn, void *site) {
+  (void)fn;
+  (void)site;
+}
+#ifdef __cplusplus
+}
+#endif
+
+static void tc__impact_begin(void) {
+  if (!tc__impact_on)
+    return;
+  if (tc__tls_addrs.count > 0) {
+    memset(tc__tls_addrs.slots, 0, tc__tls_addrs.cap * sizeof(void *));
+    tc__tls_addrs.count = 0;
+  }
+  tc__tls_recording = 1;
+}
+
+/* Take ownership of c.addrs and file the record */
+static void tc__coverage_add(tc__Coverage c) {
+  tc__mutex_lock(&tc__coverage_lock);
+  if (tc__coverage_count == tc__coverage_cap) {
+    int cap = tc__coverage_cap ? tc__coverage_cap * 2 : 256;
+    tc__Coverage *grown = (tc__Coverage *)realloc(
+        tc__coverage, (size_t)cap * sizeof(tc__Coverage));
+    if (!grown) {
+      tc__mutex_unlock(&tc__coverage_lock);
+      free(c.addrs);
+      return;
+    }
+    tc__coverage = grown;
+    tc__coverage_cap = cap;
+  }
+  tc__coverage[tc__coverage_count++] = c;
+  tc__mutex_unlock(&tc__coverage_lock);
+}
+
+/* File what the thread recorded since tc__impact_begin under owner */
+static void tc__impact_end(const void *owner) {
+  tc__Coverage c;
+  size_t i;
+
+  if (!tc__impact_on)
+    return;
+  tc__tls_recording = 0;
+
+  c.owner = owner;
+  c.count = 0;
+  c.addrs = (void **)malloc((tc__tls_addrs.count + 1) * sizeof(void *));
+  if (!c.addrs)
+    return;
+  for (i = 0; i < tc__tls_addrs.cap; i++)
+    if (tc__tls_addrs.slots[i])
+      c.addrs[c.count++] = tc__tls_addrs.slots[i];
+  tc__coverage_add(c);
+}
+
+#else
+#define tc__impact_begin() ((void)0)
+#define tc__impact_end(owner) ((void)(owner))
+#endif
+
+/* ============================================================
+   CACHE HITS
+   Tests whose earlier pass still holds under --cache, sorted by
+   address. Filled before the run and only read while it runs, so
+   workers and forked children look tests up without locking.
+   ============================================================ */
+
+static const Test **tc__cache_hits;
+static int tc__cache_hit_count;
+static TestMetrics tc__cached_metrics = {TC_METRIC_CACHED};
+
+static int tc__test_ptr_cmp(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t) * (const Test *const *)a;
+  uintptr_t y = (uintptr_t) * (const Test *const *)b;
+  return (x > y) - (x < y);
+}
+
+static int tc__cache_hit(const Test *test) {
+  return tc__cache_hit_count > 0 &&
+         bsearch(&test, tc__cache_hits, (size_t)tc__cache_hit_count,
+                 sizeof(const Test *), tc__test_ptr_cmp) != NULL;
+}
+
+static int tc__is_cached(const TestResult *r) {
+  return r->tag == TC_PASS && r->metrics &&
+         (r->metrics->present & TC_METRIC_CACHED);
+}
+
+/* A suite whose tests are all cached or skipped runs no setup */
+static int tc__suite_cached(const Suite *suite) {
+  int i, hits = 0;
+  if (tc__cache_hit_count == 0)
+    return 0;
+  for (i = 0; i < suite->test_count; i++) {
+    const Test *t = &suite->tests[i];
+    if (tc__cache_hit(t))
+      hits++;
+    else if (t->fn || t->bench)
+      return 0;
+  }
+  return hits > 0;
+}
+
+/* ============================================================
+   TIMEOUTS
+   A test's timeout_ns, else the tc_set_timeout() default, scaled like
+   budgets; suite setup, teardown and fixture setup get the default.
+   Isolated tests are killed when they overrun. In-process tests and
+   stages are registered in a slot while they run, and a watchdog
+   thread (see WATCHDOG) ends the run when one of them overruns.
+   ============================================================ */
+
+/* Deadline of one running test, or of a stage of suite; neither: free */
+typedef struct {
+  const Test *test;
+  const Suite *suite;
+  const char *stage; /* "setup", "teardown" or "fixture setup" */
+  uint64_t start;
+  uint64_t deadline;
+} tc__Watch;
+
+static uint64_t tc__timeout_ns;
+static int tc__watch_on;
+static tc__Watch *tc__watches;
+static int tc__watch_count;
+static int tc__watch_cap;
+static tc__mutex tc__watch_lock = TC__MUTEX_INIT;
+
+void tc_set_timeout(uint64_t ns) { tc__timeout_ns = ns; }
+
+static uint64_t tc__timeout_of(const Test *test) {
+  uint64_t ns = test->timeout_ns ? test->timeout_ns : tc__timeout_ns;
+  return ns ? tc__scaled_ns(ns) : 0;
+}
+
+/* Limit of a suite's setup and teardown: the default */
+static uint64_t tc__stage_timeout(void) {
+  return tc__timeout_ns ? tc__scaled_ns(tc__timeout_ns) : 0;
+}
+
+static TestResult tc__timed_out(uint64_t limit, uint64_t elapsed) {
+  TestResult r = tc_pass();
+  tc__fail_duration(&r, "test timed out", limit, elapsed);
+  r.elapsed_ns = elapsed;
+  return r;
+}
+
+static int tc__watch_add(const Test *test, const Suite *suite,
+                         const char *stage, uint64_t limit) {
+  int i;
+
+  tc__mutex_lock(&tc__watch_lock);
+  for (i = 0; i < tc__watch_count &&
+              (tc__watches[i].test || tc__watches[i].suite);
+       i++)
+    ;
+  if (i == tc__watch_count) {
+    tc__Watch *grown = (tc__Watch *)tc__grow(tc__watches, &tc__watch_cap,
+                                             i + 1, sizeof(tc__Watch));
+    if (!grown) {
+      tc__mutex_unlock(&tc__watch_lock);
+      return -1;
+    }
+    tc__watches = grown;
+    tc__watch_count++;
+  }
+  tc__watches[i].test = test;
+  tc__watches[i].suite = suite;
+  tc__watches[i].stage = stage;
+  tc__watches[i].start = tc_now_ns();
+  tc__watches[i].deadline = tc__watches[i].start + limit;
+  tc__mutex_unlock(&tc__watch_lock);
+  return i;
+}
+
+/* Slot watching test, or -1 when it has no timeout or none is kept */
+static int tc__watch_begin(const Test *test) {
+  uint64_t limit;
+  if (!tc__watch_on || (limit = tc__timeout_of(test)) == 0)
+    return -1;
+  return tc__watch_add(test, NULL, NULL, limit);
+}
+
+/* Same for a stage of suite run in-process */
+static int tc__watch_stage(const Suite *suite, const char *stage) {
+  uint64_t limit;
+  if (!tc__watch_on || (limit = tc__stage_timeout()) == 0)
+    return -1;
+  return tc__watch_add(NULL, suite, stage, limit);
+}
+
+static void tc__watch_end(int slot) {
+  if (slot < 0)
+    return;
+  tc__mutex_lock(&tc__watch_lock);
+  tc__watches[slot].test = NULL;
+  tc__watches[slot].suite = NULL;
+  tc__mutex_unlock(&tc__watch_lock);
+}
+
+/* A test that came back, but later than its limit, still timed out */
+static void tc__timeout_judge(const Test *test, TestResult *r) {
+  uint64_t limit = tc__timeout_of(test);
+  if (limit && r->elapsed_ns > limit && r->tag != TC_FAIL) {
+    uint64_t elapsed = r->elapsed_ns;
+    *r = tc__timed_out(limit, elapsed);
+  }
+}
+
+/* ============================================================
+   CANCELLATION
+   Failing tests are counted as they finish; reaching the limit set by
+   tc_set_max_failures cancels the run. Tests that have not started
+   then report "not run" instead of running, and running tests can see
+   the flag through tc_cancelled(). A forked child counts the failures
+   it sees itself, and the parent counts what the child reports.
+   ============================================================ */
+
+static int tc__max_failures;
+static int tc__failures;
+static int tc__cancel;
+static tc__mutex tc__cancel_lock = TC__MUTEX_INIT;
+static TestMetrics tc__not_run_metrics = {TC_METRIC_NOT_RUN};
+
+void tc_set_max_failures(int n) { tc__max_failures = n > 0 ? n : 0; }
+
+static void tc__cancel_reset(void) {
+  tc__mutex_lock(&tc__cancel_lock);
+  tc__failures = 0;
+  tc__cancel = 0;
+  tc__mutex_unlock(&tc__cancel_lock);
+}
+
+static int tc__run_cancelled(void) {
+  int cancelled;
+  if (tc__max_failures == 0 && !tc__watch_on)
+    return 0;
+  tc__mutex_lock(&tc__cancel_lock);
+  cancelled = tc__cancel;
+  tc__mutex_unlock(&tc__cancel_lock);
+  return cancelled;
+}
+
+int tc_cancelled(void *env) {
+  (void)env;
+  return tc__run_cancelled();
+}
+
+static void tc__count_failures(int n) {
+  if (tc__max_failures == 0 || n <= 0)
+    return;
+  tc__mutex_lock(&tc__cancel_lock);
+  tc__failures += n;
+  if (tc__failures >= tc__max_failures)
+    tc__cancel = 1;
+  tc__mutex_unlock(&tc__cancel_lock);
+}
+
+static TestResult tc__not_run(void) {
+  TestResult r = tc_skip("not run: the run was stopped");
+  r.metrics = &tc__not_run_metrics;
+  return r;
+}
+
+static int tc__is_not_run(const TestResult *r) {
+  return r->tag == TC_SKIP && r->metrics &&
+         (r->metrics->present & TC_METRIC_NOT_RUN);
+}
+
+/* ============================================================
+   TEST MEMORY
+   tc_alloc bumps through the thread's scratch arena, which tc_run_test
+   rewinds to where it stood before the test. tc_suite_alloc uses an
+   arena owned by the running suite, shared by the workers of a batch.
+   ============================================================ */
+
+/* Arena of the suite running on this thread */
+static TC__TLS tc__Arena *tc__tls_suite_arena;
+static tc__mutex tc__suite_arena_lock = TC__MUTEX_INIT;
+
+void *tc_alloc(size_t size) {
+  if (size > (size_t)-1 / 4)
+    return NULL;
+  return tc__arena_alloc(TC__SCRATCH, size ? size : 1);
+}
+
+char *tc_strdup(const char *s) {
+  size_t len = s ? strlen(s) : 0;
+  char *p = s ? (char *)tc_alloc(len + 1) : NULL;
+  if (p)
+    memcpy(p, s, len + 1);
+  return p;
+}
+
+void *tc_suite_alloc(size_t size) {
+  tc__Arena *a = tc__tls_suite_arena;
+  void *p;
+  if (!a || size > (size_t)-1 / 4)
+    return NULL;
+  tc__mutex_lock(&tc__suite_arena_lock);
+  p = tc__arena_alloc(a, size ? size : 1);
+  tc__mutex_unlock(&tc__suite_arena_lock);
+  return p;
+}
+
+/* ============================================================
+   PROPERTY TESTS
+   A case is the list of choices its draws made, each a number below
+   some bound. Cases are generated a batch at a time and then checked.
+   A failing case is shrunk by deleting, zeroing and lowering choices
+   and replaying gen on them, keeping each edit that still fails and
+   is simpler: shorter, or as long and smaller at the first choice that
+   differs. Every draw maps smaller choices to simpler values.
+   ============================================================ */
+
+#define TC__PROP_BATCH 32   /* cases generated before they are checked */
+#define TC__SHRINK_MAX 2000 /* replays spent shrinking one failure */
+
+struct TestGen {
+  uint64_t rng[4]; /* xoshiro256** */
+  uint64_t *choices;
+  int count;  /* choices made, or to replay */
+  int cap;
+  int pos;    /* next choice to replay; count while generating */
+  int replay; /* choices past count are 0 */
+  int depth;  /* draws made by other draws are not shown */
+  tc__Buf *shown;
+};
+
+static uint64_t tc__seed;
+static int tc__seed_set;
+
+void tc_set_seed(uint64_t seed) {
+  tc__seed = seed;
+  tc__seed_set = 1;
+}
+
+static uint64_t tc__splitmix(uint64_t *x) {
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* Pick the run's seed before workers or children start */
+static void tc__seed_pick(void) {
+  uint64_t x;
+  if (tc__seed_set)
+    return;
+  x = tc_now_ns() ^ ((uint64_t)time(NULL) << 32);
+  tc_set_seed(tc__splitmix(&x));
+}
+
+static uint64_t tc__rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t tc__rng_next(uint64_t *s) {
+  uint64_t result = tc__rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = tc__rotl(s[3], 45);
+  return result;
+}
+
+/* Uniform below n, or any value for n 0 */
+static uint64_t tc__rng_below(uint64_t *s, uint64_t n) {
+  uint64_t floor;
+  uint64_t v;
+  if (n == 0)
+    return tc__rng_next(s);
+  floor = (0 - n) % n; /* 2^64 mod n: draws below it would bias */
+  do {
+    v = tc__rng_next(s);
+  } while (v < floor);
+  return v % n;
+}
+
+/* Each test gets its own stream, so results do not depend on order */
+static void tc__gen_seed(TestGen *g, const char *name) {
+  uint64_t x = tc__seed;
+  int i;
+  for (; name && *name; name++)
+    x = (x ^ (unsigned char)*name) * 0x100000001b3ULL;
+  for (i = 0; i < 4; i++)
+    g->rng[i] = tc__splitmix(&x);
+}
+
+/* The next choice below n (0: any): replayed, or else fresh */
+static uint64_t tc__gen_take(TestGen *g, uint64_t n, uint64_t fresh) {
+  uint64_t v;
+  uint64_t *grown;
+  if (g->pos < g->count) {
+    v = g->choices[g->pos];
+    if (n != 0 && v >= n)
+      v = g->choices[g->pos] = n - 1;
+    g->pos++;
+    return v;
+  }
+  v = g->replay ? 0 : fresh;
+  grown =
+      (uint64_t *)tc__grow(g->choices, &g->cap, g->count + 1, sizeof(*grown));
+  if (grown) {
+    g->choices = grown;
+    g->choices[g->count++] = v;
+    g->pos = g->count;
+  }
+  return v;
+}
+
+uint64_t tc_gen_choice(TestGen *g, uint64_t n) {
+  return tc__gen_take(g, n, g->replay ? 0 : tc__rng_below(g->rng, n));
+}
+
+/*
+ * A choice up to m. Fresh ones are 0 or m now and then, or below 256,
+ * and uniform otherwise; the bias is only in how it is drawn, so it
+ * still shrinks a step at a time.
+ */
+static uint64_t tc__gen_magnitude(TestGen *g, uint64_t m) {
+  uint64_t n = m == UINT64_MAX ? 0 : m + 1;
+  uint64_t v = 0;
+  if (!g->replay) {
+    uint64_t kind = tc__rng_below(g->rng, 8);
+    if (kind == 1 || kind == 2)
+      v = m;
+    else if (kind == 3)
+      v = tc__rng_below(g->rng, m < 255 ? m + 1 : 256);
+    else if (kind > 3)
+      v = tc__rng_below(g->rng, n);
+  }
+  return tc__gen_take(g, n, v);
+}
+
+/* Whether element i follows; fresh, the length is target */
+static int tc__gen_more(TestGen *g, size_t i, size_t target) {
+  return tc__gen_take(g, 2, i < target) != 0;
+}
+
+/* Element storage for n + 1 items, doubled in the scratch arena */
+static void *tc__gen_room(void *items, size_t *cap, size_t n, size_t size) {
+  void *grown;
+  if (items && n < *cap)
+    return items;
+  if (*cap > (size_t)-1 / 2 / size)
+    return NULL;
+  grown = tc_alloc((*cap ? *cap * 2 : 16) * size);
+  if (grown && items)
+    memcpy(grown, items, n * size);
+  *cap = *cap ? *cap * 2 : 16;
+  return grown;
+}
+
+static size_t tc__gen_target(TestGen *g, size_t max_len) {
+  return g->replay ? 0 : (size_t)tc__rng_below(g->rng, (uint64_t)max_len + 1);
+}
+
+static int tc__gen_showing(TestGen *g) {
+  if (!g->shown || g->depth > 0)
+    return 0;
+  if (g->shown->len > 0)
+    tc__buf_puts(g->shown, ", ");
+  return 1;
+}
+
+/* An integer in [lo, hi], shrinking toward the one nearest 0 */
+static long long tc__gen_integer(TestGen *g, long long lo, long long hi) {
+  long long origin;
+  uint64_t up, down, m;
+  int below;
+  if (hi <= lo)
+    return lo;
+  origin = lo > 0 ? lo : hi < 0 ? hi : 0;
+  up = (uint64_t)hi - (uint64_t)origin;
+  down = (uint64_t)origin - (uint64_t)lo;
+  g->depth++;
+  below = up == 0 || (down > 0 && tc_gen_choice(g, 2) == 1);
+  m = tc__gen_magnitude(g, below ? down : up);
+  g->depth--;
+  return below ? (long long)((uint64_t)origin - m)
+               : (long long)((uint64_t)origin + m);
+}
+
+int tc_gen_int(TestGen *g, int lo, int hi) {
+  int v = (int)tc__gen_integer(g, lo, hi);
+  if (tc__gen_showing(g))
+    tc__buf_printf(g->shown, "%d", v);
+  return v;
+}
+
+/* Like tc__gen_integer, in 2^53 steps from the origin to either end */
+static double tc__gen_real(TestGen *g, double lo, double hi) {
+  const uint64_t steps = (uint64_t)1 << 53;
+  double origin, f;
+  int below;
+  if (!(hi > lo))
+    return lo;
+  origin = lo > 0 ? lo : hi < 0 ? hi : 0.0;
+  g->depth++;
+  below = origin == hi || (origin > lo && tc_gen_choice(g, 2) == 1);
+  f = (double)tc__gen_magnitude(g, steps) / (double)steps;
+  g->depth--;
+  return below ? origin - f * (origin - lo) : origin + f * (hi - origin);
+}
+
+double tc_gen_double(TestGen *g, double lo, double hi) {
+  double v = tc__gen_real(g, lo, hi);
+  if (tc__gen_showing(g))
+    tc__buf_printf(g->shown, "%.17g", v);
+  return v;
+}
+
+char *tc_gen_string(TestGen *g, size_t max_len) {
+  static const char chars[] = "abcdefghijklmnopqrstuvwxyz"
+                              "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                              "0123456789 !\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
+  size_t target, cap = 0, n;
+  char *s = NULL;
+  g->depth++;
+  target = tc__gen_target(g, max_len);
+  for (n = 0; n < max_len && tc__gen_more(g, n, target); n++) {
+    char c = chars[tc_gen_choice(g, sizeof(chars) - 1)];
+    s = (char *)tc__gen_room(s, &cap, n, 1);
+    if (!s)
+      break;
+    s[n] = c;
+  }
+  g->depth--;
+  s = (char *)tc__gen_room(s, &cap, n, 1);
+  if (s)
+    s[n] = '\0';
+  if (tc__gen_showing(g))
+    tc__buf_json(g->shown, s);
+  return s;
+}
+
+int *tc_gen_array_int(TestGen *g, size_t max_len, int lo, int hi,
+                      size_t *len) {
+  size_t target, cap = 0, n, i;
+  int *v = NULL;
+  g->depth++;
+  target = tc__gen_target(g, max_len);
+  for (n = 0; n < max_len && tc__gen_more(g, n, target); n++) {
+    int x = (int)tc__gen_integer(g, lo, hi);
+    v = (int *)tc__gen_room(v, &cap, n, sizeof(int));
+    if (!v)
+      break;
+    v[n] = x;
+  }
+  g->depth--;
+  *len = v ? n : 0;
+  if (!v)
+    v = (int *)tc_alloc(sizeof(int));
+  if (tc__gen_showing(g)) {
+    tc__buf_puts(g->shown, "[");
+    for (i = 0; i < *len; i++)
+      tc__buf_printf(g->shown, i ? ", %d" : "%d", v[i]);
+    tc__buf_puts(g->shown, "]");
+  }
+  return v;
+}
+
+double *tc_gen_array_double(TestGen *g, size_t max_len, double lo, double hi,
+                            size_t *len) {
+  size_t target, cap = 0, n, i;
+  double *v = NULL;
+  g->depth++;
+  target = tc__gen_target(g, max_len);
+  for (n = 0; n < max_len && tc__gen_more(g, n, target); n++) {
+    double x = tc__gen_real(g, lo, hi);
+    v = (double *)tc__gen_room(v, &cap, n, sizeof(double));
+    if (!v)
+      break;
+    v[n] = x;
+  }
+  g->depth--;
+  *len = v ? n : 0;
+  if (!v)
+    v = (double *)tc_alloc(sizeof(double));
+  if (tc__gen_showing(g)) {
+    tc__buf_puts(g->shown, "[");
+    for (i = 0; i < *len; i++)
+      tc__buf_printf(g->shown, i ? ", %.17g" : "%.17g", v[i]);
+    tc__buf_puts(g->shown, "]");
+  }
+  return v;
+}
+
+/* Shortlex order on choice lists: a is simpler than b */
+static int tc__simpler(const uint64_t *a, int an, const uint64_t *b, int bn) {
+  int i;
+  if (an != bn)
+    return an < bn;
+  for (i = 0; i < an; i++) {
+    if (a[i] != b[i])
+      return a[i] < b[i];
+  }
+  return 0;
+}
+
+typedef struct {
+  const Test *test;
+  void *env;
+  TestGen g; /* the candidate being replayed */
+  uint64_t *best;
+  int best_len;
+  int best_cap;
+  int budget; /* replays left */
+  int shrinks;
+} tc__Shrink;
+
+/* Replay g's choices through gen and prop, dropping what they made */
+static ResultTag tc__prop_replay(const Test *test, void *env, TestGen *g) {
+  tc__ArenaMark err_mark = tc__arena_mark(TC__ERRORS);
+  tc__ArenaMark text_mark = tc__arena_mark(TC__TEXT);
+  tc__ArenaMark scratch_mark = tc__arena_mark(TC__SCRATCH);
+  TestResult r;
+  g->pos = 0;
+  g->replay = 1;
+  r = test->prop(env, test->gen(g));
+  tc__arena_reset(TC__ERRORS, err_mark);
+  tc__arena_reset(TC__TEXT, text_mark);
+  tc__arena_reset(TC__SCRATCH, scratch_mark);
+  return r.tag;
+}
+
+static int tc__shrink_keep(tc__Shrink *s, const uint64_t *choices, int n) {
+  uint64_t *grown = (uint64_t *)tc__grow(s->best, &s->best_cap, n + 1,
+                                         sizeof(*grown));
+  if (!grown)
+    return 0;
+  s->best = grown;
+  memcpy(s->best, choices, (size_t)n * sizeof(*grown));
+  s->best_len = n;
+  return 1;
+}
+
+/* Copy the best case into the candidate, to be edited */
+static int tc__shrink_load(tc__Shrink *s) {
+  uint64_t *grown = (uint64_t *)tc__grow(s->g.choices, &s->g.cap,
+                                         s->best_len + 1, sizeof(*grown));
+  if (!grown)
+    return 0;
+  s->g.choices = grown;
+  memcpy(grown, s->best, (size_t)s->best_len * sizeof(*grown));
+  s->g.count = s->best_len;
+  return 1;
+}
+
+/* Keep the edited candidate if it still fails and is simpler */
+static int tc__shrink_try(tc__Shrink *s) {
+  if (s->budget <= 0)
+    return 0;
+  s->budget--;
+  if (tc__prop_replay(s->test, s->env, &s->g) != TC_FAIL)
+    return 0;
+  /* Choices gen did not read are not part of the case */
+  if (!tc__simpler(s->g.choices, s->g.pos, s->best, s->best_len) ||
+      !tc__shrink_keep(s, s->g.choices, s->g.pos))
+    return 0;
+  s->shrinks++;
+  return 1;
+}
+
+static void tc__shrink(tc__Shrink *s) {
+  int progress = 1;
+  int i, j, k;
+
+  while (progress && s->budget > 0) {
+    progress = 0;
+    /* Delete runs of k choices, last first */
+    for (k = 8; k >= 1; k--) {
+      for (i = s->best_len - k; i >= 0; i--) {
+        if (i + k > s->best_len || !tc__shrink_load(s))
+          continue;
+        memmove(&s->g.choices[i], &s->g.choices[i + k],
+                (size_t)(s->g.count - i - k) * sizeof(uint64_t));
+        s->g.count -= k;
+        progress |= tc__shrink_try(s);
+      }
+    }
+    /* Zero runs of k choices */
+    for (k = 8; k >= 1; k /= 2) {
+      for (i = 0; i + k <= s->best_len; i++) {
+        int zero = 1;
+        for (j = i; j < i + k; j++)
+          zero &= s->best[j] == 0;
+        if (zero || !tc__shrink_load(s))
+          continue;
+        memset(&s->g.choices[i], 0, (size_t)k * sizeof(uint64_t));
+        progress |= tc__shrink_try(s);
+      }
+    }
+    /* Lower each choice to the smallest that still fails */
+    for (i = 0; i < s->best_len; i++) {
+      uint64_t lo = 0;
+      uint64_t hi = s->best[i];
+      while (lo < hi && s->budget > 0 && tc__shrink_load(s)) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        s->g.choices[i] = mid;
+        if (tc__shrink_try(s)) {
+          progress = 1;
+          if (i >= s->best_len)
+            break;
+          hi = s->best[i];
+        } else {
+          lo = mid + 1;
+        }
+      }
+    }
+  }
+}
+
+/* Find a failing case among runs, shrink it and report it */
+static TestResult tc__run_property(const Test *test, void *env) {
+  void *values[TC__PROP_BATCH];
+  int starts[TC__PROP_BATCH + 1];
+  int runs = test->runs > 0 ? test->runs : TC_PROPERTY_RUNS;
+  int done = 0;
+  int failed = -1;
+  int n, i;
+  TestGen g;
+  tc__Shrink s;
+  tc__Buf shown = {0};
+  TestResult r, out;
+
+  tc__seed_pick();
+  memset(&g, 0, sizeof(g));
+  tc__gen_seed(&g, test->name);
+  while (done < runs && failed < 0) {
+    tc__ArenaMark err_mark = tc__arena_mark(TC__ERRORS);
+    tc__ArenaMark text_mark = tc__arena_mark(TC__TEXT);
+    tc__ArenaMark scratch_mark = tc__arena_mark(TC__SCRATCH);
+    n = runs - done < TC__PROP_BATCH ? runs - done : TC__PROP_BATCH;
+    g.count = 0;
+    g.pos = 0;
+    for (i = 0; i < n; i++) {
+      starts[i] = g.count;
+      values[i] = test->gen(&g);
+    }
+    starts[n] = g.count;
+    for (i = 0; i < n && failed < 0; i++) {
+      if (test->prop(env, values[i]).tag == TC_FAIL)
+        failed = i;
+      tc__arena_reset(TC__ERRORS, err_mark);
+      tc__arena_reset(TC__TEXT, text_mark);
+    }
+    tc__arena_reset(TC__SCRATCH, scratch_mark);
+    done += failed < 0 ? n : failed + 1;
+  }
+  if (failed < 0) {
+    free(g.choices);
+    return tc_pass();
+  }
+
+  memset(&s, 0, sizeof(s));
+  s.test = test;
+  s.env = env;
+  s.budget = TC__SHRINK_MAX;
+  if (tc__shrink_keep(&s, g.choices + starts[failed],
+                      starts[failed + 1] - starts[failed]))
+    tc__shrink(&s);
+  free(g.choices);
+
+  /* Replay the smallest case once more, this time keeping its errors */
+  memset(&g, 0, sizeof(g));
+  g.choices = s.best;
+  g.count = s.best_len;
+  g.cap = s.best_cap;
+  g.replay = 1;
+  g.shown = &shown;
+  r = test->prop(env, test->gen(&g));
+  free(g.choices);
+  free(s.g.choices);
+  tc__buf_append(&shown, "", 1);
+
+  out = tc_fail(NULL);
+  if (out.error_count > 0)
+    out.errors[0].message = tc__store_printf(
+        "property failed on case %d of %d; replay with --seed %llu", done,
+        runs, (unsigned long long)tc__seed);
+  if (tc__push_error(&out, NULL, TC_OP_NONE, TC_VAL_NONE))
+    out.errors[out.error_count - 1].message =
+        tc__store_printf("counterexample (shrunk %d times): %s", s.shrinks,
+                         shown.data ? shown.data : "");
+  tc__buf_free(&shown);
+  if (r.tag == TC_FAIL)
+    tc_check_into(&out, r);
+  else
+    tc_check_true(&out, 0, "the counterexample passed when replayed");
+  return out;
+}
+
+/* ============================================================
+   TEST VECTORS
+   A vector file is mapped read-only (mmap, or MapViewOfFile on Windows;
+   read into memory where neither exists) and indexed once into
+   pointer/size pairs, so each case reads its record in place and only
+   the pages that cases touch are loaded. tc_main expands the vector
+   tests of the suites --suite keeps into one case per record before
+   the other filters, and unmaps the files after the run.
+   ============================================================ */
+
+typedef struct {
+  const unsigned char *base;
+  size_t size;
+  TestVector *records;
+  int count;
+  int cap;
+  int mapped; /* records were indexed */
+#if defined(_WIN32)
+  HANDLE file;
+  HANDLE map;
+#endif
+} tc__VectorFile;
+
+static void tc__vectors_close(tc__VectorFile *vf) {
+#if defined(_WIN32)
+  if (vf->base)
+    UnmapViewOfFile((LPCVOID)vf->base);
+  if (vf->map)
+    CloseHandle(vf->map);
+  if (vf->file && vf->file != INVALID_HANDLE_VALUE)
+    CloseHandle(vf->file);
+#elif defined(TC__HAVE_MMAP)
+  if (vf->base)
+    munmap((void *)vf->base, vf->size);
+#else
+  free((void *)vf->base);
+#endif
+  free(vf->records);
+  memset(vf, 0, sizeof(*vf));
+}
+
+/* An empty file maps to no bytes at all */
+static int tc__vectors_map(tc__VectorFile *vf, const char *path) {
+#if defined(_WIN32)
+  LARGE_INTEGER size;
+  vf->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (vf->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(vf->file, &size) ||
+      (unsigned long long)size.QuadPart > (size_t)-1)
+    return -1;
+  vf->size = (size_t)size.QuadPart;
+  if (vf->size == 0)
+    return 0;
+  vf->map = CreateFileMappingA(vf->file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (vf->map)
+    vf->base =
+        (const unsigned char *)MapViewOfFile(vf->map, FILE_MAP_READ, 0, 0, 0);
+  return vf->base ? 0 : -1;
+#elif defined(TC__HAVE_MMAP)
+  struct stat st;
+  void *p = MAP_FAILED;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+      (unsigned long long)st.st_size <= (size_t)-1) {
+    vf->size = (size_t)st.st_size;
+    p = vf->size ? mmap(NULL, vf->size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+  }
+  close(fd);
+  if (p == MAP_FAILED)
+    return -1;
+  vf->base = (const unsigned char *)p;
+  return 0;
+#else
+  FILE *f = fopen(path, "rb");
+  unsigned char *data = NULL;
+  long size = -1;
+  if (!f)
+    return -1;
+  if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) > 0 &&
+      fseek(f, 0, SEEK_SET) == 0 && (data = (unsigned char *)malloc(
+                                         (size_t)size)) != NULL &&
+      fread(data, 1, (size_t)size, f) != (size_t)size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(f);
+  if (size < 0 || (size > 0 && !data))
+    return -1;
+  vf->base = data;
+  vf->size = (size_t)size;
+  return 0;
+#endif
+}
+
+static int tc__vectors_add(tc__VectorFile *vf, size_t at, size_t size) {
+  TestVector *grown;
+  if (vf->count == 0x7fffffff)
+    return -3;
+  grown = (TestVector *)tc__grow(vf->records, &vf->cap, vf->count + 1,
+                                 sizeof(TestVector));
+  if (!grown)
+    return -3;
+  vf->records = grown;
+  grown[vf->count].data = vf->base + at;
+  grown[vf->count].size = size;
+  grown[vf->count].index = (size_t)vf->count;
+  vf->count++;
+  return 0;
+}
+
+/* Lines are found with memchr; a sized file is walked header to header */
+static int tc__vectors_scan(tc__VectorFile *vf, VectorFormat format) {
+  size_t at = 0, len;
+
+  while (at < vf->size) {
+    const unsigned char *p = vf->base + at;
+    size_t left = vf->size - at;
+    if (format == TC_VECTORS_SIZED) {
+      if (left < 4)
+        return -2;
+      len = (size_t)p[0] | (size_t)p[1] << 8 | (size_t)p[2] << 16 |
+            (size_t)p[3] << 24;
+      if (len > left - 4)
+        return -2;
+      if (tc__vectors_add(vf, at + 4, len) != 0)
+        return -3;
+      at += 4 + len;
+      continue;
+    }
+    {
+      const unsigned char *nl = (const unsigned char *)memchr(p, '\n', left);
+      size_t next = nl ? (size_t)(nl - p) + 1 : left;
+      len = nl ? (size_t)(nl - p) : left;
+      if (len > 0 && p[len - 1] == '\r')
+        len--;
+      if (len > 0 && tc__vectors_add(vf, at, len) != 0)
+        return -3;
+      at += next;
+    }
+  }
+  return 0;
+}
+
+/*
+ * 0, or -1 if the file cannot be mapped, -2 if it ends inside a record
+ * and -3 if its index does not fit in memory
+ */
+static int tc__vectors_open(tc__VectorFile *vf, const Test *test) {
+  int ret;
+  memset(vf, 0, sizeof(*vf));
+  ret = test->vectors ? tc__vectors_map(vf, test->vectors) : -1;
+  if (ret == 0)
+    ret = tc__vectors_scan(vf, test->vector_format);
+  if (ret != 0)
+    tc__vectors_close(vf);
+  vf->mapped = ret == 0;
+  return ret;
+}
+
+static TestResult tc__vectors_error(const Test *test, int err) {
+  static const char *const why[] = {
+      "cannot map test vectors '%s'", "test vectors '%s' end inside a record",
+      "out of memory indexing test vectors '%s'"};
+  const char *path = test->vectors ? test->vectors : "(null)";
+  return tc_fail(tc__store_printf(why[-err - 1], path));
+}
+
+/* One case, or every record in turn when the test was not expanded */
+static TestResult tc__run_vectors(const Test *test, void *env) {
+  tc__VectorFile vf;
+  TestResult r, out;
+  int counting = tc__tls_alloc.on;
+  int i, err;
+
+  if (test->vector)
+    return test->vector_fn(env, test->vector);
+
+  tc__tls_alloc.on = 0;
+  err = tc__vectors_open(&vf, test);
+  tc__tls_alloc.on = counting;
+  if (err != 0)
+    return tc__vectors_error(test, err);
+
+  r = tc_pass();
+  for (i = 0; i < vf.count; i++) {
+    tc__ArenaMark err_mark = tc__arena_mark(TC__ERRORS);
+    tc__ArenaMark text_mark = tc__arena_mark(TC__TEXT);
+    tc__ArenaMark scratch_mark = tc__arena_mark(TC__SCRATCH);
+    r = test->vector_fn(env, &vf.records[i]);
+    if (r.tag == TC_FAIL)
+      break;
+    tc__arena_reset(TC__ERRORS, err_mark);
+    tc__arena_reset(TC__TEXT, text_mark);
+    tc__arena_reset(TC__SCRATCH, scratch_mark);
+  }
+  if (i == vf.count) {
+    out = tc_pass();
+  } else {
+    out = tc_fail(tc__store_printf("record %d of %d failed", i, vf.count));
+    tc_check_into(&out, r);
+  }
+  tc__tls_alloc.on = 0;
+  tc__vectors_close(&vf);
+  tc__tls_alloc.on = counting;
+  return out;
+}
+
+/* Suites as given, but with every vector test replaced by its cases */
+typedef struct {
+  Suite **suites; /* NULL-terminated */
+  Suite *headers; /* suites holding vector tests */
+  Test *tests;    /* the tests of those suites */
+  char *names;    /* "name[index]" of every case */
+  tc__VectorFile *files;
+  int file_count;
+} tc__Expansion;
+
+static void tc__expansion_free(tc__Expansion *x) {
+  int i;
+  for (i = 0; x->files && i < x->file_count; i++)
+    tc__vectors_close(&x->files[i]);
+  free(x->files);
+  if (x->file_count > 0)
+    free(x->suites);
+  free(x->headers);
+  free(x->tests);
+  free(x->names);
+  memset(x, 0, sizeof(*x));
+}
+
+static int tc__is_vector_test(const Test *t) {
+  return t->vector_fn != NULL && t->vector == NULL && t->fn != NULL;
+}
+
+static int tc__matches(const char *str, const char *pattern);
+
+/* Vector tests to expand in s; none when --suite leaves s out */
+static int tc__vector_tests(const Suite *s, const char *suite_filter) {
+  int found = 0, j;
+  if (suite_filter && !tc__matches(s->name, suite_filter))
+    return 0;
+  for (j = 0; j < s->test_count; j++)
+    found += tc__is_vector_test(&s->tests[j]);
+  return found;
+}
+
+/*
+ * A vector file that cannot be mapped leaves its test as it is, to
+ * fail with the reason when run. Suites that suite_filter leaves out
+ * are not expanded, so their files are never mapped. With no vector
+ * tests to expand, x->suites is the array given and nothing is
+ * allocated.
+ */
+static int tc__expansion_build(tc__Expansion *x, Suite **suites,
+                               const char *suite_filter) {
+  size_t name_bytes = 0;
+  int n, tests = 0, holders = 0, f = 0, i, j, k, h = 0;
+  char *name;
+  Test *next;
+
+  memset(x, 0, sizeof(*x));
+  for (n = 0; suites[n] != NULL; n++) {
+    int found = tc__vector_tests(suites[n], suite_filter);
+    x->file_count += found;
+    if (found)
+      holders++;
+  }
+  if (x->file_count == 0) {
+    x->suites = suites;
+    return 0;
+  }
+
+  x->files = (tc__VectorFile *)calloc((size_t)x->file_count,
+                                      sizeof(tc__VectorFile));
+  if (!x->files)
+    return -1;
+  for (i = 0; i < n; i++) {
+    const Suite *s = suites[i];
+    int count = 0;
+    if (!tc__vector_tests(s, suite_filter))
+      continue;
+    for (j = 0; j < s->test_count; j++) {
+      const Test *t = &s->tests[j];
+      if (!tc__is_vector_test(t)) {
+        count++;
+        continue;
+      }
+      if (tc__vectors_open(&x->files[f], t) == -3) {
+        tc__expansion_free(x);
+        return -1;
+      }
+      if (x->files[f].mapped) {
+        count += x->files[f].count;
+        name_bytes += (size_t)x->files[f].count * (strlen(t->name) + 24);
+      } else {
+        count++;
+      }
+      f++;
+    }
+    if (count > 0x7fffffff - tests) {
+      tc__expansion_free(x);
+      return -1;
+    }
+    tests += count;
+  }
+
+  x->suites = (Suite **)malloc((size_t)(n + 1) * sizeof(Suite *));
+  x->headers = (Suite *)malloc((size_t)holders * sizeof(Suite));
+  x->tests = (Test *)malloc((size_t)(tests > 0 ? tests : 1) * sizeof(Test));
+  x->names = (char *)malloc(name_bytes > 0 ? name_bytes : 1);
+  if (!x->suites || !x->headers || !x->tests || !x->names) {
+    tc__expansion_free(x);
+    return -1;
+  }
+
+  next = x->tests;
+  name = x->names;
+  f = 0;
+  for (i = 0; i < n; i++) {
+    const Suite *s = suites[i];
+    Suite *hs;
+    Test *first = next;
+    if (!tc__vector_tests(s, suite_filter)) {
+      x->suites[i] = suites[i];
+      continue;
+    }
+    for (j = 0; j < s->test_count; j++) {
+      const Test *t = &s->tests[j];
+      const tc__VectorFile *vf;
+      if (!tc__is_vector_test(t)) {
+        *next++ = *t;
+        continue;
+      }
+      vf = &x->files[f++];
+      if (!vf->mapped) {
+        *next++ = *t; /* fails with the reason when run */
+        continue;
+      }
+      for (k = 0; k < vf->count; k++) {
+        *next = *t;
+        next->vector = &vf->records[k];
+        next->name = name;
+        name += snprintf(name, strlen(t->name) + 24, "%s[%d]", t->name, k);
+        name++;
+        next++;
+      }
+    }
+    hs = &x->headers[h++];
+    *hs = *s;
+    hs->tests = first;
+    hs->test_count = (int)(next - first);
+    x->suites[i] = hs;
+  }
+  x->suites[n] = NULL;
+  return 0;
+}
+
+/* ============================================================
+   TRACING
+   With --trace, the runners note a span for the run and for each
+   suite, setup, test and teardown from the timestamps they take
+   anyway. A span goes to the store of the thread that ran it, so
+   recording takes no lock, and the store's worker is its track in
+   the trace (see TRACE OUTPUT). An isolated child sends its spans
+   back with its results, to the store of the worker that forked it.
+   ============================================================ */
+
+enum {
+  TC__SPAN_RUN,
+  TC__SPAN_SUITE,
+  TC__SPAN_SETUP,
+  TC__SPAN_TEST,
+  TC__SPAN_TEARDOWN
+};
+
+static int tc__trace_on;
+
+/* Suite whose tests this thread is running, named in their spans */
+static TC__TLS const Suite *tc__tls_suite;
+
+void tc_set_trace(int on) { tc__trace_on = on; }
+
+/* A new span in this thread's store, or NULL */
+static tc__Span *tc__trace_add(void) {
+  tc__Store *st = tc__cur_store();
+  tc__Span *sp;
+
+  if (st->span_count == st->span_cap) {
+    int counting = tc__tls_alloc.on;
+    tc__tls_alloc.on = 0;
+    sp = (tc__Span *)tc__grow(st->spans, &st->span_cap, st->span_count + 1,
+                              sizeof(tc__Span));
+    tc__tls_alloc.on = counting;
+    if (!sp)
+      return NULL;
+    st->spans = sp;
+  }
+  return &st->spans[st->span_count++];
+}
+
+static void tc__trace_span(int kind, const char *name, uint64_t start_ns,
+                           uint64_t end_ns, int tag) {
+  tc__Span *sp;
+
+  if (!tc__trace_on || (sp = tc__trace_add()) == NULL)
+    return;
+  sp->name = name;
+  sp->suite = kind == TC__SPAN_TEST && tc__tls_suite ? tc__tls_suite->name
+                                                     : NULL;
+  sp->start_ns = start_ns;
+  sp->dur_ns = end_ns > start_ns ? end_ns - start_ns : 0;
+  sp->kind = kind;
+  sp->tag = tag;
+}
+
+/* ============================================================
+   RUNNERS
+   ============================================================ */
+
+TestResult tc_run_test(Test *test, void *env) {
+  TestResult r;
+  tc__ArenaMark err_mark, text_mark, scratch_mark;
+  tc__AllocCount outer, allocs;
+  tc__PerfScope perf;
+  uint64_t start;
+  int slot;
+
+  if (tc__cache_hit(test)) {
+    r = tc_pass();
+    r.metrics = &tc__cached_metrics;
+    return r;
+  }
+  if (tc__run_cancelled())
+    return tc__not_run();
+  if (test->bench != NULL) {
+    scratch_mark = tc__arena_mark(TC__SCRATCH);
+    slot = tc__watch_begin(test);
+    tc__impact_begin();
+    tc__alloc_begin(&outer);
+    start = tc_now_ns();
+    r = tc__run_bench(test, env);
+    tc__trace_span(TC__SPAN_TEST, test->name, start, tc_now_ns(), r.tag);
+    allocs = tc__alloc_end(&outer);
+    tc__impact_end(test);
+    tc__watch_end(slot);
+    tc__arena_reset(TC__SCRATCH, scratch_mark);
+    tc__alloc_attach(&r, &allocs);
+    tc__count_failures(r.tag == TC_FAIL);
+    return r;
+  }
+  if (test->fn == NULL) {
+    return tc_skip(test->skip_reason ? test->skip_reason : "skipped");
+  }
+
+  err_mark = tc__arena_mark(TC__ERRORS);
+  text_mark = tc__arena_mark(TC__TEXT);
+  scratch_mark = tc__arena_mark(TC__SCRATCH);
+  slot = tc__watch_begin(test);
+  tc__impact_begin();
+  tc__alloc_begin(&outer);
+  memset(&perf, 0, sizeof(perf));
+  tc__perf_begin(&perf);
+  start = tc_now_ns();
+  if (test->vector_fn)
+    r = tc__run_vectors(test, env);
+  else if (test->prop && test->gen)
+    r = tc__run_property(test, env);
+  else
+    r = test->fn(env);
+  r.elapsed_ns = tc_now_ns() - start;
+  tc__perf_end(&perf);
+  allocs = tc__alloc_end(&outer);
+  tc__impact_end(test);
+  tc__watch_end(slot);
+  tc__arena_reset(TC__SCRATCH, scratch_mark);
+
+  /* Drop errors the test discarded; keep only the ones it returned */
+  tc__keep_errors(&r, err_mark, text_mark);
+  tc__timeout_judge(test, &r);
+  tc__alloc_attach(&r, &allocs);
+  tc__perf_attach(&r, &perf);
+  tc__trace_span(TC__SPAN_TEST, test->name, start, start + r.elapsed_ns,
+                 r.tag);
+
+  tc__count_failures(r.tag == TC_FAIL);
+  return r;
+}
+
+/* ============================================================
+   ERROR FORMATTING
+   ============================================================ */
+
+/* One rendered side of an error: pre + body + post */
+typedef struct {
+  const char *pre;
+  const char *body;
+  const char *post;
+} tc__Text;
+
+static const char *tc__format_value(const TestError *e, const TestValue *v,
+                                    char *buf, size_t size) {
+  switch (e->kind) {
+  case TC_VAL_STR:
+    return v->s ? v->s : "(null)";
+  case TC_VAL_LONG:
+    snprintf(buf, size, "%ld", v->l);
+    return buf;
+  case TC_VAL_SIZE:
+    snprintf(buf, size, "%zu", v->z);
+    return buf;
+  case TC_VAL_DOUBLE:
+    snprintf(buf, size, "%g", v->d);
+    return buf;
+  case TC_VAL_PTR:
+    snprintf(buf, size, "%p", v->p);
+    return buf;
+  case TC_VAL_NS:
+    tc__format_ns(buf, size, v->ns);
+    return buf;
+  default:
+    return "";
+  }
+}
+
+static int tc__has_operands(const TestError *e) {
+  if (e->op == TC_OP_NONE)
+    return 0;
+  if (e->op == TC_OP_TEXT)
+    return e->expected.s && e->expected.s[0] != '\0';
+  return 1;
+}
+
+static tc__Text tc__render(const TestError *e, int actual_side, char *buf,
+                           size_t size) {
+  tc__Text t;
+  const TestValue *v = actual_side ? &e->actual : &e->expected;
+  t.pre = "";
+  t.post = "";
+  t.body = "";
+
+  switch (e->op) {
+  case TC_OP_NONE:
+    return t;
+  case TC_OP_TEXT:
+    t.body = v->s ? v->s : "";
+    return t;
+  case TC_OP_IN_DELTA:
+    if (actual_side)
+      snprintf(buf, size, "%g (diff: %g)", e->actual.d,
+               fabs(e->expected.d - e->actual.d));
+    else
+      snprintf(buf, size, "%g +/- %g", e->expected.d, e->aux.d);
+    t.body = buf;
+    return t;
+  case TC_OP_NIL:
+    if (!actual_side) {
+      t.body = "NULL";
+      return t;
+    }
+    break;
+  case TC_OP_NOT_NIL:
+    t.body = actual_side ? "NULL" : "non-NULL";
+    return t;
+  case TC_OP_EMPTY:
+    if (!actual_side) {
+      t.body = "empty";
+      return t;
+    }
+    t.post = " elements";
+    break;
+  case TC_OP_NOT_EMPTY:
+    t.body = actual_side ? "0 elements" : "non-empty";
+    return t;
+  case TC_OP_CONTAINS:
+    if (actual_side) {
+      t.body = "not found";
+      return t;
+    }
+    t.pre = "contains ";
+    break;
+  case TC_OP_NOT_CONTAINS:
+    if (actual_side) {
+      snprintf(buf, size, "found at index %ld", e->aux.l);
+      t.body = buf;
+      return t;
+    }
+    t.pre = "not contains ";
+    break;
+  case TC_OP_LEN:
+    t.pre = "length ";
+    break;
+  case TC_OP_NE:
+    if (!actual_side) {
+      if (e->kind == TC_VAL_STR && v->s) {
+        t.pre = "not \"";
+        t.post = "\"";
+      } else {
+        t.pre = "not ";
+      }
+    }
+    break;
+  case TC_OP_GT:
+    t.pre = actual_side ? "" : "> ";
+    break;
+  case TC_OP_GE:
+    t.pre = actual_side ? "" : ">= ";
+    break;
+  case TC_OP_LT:
+    t.pre = actual_side ? "" : "< ";
+    break;
+  case TC_OP_LE:
+    t.pre = actual_side ? "" : "<= ";
+    break;
+  default:
+    break;
+  }
+
+  t.body = tc__format_value(e, v, buf, size);
+  return t;
+}
+
+static int tc__error_side(const TestError *e, int actual_side, char *buf,
+                          size_t size) {
+  char tmp[96];
+  tc__Text t;
+  if (!tc__has_operands(e)) {
+    if (size > 0)
+      buf[0] = '\0';
+    return 0;
+  }
+  t = tc__render(e, actual_side, tmp, sizeof(tmp));
+  return snprintf(buf, size, "%s%s%s", t.pre, t.body, t.post);
+}
+
+int tc_error_expected(const TestError *e, char *buf, size_t size) {
+  return tc__error_side(e, 0, buf, size);
+}
+
+int tc_error_actual(const TestError *e, char *buf, size_t size) {
+  return tc__error_side(e, 1, buf, size);
+}
+
+/* Counts with a k, M or G suffix, e.g. "1.23M" */
+static void tc__format_count(char *buf, size_t size, double n) {
+  if (n < 1e3)
+    snprintf(buf, size, "%.0f", n);
+  else if (n < 1e6)
+    snprintf(buf, size, "%.2fk", n / 1e3);
+  else if (n < 1e9)
+    snprintf(buf, size, "%.2fM", n / 1e6);
+  else
+    snprintf(buf, size, "%.2fG", n / 1e9);
+}
+
+/*
+ * "1.23M cycles, 1.87M instructions, IPC 1.52, ..." after lead; with per
+ * nonzero, each count divided by it and followed by unit
+ */
+static void tc__render_perf(tc__Buf *b, const char *lead, const PerfStats *p,
+                            double per, const char *unit) {
+  static const char *const names[TC__PERF_EVENTS] = {
+      "cycles", "instructions", "L1d misses", "LLC misses", "branch misses"};
+  char num[32];
+  int i;
+
+  for (i = 0; i < TC__PERF_EVENTS; i++) {
+    double n = (double)tc__perf_count(p, i);
+    if (!(p->present & (1u << i)))
+      continue;
+    if (per > 0)
+      snprintf(num, sizeof(num), "%.2f", n / per);
+    else
+      tc__format_count(num, sizeof(num), n);
+    tc__buf_printf(b, "%s%s %s%s", lead, num, names[i], unit);
+    lead = ", ";
+    if (i == 1 && p->ipc > 0)
+      tc__buf_printf(b, ", IPC %.2f", p->ipc);
+  }
+}
+
+static void tc__render_bench(tc__Buf *b, const BenchStats *st) {
+  char median[32], mean[32], min[32], p99[32], sd[32];
+  const char *unit = "";
+  double ops = st->ops_per_sec;
+
+  tc__format_ns_f(median, sizeof(median), st->median_ns);
+  tc__format_ns_f(mean, sizeof(mean), st->mean_ns);
+  tc__format_ns_f(min, sizeof(min), st->min_ns);
+  tc__format_ns_f(p99, sizeof(p99), st->p99_ns);
+  tc__format_ns_f(sd, sizeof(sd), st->stddev_ns);
+  if (ops >= 1e9) {
+    ops /= 1e9;
+    unit = "G";
+  } else if (ops >= 1e6) {
+    ops /= 1e6;
+    unit = "M";
+  } else if (ops >= 1e3) {
+    ops /= 1e3;
+    unit = "k";
+  }
+
+  tc__buf_printf(b, "      median %s  mean %s  min %s  p99 %s  sd %s\n",
+                 median, mean, min, p99, sd);
+  tc__buf_printf(b, "      %.2f%s ops/s  (%d samples x %llu iterations)\n",
+                 ops, unit, st->sample_count,
+                 (unsigned long long)st->iterations);
+  if (st->has_baseline) {
+    char base[32];
+    tc__format_ns_f(base, sizeof(base), st->baseline_median_ns);
+    tc__buf_printf(b, "      baseline median %s  change %+.1f%%  p=%.2g\n",
+                   base,
+                   st->baseline_median_ns > 0
+                       ? (st->median_ns / st->baseline_median_ns - 1.0) * 100.0
+                       : 0.0,
+                   st->p_value);
+  }
+}
+
+static void tc__render_result(tc__Buf *b, const char *name,
+                              const TestResult *result) {
+  const char *icon;
+  const char *color;
+  char duration[32];
+  int i;
+
+  switch (result->tag) {
+  case TC_PASS:
+    icon = "\xe2\x9c\x93";
+    color = TC__GREEN;
+    break; /* ✓ */
+  case TC_FAIL:
+    icon = "\xe2\x9c\x97";
+    color = TC__RED;
+    break; /* ✗ */
+  case TC_SKIP:
+    icon = "\xe2\x97\x8b";
+    color = TC__YELLOW;
+    break; /* ○ */
+  default:
+    icon = "?";
+    color = "";
+    break;
+  }
+
+  if (tc__is_cached(result))
+    strcpy(duration, "cached");
+  else
+    tc__format_ns(duration, sizeof(duration), result->elapsed_ns);
+  tc__buf_printf(b, "  %s%s%s %s (%s", color, icon, TC__RESET, name,
+                 duration);
+  if (result->metrics && (result->metrics->present & TC_METRIC_ALLOC)) {
+    const AllocStats *a = &result->metrics->alloc;
+    char bytes[32], peak[32];
+    tc__format_bytes(bytes, sizeof(bytes), a->bytes);
+    tc__format_bytes(peak, sizeof(peak), a->peak_bytes);
+    tc__buf_printf(b, ", %llu alloc%s, %s, peak %s",
+                   (unsigned long long)a->allocs, a->allocs == 1 ? "" : "s",
+                   bytes, peak);
+  }
+  /* A benchmark's counters are shown per operation with its stats */
+  if (result->metrics && (result->metrics->present & TC_METRIC_PERF) &&
+      !(result->metrics->present & TC_METRIC_BENCH))
+    tc__render_perf(b, ", ", &result->metrics->perf, 0, "");
+  tc__buf_puts(b, ")\n");
+
+  if (result->tag == TC_FAIL) {
+    for (i = 0; i < result->error_count; i++) {
+      const TestError *e = &result->errors[i];
+      tc__buf_printf(b, "      %s\n", e->message ? e->message : "");
+      if (tc__has_operands(e)) {
+        char buf[96];
+        tc__Text t = tc__render(e, 0, buf, sizeof(buf));
+        tc__buf_printf(b, "        Expected: %s%s%s\n", t.pre, t.body,
+                       t.post);
+        t = tc__render(e, 1, buf, sizeof(buf));
+        tc__buf_printf(b, "        Actual:   %s%s%s\n", t.pre, t.body,
+                       t.post);
+      }
+    }
+  } else if (result->tag == TC_SKIP && result->error_count > 0) {
+    tc__buf_printf(b, "      [%s]\n",
+                   result->errors[0].message ? result->errors[0].message
+                                             : "");
+  }
+
+  if (result->metrics && (result->metrics->present & TC_METRIC_BENCH)) {
+    const TestMetrics *m = result->metrics;
+    tc__render_bench(b, &m->bench);
+    if ((m->present & TC_METRIC_PERF) && m->bench.iterations > 0) {
+      tc__render_perf(b, "      ", &m->perf,
+                      (double)m->bench.iterations * m->bench.sample_count,
+                      "/op");
+      tc__buf_puts(b, "\n");
+    }
+  }
+}
+
+void tc_print_result(const char *name, TestResult *result) {
+  tc__Buf b = {0};
+  tc__render_result(&b, name, result);
+  if (b.len)
+    fwrite(b.data, 1, b.len, stdout);
+  tc__buf_free(&b);
+}
+
+/* ============================================================
+   RESULT STORE
+   One record per suite actually run, each sized to that suite's
+   test count, so memory tracks the run rather than TC_MAX_* limits.
+   ============================================================ */
+
+typedef struct {
+  Suite *suite;
+  TestResult *results;
+  int count;
+  RunSummary summary;
+  int started;  /* set before setup */
+  uint64_t start_ns; /* when the suite started, once started is set */
+  int reported; /* suite end emitted; under the report lock */
+  int setup_status;    /* what a failed setup returned */
+  TestResult teardown; /* a teardown that crashed, else a pass */
+} tc__SuiteRecord;
+
+static tc__SuiteRecord *tc__records;
+static int tc__record_count;
+
+/* Publish finished results; the watchdog may read them mid-suite */
+static void tc__record_progress(tc__SuiteRecord *rec, int count) {
+  if (!rec)
+    return;
+  if (!tc__watch_on) {
+    rec->count = count;
+    rec->started = 1;
+    return;
+  }
+  tc__mutex_lock(&tc__watch_lock);
+  rec->count = count;
+  rec->started = 1;
+  tc__mutex_unlock(&tc__watch_lock);
+}
+
+/* Worker stores back the errors of records from the last parallel run */
+static tc__Store *tc__worker_stores;
+static int tc__worker_store_count;
+
+static tc__mutex tc__out_lock = TC__MUTEX_INIT;
+
+static void tc__records_clear(void) {
+  int i;
+  for (i = 0; i < tc__record_count; i++) {
+    free(tc__records[i].results);
+  }
+  free(tc__records);
+  tc__records = NULL;
+  tc__record_count = 0;
+
+  for (i = 0; i < tc__worker_store_count; i++) {
+    tc__arena_free(&tc__worker_stores[i].errors);
+    tc__arena_free(&tc__worker_stores[i].text);
+    tc__arena_free(&tc__worker_stores[i].scratch);
+    free(tc__worker_stores[i].spans);
+  }
+  free(tc__worker_stores);
+  tc__worker_stores = NULL;
+  tc__worker_store_count = 0;
+
+  tc__arena_clear(&tc__main_store.errors);
+  tc__arena_clear(&tc__main_store.text);
+  tc__arena_clear(&tc__main_store.scratch);
+  tc__main_store.span_count = 0;
+}
+
+/* One record per suite, reserved up front so workers never reallocate */
+static int tc__records_reserve(Suite **suites, int n) {
+  int i;
+  tc__records = (tc__SuiteRecord *)calloc((size_t)(n > 0 ? n : 1),
+                                          sizeof(tc__SuiteRecord));
+  if (!tc__records)
+    return -1;
+  tc__record_count = n;
+  for (i = 0; i < n; i++) {
+    tc__records[i].suite = suites[i];
+    tc__records[i].results = (TestResult *)malloc(
+        (size_t)(suites[i]->test_count > 0 ? suites[i]->test_count : 1) *
+        sizeof(TestResult));
+  }
+  return 0;
+}
+
+/* ============================================================
+   CONSOLE OUTPUT
+   A suite's block is rendered off the lock and written in one go.
+   ============================================================ */
+
+#define TC__SUITE_BUF 16384
+#define TC__DOTS_WIDTH 72
+
+static OutputMode tc__output_mode = TC_OUTPUT_NORMAL;
+/* Dots mode: current column, and failing suites held for after the run */
+static int tc__dot_column;
+static tc__Buf tc__deferred;
+
+void tc_set_output_mode(OutputMode mode) { tc__output_mode = mode; }
+
+/* stdout, or stderr while a registered reporter streams to stdout */
+static FILE *tc__console(void);
+
+static void tc__put_dot(tc__Buf *b, char c) {
+  const char *color = c == '.' ? "" : c == 's' ? TC__YELLOW : TC__RED;
+  tc__buf_printf(b, "%s%c%s", color, c, *color ? TC__RESET : "");
+  if (++tc__dot_column == TC__DOTS_WIDTH) {
+    tc__buf_puts(b, "\n");
+    tc__dot_column = 0;
+  }
+}
+
+static void tc__report_suite(const Suite *suite, const TestResult *results,
+                             double total_ms, int setup_ret,
+                             const TestResult *teardown) {
+  tc__Buf b = {0};
+  tc__Buf dots = {0};
+  int failed = setup_ret != 0 || teardown != NULL;
+  int i;
+
+  if (tc__output_mode == TC_OUTPUT_QUIET)
+    return;
+  for (i = 0; !failed && i < suite->test_count; i++)
+    failed = results[i].tag == TC_FAIL;
+
+  if (tc__output_mode == TC_OUTPUT_NORMAL || failed) {
+    tc__buf_reserve(&b, TC__SUITE_BUF);
+    tc__buf_printf(&b, "\n=== %s (%.2fms) ===\n", suite->name, total_ms);
+    if (setup_ret != 0) {
+      tc__buf_printf(&b, "  %s\xe2\x9c\x97%s Setup failed (returned %d)\n",
+                     TC__RED, TC__RESET, setup_ret);
+    }
+    for (i = 0; setup_ret == 0 && i < suite->test_count; i++) {
+      if (tc__output_mode == TC_OUTPUT_NORMAL || results[i].tag == TC_FAIL)
+        tc__render_result(&b, suite->tests[i].name, &results[i]);
+    }
+    if (teardown)
+      tc__render_result(&b, "teardown", teardown);
+  }
+
+  tc__mutex_lock(&tc__out_lock);
+  if (tc__output_mode == TC_OUTPUT_DOTS) {
+    for (i = 0; i < suite->test_count; i++) {
+      tc__put_dot(&dots, setup_ret != 0                ? 'E'
+                         : results[i].tag == TC_PASS ? '.'
+                         : results[i].tag == TC_FAIL ? 'F'
+                                                     : 's');
+    }
+    if (teardown)
+      tc__put_dot(&dots, 'E');
+    if (b.len)
+      tc__buf_append(&tc__deferred, b.data, b.len);
+    if (dots.len)
+      fwrite(dots.data, 1, dots.len, tc__console());
+  } else if (b.len) {
+    fwrite(b.data, 1, b.len, tc__console());
+  }
+  fflush(tc__console());
+  tc__mutex_unlock(&tc__out_lock);
+
+  tc__buf_free(&dots);
+  tc__buf_free(&b);
+}
+
+/* Ends the dots line and prints the failures it held back */
+static void tc__report_finish(void) {
+  if (tc__output_mode == TC_OUTPUT_DOTS) {
+    if (tc__dot_column > 0)
+      fputc('\n', tc__console());
+    if (tc__deferred.len)
+      fwrite(tc__deferred.data, 1, tc__deferred.len, tc__console());
+    fflush(tc__console());
+  }
+  tc__dot_column = 0;
+  tc__buf_free(&tc__deferred);
+}
+
+/* ============================================================
+   JUNIT XML OUTPUT
+   Each <testsuite> is rendered into a buffer and written whole, either
+   all at the end (tc_write_junit_xml) or streamed as suites finish.
+   ============================================================ */
+
+/* Append src with XML special characters escaped; no length limit */
+static void tc__xml_write(tc__Buf *b, const char *src) {
+  const char *run;
+  if (!src)
+    return;
+
+  for (run = src; *src != '\0'; src++) {
+    const char *entity;
+    switch (*src) {
+    case '&':
+      entity = "&amp;";
+      break;
+    case '<':
+      entity = "&lt;";
+      break;
+    case '>':
+      entity = "&gt;";
+      break;
+    case '"':
+      entity = "&quot;";
+      break;
+    case '\'':
+      entity = "&apos;";
+      break;
+    default:
+      continue;
+    }
+    tc__buf_append(b, run, (size_t)(src - run));
+    tc__buf_puts(b, entity);
+    run = src + 1;
+  }
+  tc__buf_append(b, run, (size_t)(src - run));
+}
+
+static void tc__xml_write_side(tc__Buf *b, const TestError *e,
+                               int actual_side) {
+  char buf[96];
+  tc__Text t = tc__render(e, actual_side, buf, sizeof(buf));
+  tc__xml_write(b, t.pre);
+  tc__xml_write(b, t.body);
+  tc__xml_write(b, t.post);
+}
+
+/*
+ * The counters present, as pre name mid value post for each; shared by
+ * the JUnit properties and the NDJSON fields
+ */
+static void tc__perf_fields(tc__Buf *b, const PerfStats *p, const char *pre,
+                            const char *mid, const char *post) {
+  int i;
+
+  for (i = 0; i < TC__PERF_EVENTS; i++) {
+    if (p->present & (1u << i))
+      tc__buf_printf(b, "%s%s%s%llu%s", pre, tc__perf_keys[i], mid,
+                     (unsigned long long)tc__perf_count(p, i), post);
+  }
+  if (p->ipc > 0)
+    tc__buf_printf(b, "%sipc%s%.3f%s", pre, mid, p->ipc, post);
+}
+
+/* Render one <testsuite> element from the first `count` results */
+static int tc__junit_has_properties(const TestResult *r) {
+  return tc__is_cached(r) || tc__is_not_run(r) ||
+         (r->metrics &&
+          (r->metrics->present & (TC_METRIC_ALLOC | TC_METRIC_PERF)));
+}
+
+/* A testcase's <properties> line; nothing if it has none */
+static void tc__junit_properties(tc__Buf *b, const TestResult *r) {
+  if (!tc__junit_has_properties(r))
+    return;
+  tc__buf_puts(b, "            <properties>");
+  if (tc__is_cached(r))
+    tc__buf_puts(b, "<property name=\"cached\" value=\"true\"/>");
+  if (tc__is_not_run(r))
+    tc__buf_puts(b, "<property name=\"not_run\" value=\"true\"/>");
+  if (r->metrics && (r->metrics->present & TC_METRIC_ALLOC)) {
+    const AllocStats *a = &r->metrics->alloc;
+    tc__buf_printf(b,
+                   "<property name=\"allocs\" value=\"%llu\"/>"
+                   "<property name=\"frees\" value=\"%llu\"/>"
+                   "<property name=\"alloc_bytes\" value=\"%llu\"/>"
+                   "<property name=\"peak_bytes\" value=\"%llu\"/>",
+                   (unsigned long long)a->allocs,
+                   (unsigned long long)a->frees,
+                   (unsigned long long)a->bytes,
+                   (unsigned long long)a->peak_bytes);
+  }
+  if (r->metrics && (r->metrics->present & TC_METRIC_PERF))
+    tc__perf_fields(b, &r->metrics->perf, "<property name=\"", "\" value=\"",
+                    "\"/>");
+  tc__buf_puts(b, "</properties>\n");
+}
+
+/* The failure text of r: each error's message and operands */
+static void tc__junit_errors(tc__Buf *b, const TestResult *r) {
+  int k;
+  for (k = 0; k < r->error_count; k++) {
+    const TestError *e = &r->errors[k];
+    tc__xml_write(b, e->message);
+    tc__buf_puts(b, "\n");
+    if (tc__has_operands(e)) {
+      tc__buf_puts(b, "  Expected: ");
+      tc__xml_write_side(b, e, 0);
+      tc__buf_puts(b, "\n  Actual:   ");
+      tc__xml_write_side(b, e, 1);
+      tc__buf_puts(b, "\n");
+    }
+  }
+}
+
+/*
+ * A suite-level error, as a testcase named after the stage that failed;
+ * r, if set, holds the details
+ */
+static void tc__junit_error_case(tc__Buf *b, const char *stage,
+                                 const char *message, const TestResult *r) {
+  tc__buf_printf(b, "        <testcase name=\"(%s)\" time=\"%.6f\">\n", stage,
+                 r ? (double)r->elapsed_ns / 1e9 : 0.0);
+  tc__buf_puts(b, "            <error message=\"");
+  tc__xml_write(b, message);
+  tc__buf_puts(b, "\" type=\"SuiteError\">");
+  if (r)
+    tc__junit_errors(b, r);
+  else
+    tc__xml_write(b, message);
+  tc__buf_puts(b, "</error>\n");
+  tc__buf_puts(b, "        </testcase>\n");
+}
+
+/*
+ * A failed setup (setup_status nonzero, no results) and a crashed
+ * teardown (if set) are reported as errors
+ */
+static void tc__junit_suite(tc__Buf *b, const Suite *suite,
+                            const TestResult *results, int count,
+                            int setup_status, const TestResult *teardown) {
+  int suite_passed = 0, suite_failed = 0, suite_skipped = 0;
+  int suite_errors = (setup_status != 0) + (teardown != NULL);
+  double suite_time = 0;
+  int j;
+
+  for (j = 0; j < count; j++) {
+    const TestResult *r = &results[j];
+    suite_time += (double)r->elapsed_ns;
+    switch (r->tag) {
+    case TC_PASS:
+      suite_passed++;
+      break;
+    case TC_FAIL:
+      suite_failed++;
+      break;
+    case TC_SKIP:
+      suite_skipped++;
+      break;
+    }
+  }
+
+  tc__buf_puts(b, "    <testsuite name=\"");
+  tc__xml_write(b, suite->name);
+  tc__buf_printf(b,
+                 "\" tests=\"%d\" failures=\"%d\" "
+                 "errors=\"%d\" skipped=\"%d\" time=\"%.6f\">\n",
+                 suite_passed + suite_failed + suite_skipped + suite_errors,
+                 suite_failed, suite_errors, suite_skipped, suite_time / 1e9);
+
+  for (j = 0; j < count && j < suite->test_count; j++) {
+    const TestResult *r = &results[j];
+
+    tc__buf_puts(b, "        <testcase name=\"");
+    tc__xml_write(b, suite->tests[j].name);
+
+    switch (r->tag) {
+    case TC_PASS:
+      if (!tc__junit_has_properties(r)) {
+        tc__buf_printf(b, "\" time=\"%.6f\"/>\n",
+                       (double)r->elapsed_ns / 1e9);
+        break;
+      }
+      if (tc__is_cached(r))
+        tc__buf_puts(b, "\" time=\"0\">\n");
+      else
+        tc__buf_printf(b, "\" time=\"%.6f\">\n",
+                       (double)r->elapsed_ns / 1e9);
+      tc__junit_properties(b, r);
+      tc__buf_puts(b, "        </testcase>\n");
+      break;
+
+    case TC_FAIL:
+      tc__buf_printf(b, "\" time=\"%.6f\">\n", (double)r->elapsed_ns / 1e9);
+      tc__junit_properties(b, r);
+      if (r->error_count > 0) {
+        tc__buf_puts(b, "            <failure message=\"");
+        tc__xml_write(b, r->errors[0].message);
+        tc__buf_puts(b, "\" type=\"AssertionError\">");
+        tc__junit_errors(b, r);
+        tc__buf_puts(b, "</failure>\n");
+      }
+      tc__buf_puts(b, "        </testcase>\n");
+      break;
+
+    case TC_SKIP:
+      tc__buf_puts(b, "\" time=\"0\">\n");
+      tc__junit_properties(b, r);
+      if (r->error_count > 0) {
+        tc__buf_puts(b, "            <skipped message=\"");
+        tc__xml_write(b, r->errors[0].message);
+        tc__buf_puts(b, "\"/>\n");
+      } else {
+        tc__buf_puts(b, "            <skipped/>\n");
+      }
+      tc__buf_puts(b, "        </testcase>\n");
+      break;
+    }
+  }
+  if (setup_status != 0) {
+    char message[64];
+    snprintf(message, sizeof(message), "Setup failed (returned %d)",
+             setup_status);
+    tc__junit_error_case(b, "setup", message, NULL);
+  }
+  if (teardown)
+    tc__junit_error_case(b, "teardown",
+                         teardown->error_count > 0
+                             ? teardown->errors[0].message
+                             : "teardown crashed",
+                         teardown);
+
+  tc__buf_puts(b, "    </testsuite>\n");
+}
+
+static void tc__junit_totals(tc__Buf *b, int tests, int failures, int errors,
+                             int skipped, double total_ms) {
+  tc__buf_printf(b,
+                 "<testsuites tests=\"%d\" failures=\"%d\" errors=\"%d\" "
+                 "skipped=\"%d\" time=\"%.3f\"",
+                 tests, failures, errors, skipped, total_ms / 1000.0);
+}
+
+int tc_write_junit_xml(const char *filename, Suite **suites,
+                       RunSummary summary) {
+  tc__Buf b = {0, 0, 0};
+  FILE *f;
+  int i, errors = 0;
+
+  f = fopen(filename, "w");
+  if (!f) {
+    fprintf(stderr, "Error: Cannot open file '%s' for writing\n", filename);
+    return -1;
+  }
+
+  for (i = 0; suites[i] != NULL; i++) {
+    if (i < tc__record_count && tc__records[i].suite == suites[i])
+      errors += (tc__records[i].setup_status != 0) +
+                (tc__records[i].teardown.tag == TC_FAIL);
+  }
+  tc__buf_puts(&b, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  tc__junit_totals(&b,
+                   summary.passed + summary.failed + summary.skipped + errors,
+                   summary.failed, errors, summary.skipped, summary.total_ms);
+  tc__buf_puts(&b, ">\n");
+
+  for (i = 0; suites[i] != NULL; i++) {
+    const TestResult *results = NULL;
+    const TestResult *teardown = NULL;
+    int count = 0, setup_status = 0;
+    if (i < tc__record_count && tc__records[i].suite == suites[i]) {
+      results = tc__records[i].results;
+      count = tc__records[i].count;
+      setup_status = tc__records[i].setup_status;
+      if (tc__records[i].teardown.tag == TC_FAIL)
+        teardown = &tc__records[i].teardown;
+    }
+    if (setup_status != 0)
+      count = 0;
+    tc__junit_suite(&b, suites[i], results, count, setup_status, teardown);
+    /* Bound memory: write out each suite's XML as it is produced */
+    if (b.len >= 65536) {
+      fwrite(b.data, 1, b.len, f);
+      b.len = 0;
+    }
+  }
+
+  tc__buf_puts(&b, "</testsuites>\n");
+  fwrite(b.data, 1, b.len, f);
+  tc__buf_free(&b);
+  fclose(f);
+
+  return 0;
+}
+
+/*
+ * Streaming report. The file is a complete document after every suite:
+ * the suite's XML overwrites the closing tag, which is written again in
+ * the same write. The root element's totals sit in a fixed-width,
+ * space-padded slot re-patched at most every TC__JUNIT_PATCH_NS and at
+ * the end. A killed run leaves every suite that finished.
+ */
+
+#define TC__JUNIT_HEAD_WIDTH 160
+#define TC__JUNIT_PATCH_NS 100000000u
+
+typedef struct {
+  FILE *f;
+  long head_at;     /* offset of the <testsuites ...> slot */
+  long content_end; /* offset where the closing tag starts */
+  tc__Buf pending;
+  uint64_t last_patch;
+  int tests, failures, errors, skipped;
+  double total_ms;
+} tc__JUnitStream;
+
+static tc__JUnitStream tc__junit;
+
+static void tc__junit_patch_head(void) {
+  tc__Buf head = {0, 0, 0};
+  tc__junit_totals(&head, tc__junit.tests, tc__junit.failures,
+                   tc__junit.errors, tc__junit.skipped, tc__junit.total_ms);
+  while (head.len < TC__JUNIT_HEAD_WIDTH - 2)
+    tc__buf_puts(&head, " ");
+  tc__buf_puts(&head, ">\n");
+  fseek(tc__junit.f, tc__junit.head_at, SEEK_SET);
+  fwrite(head.data, 1, head.len, tc__junit.f);
+  tc__buf_free(&head);
+  tc__junit.last_patch = tc_now_ns();
+}
+
+/* Write the pending suites plus the closing tag in one go */
+static void tc__junit_flush(void) {
+  size_t body = tc__junit.pending.len;
+  tc__buf_puts(&tc__junit.pending, "</testsuites>\n");
+  fseek(tc__junit.f, tc__junit.content_end, SEEK_SET);
+  fwrite(tc__junit.pending.data, 1, tc__junit.pending.len, tc__junit.f);
+  tc__junit.content_end += (long)body;
+  tc__junit.pending.len = 0;
+  if (tc_now_ns() - tc__junit.last_patch >= TC__JUNIT_PATCH_NS)
+    tc__junit_patch_head();
+  fflush(tc__junit.f);
+}
+
+static int tc__junit_open(const char *filename) {
+  memset(&tc__junit, 0, sizeof(tc__junit));
+  tc__junit.f = fopen(filename, "wb");
+  if (!tc__junit.f)
+    return -1;
+  fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n", tc__junit.f);
+  tc__junit.head_at = ftell(tc__junit.f);
+  tc__junit.content_end = tc__junit.head_at + TC__JUNIT_HEAD_WIDTH;
+  tc__junit_patch_head();
+  tc__junit_flush();
+  return 0;
+}
+
+/* Called as each suite finishes, under the report lock */
+static void tc__junit_append(const Suite *suite, const TestResult *results,
+                             int count, int setup_status,
+                             const TestResult *teardown) {
+  int j;
+  if (!tc__junit.f)
+    return;
+
+  tc__junit_suite(&tc__junit.pending, suite, results, count, setup_status,
+                  teardown);
+  for (j = 0; j < count; j++) {
+    tc__junit.tests++;
+    tc__junit.failures += results[j].tag == TC_FAIL;
+    tc__junit.skipped += results[j].tag == TC_SKIP;
+  }
+  tc__junit.tests += (setup_status != 0) + (teardown != NULL);
+  tc__junit.errors += (setup_status != 0) + (teardown != NULL);
+  tc__junit_flush();
+}
+
+static void tc__junit_close(RunSummary summary) {
+  if (!tc__junit.f)
+    return;
+  tc__junit.total_ms = summary.total_ms;
+  tc__junit_flush();
+  tc__junit_patch_head();
+  fclose(tc__junit.f);
+  tc__buf_free(&tc__junit.pending);
+  tc__junit.f = NULL;
+}
+
+/* ============================================================
+   REPORTERS
+   The console and the streaming JUnit report are built-in reporters
+   run ahead of the registered ones. Every hook runs under
+   tc__report_lock, which also keeps fork() from copying a stream that
+   is half written.
+   ============================================================ */
+
+static Reporter tc__reporters[TC_MAX_REPORTERS];
+static int tc__reporter_count;
+static tc__mutex tc__report_lock = TC__MUTEX_INIT;
+/* Crashed teardown of the suite being reported, for the built-ins */
+static const TestResult *tc__report_teardown;
+
+static void tc__console_suite_end(void *ctx, const Suite *suite,
+                                  const TestResult *results, int setup_status,
+                                  RunSummary summary) {
+  (void)ctx;
+  tc__report_suite(suite, results, summary.total_ms, setup_status,
+                   tc__report_teardown);
+}
+
+static void tc__console_run_end(void *ctx, RunSummary summary) {
+  (void)ctx;
+  (void)summary;
+  tc__report_finish();
+}
+
+static void tc__junit_suite_end(void *ctx, const Suite *suite,
+                                const TestResult *results, int setup_status,
+                                RunSummary summary) {
+  (void)ctx;
+  (void)summary;
+  tc__junit_append(suite, results, results ? suite->test_count : 0,
+                   results ? 0 : setup_status, tc__report_teardown);
+}
+
+static void tc__junit_run_end(void *ctx, RunSummary summary) {
+  (void)ctx;
+  tc__junit_close(summary);
+}
+
+#define TC__BUILTIN_REPORTERS 2
+
+static const Reporter tc__builtin_reporters[TC__BUILTIN_REPORTERS] = {
+    {NULL, NULL, NULL, NULL, tc__console_suite_end, tc__console_run_end,
+     NULL},
+    {NULL, NULL, NULL, NULL, tc__junit_suite_end, tc__junit_run_end, NULL},
+};
+
+static const Reporter *tc__reporter_at(int i) {
+  return i < TC__BUILTIN_REPORTERS ? &tc__builtin_reporters[i]
+                                   : &tc__reporters[i - TC__BUILTIN_REPORTERS];
+}
+
+int tc_add_reporter(const Reporter *reporter) {
+  int ret = -1;
+  tc__mutex_lock(&tc__report_lock);
+  if (tc__reporter_count < TC_MAX_REPORTERS) {
+    tc__reporters[tc__reporter_count++] = *reporter;
+    ret = 0;
+  }
+  tc__mutex_unlock(&tc__report_lock);
+  return ret;
+}
+
+void tc_clear_reporters(void) {
+  int i;
+  tc__mutex_lock(&tc__report_lock);
+  for (i = 0; i < tc__reporter_count; i++) {
+    if (tc__reporters[i].close)
+      tc__reporters[i].close(tc__reporters[i].ctx);
+  }
+  tc__reporter_count = 0;
+  tc__mutex_unlock(&tc__report_lock);
+}
+
+static void tc__emit_run_start(Suite **suites) {
+  int i;
+  tc__mutex_lock(&tc__report_lock);
+  for (i = 0; i < TC__BUILTIN_REPORTERS + tc__reporter_count; i++) {
+    const Reporter *r = tc__reporter_at(i);
+    if (r->on_run_start)
+      r->on_run_start(r->ctx, suites);
+  }
+  tc__mutex_unlock(&tc__report_lock);
+}
+
+static void tc__emit_suite_start(const Suite *suite) {
+  int i;
+  tc__mutex_lock(&tc__report_lock);
+  for (i = 0; i < TC__BUILTIN_REPORTERS + tc__reporter_count; i++) {
+    const Reporter *r = tc__reporter_at(i);
+    if (r->on_suite_start)
+      r->on_suite_start(r->ctx, suite);
+  }
+  tc__mutex_unlock(&tc__report_lock);
+}
+
+/* Totals of the suites reported so far in this run */
+static RunSummary tc__reported;
+
+static void tc__summary_add(RunSummary *total, RunSummary part) {
+  total->passed += part.passed;
+  total->failed += part.failed;
+  total->skipped += part.skipped;
+  total->errored += part.errored;
+  total->cached += part.cached;
+  total->not_run += part.not_run;
+}
+
+/* Caller holds tc__report_lock; teardown is a crashed teardown or NULL */
+static void tc__emit_suite_end_locked(const Suite *suite,
+                                      const TestResult *results,
+                                      int setup_status,
+                                      const TestResult *teardown,
+                                      RunSummary summary) {
+  int i, j;
+  tc__report_teardown = teardown;
+  for (i = 0; i < TC__BUILTIN_REPORTERS + tc__reporter_count; i++) {
+    const Reporter *r = tc__reporter_at(i);
+    for (j = 0; results && r->on_test_end && j < suite->test_count; j++)
+      r->on_test_end(r->ctx, suite, &suite->tests[j], &results[j]);
+    if (r->on_suite_end)
+      r->on_suite_end(r->ctx, suite, results, setup_status, summary);
+  }
+  tc__report_teardown = NULL;
+  tc__summary_add(&tc__reported, summary);
+}
+
+/* A suite's test events, then its end, in one hold of the lock */
+static void tc__emit_suite_end(tc__SuiteRecord *rec, const Suite *suite,
+                               const TestResult *results, int setup_status,
+                               const TestResult *teardown,
+                               RunSummary summary) {
+  tc__mutex_lock(&tc__report_lock);
+  if (!rec || !rec->reported)
+    tc__emit_suite_end_locked(suite, results, setup_status, teardown,
+                              summary);
+  if (rec) {
+    rec->reported = 1;
+    rec->setup_status = results ? 0 : setup_status;
+    if (teardown)
+      rec->teardown = *teardown;
+  }
+  tc__mutex_unlock(&tc__report_lock);
+}
+
+/* Caller holds tc__report_lock */
+static void tc__emit_run_end_locked(RunSummary summary) {
+  int i;
+  for (i = 0; i < TC__BUILTIN_REPORTERS + tc__reporter_count; i++) {
+    const Reporter *r = tc__reporter_at(i);
+    if (r->on_run_end)
+      r->on_run_end(r->ctx, summary);
+  }
+}
+
+static void tc__emit_run_end(RunSummary summary) {
+  tc__mutex_lock(&tc__report_lock);
+  tc__emit_run_end_locked(summary);
+  tc__mutex_unlock(&tc__report_lock);
+}
+
+/* State shared by the built-in stream reporters */
+typedef struct {
+  FILE *f;
+  tc__Buf out;
+  int tests;   /* TAP: last test point written */
+  int planned; /* TAP: plan already written for this run */
+  const Suite **ids;
+  int id_count;
+  int id_cap;
+} tc__Stream;
+
+static const char *tc__tag_name(ResultTag tag) {
+  return tag == TC_PASS ? "pass" : tag == TC_FAIL ? "fail" : "skip";
+}
+
+static void tc__count_run(Suite **suites, int *suite_count, int *test_count) {
+  int i;
+  *suite_count = 0;
+  *test_count = 0;
+  for (i = 0; suites[i] != NULL; i++) {
+    (*suite_count)++;
+    *test_count += suites[i]->test_count;
+  }
+}
+
+static tc__Stream *tc__stream_open(const char *filename, const char *mode) {
+  tc__Stream *s = (tc__Stream *)calloc(1, sizeof(tc__Stream));
+  if (!s)
+    return NULL;
+  if (strcmp(filename, "-") == 0) {
+    s->f = stdout;
+  } else {
+    s->f = fopen(filename, mode);
+  }
+  if (!s->f) {
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+/* Hand the buffered events to the stream; flush = suite boundary */
+static void tc__stream_write(tc__Stream *s, int flush) {
+  if (s->out.len)
+    fwrite(s->out.data, 1, s->out.len, s->f);
+  s->out.len = 0;
+  if (flush)
+    fflush(s->f);
+}
+
+static void tc__stream_close(void *ctx) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  tc__stream_write(s, 1);
+  if (s->f != stdout)
+    fclose(s->f);
+  tc__buf_free(&s->out);
+  free(s->ids);
+  free(s);
+}
+
+static FILE *tc__console(void) {
+  int i;
+  for (i = 0; i < tc__reporter_count; i++) {
+    if (tc__reporters[i].close == tc__stream_close &&
+        ((tc__Stream *)tc__reporters[i].ctx)->f == stdout)
+      return stderr;
+  }
+  return stdout;
+}
+
+static int tc__stream_add(tc__Stream *s, Reporter *r) {
+  r->ctx = s;
+  r->close = tc__stream_close;
+  if (tc_add_reporter(r) != 0) {
+    tc__stream_close(s);
+    return -1;
+  }
+  return 0;
+}
+
+/* ---- NDJSON ---- */
+
+static void tc__ndjson_counts(tc__Buf *b, RunSummary sum) {
+  tc__buf_printf(b,
+                 "\"passed\":%d,\"failed\":%d,\"skipped\":%d,\"errored\":%d,"
+                 "\"ms\":%.3f",
+                 sum.passed, sum.failed, sum.skipped, sum.errored,
+                 sum.total_ms);
+  if (sum.cached > 0)
+    tc__buf_printf(b, ",\"cached\":%d", sum.cached);
+  if (sum.not_run > 0)
+    tc__buf_printf(b, ",\"not_run\":%d", sum.not_run);
+}
+
+static void tc__ndjson_run_start(void *ctx, Suite **suites) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  int suite_count, test_count;
+  tc__count_run(suites, &suite_count, &test_count);
+  tc__buf_printf(&s->out,
+                 "{\"event\":\"run_start\",\"suites\":%d,\"tests\":%d}\n",
+                 suite_count, test_count);
+  tc__stream_write(s, 1);
+}
+
+static void tc__ndjson_suite_start(void *ctx, const Suite *suite) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  tc__buf_puts(&s->out, "{\"event\":\"suite_start\",\"suite\":");
+  tc__buf_json(&s->out, suite->name);
+  tc__buf_puts(&s->out, "}\n");
+  tc__stream_write(s, 0);
+}
+
+static void tc__ndjson_test_end(void *ctx, const Suite *suite,
+                                const Test *test, const TestResult *result) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  tc__Buf *b = &s->out;
+  char side[160];
+  int i;
+
+  tc__buf_puts(b, "{\"event\":\"test\",\"suite\":");
+  tc__buf_json(b, suite->name);
+  tc__buf_puts(b, ",\"test\":");
+  tc__buf_json(b, test->name);
+  tc__buf_printf(b, ",\"status\":\"%s\",\"elapsed_ns\":%llu",
+                 tc__tag_name(result->tag),
+                 (unsigned long long)result->elapsed_ns);
+  if (tc__is_cached(result))
+    tc__buf_puts(b, ",\"cached\":true");
+  if (tc__is_not_run(result))
+    tc__buf_puts(b, ",\"not_run\":true");
+  if (result->metrics && (result->metrics->present & TC_METRIC_ALLOC)) {
+    const AllocStats *a = &result->metrics->alloc;
+    tc__buf_printf(b,
+                   ",\"allocs\":%llu,\"frees\":%llu,\"alloc_bytes\":%llu,"
+                   "\"peak_bytes\":%llu",
+                   (unsigned long long)a->allocs,
+                   (unsigned long long)a->frees,
+                   (unsigned long long)a->bytes,
+                   (unsigned long long)a->peak_bytes);
+  }
+  if (result->metrics && (result->metrics->present & TC_METRIC_PERF))
+    tc__perf_fields(b, &result->metrics->perf, ",\"", "\":", "");
+  if (result->tag == TC_FAIL) {
+    tc__buf_puts(b, ",\"errors\":[");
+    for (i = 0; i < result->error_count; i++) {
+      const TestError *e = &result->errors[i];
+      tc__buf_puts(b, i ? ",{\"message\":" : "{\"message\":");
+      tc__buf_json(b, e->message);
+      if (tc__has_operands(e)) {
+        tc_error_expected(e, side, sizeof(side));
+        tc__buf_puts(b, ",\"expected\":");
+        tc__buf_json(b, side);
+        tc_error_actual(e, side, sizeof(side));
+        tc__buf_puts(b, ",\"actual\":");
+        tc__buf_json(b, side);
+      }
+      tc__buf_puts(b, "}");
+    }
+    tc__buf_puts(b, "]");
+  } else if (result->tag == TC_SKIP && result->error_count > 0) {
+    tc__buf_puts(b, ",\"reason\":");
+    tc__buf_json(b, result->errors[0].message);
+  }
+  if (result->metrics && (result->metrics->present & TC_METRIC_BENCH)) {
+    const BenchStats *st = &result->metrics->bench;
+    tc__buf_printf(b,
+                   ",\"bench\":{\"iterations\":%llu,\"median_ns\":%.6g,"
+                   "\"mean_ns\":%.6g,\"p99_ns\":%.6g,\"ops_per_sec\":%.6g}",
+                   (unsigned long long)st->iterations, st->median_ns,
+                   st->mean_ns, st->p99_ns, st->ops_per_sec);
+  }
+  tc__buf_puts(b, "}\n");
+  tc__stream_write(s, 0);
+}
+
+static void tc__ndjson_suite_end(void *ctx, const Suite *suite,
+                                 const TestResult *results, int setup_status,
+                                 RunSummary summary) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  (void)results;
+  tc__buf_puts(&s->out, "{\"event\":\"suite_end\",\"suite\":");
+  tc__buf_json(&s->out, suite->name);
+  tc__buf_puts(&s->out, ",");
+  tc__ndjson_counts(&s->out, summary);
+  if (setup_status != 0)
+    tc__buf_printf(&s->out, ",\"setup_status\":%d", setup_status);
+  tc__buf_puts(&s->out, "}\n");
+  tc__stream_write(s, 1);
+}
+
+static void tc__ndjson_run_end(void *ctx, RunSummary summary) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  tc__buf_puts(&s->out, "{\"event\":\"run_end\",");
+  tc__ndjson_counts(&s->out, summary);
+  tc__buf_puts(&s->out, "}\n");
+  tc__stream_write(s, 1);
+}
+
+int tc_add_ndjson_reporter(const char *filename) {
+  Reporter r = {NULL,
+                tc__ndjson_run_start,
+                tc__ndjson_suite_start,
+                tc__ndjson_test_end,
+                tc__ndjson_suite_end,
+                tc__ndjson_run_end,
+                NULL};
+  tc__Stream *s = tc__stream_open(filename, "w");
+  return s ? tc__stream_add(s, &r) : -1;
+}
+
+/* ---- TAP ---- */
+
+/* Text on a test line: '#' and '\\' escaped, cut at the first newline */
+static void tc__tap_text(tc__Buf *b, const char *p) {
+  for (; p && *p && *p != '\n' && *p != '\r'; p++) {
+    if (*p == '#' || *p == '\\')
+      tc__buf_puts(b, "\\");
+    tc__buf_append(b, p, 1);
+  }
+}
+
+/* Test point description: "suite: test", each part escaped */
+static void tc__tap_name(tc__Buf *b, const Suite *suite, const Test *test) {
+  tc__tap_text(b, suite->name);
+  tc__buf_puts(b, ": ");
+  tc__tap_text(b, test->name);
+}
+
+static void tc__tap_run_start(void *ctx, Suite **suites) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  int suite_count, test_count;
+  tc__count_run(suites, &suite_count, &test_count);
+  tc__buf_printf(&s->out, "1..%d\n", test_count);
+  s->tests = 0;
+  s->planned = 1;
+  tc__stream_write(s, 1);
+}
+
+static void tc__tap_test_end(void *ctx, const Suite *suite, const Test *test,
+                             const TestResult *result) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  tc__Buf *b = &s->out;
+  char side[160];
+  int i;
+
+  tc__buf_printf(b, "%s %d - ", result->tag == TC_FAIL ? "not ok" : "ok",
+                 ++s->tests);
+  tc__tap_name(b, suite, test);
+  if (tc__is_cached(result))
+    tc__buf_puts(b, " # cached");
+  if (result->tag == TC_SKIP) {
+    tc__buf_puts(b, " # SKIP");
+    if (result->error_count > 0 && result->errors[0].message) {
+      tc__buf_puts(b, " ");
+      tc__tap_text(b, result->errors[0].message);
+    }
+  }
+  tc__buf_puts(b, "\n");
+
+  if (result->tag == TC_FAIL) {
+    tc__buf_printf(b, "  ---\n  duration_ms: %.3f\n  failures:\n",
+                   (double)result->elapsed_ns / 1e6);
+    for (i = 0; i < result->error_count; i++) {
+      const TestError *e = &result->errors[i];
+      tc__buf_puts(b, "    - message: ");
+      tc__buf_json(b, e->message);
+      if (tc__has_operands(e)) {
+        tc_error_expected(e, side, sizeof(side));
+        tc__buf_puts(b, "\n      expected: ");
+        tc__buf_json(b, side);
+        tc_error_actual(e, side, sizeof(side));
+        tc__buf_puts(b, "\n      actual: ");
+        tc__buf_json(b, side);
+      }
+      tc__buf_puts(b, "\n");
+    }
+    tc__buf_puts(b, "  ...\n");
+  }
+  tc__stream_write(s, 0);
+}
+
+static void tc__tap_suite_end(void *ctx, const Suite *suite,
+                              const TestResult *results, int setup_status,
+                              RunSummary summary) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  int j;
+  (void)summary;
+  for (j = 0; !results && j < suite->test_count; j++) {
+    tc__buf_printf(&s->out, "not ok %d - ", ++s->tests);
+    tc__tap_name(&s->out, suite, &suite->tests[j]);
+    tc__buf_printf(&s->out,
+                   "\n  ---\n  message: \"setup failed (returned %d)\"\n"
+                   "  ...\n",
+                   setup_status);
+  }
+  tc__stream_write(s, 1);
+}
+
+static void tc__tap_run_end(void *ctx, RunSummary summary) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  (void)summary;
+  if (!s->planned)
+    tc__buf_printf(&s->out, "1..%d\n", s->tests);
+  s->planned = 0;
+  tc__stream_write(s, 1);
+}
+
+int tc_add_tap_reporter(const char *filename) {
+  Reporter r = {NULL, tc__tap_run_start, NULL, tc__tap_test_end,
+                tc__tap_suite_end, tc__tap_run_end, NULL};
+  tc__Stream *s = tc__stream_open(filename, "w");
+  if (!s)
+    return -1;
+  fputs("TAP version 13\n", s->f);
+  return tc__stream_add(s, &r);
+}
+
+/* ---- Binary ---- */
+
+enum {
+  TC__REC_RUN_START = 1,
+  TC__REC_SUITE_START,
+  TC__REC_TEST,
+  TC__REC_SUITE_END,
+  TC__REC_RUN_END
+};
+
+static void tc__wire_u32(tc__Buf *b, uint32_t v) {
+  unsigned char x[4];
+  x[0] = (unsigned char)v;
+  x[1] = (unsigned char)(v >> 8);
+  x[2] = (unsigned char)(v >> 16);
+  x[3] = (unsigned char)(v >> 24);
+  tc__buf_append(b, x, 4);
+}
+
+static void tc__wire_u64(tc__Buf *b, uint64_t v) {
+  tc__wire_u32(b, (uint32_t)v);
+  tc__wire_u32(b, (uint32_t)(v >> 32));
+}
+
+static void tc__wire_str(tc__Buf *b, const char *str) {
+  size_t len = str ? strlen(str) : 0;
+  tc__wire_u32(b, (uint32_t)len);
+  tc__buf_append(b, str, len);
+}
+
+/* Start a record; returns where its length goes */
+static size_t tc__wire_begin(tc__Buf *b, int type) {
+  size_t at = b->len;
+  unsigned char t = (unsigned char)type;
+  tc__wire_u32(b, 0);
+  tc__buf_append(b, &t, 1);
+  return at;
+}
+
+static void tc__wire_end(tc__Buf *b, size_t at) {
+  uint32_t len = (uint32_t)(b->len - at - 4);
+  if (!b->data)
+    return;
+  b->data[at] = (char)(len & 0xff);
+  b->data[at + 1] = (char)((len >> 8) & 0xff);
+  b->data[at + 2] = (char)((len >> 16) & 0xff);
+  b->data[at + 3] = (char)((len >> 24) & 0xff);
+}
+
+static void tc__wire_counts(tc__Buf *b, RunSummary sum) {
+  tc__wire_u32(b, (uint32_t)sum.passed);
+  tc__wire_u32(b, (uint32_t)sum.failed);
+  tc__wire_u32(b, (uint32_t)sum.skipped);
+  tc__wire_u32(b, (uint32_t)sum.errored);
+  tc__wire_u64(b, (uint64_t)(sum.total_ms * 1e6));
+}
+
+/* Suite id: its position in suite-start order, assigned on first sight */
+static uint32_t tc__binary_id(tc__Stream *s, const Suite *suite) {
+  int i;
+  for (i = s->id_count - 1; i >= 0; i--) {
+    if (s->ids[i] == suite)
+      return (uint32_t)i;
+  }
+  if (s->id_count == s->id_cap) {
+    int cap = s->id_cap ? s->id_cap * 2 : 64;
+    const Suite **grown =
+        (const Suite **)realloc((void *)s->ids, (size_t)cap * sizeof(*grown));
+    if (!grown)
+      return (uint32_t)s->id_count;
+    s->ids = grown;
+    s->id_cap = cap;
+  }
+  s->ids[s->id_count] = suite;
+  return (uint32_t)s->id_count++;
+}
+
+static void tc__binary_run_start(void *ctx, Suite **suites) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  int suite_count, test_count;
+  size_t at = tc__wire_begin(&s->out, TC__REC_RUN_START);
+  tc__count_run(suites, &suite_count, &test_count);
+  tc__wire_u32(&s->out, (uint32_t)suite_count);
+  tc__wire_u32(&s->out, (uint32_t)test_count);
+  tc__wire_end(&s->out, at);
+  s->id_count = 0;
+  tc__stream_write(s, 1);
+}
+
+static void tc__binary_suite_start(void *ctx, const Suite *suite) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  size_t at = tc__wire_begin(&s->out, TC__REC_SUITE_START);
+  tc__wire_u32(&s->out, tc__binary_id(s, suite));
+  tc__wire_str(&s->out, suite->name);
+  tc__wire_end(&s->out, at);
+}
+
+static void tc__binary_test_end(void *ctx, const Suite *suite,
+                                const Test *test, const TestResult *result) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  tc__Buf *b = &s->out;
+  unsigned char tag = (unsigned char)result->tag;
+  char side[160];
+  size_t at = tc__wire_begin(b, TC__REC_TEST);
+  int i;
+
+  tc__wire_u32(b, tc__binary_id(s, suite));
+  tc__wire_u32(b, (uint32_t)(test - suite->tests));
+  tc__buf_append(b, &tag, 1);
+  tc__wire_u64(b, result->elapsed_ns);
+  tc__wire_str(b, test->name);
+  tc__wire_u32(b, (uint32_t)result->error_count);
+  for (i = 0; i < result->error_count; i++) {
+    const TestError *e = &result->errors[i];
+    tc__wire_str(b, e->message);
+    tc_error_expected(e, side, sizeof(side));
+    tc__wire_str(b, side);
+    tc_error_actual(e, side, sizeof(side));
+    tc__wire_str(b, side);
+  }
+  tc__wire_end(b, at);
+  /* Tens of thousands of records: hand over in large writes */
+  if (b->len >= 65536)
+    tc__stream_write(s, 0);
+}
+
+static void tc__binary_suite_end(void *ctx, const Suite *suite,
+                                 const TestResult *results, int setup_status,
+                                 RunSummary summary) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  size_t at = tc__wire_begin(&s->out, TC__REC_SUITE_END);
+  (void)results;
+  tc__wire_u32(&s->out, tc__binary_id(s, suite));
+  tc__wire_u32(&s->out, (uint32_t)setup_status);
+  tc__wire_counts(&s->out, summary);
+  tc__wire_end(&s->out, at);
+  tc__stream_write(s, 1);
+}
+
+static void tc__binary_run_end(void *ctx, RunSummary summary) {
+  tc__Stream *s = (tc__Stream *)ctx;
+  size_t at = tc__wire_begin(&s->out, TC__REC_RUN_END);
+  tc__wire_counts(&s->out, summary);
+  tc__wire_end(&s->out, at);
+  tc__stream_write(s, 1);
+}
+
+int tc_add_binary_reporter(const char *filename) {
+  Reporter r = {NULL,
+                tc__binary_run_start,
+                tc__binary_suite_start,
+                tc__binary_test_end,
+                tc__binary_suite_end,
+                tc__binary_run_end,
+                NULL};
+  tc__Stream *s = tc__stream_open(filename, "wb");
+  if (!s)
+    return -1;
+  fwrite("TCR1", 1, 4, s->f);
+  return tc__stream_add(s, &r);
+}
+
+/* ============================================================
+   WORKER POOL
+   Work-stealing pool: each worker owns a deque of tasks, takes from
+   its front, and steals from the back of another worker's deque when
+   its own runs dry. The calling thread acts as worker 0.
+   ============================================================ */
+
+typedef struct {
+  void (*fn)(void *arg);
+  void *arg;
+  const void *group; /* batch the task belongs to, or NULL */
+} tc__Task;
+
+typedef struct {
+  tc__mutex lock;
+  tc__Task *items;
+  int head;
+  int tail;
+  int cap;
+} tc__Deque;
+
+typedef struct tc__Pool tc__Pool;
+
+typedef struct {
+  tc__Pool *pool;
+  int id;
+  tc__Deque queue;
+  tc__Store *store;
+  tc__thread thread;
+} tc__Worker;
+
+struct tc__Pool {
+  tc__Worker *workers;
+  int count;
+  tc__mutex lock;
+  tc__cond wake;
+  int queued;  /* pushed but not yet taken */
+  int pending; /* pushed but not yet finished */
+};
+
+/* Worker running on this thread, if inside a pool */
+static TC__TLS tc__Worker *tc__tls_worker;
+
+static int tc__deque_push(tc__Deque *d, tc__Task task) {
+  tc__mutex_lock(&d->lock);
+  if (d->head > 0 && d->tail == d->cap) {
+    memmove(d->items, d->items + d->head,
+            (size_t)(d->tail - d->head) * sizeof(tc__Task));
+    d->tail -= d->head;
+    d->head = 0;
+  }
+  if (d->tail == d->cap) {
+    int cap = d->cap ? d->cap * 2 : 16;
+    tc__Task *grown =
+        (tc__Task *)realloc(d->items, (size_t)cap * sizeof(tc__Task));
+    if (!grown) {
+      tc__mutex_unlock(&d->lock);
+      return -1;
+    }
+    d->items = grown;
+    d->cap = cap;
+  }
+  d->items[d->tail++] = task;
+  tc__mutex_unlock(&d->lock);
+  return 0;
+}
+
+/* Take a task; with group set, only the newest one of that batch */
+static int tc__deque_take(tc__Deque *d, int steal, const void *group,
+                          tc__Task *out) {
+  int got = 0;
+  int i;
+  tc__mutex_lock(&d->lock);
+  if (!group && d->head < d->tail) {
+    *out = steal ? d->items[--d->tail] : d->items[d->head++];
+    got = 1;
+  }
+  for (i = d->tail - 1; group && !got && i >= d->head; i--) {
+    if (d->items[i].group == group) {
+      *out = d->items[i];
+      memmove(d->items + i, d->items + i + 1,
+              (size_t)(d->tail - i - 1) * sizeof(tc__Task));
+      d->tail--;
+      got = 1;
+    }
+  }
+  tc__mutex_unlock(&d->lock);
+  return got;
+}
+
+static int tc__pool_init(tc__Pool *pool, int count, tc__Store *stores) {
+  int i;
+  memset(pool, 0, sizeof(*pool));
+  pool->workers = (tc__Worker *)calloc((size_t)count, sizeof(tc__Worker));
+  if (!pool->workers)
+    return -1;
+  pool->count = count;
+  tc__mutex_init(&pool->lock);
+  tc__cond_init(&pool->wake);
+  for (i = 0; i < count; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].id = i;
+    pool->workers[i].store = &stores[i];
+    tc__mutex_init(&pool->workers[i].queue.lock);
+  }
+  return 0;
+}
+
+static void tc__pool_destroy(tc__Pool *pool) {
+  int i;
+  for (i = 0; i < pool->count; i++) {
+    free(pool->workers[i].queue.items);
+  }
+  free(pool->workers);
+  pool->workers = NULL;
+}
+
+/* Queue a task on a worker's deque; runs it inline if that fails */
+static void tc__pool_push(tc__Pool *pool, int worker, void (*fn)(void *),
+                          void *arg, const void *group) {
+  tc__Task task;
+  task.fn = fn;
+  task.arg = arg;
+  task.group = group;
+  if (tc__deque_push(&pool->workers[worker % pool->count].queue, task) != 0) {
+    fn(arg);
+    return;
+  }
+  tc__mutex_lock(&pool->lock);
+  pool->queued++;
+  pool->pending++;
+  tc__cond_broadcast(&pool->wake);
+  tc__mutex_unlock(&pool->lock);
+}
+
+static int tc__pool_take(tc__Pool *pool, tc__Worker *self, const void *group,
+                         tc__Task *out) {
+  int i;
+  int got = tc__deque_take(&self->queue, 0, group, out);
+  for (i = 1; !got && i < pool->count; i++) {
+    got = tc__deque_take(&pool->workers[(self->id + i) % pool->count].queue, 1,
+                         group, out);
+  }
+  if (got) {
+    tc__mutex_lock(&pool->lock);
+    pool->queued--;
+    tc__mutex_unlock(&pool->lock);
+  }
+  return got;
+}
+
+static void tc__pool_execute(tc__Pool *pool, tc__Task task) {
+  task.fn(task.arg);
+  tc__mutex_lock(&pool->lock);
+  if (--pool->pending == 0)
+    tc__cond_broadcast(&pool->wake);
+  tc__mutex_unlock(&pool->lock);
+}
+
+/*
+ * Help run the batch pushed with group `remaining` until *remaining
+ * (guarded by the pool lock) drops to zero. Used by a task that fanned
+ * out work and must wait for it. Other tasks are left alone, so no
+ * unrelated suite ends up running nested on the waiter's stack; once
+ * the batch is all taken, the waiter sleeps until the last one ends.
+ */
+static void tc__pool_wait(tc__Pool *pool, tc__Worker *self, int *remaining) {
+  tc__Task task;
+  while (tc__pool_take(pool, self, remaining, &task))
+    tc__pool_execute(pool, task);
+
+  tc__mutex_lock(&pool->lock);
+  while (*remaining > 0)
+    tc__cond_wait(&pool->wake, &pool->lock);
+  tc__mutex_unlock(&pool->lock);
+}
+
+static void tc__pool_worker(void *arg) {
+  tc__Worker *self = (tc__Worker *)arg;
+  tc__Pool *pool = self->pool;
+  tc__Store *saved_store = tc__tls_store;
+  tc__Worker *saved_worker = tc__tls_worker;
+  tc__Task task;
+
+  tc__tls_store = self->store;
+  tc__tls_worker = self;
+  for (;;) {
+    if (tc__pool_take(pool, self, NULL, &task)) {
+      tc__pool_execute(pool, task);
+      continue;
+    }
+    tc__mutex_lock(&pool->lock);
+    if (pool->pending == 0) {
+      tc__mutex_unlock(&pool->lock);
+      break;
+    }
+    if (pool->queued == 0)
+      tc__cond_wait(&pool->wake, &pool->lock);
+    tc__mutex_unlock(&pool->lock);
+  }
+  if (self != &pool->workers[0])
+    tc__perf_close(); /* the thread ends with this run */
+  tc__tls_store = saved_store;
+  tc__tls_worker = saved_worker;
+}
+
+/* Run queued tasks to completion on count workers, the caller included */
+static void tc__pool_run(tc__Pool *pool) {
+  int i;
+  int *started = (int *)calloc((size_t)pool->count, sizeof(int));
+
+  for (i = 1; i < pool->count; i++) {
+    if (started)
+      started[i] = tc__thread_start(&pool->workers[i].thread, tc__pool_worker,
+                                    &pool->workers[i]) == 0;
+  }
+  tc__pool_worker(&pool->workers[0]);
+  for (i = 1; i < pool->count; i++) {
+    if (started && started[i])
+      tc__thread_join(pool->workers[i].thread);
+  }
+  free(started);
+}
+
+/* ============================================================
+   SHARED-ENV TEST BATCHES
+   Consecutive tests that only read env are fanned out across the pool
+   after the suite's single setup; results land in declaration order.
+   ============================================================ */
+
+typedef struct {
+  Test *test;
+  void *env;
+  TestResult *slot;
+  tc__Pool *pool;
+  int *remaining;
+  tc__FixtureSet *fixtures;
+  tc__Arena *suite_arena;
+  const Suite *suite;
+} tc__TestTask;
+
+static int tc__test_shared(const Suite *suite, const Test *test) {
+  return (suite->flags & TC_SUITE_SHARED_ENV) ||
+         (test->flags & TC_TEST_READ_ONLY);
+}
+
+static void tc__test_task(void *arg) {
+  tc__TestTask *t = (tc__TestTask *)arg;
+  tc__FixtureSet *saved = tc__tls_fixtures;
+  tc__Arena *saved_arena = tc__tls_suite_arena;
+  const Suite *saved_suite = tc__tls_suite;
+  tc__tls_fixtures = t->fixtures;
+  tc__tls_suite_arena = t->suite_arena;
+  tc__tls_suite = t->suite;
+  *t->slot = tc_run_test(t->test, t->env);
+  tc__tls_fixtures = saved;
+  tc__tls_suite_arena = saved_arena;
+  tc__tls_suite = saved_suite;
+  tc__mutex_lock(&t->pool->lock);
+  if (--*t->remaining == 0)
+    tc__cond_broadcast(&t->pool->wake);
+  tc__mutex_unlock(&t->pool->lock);
+}
+
+/* Run count tests concurrently; returns 0 if it had to fall back */
+static int tc__run_batch(Test *tests, int count, void *env,
+                         TestResult *results) {
+  tc__Worker *self = tc__tls_worker;
+  tc__TestTask *tasks;
+  int remaining = count;
+  int i;
+
+  if (!self || self->pool->count < 2 || count < 2)
+    return 0;
+  tasks = (tc__TestTask *)malloc((size_t)count * sizeof(tc__TestTask));
+  if (!tasks)
+    return 0;
+
+  for (i = 0; i < count; i++) {
+    tasks[i].test = &tests[i];
+    tasks[i].env = env;
+    tasks[i].slot = &results[i];
+    tasks[i].pool = self->pool;
+    tasks[i].remaining = &remaining;
+    tasks[i].fixtures = tc__tls_fixtures;
+    tasks[i].suite_arena = tc__tls_suite_arena;
+    tasks[i].suite = tc__tls_suite;
+    tc__pool_push(self->pool, self->id, tc__test_task, &tasks[i],
+                  &remaining);
+  }
+  tc__pool_wait(self->pool, self, &remaining);
+
+  free(tasks);
+  return 1;
+}
+
+/* ============================================================
+   ENV RESET
+   TC_SUITE_RESET_ENV puts env back to its state after setup before
+   each test that follows one that may have changed it. Tests that
+   only read env do not count, so a batch of them still shares one
+   state.
+   ============================================================ */
+
+#define TC__RESET_NONE 0
+#define TC__RESET_COPY 1  /* snapshot hooks, or env_size bytes */
+#define TC__RESET_FORK 2  /* each test in a fresh child */
+#define TC__RESET_SETUP 3 /* teardown, then setup again */
+
+typedef struct {
+  const Suite *suite;
+  int mode;
+  void *saved;
+  int dirty;  /* env may differ from the snapshot */
+  int broken; /* setting up again failed, so there is no env */
+} tc__Reset;
+
+/* 0 unless suite resets env with a snapshot lacking save or restore */
+static int tc__reset_check(const Suite *suite) {
+  const EnvSnapshot *snap = suite->snapshot;
+  if (!(suite->flags & TC_SUITE_RESET_ENV) || !snap ||
+      (snap->save && snap->restore))
+    return 0;
+  fprintf(stderr, "Error: Suite '%s' has an EnvSnapshot without %s\n",
+          suite->name, snap->save ? "restore" : "save");
+  return -1;
+}
+
+/* Choose how to reset env and take the snapshot; nonzero if that failed */
+static int tc__reset_init(tc__Reset *r, const Suite *suite, void *env,
+                          int can_fork) {
+  memset(r, 0, sizeof(*r));
+  r->suite = suite;
+  if (!(suite->flags & TC_SUITE_RESET_ENV))
+    return 0;
+  if (suite->snapshot) {
+    r->mode = TC__RESET_COPY;
+    return suite->snapshot->save(env, &r->saved);
+  }
+  if (suite->env_size > 0) {
+    r->mode = TC__RESET_COPY;
+    if (!env)
+      return 0;
+    r->saved = malloc(suite->env_size);
+    if (!r->saved) {
+      fprintf(stderr, "Error: Out of memory saving env of suite '%s'\n",
+              suite->name);
+      return -1;
+    }
+    memcpy(r->saved, env, suite->env_size);
+    return 0;
+  }
+  r->mode = can_fork ? TC__RESET_FORK : TC__RESET_SETUP;
+  return 0;
+}
+
+/* Before test: restore *env if it may have changed; -1 if env is gone */
+static int tc__reset_env(tc__Reset *r, const Test *test, void **env) {
+  const Suite *suite = r->suite;
+
+  if (r->dirty && (test->fn || test->bench) && !tc__cache_hit(test) &&
+      !tc__run_cancelled()) {
+    r->dirty = 0;
+    if (r->mode == TC__RESET_COPY && suite->snapshot) {
+      suite->snapshot->restore(*env, r->saved);
+    } else if (r->mode == TC__RESET_COPY) {
+      if (r->saved)
+        memcpy(*env, r->saved, suite->env_size);
+    } else if (r->mode == TC__RESET_SETUP) {
+      if (suite->teardown)
+        suite->teardown(*env);
+      *env = NULL;
+      r->broken = suite->setup && suite->setup(env) != 0;
+    }
+  }
+  return r->broken ? -1 : 0;
+}
+
+/* After test ran: note whether it may have changed env */
+static void tc__reset_touch(tc__Reset *r, const Test *test,
+                            const TestResult *result) {
+  if (r->mode != TC__RESET_NONE && !tc__test_shared(r->suite, test) &&
+      (test->fn || test->bench) && !tc__is_cached(result) &&
+      !tc__is_not_run(result))
+    r->dirty = 1;
+}
+
+static TestResult tc__reset_failed(void) {
+  tc__count_failures(1);
+  return tc_fail("setup failed while resetting env");
+}
+
+static void tc__reset_free(tc__Reset *r) {
+  if (r->saved && r->suite->snapshot) {
+    if (r->suite->snapshot->discard)
+      r->suite->snapshot->discard(r->saved);
+  } else {
+    free(r->saved);
+  }
+  r->saved = NULL;
+}
+
+/* ============================================================
+   PROCESS ISOLATION (POSIX)
+   --isolate runs tests in a forked child that is reused until it
+   crashes; --isolate-suite forks one child per suite, which runs setup,
+   tests and teardown. Results stream back over a pipe, and a child that
+   dies is reported as a failure of the test it was running.
+   ============================================================ */
+
+static IsolationMode tc__isolation = TC_ISOLATE_NONE;
+
+void tc_set_isolation(IsolationMode mode) { tc__isolation = mode; }
+
+#ifdef TC__HAVE_FORK
+
+typedef struct {
+  pid_t pid;
+  int cmd; /* parent -> child: test index to run, -1 to quit */
+  int res; /* child -> parent: encoded results */
+} tc__Child;
+
+/* Control records sent in place of a test index */
+#define TC__MSG_DONE (-1)
+#define TC__MSG_SETUP_FAILED (-2)
+#define TC__MSG_COVERAGE (-3)
+#define TC__MSG_SETUP_DONE (-4)
+#define TC__MSG_SPANS (-5)
+
+/*
+ * Every pipe end held by a parent thread is registered here so a child
+ * forked by another worker can close it; otherwise the sibling would keep
+ * the pipe open and hide a crash from the parent.
+ */
+static tc__mutex tc__fork_lock = TC__MUTEX_INIT;
+static int *tc__child_fds;
+static int tc__child_fd_count;
+static int tc__child_fd_cap;
+
+static void tc__fds_add(int fd) {
+  if (tc__child_fd_count == tc__child_fd_cap) {
+    int cap = tc__child_fd_cap ? tc__child_fd_cap * 2 : 16;
+    int *grown = (int *)realloc(tc__child_fds, (size_t)cap * sizeof(int));
+    if (!grown)
+      return;
+    tc__child_fds = grown;
+    tc__child_fd_cap = cap;
+  }
+  tc__child_fds[tc__child_fd_count++] = fd;
+}
+
+static void tc__fds_remove(int fd) {
+  int i;
+  for (i = 0; i < tc__child_fd_count; i++) {
+    if (tc__child_fds[i] == fd) {
+      tc__child_fds[i] = tc__child_fds[--tc__child_fd_count];
+      return;
+    }
+  }
+}
+
+static int tc__write_all(int fd, const void *data, size_t len) {
+  const char *p = (const char *)data;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+static int tc__read_all(int fd, void *data, size_t len) {
+  char *p = (char *)data;
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+#ifdef TC__HAVE_IMPACT
+/*
+ * Child side: what the child recorded goes ahead of each record, as
+ * [TC__MSG_COVERAGE, count, owner, addrs...]. Owners and addresses are
+ * raw pointers: the parent is the same image.
+ */
+static void tc__send_coverage(int fd) {
+  int k;
+  tc__mutex_lock(&tc__coverage_lock);
+  for (k = 0; k < tc__coverage_count; k++) {
+    const tc__Coverage *c = &tc__coverage[k];
+    int rec[2];
+    rec[0] = TC__MSG_COVERAGE;
+    rec[1] = (int)c->count;
+    if (tc__write_all(fd, rec, sizeof(rec)) != 0 ||
+        tc__write_all(fd, &c->owner, sizeof(c->owner)) != 0 ||
+        tc__write_all(fd, c->addrs, c->count * sizeof(void *)) != 0)
+      break;
+  }
+  for (k = 0; k < tc__coverage_count; k++)
+    free(tc__coverage[k].addrs);
+  tc__coverage_count = 0;
+  tc__mutex_unlock(&tc__coverage_lock);
+}
+
+/* Parent side: file a record of count addresses sent by a child */
+static int tc__recv_coverage(int fd, int count) {
+  tc__Coverage c;
+  if (count < 0 || tc__read_all(fd, &c.owner, sizeof(c.owner)) != 0)
+    return -1;
+  c.count = (size_t)count;
+  c.addrs = (void **)malloc((c.count + 1) * sizeof(void *));
+  if (!c.addrs)
+    return -1;
+  if (tc__read_all(fd, c.addrs, c.count * sizeof(void *)) != 0) {
+    free(c.addrs);
+    return -1;
+  }
+  tc__coverage_add(c);
+  return 0;
+}
+#else
+#define tc__send_coverage(fd) ((void)(fd))
+#endif
+
+/*
+ * Child side: spans recorded since the last record go ahead of it, as
+ * [TC__MSG_SPANS, count, spans...]. Their names are raw pointers too.
+ */
+static void tc__send_spans(int fd) {
+  tc__Store *st = tc__cur_store();
+  int rec[2];
+  if (st->span_count == 0)
+    return;
+  rec[0] = TC__MSG_SPANS;
+  rec[1] = st->span_count;
+  if (tc__write_all(fd, rec, sizeof(rec)) == 0)
+    tc__write_all(fd, st->spans, (size_t)st->span_count * sizeof(tc__Span));
+  st->span_count = 0;
+}
+
+/* Parent side: file count spans sent by a child in this thread's store */
+static int tc__recv_spans(int fd, int count) {
+  tc__Span sp, *to;
+  for (; count > 0; count--) {
+    if (tc__read_all(fd, &sp, sizeof(sp)) != 0)
+      return -1;
+    if ((to = tc__trace_add()) != NULL)
+      *to = sp;
+  }
+  return count == 0 ? 0 : -1;
+}
+
+static void tc__buf_put_int(tc__Buf *b, int v) {
+  tc__buf_append(b, &v, sizeof(v));
+}
+
+static void tc__buf_put_str(tc__Buf *b, const char *s, size_t len) {
+  unsigned int n = (unsigned int)len;
+  tc__buf_append(b, &n, sizeof(n));
+  tc__buf_append(b, s, len);
+}
+
+static void tc__buf_put_side(tc__Buf *b, const TestError *e, int actual_side) {
+  char small[128];
+  int len = tc__error_side(e, actual_side, small, sizeof(small));
+  if (len < (int)sizeof(small)) {
+    tc__buf_put_str(b, small, (size_t)len);
+  } else {
+    char *big = (char *)malloc((size_t)len + 1);
+    if (big) {
+      tc__error_side(e, actual_side, big, (size_t)len + 1);
+      tc__buf_put_str(b, big, (size_t)len);
+      free(big);
+    } else {
+      tc__buf_put_str(b, small, sizeof(small) - 1);
+    }
+  }
+}
+
+/* Child side: one record is [index, tag, elapsed, count, errors...] */
+static void tc__send_result(int fd, int index, const TestResult *r) {
+  tc__Buf b = {0, 0, 0};
+  int i;
+
+  tc__send_coverage(fd);
+  tc__send_spans(fd);
+  tc__buf_put_int(&b, index);
+  tc__buf_put_int(&b, (int)r->tag);
+  tc__buf_append(&b, &r->elapsed_ns, sizeof(r->elapsed_ns));
+  tc__buf_put_int(&b, r->error_count);
+  for (i = 0; i < r->error_count; i++) {
+    const TestError *e = &r->errors[i];
+    const char *msg = e->message ? e->message : "";
+    int has = tc__has_operands(e);
+    tc__buf_put_str(&b, msg, strlen(msg));
+    tc__buf_put_int(&b, has);
+    if (has) {
+      tc__buf_put_side(&b, e, 0);
+      tc__buf_put_side(&b, e, 1);
+    }
+  }
+  /* Metrics go as raw bytes: both ends are the same binary */
+  tc__buf_put_int(&b, r->metrics != NULL);
+  if (r->metrics) {
+    tc__buf_append(&b, r->metrics, sizeof(TestMetrics));
+    if (r->metrics->present & TC_METRIC_BENCH)
+      tc__buf_append(&b, r->metrics->bench.samples,
+                     (size_t)r->metrics->bench.sample_count * sizeof(double));
+  }
+  fflush(NULL);
+  tc__write_all(fd, b.data, b.len);
+  free(b.data);
+}
+
+static void tc__send_control(int fd, int msg, int code) {
+  int rec[2];
+  tc__send_coverage(fd);
+  tc__send_spans(fd);
+  rec[0] = msg;
+  rec[1] = code;
+  fflush(NULL);
+  tc__write_all(fd, rec, sizeof(rec));
+}
+
+static const char *tc__read_str(int fd) {
+  unsigned int len;
+  char *s;
+  if (tc__read_all(fd, &len, sizeof(len)) != 0)
+    return NULL;
+  s = (char *)tc__arena_alloc(TC__TEXT, (size_t)len + 1);
+  if (!s) {
+    char sink[256];
+    while (len > 0) {
+      unsigned int chunk = len < sizeof(sink) ? len : (unsigned)sizeof(sink);
+      if (tc__read_all(fd, sink, chunk) != 0)
+        return NULL;
+      len -= chunk;
+    }
+    return "(out of memory)";
+  }
+  if (tc__read_all(fd, s, len) != 0)
+    return NULL;
+  s[len] = '\0';
+  return s;
+}
+
+/*
+ * Parent side: read the next record. Returns 0 with *index set (test index
+ * or a TC__MSG_* control code, with *code filled in), -1 if the child died.
+ */
+static int tc__recv_result(int fd, int *index, int *code, TestResult *out) {
+  int tag, count, i, has_metrics;
+
+  if (tc__read_all(fd, index, sizeof(*index)) != 0)
+    return -1;
+  while (*index == TC__MSG_SPANS || *index == TC__MSG_COVERAGE) {
+    int msg = *index;
+    if (tc__read_all(fd, code, sizeof(*code)) != 0)
+      return -1;
+    if (msg == TC__MSG_SPANS && tc__recv_spans(fd, *code) != 0)
+      return -1;
+#ifdef TC__HAVE_IMPACT
+    if (msg == TC__MSG_COVERAGE && tc__recv_coverage(fd, *code) != 0)
+      return -1;
+#else
+    if (msg == TC__MSG_COVERAGE)
+      return -1;
+#endif
+    if (tc__read_all(fd, index, sizeof(*index)) != 0)
+      return -1;
+  }
+  if (*index < 0)
+    return tc__read_all(fd, code, sizeof(*code));
+
+  *out = tc_pass();
+  if (tc__read_all(fd, &tag, sizeof(tag)) != 0 ||
+      tc__read_all(fd, &out->elapsed_ns, sizeof(out->elapsed_ns)) != 0 ||
+      tc__read_all(fd, &count, sizeof(count)) != 0)
+    return -1;
+  out->tag = (ResultTag)tag;
+
+  for (i = 0; i < count; i++) {
+    const char *msg = tc__read_str(fd);
+    int has;
+    TestError *e;
+    if (!msg || tc__read_all(fd, &has, sizeof(has)) != 0)
+      return -1;
+    e = tc__push_error(out, NULL, has ? TC_OP_TEXT : TC_OP_NONE,
+                       has ? TC_VAL_STR : TC_VAL_NONE);
+    if (e)
+      e->message = msg;
+    if (has) {
+      const char *exp = tc__read_str(fd);
+      const char *act = exp ? tc__read_str(fd) : NULL;
+      if (!act)
+        return -1;
+      if (e) {
+        e->expected.s = exp;
+        e->actual.s = act;
+      }
+    }
+  }
+
+  if (tc__read_all(fd, &has_metrics, sizeof(has_metrics)) != 0)
+    return -1;
+  if (has_metrics) {
+    TestMetrics m;
+    TestMetrics *kept;
+    double *samples = NULL;
+    size_t bytes = 0;
+    if (tc__read_all(fd, &m, sizeof(m)) != 0)
+      return -1;
+    if (m.present & TC_METRIC_BENCH) {
+      bytes = (size_t)m.bench.sample_count * sizeof(double);
+      samples = (double *)tc__arena_alloc(TC__TEXT, bytes ? bytes : 1);
+      if (!samples || tc__read_all(fd, samples, bytes) != 0)
+        return -1;
+      m.bench.samples = samples;
+    }
+    kept = tc__attach_metrics(out);
+    if (kept)
+      *kept = m;
+  }
+  return 0;
+}
+
+static void tc__child_close(tc__Child *c) {
+  tc__mutex_lock(&tc__fork_lock);
+  tc__fds_remove(c->cmd);
+  tc__fds_remove(c->res);
+  tc__mutex_unlock(&tc__fork_lock);
+  close(c->cmd);
+  close(c->res);
+}
+
+/* Wait for the child and describe how it ended */
+static TestResult tc__child_crash(tc__Child *c, uint64_t elapsed_ns) {
+  char actual[128];
+  int status = 0;
+  TestResult r = tc_pass();
+
+  tc__child_close(c);
+  while (waitpid(c->pid, &status, 0) < 0 && errno == EINTR)
+    ;
+
+  if (WIFSIGNALED(status)) {
+    snprintf(actual, sizeof(actual), "killed by signal %d (%s)",
+             WTERMSIG(status), strsignal(WTERMSIG(status)));
+  } else if (WIFEXITED(status)) {
+    snprintf(actual, sizeof(actual), "exited with status %d",
+             WEXITSTATUS(status));
+  } else {
+    snprintf(actual, sizeof(actual), "ended with wait status %d", status);
+  }
+
+  r.tag = TC_FAIL;
+  tc__append_error(&r, "test process crashed", "normal completion", actual);
+  r.elapsed_ns = elapsed_ns;
+  return r;
+}
+
+/* 0 once fd has data (or EOF), -1 if deadline (0: none) passes first */
+static int tc__wait_readable(int fd, uint64_t deadline) {
+  struct pollfd p;
+  uint64_t now, wait_ms;
+  int n;
+
+  while (deadline != 0) {
+    if ((now = tc_now_ns()) >= deadline)
+      return -1;
+    p.fd = fd;
+    p.events = POLLIN;
+    wait_ms = (deadline - now + 999999u) / 1000000u;
+    n = poll(&p, 1, wait_ms > 0x7fffffff ? 0x7fffffff : (int)wait_ms);
+    if (n > 0 || (n < 0 && errno != EINTR))
+      break;
+  }
+  return 0;
+}
+
+/* Kill a child whose test overran its limit */
+static TestResult tc__child_timeout(tc__Child *c, uint64_t limit,
+                                    uint64_t elapsed_ns) {
+  kill(c->pid, SIGKILL);
+  tc__child_close(c);
+  while (waitpid(c->pid, NULL, 0) < 0 && errno == EINTR)
+    ;
+  return tc__timed_out(limit, elapsed_ns);
+}
+
+/*
+ * Every framework lock a child may take, in the order they nest. Each is
+ * held across fork(), so no child starts with one that another worker
+ * had taken mid-update; forks are serialized by tc__fork_lock. This
+ * covers every fork: --isolate, --isolate-suite and TC__RESET_FORK. malloc
+ * and stdio keep their own locks consistent across fork in the C
+ * libraries this path builds on (glibc, musl and the BSDs).
+ */
+static tc__mutex *const tc__fork_held[] = {
+    &tc__report_lock, &tc__out_lock,     &tc__cancel_lock,
+    &tc__watch_lock,  &tc__fixture_lock, &tc__suite_arena_lock,
+#ifdef TC__HAVE_IMPACT
+    &tc__coverage_lock,
+#endif
+};
+
+#define TC__FORK_HELD (int)(sizeof(tc__fork_held) / sizeof(tc__fork_held[0]))
+
+/*
+ * Fork a child that runs body(arg, cmd_fd, res_fd) and then _exits.
+ * Returns 0 in the parent with *c filled in, -1 if the fork failed.
+ */
+static int tc__child_spawn(tc__Child *c, void (*body)(void *, int, int),
+                           void *arg) {
+  int cmd[2], res[2];
+  int i;
+
+  tc__mutex_lock(&tc__fork_lock);
+  if (pipe(cmd) != 0) {
+    tc__mutex_unlock(&tc__fork_lock);
+    return -1;
+  }
+  if (pipe(res) != 0) {
+    close(cmd[0]);
+    close(cmd[1]);
+    tc__mutex_unlock(&tc__fork_lock);
+    return -1;
+  }
+
+  /* No half-written report may be buffered in the child's copy, and no
+     lock the child may take can be held by another thread */
+  for (i = 0; i < TC__FORK_HELD; i++)
+    tc__mutex_lock(tc__fork_held[i]);
+  fflush(NULL);
+  c->pid = fork();
+  for (i = TC__FORK_HELD - 1; i >= 0; i--)
+    tc__mutex_unlock(tc__fork_held[i]);
+  if (c->pid < 0) {
+    close(cmd[0]);
+    close(cmd[1]);
+    close(res[0]);
+    close(res[1]);
+    tc__mutex_unlock(&tc__fork_lock);
+    return -1;
+  }
+
+  if (c->pid == 0) {
+    tc__watch_on = 0; /* the parent enforces the child's timeouts */
+    tc__tls_worker = NULL; /* the pool's threads stayed in the parent */
+    tc__cur_store()->span_count = 0; /* sent to the parent as recorded */
+#ifdef TC__HAVE_IMPACT
+    tc__coverage_count = 0; /* the parent's records stay with the parent */
+#endif
+    for (i = 0; i < tc__child_fd_count; i++)
+      close(tc__child_fds[i]);
+    close(cmd[1]);
+    close(res[0]);
+    body(arg, cmd[0], res[1]);
+    fflush(NULL);
+    _exit(0);
+  }
+
+  close(cmd[0]);
+  close(res[1]);
+  c->cmd = cmd[1];
+  c->res = res[0];
+  tc__fds_add(c->cmd);
+  tc__fds_add(c->res);
+  tc__mutex_unlock(&tc__fork_lock);
+  return 0;
+}
+
+/* --isolate: child inherits env from the parent's setup */
+typedef struct {
+  Suite *suite;
+  void *env;
+  tc__Reset *reset;
+} tc__TestChildArg;
+
+static void tc__test_child(void *arg, int cmd, int res) {
+  tc__TestChildArg *a = (tc__TestChildArg *)arg;
+  int index;
+  while (tc__read_all(cmd, &index, sizeof(index)) == 0 && index >= 0 &&
+         index < a->suite->test_count) {
+    tc__ArenaMark err_mark = tc__arena_mark(TC__ERRORS);
+    tc__ArenaMark text_mark = tc__arena_mark(TC__TEXT);
+    Test *test = &a->suite->tests[index];
+    TestResult r;
+    if (tc__reset_env(a->reset, test, &a->env) != 0) {
+      r = tc__reset_failed();
+    } else {
+      r = tc_run_test(test, a->env);
+      tc__reset_touch(a->reset, test, &r);
+    }
+    tc__send_result(res, index, &r);
+    tc__arena_reset(TC__ERRORS, err_mark);
+    tc__arena_reset(TC__TEXT, text_mark);
+  }
+}
+
+/* Whether a suite resets env by forking, which needs SIGPIPE ignored */
+static int tc__reset_forks(Suite **suites) {
+  int i;
+  for (i = 0; suites[i] != NULL; i++) {
+    if ((suites[i]->flags & TC_SUITE_RESET_ENV) && !suites[i]->snapshot &&
+        suites[i]->env_size == 0)
+      return 1;
+  }
+  return 0;
+}
+
+/* Ask a child to quit and reap it */
+static void tc__child_quit(tc__Child *c) {
+  int quit = -1;
+  tc__write_all(c->cmd, &quit, sizeof(quit));
+  tc__child_close(c);
+  while (waitpid(c->pid, NULL, 0) < 0 && errno == EINTR)
+    ;
+}
+
+/*
+ * Returns 0 if tests ran isolated, -1 to fall back to in-process. With
+ * TC__RESET_FORK every test gets a fresh child, so env is as set up.
+ */
+static int tc__run_tests_forked(Suite *suite, void *env, TestResult *results,
+                                tc__SuiteRecord *rec, tc__Reset *reset) {
+  tc__TestChildArg arg;
+  tc__Child child;
+  int alive = 0;
+  int i;
+
+  arg.suite = suite;
+  arg.env = env;
+  arg.reset = reset;
+
+  for (i = 0; i < suite->test_count; i++) {
+    Test *test = &suite->tests[i];
+    int index, code;
+    uint64_t start, limit;
+
+    if ((test->fn == NULL && test->bench == NULL) || tc__cache_hit(test) ||
+        tc__run_cancelled()) {
+      results[i] = tc_run_test(test, env);
+      continue;
+    }
+    if (!alive) {
+      if (tc__child_spawn(&child, tc__test_child, &arg) != 0) {
+        if (i == 0)
+          return -1;
+        results[i] = tc_fail("could not fork test process");
+        continue;
+      }
+      alive = 1;
+    }
+
+    start = tc_now_ns();
+    limit = tc__timeout_of(test);
+    if (tc__write_all(child.cmd, &i, sizeof(i)) == 0 &&
+        tc__wait_readable(child.res, limit ? start + limit : 0) != 0) {
+      results[i] = tc__child_timeout(&child, limit, tc_now_ns() - start);
+      tc__trace_span(TC__SPAN_TEST, test->name, start, tc_now_ns(), TC_FAIL);
+      alive = 0;
+    } else if (tc__recv_result(child.res, &index, &code, &results[i]) != 0 ||
+               index != i) {
+      results[i] = tc__child_crash(&child, tc_now_ns() - start);
+      tc__trace_span(TC__SPAN_TEST, test->name, start, tc_now_ns(), TC_FAIL);
+      alive = 0;
+    }
+    if (alive && reset->mode == TC__RESET_FORK) {
+      tc__child_quit(&child);
+      alive = 0;
+    }
+    tc__count_failures(results[i].tag == TC_FAIL);
+    tc__record_progress(rec, i + 1);
+  }
+
+  if (alive)
+    tc__child_quit(&child);
+  tc__record_progress(rec, suite->test_count);
+  return 0;
+}
+
+/* --isolate-suite: child runs setup, tests from `first`, then teardown */
+typedef struct {
+  Suite *suite;
+  int first;
+} tc__SuiteChildArg;
+
+static void tc__suite_child(void *arg, int cmd, int res) {
+  tc__SuiteChildArg *a = (tc__SuiteChildArg *)arg;
+  void *env = NULL;
+  tc__Reset reset;
+  uint64_t mark = tc_now_ns();
+  int i, ret = 0;
+  (void)cmd;
+
+  if (a->suite->setup) {
+    tc__impact_begin();
+    ret = a->suite->setup(&env);
+    tc__impact_end(a->suite);
+  }
+  if (ret == 0) {
+    ret = tc__reset_init(&reset, a->suite, env, 0);
+    if (ret != 0 && a->suite->teardown)
+      a->suite->teardown(env);
+  }
+  tc__trace_span(TC__SPAN_SETUP, "setup", mark, tc_now_ns(),
+                 ret != 0 ? TC_FAIL : TC_PASS);
+  if (ret != 0) {
+    tc__send_control(res, TC__MSG_SETUP_FAILED, ret);
+    return;
+  }
+  tc__send_control(res, TC__MSG_SETUP_DONE, 0);
+  for (i = a->first; i < a->suite->test_count; i++) {
+    tc__ArenaMark err_mark = tc__arena_mark(TC__ERRORS);
+    tc__ArenaMark text_mark = tc__arena_mark(TC__TEXT);
+    Test *test = &a->suite->tests[i];
+    TestResult r;
+    if (tc__reset_env(&reset, test, &env) != 0) {
+      r = tc__reset_failed();
+    } else {
+      r = tc_run_test(test, env);
+      tc__reset_touch(&reset, test, &r);
+    }
+    tc__send_result(res, i, &r);
+    tc__arena_reset(TC__ERRORS, err_mark);
+    tc__arena_reset(TC__TEXT, text_mark);
+  }
+  mark = tc_now_ns();
+  tc__reset_free(&reset);
+  if (a->suite->teardown && !reset.broken) {
+    tc__impact_begin();
+    a->suite->teardown(env);
+    tc__impact_end(a->suite);
+  }
+  tc__trace_span(TC__SPAN_TEARDOWN, "teardown", mark, tc_now_ns(), TC_PASS);
+  tc__send_control(res, TC__MSG_DONE, 0);
+}
+
+/*
+ * Returns the setup result (0 on success). A crash costs only the test
+ * that was running: a fresh child picks up from the next one. A crash
+ * or timeout in teardown is left in *teardown. Setup and teardown are
+ * timed against the default limit, each test from when the child is
+ * done with what came before it.
+ */
+static int tc__run_suite_forked(Suite *suite, TestResult *results,
+                                tc__SuiteRecord *rec, int *forked,
+                                TestResult *teardown) {
+  tc__SuiteChildArg arg;
+  int next = 0;
+
+  *forked = 1;
+  arg.suite = suite;
+
+  while (next < suite->test_count) {
+    tc__Child child;
+    uint64_t start = tc_now_ns();
+    int done = 0, ready = 0;
+
+    arg.first = next;
+    if (tc__child_spawn(&child, tc__suite_child, &arg) != 0) {
+      if (next == 0) {
+        *forked = 0;
+        return 0;
+      }
+      for (; next < suite->test_count; next++)
+        results[next] = tc_fail("could not fork suite process");
+      break;
+    }
+
+    while (!done) {
+      int index, code;
+      TestResult r;
+      uint64_t limit = ready && next < suite->test_count
+                           ? tc__timeout_of(&suite->tests[next])
+                           : tc__stage_timeout();
+      if (tc__wait_readable(child.res, limit ? start + limit : 0) != 0) {
+        uint64_t elapsed = tc_now_ns() - start;
+        r = tc__child_timeout(&child, limit, elapsed);
+        if (!ready) {
+          /* Setup hung: none of the tests left can run */
+          tc__count_failures(suite->test_count - next);
+          for (; next < suite->test_count; next++) {
+            if (r.error_count > 0)
+              r.errors[0].message = "setup timed out";
+            results[next] = r;
+            r = tc__timed_out(limit, elapsed);
+          }
+        } else if (next < suite->test_count) {
+          results[next] = r;
+          tc__trace_span(TC__SPAN_TEST, suite->tests[next].name, start,
+                         tc_now_ns(), TC_FAIL);
+          tc__count_failures(1);
+          next++;
+        } else {
+          *teardown = r;
+          if (teardown->error_count > 0)
+            teardown->errors[0].message = "teardown timed out";
+        }
+        break;
+      }
+      if (tc__recv_result(child.res, &index, &code, &r) != 0) {
+        if (!ready) {
+          /* Setup crashed: it would crash again for every test left */
+          r = tc__child_crash(&child, tc_now_ns() - start);
+          if (r.error_count > 0)
+            r.errors[0].message = "setup crashed";
+          tc__count_failures(suite->test_count - next);
+          for (; next < suite->test_count; next++)
+            results[next] = r;
+        } else if (next < suite->test_count) {
+          results[next] = tc__child_crash(&child, tc_now_ns() - start);
+          tc__trace_span(TC__SPAN_TEST, suite->tests[next].name, start,
+                         tc_now_ns(), TC_FAIL);
+          tc__count_failures(1);
+          next++;
+        } else {
+          *teardown = tc__child_crash(&child, tc_now_ns() - start);
+          if (teardown->error_count > 0)
+            teardown->errors[0].message = "teardown crashed";
+        }
+        break;
+      }
+      if (index == TC__MSG_SETUP_FAILED) {
+        tc__child_close(&child);
+        while (waitpid(child.pid, NULL, 0) < 0 && errno == EINTR)
+          ;
+        if (next == 0)
+          return code;
+        for (; next < suite->test_count; next++)
+          results[next] = tc_fail("setup failed in restarted suite process");
+        break;
+      }
+      if (index == TC__MSG_SETUP_DONE) {
+        ready = 1;
+        start = tc_now_ns();
+        continue;
+      }
+      if (index == TC__MSG_DONE) {
+        tc__child_close(&child);
+        while (waitpid(child.pid, NULL, 0) < 0 && errno == EINTR)
+          ;
+        done = 1;
+        break;
+      }
+      if (index >= 0 && index < suite->test_count) {
+        results[index] = r;
+        tc__count_failures(r.tag == TC_FAIL);
+        next = index + 1;
+        start = tc_now_ns();
+        tc__record_progress(rec, next);
+      }
+    }
+    if (done)
+      break;
+  }
+  tc__record_progress(rec, suite->test_count);
+  return 0;
+}
+
+#endif
+
+/* ============================================================
+   WATCHDOG
+   Enforces in-process timeouts. A test that overruns its limit but
+   returns within TC__WATCH_GRACE_NS just fails. One still running
+   after that is hung, and cannot be stopped safely inside the
+   process, so the run ends instead. The watchdog:
+   1. cancels the run, so nothing new starts;
+   2. waits for the other running tests to finish or hang too;
+   3. reports each unfinished suite: finished results, the hung tests
+      as timed out, and the rest as not run;
+   4. ends the reports and exits with status 1.
+   The run thus ends within the longest limit of the tests running
+   when the first one hung, plus twice TC__WATCH_GRACE_NS.
+   ============================================================ */
+
+#ifndef TC_NO_THREADS
+
+#define TC__WATCH_TICK_NS TC_MS(5)
+#define TC__WATCH_GRACE_NS TC_MS(1000)
+
+static int tc__watch_stop;
+static tc__thread tc__watch_thread;
+static tc__Store tc__watch_store;
+static uint64_t tc__run_start_ns;
+
+/* Slot running test, or -1; caller holds tc__watch_lock */
+static int tc__watch_slot(const Test *test) {
+  int i;
+  for (i = 0; i < tc__watch_count; i++)
+    if (tc__watches[i].test == test)
+      return i;
+  return -1;
+}
+
+/* Every started suite has been reported or holds a hung test or stage */
+static int tc__records_settled(uint64_t now) {
+  int i, j, settled = 1;
+  tc__mutex_lock(&tc__report_lock);
+  tc__mutex_lock(&tc__watch_lock);
+  for (i = 0; settled && i < tc__record_count; i++) {
+    const tc__SuiteRecord *rec = &tc__records[i];
+    int hung = 0;
+    if (!rec->started || rec->reported)
+      continue;
+    for (j = 0; !hung && j < tc__watch_count; j++) {
+      const Test *t = tc__watches[j].test;
+      hung = now >= tc__watches[j].deadline + TC__WATCH_GRACE_NS &&
+             (tc__watches[j].suite == rec->suite ||
+              (t && (uintptr_t)t >= (uintptr_t)rec->suite->tests &&
+               (uintptr_t)t < (uintptr_t)(rec->suite->tests +
+                                          rec->suite->test_count)));
+    }
+    settled = hung;
+  }
+  tc__mutex_unlock(&tc__watch_lock);
+  tc__mutex_unlock(&tc__report_lock);
+  return settled;
+}
+
+/* Slot holding a stage of suite, or -1; caller holds tc__watch_lock */
+static int tc__watch_stage_slot(const Suite *suite) {
+  int i;
+  for (i = 0; i < tc__watch_count; i++)
+    if (!tc__watches[i].test && tc__watches[i].suite == suite)
+      return i;
+  return -1;
+}
+
+/*
+ * Report what is unfinished, end the run's reports and exit. Tests a
+ * hung setup held back fail as timed out, as under --isolate-suite, and
+ * a hung teardown is the suite's error.
+ */
+static void tc__watchdog_flush(void) {
+  uint64_t now = tc_now_ns();
+  RunSummary total;
+  int i, j;
+
+  tc__mutex_lock(&tc__report_lock); /* held until exit */
+  tc__mutex_lock(&tc__watch_lock);
+  for (i = 0; i < tc__record_count; i++) {
+    tc__SuiteRecord *rec = &tc__records[i];
+    const Suite *suite = rec->suite;
+    TestResult *partial;
+    TestResult teardown;
+    RunSummary part;
+    int stage, in_teardown;
+
+    if (rec->reported)
+      continue;
+    stage = tc__watch_stage_slot(suite);
+    in_teardown =
+        stage >= 0 && strcmp(tc__watches[stage].stage, "teardown") == 0;
+    partial = (TestResult *)malloc(
+        (size_t)(suite->test_count > 0 ? suite->test_count : 1) *
+        sizeof(TestResult));
+    if (!partial)
+      continue;
+    memset(&part, 0, sizeof(part));
+    if (rec->started)
+      part.total_ms = tc__ms_since(rec->start_ns);
+    for (j = 0; j < suite->test_count; j++) {
+      int slot = tc__watch_slot(&suite->tests[j]);
+      if (rec->results && j < rec->count)
+        partial[j] = rec->results[j];
+      else if (slot >= 0)
+        partial[j] = tc__timed_out(
+            tc__watches[slot].deadline - tc__watches[slot].start,
+            now - tc__watches[slot].start);
+      else if (stage >= 0 && !in_teardown) {
+        partial[j] = tc__timed_out(
+            tc__watches[stage].deadline - tc__watches[stage].start,
+            now - tc__watches[stage].start);
+        if (partial[j].error_count > 0)
+          partial[j].errors[0].message =
+              tc__store_printf("%s timed out", tc__watches[stage].stage);
+      } else
+        partial[j] = tc__not_run();
+      switch (partial[j].tag) {
+      case TC_PASS:
+        part.passed++;
+        part.cached += tc__is_cached(&partial[j]);
+        break;
+      case TC_FAIL:
+        part.failed++;
+        break;
+      case TC_SKIP:
+        part.skipped++;
+        part.not_run += tc__is_not_run(&partial[j]);
+        break;
+      }
+    }
+    if (in_teardown) {
+      teardown = tc__timed_out(
+          tc__watches[stage].deadline - tc__watches[stage].start,
+          now - tc__watches[stage].start);
+      if (teardown.error_count > 0)
+        teardown.errors[0].message = "teardown timed out";
+      part.errored++;
+    }
+    rec->reported = 1;
+    tc__emit_suite_end_locked(suite, partial, 0, in_teardown ? &teardown : NULL,
+                              part);
+    free(partial);
+  }
+  tc__mutex_unlock(&tc__watch_lock);
+
+  total = tc__reported;
+  total.total_ms = tc__ms_since(tc__run_start_ns);
+  tc__emit_run_end_locked(total);
+  tc_print_summary(total);
+  fflush(NULL);
+  _Exit(1);
+}
+
+static void tc__watchdog(void *arg) {
+  uint64_t settle_by = 0;
+  (void)arg;
+  tc__tls_store = &tc__watch_store;
+
+  for (;;) {
+    tc__Watch hung;
+    uint64_t now;
+    int stop, busy = 0, found = 0, i;
+
+    memset(&hung, 0, sizeof(hung));
+    tc__sleep_ns(TC__WATCH_TICK_NS);
+    tc__mutex_lock(&tc__watch_lock);
+    stop = tc__watch_stop;
+    now = tc_now_ns();
+    for (i = 0; i < tc__watch_count; i++) {
+      if (!tc__watches[i].test && !tc__watches[i].suite)
+        continue;
+      if (now < tc__watches[i].deadline + TC__WATCH_GRACE_NS) {
+        busy = 1;
+      } else if (!found) {
+        hung = tc__watches[i];
+        found = 1;
+      }
+    }
+    tc__mutex_unlock(&tc__watch_lock);
+
+    if (stop)
+      return;
+    if (!found && settle_by == 0)
+      continue;
+    if (settle_by == 0) {
+      char shown[32];
+      tc__format_ns(shown, sizeof(shown), hung.deadline - hung.start);
+      if (hung.test)
+        fprintf(stderr,
+                "\nError: Test '%s' hangs past its %s timeout; stopping the "
+                "run\n",
+                hung.test->name, shown);
+      else
+        fprintf(stderr,
+                "\nError: Suite '%s' %s hangs past its %s timeout; stopping "
+                "the run\n",
+                hung.suite->name, hung.stage, shown);
+      tc__mutex_lock(&tc__cancel_lock);
+      tc__cancel = 1;
+      tc__mutex_unlock(&tc__cancel_lock);
+      settle_by = now + TC__WATCH_GRACE_NS;
+    }
+    if (!busy && (now >= settle_by || tc__records_settled(now)))
+      tc__watchdog_flush();
+  }
+}
+
+/* Start the watchdog if any test of the run has a timeout */
+static void tc__watchdog_start(Suite **suites, uint64_t start) {
+  int i, j, any = tc__timeout_ns != 0;
+  for (i = 0; !any && suites[i] != NULL; i++)
+    for (j = 0; !any && j < suites[i]->test_count; j++)
+      any = suites[i]->tests[j].timeout_ns != 0;
+  if (!any)
+    return;
+  tc__run_start_ns = start;
+  tc__watch_stop = 0;
+  tc__watch_on = 1;
+  if (tc__thread_start(&tc__watch_thread, tc__watchdog, NULL) != 0)
+    tc__watch_on = 0;
+}
+
+static void tc__watchdog_stop(void) {
+  if (!tc__watch_on)
+    return;
+  tc__mutex_lock(&tc__watch_lock);
+  tc__watch_stop = 1;
+  tc__mutex_unlock(&tc__watch_lock);
+  tc__thread_join(tc__watch_thread);
+  tc__watch_on = 0;
+}
+
+#else
+
+/* Without threads only isolated tests can be stopped */
+static void tc__watchdog_start(Suite **suites, uint64_t start) {
+  int i, j, any = tc__timeout_ns != 0;
+  (void)start;
+  for (i = 0; !any && suites[i] != NULL; i++)
+    for (j = 0; !any && j < suites[i]->test_count; j++)
+      any = suites[i]->tests[j].timeout_ns != 0;
+  if (any && tc__isolation == TC_ISOLATE_NONE)
+    fprintf(stderr, "Warning: timeouts need threads or --isolate; tests "
+                    "that overrun fail only once they return\n");
+}
+
+#define tc__watchdog_stop() ((void)0)
+
+#endif
+
+static RunSummary tc__run_suite_ex(Suite *suite, tc__SuiteRecord *rec) {
+  RunSummary summary;
+  TestResult *results;
+  uint64_t start, mark;
+  int i, slot;
+  int setup_ret = 0;
+  int forked = 0, isolated = 0, can_fork = 0;
+  int cached = tc__suite_cached(suite);
+  int skipped = tc__run_cancelled(); /* not started: no setup either */
+  void *env = NULL;
+  tc__FixtureSet fixtures;
+  tc__FixtureSet *saved_fixtures = tc__tls_fixtures;
+  tc__Arena suite_arena, *saved_arena = tc__tls_suite_arena;
+  const Suite *saved_suite = tc__tls_suite;
+  tc__Reset reset;
+  TestResult teardown = tc_pass();
+
+  memset(&summary, 0, sizeof(summary));
+  memset(&reset, 0, sizeof(reset));
+  start = tc_now_ns();
+
+  results = rec ? rec->results
+                : (TestResult *)malloc(
+                      (size_t)(suite->test_count > 0 ? suite->test_count : 1) *
+                      sizeof(TestResult));
+  if (!results) {
+    fprintf(stderr, "Error: Out of memory running suite '%s'\n", suite->name);
+    if (tc__fixture_set_init(&fixtures, suite, 1) == 0)
+      tc__fixtures_release(&fixtures);
+    summary.errored = suite->test_count;
+    return summary;
+  }
+  tc__emit_suite_start(suite);
+  if (rec)
+    rec->start_ns = start; /* published with started */
+  tc__record_progress(rec, 0);
+
+  /* Built here even for --isolate-suite, so children share them */
+  memset(&fixtures, 0, sizeof(fixtures));
+  memset(&suite_arena, 0, sizeof(suite_arena));
+  tc__tls_fixtures = &fixtures;
+  tc__tls_suite_arena = &suite_arena;
+  tc__tls_suite = suite;
+  mark = tc_now_ns();
+  if (cached || skipped || (setup_ret = tc__reset_check(suite)) != 0) {
+    tc__fixture_set_init(&fixtures, suite, 1); /* counts to drop */
+  } else {
+    slot = tc__watch_stage(suite, "fixture setup");
+    setup_ret = tc__fixtures_acquire(suite, &fixtures);
+    tc__watch_end(slot);
+  }
+
+#ifdef TC__HAVE_FORK
+  if (tc__isolation == TC_ISOLATE_SUITE && !cached && !skipped &&
+      setup_ret == 0) {
+    setup_ret = tc__run_suite_forked(suite, results, rec, &forked, &teardown);
+  }
+#endif
+  if (!forked && !cached && !skipped && setup_ret == 0 && suite->setup) {
+    slot = tc__watch_stage(suite, "setup");
+    tc__impact_begin();
+    setup_ret = suite->setup(&env);
+    tc__impact_end(suite);
+    tc__watch_end(slot);
+  }
+#ifdef TC__HAVE_FORK
+  can_fork = tc__isolation != TC_ISOLATE_SUITE;
+#endif
+  if (!forked && !cached && !skipped && setup_ret == 0) {
+    setup_ret = tc__reset_init(&reset, suite, env, can_fork);
+    if (setup_ret != 0 && suite->teardown)
+      suite->teardown(env);
+  }
+  if (!forked && !cached && !skipped)
+    tc__trace_span(TC__SPAN_SETUP, "setup", mark, tc_now_ns(),
+                   setup_ret != 0 ? TC_FAIL : TC_PASS);
+
+  if (setup_ret != 0) {
+    tc__count_failures(suite->test_count);
+    tc__fixtures_release(&fixtures);
+    tc__tls_fixtures = saved_fixtures;
+    tc__arena_free(&suite_arena);
+    tc__tls_suite_arena = saved_arena;
+    tc__tls_suite = saved_suite;
+    tc__trace_span(TC__SPAN_SUITE, suite->name, start, tc_now_ns(), TC_FAIL);
+    summary.total_ms = tc__ms_since(start);
+    summary.errored = suite->test_count;
+    tc__emit_suite_end(rec, suite, NULL, setup_ret, NULL, summary);
+    if (!rec)
+      free(results);
+    return summary;
+  }
+
+#ifdef TC__HAVE_FORK
+  if (!forked && !cached && !skipped &&
+      (tc__isolation == TC_ISOLATE_TEST || reset.mode == TC__RESET_FORK) &&
+      tc__run_tests_forked(suite, env, results, rec, &reset) == 0) {
+    isolated = 1;
+  }
+#endif
+  if (reset.mode == TC__RESET_FORK && !isolated)
+    reset.mode = TC__RESET_SETUP;
+
+  i = 0;
+  while (!forked && !isolated && i < suite->test_count) {
+    int end = i;
+    while (end < suite->test_count &&
+           tc__test_shared(suite, &suite->tests[end]))
+      end++;
+    if (tc__reset_env(&reset, &suite->tests[i], &env) != 0) {
+      results[i] = tc__reset_failed();
+      i++;
+    } else if (end - i > 1 &&
+               tc__run_batch(&suite->tests[i], end - i, env, &results[i])) {
+      i = end;
+    } else {
+      results[i] = tc_run_test(&suite->tests[i], env);
+      tc__reset_touch(&reset, &suite->tests[i], &results[i]);
+      i++;
+    }
+    tc__record_progress(rec, i);
+  }
+
+  for (i = 0; i < suite->test_count; i++) {
+    ResultTag before = results[i].tag;
+    tc__budget_judge(suite, &suite->tests[i], &results[i]);
+    if (tc__baseline_count > 0)
+      tc__bench_judge(suite, &suite->tests[i], &results[i]);
+    tc__count_failures(before != TC_FAIL && results[i].tag == TC_FAIL);
+  }
+
+  for (i = 0; i < suite->test_count; i++) {
+    switch (results[i].tag) {
+    case TC_PASS:
+      summary.passed++;
+      summary.cached += tc__is_cached(&results[i]);
+      break;
+    case TC_FAIL:
+      summary.failed++;
+      break;
+    case TC_SKIP:
+      summary.skipped++;
+      summary.not_run += tc__is_not_run(&results[i]);
+      break;
+    }
+  }
+
+  mark = tc_now_ns();
+  tc__reset_free(&reset);
+  if (!forked && !cached && !skipped && !reset.broken && suite->teardown) {
+    slot = tc__watch_stage(suite, "teardown");
+    tc__impact_begin();
+    suite->teardown(env);
+    tc__impact_end(suite);
+    tc__watch_end(slot);
+  }
+  tc__fixtures_release(&fixtures);
+  if (teardown.tag == TC_FAIL) {
+    tc__count_failures(1);
+    summary.errored++;
+  }
+  if (!forked && !cached && !skipped)
+    tc__trace_span(TC__SPAN_TEARDOWN, "teardown", mark, tc_now_ns(),
+                   TC_PASS);
+  tc__tls_fixtures = saved_fixtures;
+  tc__arena_free(&suite_arena);
+  tc__tls_suite_arena = saved_arena;
+  tc__tls_suite = saved_suite;
+
+  tc__trace_span(TC__SPAN_SUITE, suite->name, start, tc_now_ns(),
+                 summary.failed > 0 || summary.errored > 0 ? TC_FAIL
+                                                          : TC_PASS);
+  summary.total_ms = tc__ms_since(start);
+
+  tc__emit_suite_end(rec, suite, results, 0,
+                     teardown.tag == TC_FAIL ? &teardown : NULL, summary);
+
+  if (!rec)
+    free(results);
+  return summary;
+}
+
+RunSummary tc_run_suite(Suite *suite) {
+  RunSummary summary;
+  Suite *run[2];
+  run[0] = suite;
+  run[1] = NULL;
+  tc__cancel_reset();
+  tc__seed_pick();
+  tc__fixtures_plan(run);
+  summary = tc__run_suite_ex(suite, NULL);
+  tc__fixtures_finish();
+  tc__report_finish();
+  return summary;
+}
+
+static void tc__suite_task(void *arg) {
+  tc__SuiteRecord *rec = (tc__SuiteRecord *)arg;
+  rec->summary = tc__run_suite_ex(rec->suite, rec);
+}
+
+/* Serial flag, or has benchmarks, whose timings need an idle machine */
+static int tc__suite_serial(const Suite *suite) {
+  int j;
+  if (suite->flags & TC_SUITE_SERIAL)
+    return 1;
+  for (j = 0; j < suite->test_count; j++)
+    if (suite->tests[j].bench)
+      return 1;
+  return 0;
+}
+
+static void tc__run_records(int jobs) {
+  int i;
+  int parallel = 0;
+  tc__Pool pool;
+
+#ifdef TC_NO_THREADS
+  jobs = 1;
+#endif
+  /* Suites count once; shared-env tests can each use a worker */
+  for (i = 0; i < tc__record_count; i++) {
+    Suite *suite = tc__records[i].suite;
+    int j, shared = 0;
+    if (!tc__records[i].results || tc__suite_serial(suite))
+      continue;
+    for (j = 0; j < suite->test_count && tc__isolation == TC_ISOLATE_NONE; j++)
+      shared += tc__test_shared(suite, &suite->tests[j]);
+    parallel += shared > 1 ? shared : 1;
+  }
+  if (jobs > parallel)
+    jobs = parallel;
+
+  if (jobs > 1) {
+    tc__worker_stores = (tc__Store *)calloc((size_t)jobs, sizeof(tc__Store));
+    if (tc__worker_stores &&
+        tc__pool_init(&pool, jobs, tc__worker_stores) == 0) {
+      int next = 0;
+      tc__worker_store_count = jobs;
+      for (i = 0; i < tc__record_count; i++) {
+        tc__SuiteRecord *rec = &tc__records[i];
+        if (rec->results && !tc__suite_serial(rec->suite))
+          tc__pool_push(&pool, next++, tc__suite_task, rec, NULL);
+      }
+      tc__pool_run(&pool);
+      tc__pool_destroy(&pool);
+    } else {
+      free(tc__worker_stores);
+      tc__worker_stores = NULL;
+      jobs = 1;
+    }
+  }
+
+  /* Serial suites, and everything when not running in parallel */
+  for (i = 0; i < tc__record_count; i++) {
+    tc__SuiteRecord *rec = &tc__records[i];
+    if (jobs > 1 && !tc__suite_serial(rec->suite))
+      continue;
+    if (!rec->results) {
+      fprintf(stderr, "Error: Out of memory storing results for '%s'\n",
+              rec->suite->name);
+      rec->summary.errored = rec->suite->test_count;
+      continue;
+    }
+    rec->summary = tc__run_suite_ex(rec->suite, rec);
+  }
+}
+
+static RunSummary tc__run_all_ex(Suite **suites, int jobs) {
+  RunSummary total;
+  uint64_t start;
+  int i, n;
+
+  memset(&total, 0, sizeof(total));
+  tc__records_clear();
+  tc__cancel_reset();
+  tc__clock_init();
+
+  for (n = 0; suites[n] != NULL; n++)
+    ;
+  if (tc__records_reserve(suites, n) != 0) {
+    fprintf(stderr, "Error: Out of memory reserving results\n");
+    for (i = 0; i < n; i++)
+      total.errored += suites[i]->test_count;
+    return total;
+  }
+
+  tc__seed_pick();
+  tc__fixtures_plan(suites);
+  start = tc_now_ns();
+  memset(&tc__reported, 0, sizeof(tc__reported));
+  tc__emit_run_start(suites);
+  tc__watchdog_start(suites, start);
+#ifdef TC__HAVE_FORK
+  if (tc__isolation != TC_ISOLATE_NONE || tc__reset_forks(suites)) {
+    /* A dead child must show up as EOF, not kill the runner */
+    void (*old_pipe)(int) = signal(SIGPIPE, SIG_IGN);
+    tc__run_records(jobs);
+    signal(SIGPIPE, old_pipe);
+  } else {
+    tc__run_records(jobs);
+  }
+#else
+  if (tc__isolation != TC_ISOLATE_NONE) {
+    fprintf(stderr, "Warning: process isolation is not supported on this "
+                    "platform; running tests in-process\n");
+  }
+  tc__run_records(jobs);
+#endif
+
+  tc__watchdog_stop();
+  tc__fixtures_finish();
+  tc__trace_span(TC__SPAN_RUN, "run", start, tc_now_ns(), TC_PASS);
+
+  for (i = 0; i < tc__record_count; i++) {
+    total.passed += tc__records[i].summary.passed;
+    total.failed += tc__records[i].summary.failed;
+    total.skipped += tc__records[i].summary.skipped;
+    total.errored += tc__records[i].summary.errored;
+    total.cached += tc__records[i].summary.cached;
+    total.not_run += tc__records[i].summary.not_run;
+  }
+
+  total.total_ms = tc__ms_since(start);
+  tc__emit_run_end(total);
+  return total;
+}
+
+RunSummary tc_run_all(Suite **suites) { return tc__run_all_ex(suites, 1); }
+
+RunSummary tc_run_all_parallel(Suite **suites, int jobs) {
+  return tc__run_all_ex(suites, jobs > 0 ? jobs : tc__cpu_count());
+}
+
+int tc_print_summary(RunSummary summary) {
+  int total =
+      summary.passed + summary.failed + summary.skipped + summary.errored;
+
+  fprintf(tc__console(), "\n%d/%d passed", summary.passed, total);
+  if (summary.cached > 0)
+    fprintf(tc__console(), " (%d cached)", summary.cached);
+  fprintf(tc__console(), ", %d failed, %d skipped", summary.failed,
+          summary.skipped);
+  if (summary.not_run > 0)
+    fprintf(tc__console(), " (%d not run)", summary.not_run);
+  fprintf(tc__console(), ", %d errored (Total: %.2fms)\n", summary.errored,
+          summary.total_ms);
+
+  return (summary.failed > 0 || summary.errored > 0) ? 1 : 0;
+}
+
+/* ============================================================
+   BENCHMARK OUTPUT
+   ============================================================ */
+
+static void tc__json_write(FILE *f, const char *src) {
+  tc__Buf b = {0};
+  tc__buf_json(&b, src);
+  fwrite(b.data, 1, b.len, f);
+  tc__buf_free(&b);
+}
+
+/* Counters per operation, e.g. "cycles_per_op": 12.5 */
+static void tc__bench_perf_json(FILE *f, const PerfStats *p, double ops) {
+  int i;
+
+  for (i = 0; i < TC__PERF_EVENTS; i++) {
+    if (p->present & (1u << i))
+      fprintf(f, ", \"%s_per_op\": %.6g", tc__perf_keys[i],
+              (double)tc__perf_count(p, i) / ops);
+  }
+  if (p->ipc > 0)
+    fprintf(f, ", \"ipc\": %.6g", p->ipc);
+}
+
+int tc_write_bench_json(const char *filename, Suite **suites) {
+  FILE *f;
+  int i, j, k;
+  int first = 1;
+
+  f = fopen(filename, "w");
+  if (!f) {
+    fprintf(stderr, "Error: Cannot open file '%s' for writing\n", filename);
+    return -1;
+  }
+
+  fputs("{\"benchmarks\": [", f);
+  for (i = 0; suites[i] != NULL; i++) {
+    Suite *suite = suites[i];
+    if (i >= tc__record_count || tc__records[i].suite != suite)
+      continue;
+
+    for (j = 0; j < tc__records[i].count && j < suite->test_count; j++) {
+      const TestResult *r = &tc__records[i].results[j];
+      const BenchStats *st;
+      if (!r->metrics || !(r->metrics->present & TC_METRIC_BENCH))
+        continue;
+      st = &r->metrics->bench;
+
+      fputs(first ? "\n{\"suite\": " : ",\n{\"suite\": ", f);
+      first = 0;
+      tc__json_write(f, suite->name);
+      fputs(", \"name\": ", f);
+      tc__json_write(f, suite->tests[j].name);
+      fprintf(f,
+              ", \"iterations\": %llu, \"samples\": %d, \"min_ns\": %.6g, "
+              "\"median_ns\": %.6g, \"mean_ns\": %.6g, \"p99_ns\": %.6g, "
+              "\"stddev_ns\": %.6g, \"ops_per_sec\": %.6g, \"sample_ns\": [",
+              (unsigned long long)st->iterations, st->sample_count, st->min_ns,
+              st->median_ns, st->mean_ns, st->p99_ns, st->stddev_ns,
+              st->ops_per_sec);
+      for (k = 0; k < st->sample_count; k++)
+        fprintf(f, k ? ", %.6g" : "%.6g", st->samples[k]);
+      fputs("]", f);
+      if ((r->metrics->present & TC_METRIC_PERF) && st->iterations > 0)
+        tc__bench_perf_json(f, &r->metrics->perf,
+                            (double)st->iterations * st->sample_count);
+      fputs("}", f);
+    }
+  }
+  fputs("\n]}\n", f);
+  fclose(f);
+
+  return 0;
+}
+
+/* ============================================================
+   TRACE OUTPUT
+   Chrome trace-event JSON: one complete ("X") event per span, in
+   microseconds from the first span, with the worker as tid. The main
+   thread is worker 0 of a parallel run, so both share track 0.
+   ============================================================ */
+
+static uint64_t tc__trace_first(const tc__Store *st, uint64_t first) {
+  int i;
+  for (i = 0; i < st->span_count; i++) {
+    if (st->spans[i].start_ns < first)
+      first = st->spans[i].start_ns;
+  }
+  return first;
+}
+
+static void tc__trace_write_spans(FILE *f, tc__Buf *b, const tc__Store *st,
+                                  int track, uint64_t base) {
+  static const char *const cats[] = {"run", "suite", "setup", "test",
+                                     "teardown"};
+  int i;
+
+  for (i = 0; i < st->span_count; i++) {
+    const tc__Span *sp = &st->spans[i];
+    tc__buf_puts(b, ",\n{\"name\":");
+    tc__buf_json(b, sp->name);
+    tc__buf_printf(b,
+                   ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                   "\"pid\":1,\"tid\":%d",
+                   cats[sp->kind], (double)(sp->start_ns - base) / 1e3,
+                   (double)sp->dur_ns / 1e3, track);
+    if (sp->kind == TC__SPAN_TEST) {
+      tc__buf_puts(b, ",\"args\":{\"suite\":");
+      tc__buf_json(b, sp->suite);
+      tc__buf_printf(b, ",\"status\":\"%s\"}",
+                     tc__tag_name((ResultTag)sp->tag));
+    } else if (sp->kind == TC__SPAN_SETUP && sp->tag == TC_FAIL) {
+      tc__buf_puts(b, ",\"args\":{\"status\":\"fail\"}");
+    }
+    tc__buf_puts(b, "}");
+    if (b->len >= 65536) {
+      fwrite(b->data, 1, b->len, f);
+      b->len = 0;
+    }
+  }
+}
+
+int tc_write_trace(const char *filename) {
+  int tracks = tc__worker_store_count > 0 ? tc__worker_store_count : 1;
+  uint64_t base = tc__trace_first(&tc__main_store, (uint64_t)-1);
+  tc__Buf b = {0};
+  FILE *f;
+  int i;
+
+  f = fopen(filename, "w");
+  if (!f) {
+    fprintf(stderr, "Error: Cannot open file '%s' for writing\n", filename);
+    return -1;
+  }
+  for (i = 0; i < tc__worker_store_count; i++)
+    base = tc__trace_first(&tc__worker_stores[i], base);
+
+  tc__buf_puts(&b, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+                   "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+                   "\"args\":{\"name\":\"testcracks\"}}");
+  for (i = 0; i < tracks; i++) {
+    tc__buf_printf(&b,
+                   ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                   "\"tid\":%d,\"args\":{\"name\":\"worker %d\"}}",
+                   i, i);
+    if (i == 0)
+      tc__trace_write_spans(f, &b, &tc__main_store, 0, base);
+    if (i < tc__worker_store_count)
+      tc__trace_write_spans(f, &b, &tc__worker_stores[i], i, base);
+  }
+  tc__buf_puts(&b, "\n]}\n");
+  if (b.len)
+    fwrite(b.data, 1, b.len, f);
+  tc__buf_free(&b);
+  return fclose(f) == 0 ? 0 : -1;
+}
+
+/* ============================================================
+   FILTERS
+   --include/--exclude patterns are compiled once: wildcard-free,
+   prefix, suffix and infix globs become plain compares, the rest use
+   a glob matcher, and "re:" patterns are POSIX extended regexes. Tag
+   expressions compile to a postfix program over the tags they name, and
+   each test's tags become a bit mask, so evaluation is a few shifts.
+   ============================================================ */
+
+#define TC__FILTER_TAGS 64
+
+enum {
+  TC__PAT_EXACT,
+  TC__PAT_PREFIX,
+  TC__PAT_SUFFIX,
+  TC__PAT_CONTAINS,
+  TC__PAT_GLOB,
+  TC__PAT_REGEX
+};
+
+typedef struct {
+  int kind;
+  const char *glob; /* TC__PAT_GLOB: the pattern itself */
+  char *literal;    /* the fixed text of the compare kinds */
+  size_t len;
+#ifdef TC__HAVE_REGEX
+  regex_t re;
+#endif
+} tc__Pattern;
+
+enum { TC__TAG_HAS, TC__TAG_NOT, TC__TAG_AND, TC__TAG_OR };
+
+typedef struct {
+  int op;
+  int bit; /* TC__TAG_HAS */
+} tc__TagOp;
+
+typedef struct {
+  tc__Pattern *include;
+  int include_count;
+  tc__Pattern *exclude;
+  int exclude_count;
+  tc__TagOp *ops; /* postfix; none means no tag expression */
+  int op_count;
+  int depth; /* evaluation stack depth of the program so far */
+  const char *tag_names[TC__FILTER_TAGS];
+  size_t tag_lens[TC__FILTER_TAGS];
+  int tag_count;
+  tc__Buf name; /* scratch "suite/test" */
+} tc__Filter;
+
+/*
+ * Class body after '['; 1 on a match, with *end just past the ']', 0 on
+ * a mismatch, -1 if the class is unterminated
+ */
+static int tc__glob_class(const char *p, char c, const char **end) {
+  int negate = *p == '!' || *p == '^';
+  int hit = 0, first = 1;
+
+  if (negate)
+    p++;
+  while (*p && (*p != ']' || first)) {
+    if (p[1] == '-' && p[2] && p[2] != ']') {
+      hit |= c >= p[0] && c <= p[2];
+      p += 3;
+    } else {
+      hit |= *p == c;
+      p++;
+    }
+    first = 0;
+  }
+  if (*p != ']')
+    return -1; /* '[' is then matched literally by the caller */
+  *end = p + 1;
+  return hit != negate;
+}
+
+/* '*' any run, '?' any char, [a-z] / [!a-z] classes */
+static int tc__glob(const char *p, const char *s) {
+  const char *star = NULL, *resume = NULL;
+  const char *end;
+
+  while (*s) {
+    int cls = *p == '[' ? tc__glob_class(p + 1, *s, &end) : -1;
+    if (*p == '*') {
+      star = ++p;
+      resume = s;
+      continue;
+    }
+    if (*p == '?' || cls > 0) {
+      p = *p == '?' ? p + 1 : end;
+      s++;
+      continue;
+    }
+    if (cls < 0 && *p == *s) {
+      p++;
+      s++;
+      continue;
+    }
+    if (!star)
+      return 0;
+    p = star;
+    s = ++resume;
+  }
+  while (*p == '*')
+    p++;
+  return *p == '\0';
+}
+
+static int tc__pattern_compile(tc__Pattern *pat, const char *src) {
+  size_t n = strlen(src);
+  size_t lead, trail, i;
+
+  memset(pat, 0, sizeof(*pat));
+  if (strncmp(src, "re:", 3) == 0) {
+#ifdef TC__HAVE_REGEX
+    if (regcomp(&pat->re, src + 3, REG_EXTENDED | REG_NOSUB) != 0)
+      return -1;
+    pat->kind = TC__PAT_REGEX;
+    return 0;
+#else
+    return -1;
+#endif
+  }
+
+  lead = n > 0 && src[0] == '*';
+  trail = n > lead && src[n - 1] == '*';
+  pat->len = n - lead - trail;
+  for (i = lead; i < lead + pat->len; i++) {
+    if (src[i] == '*' || src[i] == '?' || src[i] == '[') {
+      pat->kind = TC__PAT_GLOB;
+      pat->glob = src;
+      return 0;
+    }
+  }
+
+  pat->literal = (char *)malloc(pat->len + 1);
+  if (!pat->literal)
+    return -1;
+  memcpy(pat->literal, src + lead, pat->len);
+  pat->literal[pat->len] = '\0';
+  pat->kind = lead && trail ? TC__PAT_CONTAINS
+              : lead        ? TC__PAT_SUFFIX
+              : trail       ? TC__PAT_PREFIX
+                            : TC__PAT_EXACT;
+  return 0;
+}
+
+static int tc__pattern_match(const tc__Pattern *pat, const char *s,
+                             size_t len) {
+  switch (pat->kind) {
+  case TC__PAT_EXACT:
+    return len == pat->len && memcmp(s, pat->literal, len) == 0;
+  case TC__PAT_PREFIX:
+    return len >= pat->len && memcmp(s, pat->literal, pat->len) == 0;
+  case TC__PAT_SUFFIX:
+    return len >= pat->len &&
+           memcmp(s + len - pat->len, pat->literal, pat->len) == 0;
+  case TC__PAT_CONTAINS:
+    return strstr(s, pat->literal) != NULL;
+  case TC__PAT_GLOB:
+    return tc__glob(pat->glob, s);
+#ifdef TC__HAVE_REGEX
+  case TC__PAT_REGEX:
+    return regexec(&pat->re, s, 0, NULL, 0) == 0;
+#endif
+  }
+  return 0;
+}
+
+static void tc__pattern_free(tc__Pattern *pat) {
+#ifdef TC__HAVE_REGEX
+  if (pat->kind == TC__PAT_REGEX)
+    regfree(&pat->re);
+#endif
+  free(pat->literal);
+}
+
+static int tc__tag_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.' ||
+         c == ':' || c == '/';
+}
+
+/* Bit for a tag named in an expression; -1 past TC__FILTER_TAGS */
+static int tc__tag_intern(tc__Filter *f, const char *name, size_t len) {
+  int i;
+  for (i = 0; i < f->tag_count; i++) {
+    if (f->tag_lens[i] == len && memcmp(f->tag_names[i], name, len) == 0)
+      return i;
+  }
+  if (f->tag_count == TC__FILTER_TAGS)
+    return -1;
+  f->tag_names[f->tag_count] = name;
+  f->tag_lens[f->tag_count] = len;
+  return f->tag_count++;
+}
+
+/* Bits of the expression's tags that appear in a tag list */
+static uint64_t tc__tag_mask(const tc__Filter *f, const char *tags) {
+  uint64_t mask = 0;
+  int i;
+
+  if (f->tag_count == 0)
+    return 0;
+  while (tags && *tags) {
+    const char *start;
+    while (*tags && !tc__tag_char(*tags))
+      tags++;
+    start = tags;
+    while (tc__tag_char(*tags))
+      tags++;
+    for (i = 0; tags > start && i < f->tag_count; i++) {
+      if (f->tag_lens[i] == (size_t)(tags - start) &&
+          memcmp(f->tag_names[i], start, f->tag_lens[i]) == 0) {
+        mask |= (uint64_t)1 << i;
+        break;
+      }
+    }
+  }
+  return mask;
+}
+
+/* The program runs on a 64-bit stack, one bit per entry */
+static int tc__tag_emit(tc__Filter *f, int op, int bit) {
+  f->depth += op == TC__TAG_HAS ? 1 : op == TC__TAG_NOT ? 0 : -1;
+  if (f->depth > 64)
+    return -1;
+  f->ops[f->op_count].op = op;
+  f->ops[f->op_count].bit = bit;
+  f->op_count++;
+  return 0;
+}
+
+static int tc__tag_or(tc__Filter *f, const char **p);
+
+static void tc__tag_skip(const char **p) {
+  while (**p == ' ' || **p == '\t')
+    (*p)++;
+}
+
+static int tc__tag_unary(tc__Filter *f, const char **p) {
+  const char *start;
+  int bit;
+
+  tc__tag_skip(p);
+  if (**p == '!') {
+    (*p)++;
+    return tc__tag_unary(f, p) == 0 ? tc__tag_emit(f, TC__TAG_NOT, 0) : -1;
+  }
+  if (**p == '(') {
+    (*p)++;
+    if (tc__tag_or(f, p) != 0)
+      return -1;
+    tc__tag_skip(p);
+    if (**p != ')')
+      return -1;
+    (*p)++;
+    return 0;
+  }
+  start = *p;
+  while (tc__tag_char(**p))
+    (*p)++;
+  if (*p == start)
+    return -1;
+  bit = tc__tag_intern(f, start, (size_t)(*p - start));
+  return bit < 0 ? -1 : tc__tag_emit(f, TC__TAG_HAS, bit);
+}
+
+static int tc__tag_and(tc__Filter *f, const char **p) {
+  if (tc__tag_unary(f, p) != 0)
+    return -1;
+  for (;;) {
+    tc__tag_skip(p);
+    if (**p != '&')
+      return 0;
+    (*p)++;
+    if (tc__tag_unary(f, p) != 0 || tc__tag_emit(f, TC__TAG_AND, 0) != 0)
+      return -1;
+  }
+}
+
+static int tc__tag_or(tc__Filter *f, const char **p) {
+  if (tc__tag_and(f, p) != 0)
+    return -1;
+  for (;;) {
+    tc__tag_skip(p);
+    if (**p != '|')
+      return 0;
+    (*p)++;
+    if (tc__tag_and(f, p) != 0 || tc__tag_emit(f, TC__TAG_OR, 0) != 0)
+      return -1;
+  }
+}
+
+static int tc__tags_eval(const tc__Filter *f, uint64_t mask) {
+  uint64_t stack = 0, top;
+  int i;
+
+  for (i = 0; i < f->op_count; i++) {
+    switch (f->ops[i].op) {
+    case TC__TAG_HAS:
+      stack = (stack << 1) | ((mask >> f->ops[i].bit) & 1);
+      break;
+    case TC__TAG_NOT:
+      stack ^= 1;
+      break;
+    case TC__TAG_AND:
+      top = stack & 1;
+      stack >>= 1;
+      stack &= ~(uint64_t)1 | top;
+      break;
+    case TC__TAG_OR:
+      top = stack & 1;
+      stack >>= 1;
+      stack |= top;
+      break;
+    }
+  }
+  return (int)(stack & 1);
+}
+
+static void tc__filter_free(tc__Filter *f) {
+  int i;
+  for (i = 0; i < f->include_count; i++)
+    tc__pattern_free(&f->include[i]);
+  for (i = 0; i < f->exclude_count; i++)
+    tc__pattern_free(&f->exclude[i]);
+  free(f->include);
+  free(f->exclude);
+  free(f->ops);
+  tc__buf_free(&f->name);
+  memset(f, 0, sizeof(*f));
+}
+
+static int tc__patterns_compile(tc__Pattern **out, int *count,
+                                const char **src, int n) {
+  int i;
+  *out = (tc__Pattern *)calloc((size_t)(n > 0 ? n : 1), sizeof(tc__Pattern));
+  if (!*out)
+    return -1;
+  for (i = 0; i < n; i++) {
+    if (tc__pattern_compile(&(*out)[i], src[i]) != 0) {
+      fprintf(stderr, "Error: Invalid pattern '%s'\n", src[i]);
+      return -1;
+    }
+    (*count)++;
+  }
+  return 0;
+}
+
+/*
+ * Compile every --include, --exclude and --tags of the command line;
+ * several tag expressions must all hold.
+ */
+static int tc__filter_compile(tc__Filter *f, int argc, char **argv) {
+  const char **args;
+  const char **include, **exclude, **tags;
+  int include_n = 0, exclude_n = 0, tags_n = 0;
+  size_t ops = 0;
+  int i, ret;
+
+  memset(f, 0, sizeof(*f));
+  args = (const char **)malloc((size_t)(3 * argc + 1) * sizeof(char *));
+  if (!args)
+    return -1;
+  include = args;
+  exclude = args + argc;
+  tags = args + 2 * argc;
+  for (i = 1; i + 1 < argc; i++) {
+    if (strcmp(argv[i], "--include") == 0)
+      include[include_n++] = argv[++i];
+    else if (strcmp(argv[i], "--exclude") == 0)
+      exclude[exclude_n++] = argv[++i];
+    else if (strcmp(argv[i], "--tags") == 0)
+      tags[tags_n++] = argv[++i];
+  }
+
+  for (i = 0; i < tags_n; i++)
+    ops += strlen(tags[i]) + 1;
+  f->ops = (tc__TagOp *)malloc((ops > 0 ? ops : 1) * sizeof(tc__TagOp));
+  ret = 0;
+  if (!f->ops ||
+      tc__patterns_compile(&f->include, &f->include_count, include,
+                           include_n) != 0 ||
+      tc__patterns_compile(&f->exclude, &f->exclude_count, exclude,
+                           exclude_n) != 0)
+    ret = -1;
+
+  for (i = 0; ret == 0 && i < tags_n; i++) {
+    const char *p = tags[i];
+    int ok = tc__tag_or(f, &p) == 0;
+    tc__tag_skip(&p);
+    if (!ok || *p != '\0' || (i > 0 && tc__tag_emit(f, TC__TAG_AND, 0) != 0)) {
+      fprintf(stderr, "Error: Invalid tag expression '%s'\n", tags[i]);
+      ret = -1;
+    }
+  }
+
+  free(args);
+  return ret;
+}
+
+static int tc__filter_test(tc__Filter *f, const Suite *suite, const Test *test,
+                           uint64_t suite_mask) {
+  int i, hit;
+
+  if (f->op_count > 0 &&
+      !tc__tags_eval(f, suite_mask | tc__tag_mask(f, test->tags)))
+    return 0;
+  if (f->include_count == 0 && f->exclude_count == 0)
+    return 1;
+
+  f->name.len = 0;
+  tc__buf_puts(&f->name, suite->name);
+  tc__buf_puts(&f->name, "/");
+  tc__buf_puts(&f->name, test->name);
+  if (tc__buf_append(&f->name, "", 1) != 0)
+    return 0;
+
+  for (i = 0; i < f->exclude_count; i++) {
+    if (tc__pattern_match(&f->exclude[i], f->name.data, f->name.len - 1))
+      return 0;
+  }
+  hit = f->include_count == 0;
+  for (i = 0; !hit && i < f->include_count; i++)
+    hit = tc__pattern_match(&f->include[i], f->name.data, f->name.len - 1);
+  return hit;
+}
+
+/* ============================================================
+   SELECTION
+   Filters and shards narrow index views over the suites given to
+   tc_main; no Suite or Test is copied while choosing. Only when the run
+   starts does a partly selected suite get a small header, whose tests
+   alias the original array if the picks are contiguous and are
+   gathered into one block otherwise. Vector tests are expanded into
+   their cases first, see TEST VECTORS.
+   ============================================================ */
+
+typedef struct {
+  Suite *suite;
+  int *index; /* selected test indices, ascending */
+  int count;
+} tc__View;
+
+typedef struct {
+  tc__View *views;
+  int count;
+  int *indices;   /* storage behind every view's index list */
+  Suite **run;    /* NULL-terminated suites for the runners */
+  Suite *headers; /* partly selected suites */
+  Test *gathered; /* scattered picks */
+  tc__Expansion cases;
+} tc__Selection;
+
+static void tc__selection_free(tc__Selection *sel) {
+  tc__expansion_free(&sel->cases);
+  free(sel->views);
+  free(sel->indices);
+  free(sel->run);
+  free(sel->headers);
+  free(sel->gathered);
+  memset(sel, 0, sizeof(*sel));
+}
+
+/* One view per suite, every test selected */
+static int tc__selection_init(tc__Selection *sel, Suite **suites,
+                              const char *suite_filter) {
+  int n = 0, tests = 0, i, j, k = 0;
+
+  memset(sel, 0, sizeof(*sel));
+  if (tc__expansion_build(&sel->cases, suites, suite_filter) != 0)
+    return -1;
+  suites = sel->cases.suites;
+  for (n = 0; suites[n] != NULL; n++)
+    tests += suites[n]->test_count;
+  sel->views = (tc__View *)calloc((size_t)(n > 0 ? n : 1), sizeof(tc__View));
+  sel->indices = (int *)malloc((size_t)(tests > 0 ? tests : 1) * sizeof(int));
+  if (!sel->views || !sel->indices) {
+    tc__selection_free(sel);
+    return -1;
+  }
+  for (i = 0; i < n; i++) {
+    tc__View *v = &sel->views[i];
+    v->suite = suites[i];
+    v->index = &sel->indices[k];
+    v->count = suites[i]->test_count;
+    for (j = 0; j < v->count; j++)
+      v->index[j] = j;
+    k += v->count;
+  }
+  sel->count = n;
+  return 0;
+}
+
+static int tc__selection_tests(const tc__Selection *sel) {
+  int i, n = 0;
+  for (i = 0; i < sel->count; i++)
+    n += sel->views[i].count;
+  return n;
+}
+
+/* Build the NULL-terminated suite list; returns its length or -1 */
+static int tc__selection_build(tc__Selection *sel) {
+  int suites = 0, scattered = 0, out = 0, i, j;
+  Test *next;
+
+  for (i = 0; i < sel->count; i++) {
+    const tc__View *v = &sel->views[i];
+    if (v->count == 0)
+      continue;
+    suites++;
+    if (v->index[v->count - 1] - v->index[0] != v->count - 1)
+      scattered += v->count;
+  }
+
+  sel->run = (Suite **)malloc((size_t)(suites + 1) * sizeof(Suite *));
+  sel->headers = (Suite *)malloc((size_t)(suites > 0 ? suites : 1) *
+                                 sizeof(Suite));
+  if (scattered > 0)
+    sel->gathered = (Test *)malloc((size_t)scattered * sizeof(Test));
+  if (!sel->run || !sel->headers || (scattered > 0 && !sel->gathered))
+    return -1;
+
+  next = sel->gathered;
+  for (i = 0; i < sel->count; i++) {
+    const tc__View *v = &sel->views[i];
+    Suite *h;
+    if (v->count == 0)
+      continue;
+    if (v->count == v->suite->test_count) {
+      sel->run[out++] = v->suite;
+      continue;
+    }
+    h = &sel->headers[out];
+    *h = *v->suite;
+    h->test_count = v->count;
+    if (v->index[v->count - 1] - v->index[0] == v->count - 1) {
+      h->tests = &v->suite->tests[v->index[0]];
+    } else {
+      for (j = 0; j < v->count; j++)
+        next[j] = v->suite->tests[v->index[j]];
+      h->tests = next;
+      next += v->count;
+    }
+    sel->run[out++] = h;
+  }
+  sel->run[out] = NULL;
+  return out;
+}
+
+/* ============================================================
+   SHARDING
+   --shard I/N keeps the tests of shard I (1-based) out of N. Without a
+   timing file each test goes to a stable hash of its suite and name; with
+   one, tests are bin-packed longest first onto the least-loaded shard, so
+   every node works out the same split and the shards finish together.
+   ============================================================ */
+
+#define TC__FNV_OFFSET 14695981039346656037ULL
+#define TC__FNV_PRIME 1099511628211ULL
+
+typedef struct {
+  unsigned long long key;
+  double ms;
+} tc__Timing;
+
+typedef struct {
+  unsigned long long key;
+  double ms;
+  int index; /* position in declaration order */
+  int shard;
+} tc__ShardItem;
+
+static unsigned long long tc__fnv(unsigned long long h, unsigned char c) {
+  return (h ^ c) * TC__FNV_PRIME;
+}
+
+static unsigned long long tc__fnv_str(unsigned long long h, const char *s) {
+  for (; *s != '\0'; s++)
+    h = tc__fnv(h, (unsigned char)*s);
+  return h;
+}
+
+/* Key of a test: its suite name, a separator byte, then its own name */
+static unsigned long long tc__test_key(const char *suite, const char *test) {
+  unsigned long long h = tc__fnv_str(TC__FNV_OFFSET, suite ? suite : "");
+  return tc__fnv_str(tc__fnv(h, 0xff), test ? test : "");
+}
+
+/* Find attribute `attr` (e.g. " name=\"") inside the tag [tag, end) */
+static const char *tc__xml_attr(const char *tag, const char *end,
+                                const char *attr, const char **value_end) {
+  const char *v = strstr(tag, attr);
+  const char *q;
+  if (!v || v >= end)
+    return NULL;
+  v += strlen(attr);
+  q = strchr(v, '"');
+  if (!q || q > end)
+    return NULL;
+  *value_end = q;
+  return v;
+}
+
+/* Hash an escaped attribute value as the name tc__xml_write escaped */
+static unsigned long long tc__fnv_xml(unsigned long long h, const char *v,
+                                      const char *end) {
+  static const struct {
+    const char *entity;
+    char c;
+  } entities[] = {{"&amp;", '&'},
+                  {"&lt;", '<'},
+                  {"&gt;", '>'},
+                  {"&quot;", '"'},
+                  {"&apos;", '\''}};
+  while (v < end) {
+    char c = *v;
+    size_t skip = 1;
+    size_t k;
+    if (c == '&') {
+      for (k = 0; k < sizeof(entities) / sizeof(entities[0]); k++) {
+        size_t len = strlen(entities[k].entity);
+        if (strncmp(v, entities[k].entity, len) == 0) {
+          c = entities[k].c;
+          skip = len;
+          break;
+        }
+      }
+    }
+    h = tc__fnv(h, (unsigned char)c);
+    v += skip;
+  }
+  return h;
+}
+
+static int tc__timing_cmp(const void *a, const void *b) {
+  unsigned long long x = ((const tc__Timing *)a)->key;
+  unsigned long long y = ((const tc__Timing *)b)->key;
+  return x < y ? -1 : x > y;
+}
+
+/* Longest first; equal times fall back to the key so every node agrees */
+static int tc__shard_item_cmp(const void *a, const void *b) {
+  const tc__ShardItem *x = (const tc__ShardItem *)a;
+  const tc__ShardItem *y = (const tc__ShardItem *)b;
+  if (x->ms != y->ms)
+    return x->ms > y->ms ? -1 : 1;
+  return x->key < y->key ? -1 : x->key > y->key;
+}
+
+/* Read testcase times (in ms) from a JUnit report, sorted by key */
+static tc__Timing *tc__load_timings(const char *path, int *count) {
+  FILE *f = fopen(path, "rb");
+  tc__Timing *timings = NULL;
+  int cap = 0;
+  char *data;
+  const char *p;
+  long size;
+  unsigned long long suite_key = tc__fnv(TC__FNV_OFFSET, 0xff);
+
+  *count = 0;
+  if (!f)
+    return NULL;
+  if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+      fseek(f, 0, SEEK_SET) != 0 ||
+      !(data = (char *)malloc((size_t)size + 1))) {
+    fclose(f);
+    return NULL;
+  }
+  size = (long)fread(data, 1, (size_t)size, f);
+  data[size] = '\0';
+  fclose(f);
+
+  for (p = strchr(data, '<'); p != NULL; p = strchr(p + 1, '<')) {
+    const char *end = strchr(p, '>');
+    const char *v, *q;
+    if (!end)
+      break;
+    if (strncmp(p, "<testsuite ", 11) == 0) {
+      v = tc__xml_attr(p, end, " name=\"", &q);
+      suite_key = v ? tc__fnv_xml(TC__FNV_OFFSET, v, q) : TC__FNV_OFFSET;
+      suite_key = tc__fnv(suite_key, 0xff);
+    } else if (strncmp(p, "<testcase ", 10) == 0 &&
+               (v = tc__xml_attr(p, end, " name=\"", &q)) != NULL) {
+      unsigned long long key = tc__fnv_xml(suite_key, v, q);
+      if (!(v = tc__xml_attr(p, end, " time=\"", &q)))
+        continue;
+      if (*count == cap) {
+        int grown_cap = cap ? cap * 2 : 64;
+        tc__Timing *grown = (tc__Timing *)realloc(
+            timings, (size_t)grown_cap * sizeof(tc__Timing));
+        if (!grown)
+          break;
+        timings = grown;
+        cap = grown_cap;
+      }
+      timings[*count].key = key;
+      timings[*count].ms = strtod(v, NULL) * 1000.0;
+      (*count)++;
+    }
+  }
+  free(data);
+
+  if (timings)
+    qsort(timings, (size_t)*count, sizeof(tc__Timing), tc__timing_cmp);
+  return timings;
+}
+
+/* Narrow the selection to shard `index`; returns the tests left */
+static int tc__shard_selection(tc__Selection *sel, int index, int total,
+                               const char *timing_file) {
+  tc__ShardItem *items;
+  tc__Timing *timings = NULL;
+  int timing_count = 0;
+  int n = tc__selection_tests(sel), i, j, k, kept;
+
+  items = (tc__ShardItem *)malloc((size_t)(n > 0 ? n : 1) *
+                                  sizeof(tc__ShardItem));
+  if (!items) {
+    fprintf(stderr, "Error: Out of memory assigning shards\n");
+    return 0;
+  }
+
+  for (i = 0, k = 0; i < sel->count; i++) {
+    const tc__View *v = &sel->views[i];
+    for (j = 0; j < v->count; j++, k++) {
+      items[k].key =
+          tc__test_key(v->suite->name, v->suite->tests[v->index[j]].name);
+      items[k].index = k;
+    }
+  }
+
+  if (timing_file) {
+    timings = tc__load_timings(timing_file, &timing_count);
+    if (!timings)
+      fprintf(stderr,
+              "Warning: No timings read from '%s'; sharding by hash\n",
+              timing_file);
+  }
+
+  if (timings) {
+    tc__ShardItem *sorted;
+    double *load;
+    int *tests;
+    double known = 0;
+    int known_count = 0;
+
+    for (k = 0; k < n; k++) {
+      tc__Timing probe, *hit;
+      probe.key = items[k].key;
+      hit = (tc__Timing *)bsearch(&probe, timings, (size_t)timing_count,
+                                  sizeof(tc__Timing), tc__timing_cmp);
+      items[k].ms = hit ? hit->ms : -1;
+      if (hit) {
+        known += hit->ms;
+        known_count++;
+      }
+    }
+    /* Tests missing from the report are assumed to take the mean time */
+    for (k = 0; k < n; k++)
+      if (items[k].ms < 0)
+        items[k].ms = known_count ? known / known_count : 1.0;
+
+    sorted = (tc__ShardItem *)malloc((size_t)(n > 0 ? n : 1) *
+                                     sizeof(tc__ShardItem));
+    load = (double *)calloc((size_t)total, sizeof(double));
+    tests = (int *)calloc((size_t)total, sizeof(int));
+    if (sorted && load && tests) {
+      memcpy(sorted, items, (size_t)n * sizeof(tc__ShardItem));
+      qsort(sorted, (size_t)n, sizeof(tc__ShardItem), tc__shard_item_cmp);
+      for (k = 0; k < n; k++) {
+        int best = 0, s;
+        for (s = 1; s < total; s++)
+          if (load[s] < load[best] ||
+              (load[s] == load[best] && tests[s] < tests[best]))
+            best = s;
+        load[best] += sorted[k].ms;
+        tests[best]++;
+        items[sorted[k].index].shard = best;
+      }
+    } else {
+      free(timings);
+      timings = NULL;
+    }
+    free(sorted);
+    free(load);
+    free(tests);
+  }
+
+  if (!timings)
+    for (k = 0; k < n; k++)
+      items[k].shard = (int)(items[k].key % (unsigned long long)total);
+  free(timings);
+
+  for (i = 0, k = 0; i < sel->count; i++) {
+    tc__View *v = &sel->views[i];
+    kept = 0;
+    for (j = 0; j < v->count; j++, k++)
+      if (items[k].shard == index)
+        v->index[kept++] = v->index[j];
+    v->count = kept;
+  }
+
+  free(items);
+  return tc__selection_tests(sel);
+}
+
+/* ============================================================
+   IMPACT ANALYSIS
+   --impact FILE keeps a map from each test to the source files its run
+   touched (its own functions plus its suite's setup and teardown).
+   --changed-files / --changed-since then keep only the tests whose map
+   names a changed file; tests missing from the map, or mapped to no
+   file, always run. Every recording run refreshes the entries of the
+   tests it ran and drops entries of tests that no longer exist.
+
+   Format, one record per line:
+     testcracks-impact 1
+     F <path>                      file table, numbered from 0
+     T <suite>\t<test>\t<n> <n>... files of one test
+   ============================================================ */
+
+typedef struct {
+  const char *suite;
+  const char *test;
+  unsigned long long key;
+  int first; /* into refs */
+  int count;
+} tc__ImpactTest;
+
+typedef struct {
+  char *data; /* the file, split in place */
+  const char **files;
+  int file_count;
+  int *refs;
+  int ref_count;
+  tc__ImpactTest *tests; /* sorted by key */
+  int test_count;
+} tc__ImpactMap;
+
+static void tc__impact_free(tc__ImpactMap *map) {
+  free(map->data);
+  free(map->files);
+  free(map->refs);
+  free(map->tests);
+  memset(map, 0, sizeof(*map));
+}
+
+static int tc__impact_key_cmp(const void *a, const void *b) {
+  unsigned long long x = ((const tc__ImpactTest *)a)->key;
+  unsigned long long y = ((const tc__ImpactTest *)b)->key;
+  return x < y ? -1 : x > y;
+}
 
-  printf("  %s%s%s %s (%.2fms)\n", color, icon, TC__RESET, name,
-         result->elapsed_ms);
+static const tc__ImpactTest *tc__impact_find(const tc__ImpactMap *map,
+                                             unsigned long long key) {
+  tc__ImpactTest probe;
+  if (map->test_count == 0)
+    return NULL;
+  probe.key = key;
+  return (const tc__ImpactTest *)bsearch(&probe, map->tests,
+                                         (size_t)map->test_count,
+                                         sizeof(tc__ImpactTest),
+                                         tc__impact_key_cmp);
+}
 
-  if (result->tag == TC_FAIL) {
-    for (i = 0; i < result->error_count; i++) {
-      printf("      %s\n", result->errors[i].message);
-      if (result->errors[i].expected[0] != '\0') {
-        printf("        Expected: %s\n", result->errors[i].expected);
-        printf("        Actual:   %s\n", result->errors[i].actual);
-      }
+/* Split text into trimmed, non-empty lines in place */
+static char **tc__split_lines(char *text, int *count) {
+  char **lines = NULL;
+  int cap = 0;
+  char *p = text;
+
+  *count = 0;
+  while (p && *p) {
+    char *end = strchr(p, '\n');
+    char *next = end ? end + 1 : NULL;
+    char **grown;
+    if (!end)
+      end = p + strlen(p);
+    while (end > p && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+      end--;
+    *end = '\0';
+    if (*p) {
+      grown = (char **)tc__grow(lines, &cap, *count + 1, sizeof(char *));
+      if (!grown)
+        break;
+      lines = grown;
+      lines[(*count)++] = p;
     }
-  } else if (result->tag == TC_SKIP && result->error_count > 0) {
-    printf("      [%s]\n", result->errors[0].message);
+    p = next;
   }
+  return lines;
 }
 
-/* Storage for test results (needed for XML output) */
-static TestResult tc__results[TC_MAX_SUITES][TC_MAX_TESTS_PER_SUITE];
-static int tc__result_counts[TC_MAX_SUITES];
+/* 0 when loaded, -1 when missing or unreadable (the map is then empty) */
+static int tc__impact_load(tc__ImpactMap *map, const char *path) {
+  FILE *f = fopen(path, "rb");
+  char **lines;
+  int line_count, i, file_cap = 0, ref_cap = 0, test_cap = 0;
 
-static RunSummary tc__run_suite_ex(Suite *suite, int suite_idx) {
-  RunSummary summary;
-  int idx = (suite_idx >= 0 && suite_idx < TC_MAX_SUITES) ? suite_idx : 0;
-  double start;
-  int i;
-  void *env = NULL;
+  memset(map, 0, sizeof(*map));
+  if (!f)
+    return -1;
+  map->data = tc__slurp(f);
+  fclose(f);
+  if (!map->data)
+    return -1;
 
-  memset(&summary, 0, sizeof(summary));
-  start = tc__get_time_ms();
+  lines = tc__split_lines(map->data, &line_count);
+  if (line_count == 0 || strcmp(lines[0], "testcracks-impact 1") != 0) {
+    free(lines);
+    tc__impact_free(map);
+    return -1;
+  }
 
-  if (suite->setup) {
-    int ret = suite->setup(&env);
-    if (ret != 0) {
-      summary.total_ms = tc__get_time_ms() - start;
-      printf("\n=== %s (%.2fms) ===\n", suite->name, summary.total_ms);
-      printf("  %s\xe2\x9c\x97%s Setup failed (returned %d)\n", TC__RED,
-             TC__RESET, ret);
-      summary.errored = suite->test_count;
-      return summary;
+  for (i = 1; i < line_count; i++) {
+    char *line = lines[i];
+    if (line[0] == 'F' && line[1] == ' ') {
+      const char **grown = (const char **)tc__grow(
+          (void *)map->files, &file_cap, map->file_count + 1, sizeof(char *));
+      if (!grown)
+        break;
+      map->files = grown;
+      map->files[map->file_count++] = line + 2;
+    } else if (line[0] == 'T' && line[1] == ' ') {
+      tc__ImpactTest t;
+      tc__ImpactTest *grown;
+      char *tab1 = strchr(line + 2, '\t');
+      char *tab2 = tab1 ? strchr(tab1 + 1, '\t') : NULL;
+      char *p;
+      if (!tab2)
+        continue;
+      *tab1 = '\0';
+      *tab2 = '\0';
+      t.suite = line + 2;
+      t.test = tab1 + 1;
+      t.key = tc__test_key(t.suite, t.test);
+      t.first = map->ref_count;
+      t.count = 0;
+      for (p = tab2 + 1; *p;) {
+        char *end;
+        long id = strtol(p, &end, 10);
+        int *refs;
+        if (end == p)
+          break;
+        p = end;
+        if (id < 0 || id >= map->file_count)
+          continue;
+        refs = (int *)tc__grow(map->refs, &ref_cap, map->ref_count + 1,
+                               sizeof(int));
+        if (!refs)
+          break;
+        map->refs = refs;
+        map->refs[map->ref_count++] = (int)id;
+        t.count++;
+      }
+      grown = (tc__ImpactTest *)tc__grow(map->tests, &test_cap,
+                                         map->test_count + 1,
+                                         sizeof(tc__ImpactTest));
+      if (!grown)
+        break;
+      map->tests = grown;
+      map->tests[map->test_count++] = t;
     }
   }
+  free(lines);
 
-  for (i = 0; i < suite->test_count; i++) {
-    tc__results[idx][i] = tc_run_test(&suite->tests[i], env);
-    tc__result_counts[idx] = i + 1;
+  if (map->test_count > 0)
+    qsort(map->tests, (size_t)map->test_count, sizeof(tc__ImpactTest),
+          tc__impact_key_cmp);
+  return 0;
+}
 
-    switch (tc__results[idx][i].tag) {
-    case TC_PASS:
-      summary.passed++;
-      break;
-    case TC_FAIL:
-      summary.failed++;
-      break;
-    case TC_SKIP:
-      summary.skipped++;
-      break;
-    }
-  }
+#if defined(_WIN32)
+#define tc__popen _popen
+#define tc__pclose _pclose
+#define TC__GIT_DIFF "git diff --name-only \"%s\" --"
+#else
+#define tc__popen popen
+#define tc__pclose pclose
+#define TC__GIT_DIFF "git diff --name-only '%s' --"
+#endif
 
-  if (suite->teardown) {
-    suite->teardown(env);
+/* Changed paths, one per line, from a file ("-": stdin) or git */
+static char *tc__changed_text(const char *file, const char *since) {
+  tc__Buf cmd = {0};
+  FILE *f;
+  char *text;
+
+  if (file) {
+    f = strcmp(file, "-") == 0 ? stdin : fopen(file, "rb");
+    if (!f)
+      return NULL;
+    text = tc__slurp(f);
+    if (f != stdin)
+      fclose(f);
+    return text;
   }
 
-  summary.total_ms = tc__get_time_ms() - start;
+  if (strchr(since, '\'') || strchr(since, '"')) /* quoted below */
+    return NULL;
+  tc__buf_printf(&cmd, TC__GIT_DIFF, since);
+  f = tc__buf_append(&cmd, "", 1) == 0 ? tc__popen(cmd.data, "r") : NULL;
+  tc__buf_free(&cmd);
+  if (!f)
+    return NULL;
+  text = tc__slurp(f);
+  if (tc__pclose(f) != 0) {
+    free(text);
+    return NULL;
+  }
+  return text;
+}
 
-  printf("\n=== %s (%.2fms) ===\n", suite->name, summary.total_ms);
-  for (i = 0; i < suite->test_count; i++) {
-    tc_print_result(suite->tests[i].name, &tc__results[idx][i]);
+/* Same file: equal, or one path is the other with leading directories */
+static int tc__same_source(const char *mapped, const char *changed) {
+  size_t a = strlen(mapped), b = strlen(changed);
+  if (strncmp(changed, "./", 2) == 0) {
+    changed += 2;
+    b -= 2;
   }
+  if (a == b)
+    return strcmp(mapped, changed) == 0;
+  if (a > b)
+    return mapped[a - b - 1] == '/' && strcmp(mapped + a - b, changed) == 0;
+  return changed[b - a - 1] == '/' && strcmp(changed + b - a, mapped) == 0;
+}
 
-  return summary;
+/*
+ * Narrow the selection to the tests affected by the changed files.
+ * Returns the tests left, or -1 when the changed list is unreadable.
+ */
+static int tc__impact_select(tc__Selection *sel, const tc__ImpactMap *map,
+                             const char *changed_file,
+                             const char *changed_since) {
+  char *text = tc__changed_text(changed_file, changed_since);
+  char **changed;
+  unsigned char *hit;
+  int changed_count, i, j, k;
+
+  if (!text)
+    return -1;
+  changed = tc__split_lines(text, &changed_count);
+  hit = (unsigned char *)calloc((size_t)map->file_count + 1, 1);
+  if (!hit) {
+    free(changed);
+    free(text);
+    return tc__selection_tests(sel);
+  }
+  for (i = 0; i < map->file_count; i++)
+    for (k = 0; !hit[i] && k < changed_count; k++)
+      hit[i] = (unsigned char)tc__same_source(map->files[i], changed[k]);
+
+  for (i = 0; i < sel->count; i++) {
+    tc__View *v = &sel->views[i];
+    int kept = 0;
+    for (j = 0; j < v->count; j++) {
+      const Test *t = &v->suite->tests[v->index[j]];
+      const tc__ImpactTest *entry =
+          tc__impact_find(map, tc__test_key(v->suite->name, t->name));
+      int affected = !entry || entry->count == 0;
+      for (k = 0; !affected && k < entry->count; k++)
+        affected = hit[map->refs[entry->first + k]];
+      if (affected)
+        v->index[kept++] = v->index[j];
+    }
+    v->count = kept;
+  }
+  free(hit);
+  free(changed);
+  free(text);
+  return tc__selection_tests(sel);
 }
 
-RunSummary tc_run_suite(Suite *suite) { return tc__run_suite_ex(suite, -1); }
+#ifdef TC__HAVE_IMPACT
 
-static RunSummary tc__run_all_ex(Suite **suites, int store_results) {
-  RunSummary total;
-  RunSummary s;
-  double start;
-  int i;
+/* Interned strings; ids are stable, the text lives in one buffer */
+typedef struct {
+  tc__Buf text;
+  size_t *offs;
+  int count;
+  int cap;
+} tc__Strings;
 
-  memset(&total, 0, sizeof(total));
-  memset(tc__result_counts, 0, sizeof(tc__result_counts));
-  start = tc__get_time_ms();
+static const char *tc__strings_at(const tc__Strings *s, int id) {
+  return s->text.data + s->offs[id];
+}
 
-  for (i = 0; suites[i] != NULL; i++) {
-    s = tc__run_suite_ex(suites[i], store_results ? i : -1);
-    total.passed += s.passed;
-    total.failed += s.failed;
-    total.skipped += s.skipped;
-    total.errored += s.errored;
+static int tc__strings_intern(tc__Strings *s, const char *str, size_t len) {
+  int i;
+  size_t *grown;
+  for (i = 0; i < s->count; i++) {
+    const char *have = tc__strings_at(s, i);
+    if (strncmp(have, str, len) == 0 && have[len] == '\0')
+      return i;
   }
+  grown = (size_t *)tc__grow(s->offs, &s->cap, s->count + 1, sizeof(size_t));
+  if (!grown)
+    return -1;
+  s->offs = grown;
+  s->offs[s->count] = s->text.len;
+  if (tc__buf_append(&s->text, str, len) != 0 ||
+      tc__buf_append(&s->text, "", 1) != 0)
+    return -1;
+  return s->count++;
+}
 
-  total.total_ms = tc__get_time_ms() - start;
-  return total;
+static void tc__strings_free(tc__Strings *s) {
+  tc__buf_free(&s->text);
+  free(s->offs);
+  memset(s, 0, sizeof(*s));
 }
 
-RunSummary tc_run_all(Suite **suites) { return tc__run_all_ex(suites, 1); }
+typedef struct {
+  void *addr;
+  const char *object; /* shared object or executable holding addr */
+  uintptr_t base;     /* where object is loaded */
+  int file;           /* id in the file table, -1 if unknown */
+} tc__Site;
+
+static int tc__site_object_cmp(const void *a, const void *b) {
+  const tc__Site *x = (const tc__Site *)a, *y = (const tc__Site *)b;
+  int c = strcmp(x->object, y->object);
+  uintptr_t p = (uintptr_t)x->addr, q = (uintptr_t)y->addr;
+  return c ? c : (p > q) - (p < q);
+}
 
-int tc_print_summary(RunSummary summary) {
-  int total =
-      summary.passed + summary.failed + summary.skipped + summary.errored;
+static int tc__site_addr_cmp(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t)((const tc__Site *)a)->addr;
+  uintptr_t y = (uintptr_t)((const tc__Site *)b)->addr;
+  return (x > y) - (x < y);
+}
+
+static int tc__ptr_cmp(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t) * (void *const *)a;
+  uintptr_t y = (uintptr_t) * (void *const *)b;
+  return (x > y) - (x < y);
+}
 
-  printf("\n%d/%d passed, %d failed, %d skipped, %d errored (Total: %.2fms)\n",
-         summary.passed, total, summary.failed, summary.skipped,
-         summary.errored, summary.total_ms);
+static int tc__coverage_owner_cmp(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t)((const tc__Coverage *)a)->owner;
+  uintptr_t y = (uintptr_t)((const tc__Coverage *)b)->owner;
+  return (x > y) - (x < y);
+}
 
-  return (summary.failed > 0 || summary.errored > 0) ? 1 : 0;
+/* Records of owner in the owner-sorted coverage list: [*first, return) */
+static int tc__coverage_range(const void *owner, int *first) {
+  int lo = 0, hi = tc__coverage_count, end;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if ((uintptr_t)tc__coverage[mid].owner < (uintptr_t)owner)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (end = lo; end < tc__coverage_count && tc__coverage[end].owner == owner;)
+    end++;
+  *first = lo;
+  return end;
 }
 
-/* ============================================================
-   JUNIT XML OUTPUT
-   ============================================================ */
+/* Position-independent objects are looked up by offset from their base */
+static int tc__elf_is_dyn(const char *path) {
+  unsigned char h[18];
+  FILE *f = fopen(path, "rb");
+  int dyn = 0;
+  if (!f)
+    return 1;
+  if (fread(h, 1, sizeof(h), f) == sizeof(h) && memcmp(h, "\177ELF", 4) == 0)
+    dyn = (h[5] == 2 ? h[17] | (h[16] << 8) : h[16] | (h[17] << 8)) == 3;
+  fclose(f);
+  return dyn;
+}
 
-static void tc__xml_escape(char *dst, const char *src, size_t max) {
-  size_t di = 0;
-  size_t si;
-  if (!src) {
-    dst[0] = '\0';
+/* Resolve sites[first, end) of one object through a single addr2line */
+static void tc__resolve_object(tc__Site *sites, int first, int end,
+                               tc__Strings *files) {
+  char tmp[] = "/tmp/testcracks-impact-XXXXXX";
+  uintptr_t base = tc__elf_is_dyn(sites[first].object) ? sites[first].base : 0;
+  char *argv[4];
+  FILE *out, *in;
+  char line[4096];
+  int fd, pipefd[2], i;
+  pid_t pid;
+
+  if ((fd = mkstemp(tmp)) < 0)
+    return;
+  if (!(out = fdopen(fd, "w"))) {
+    close(fd);
+    remove(tmp);
+    return;
+  }
+  for (i = first; i < end; i++)
+    fprintf(out, "%llx\n", (unsigned long long)((uintptr_t)sites[i].addr -
+                                                 base));
+  if (fclose(out) != 0 || pipe(pipefd) != 0) {
+    remove(tmp);
     return;
   }
 
-  for (si = 0; src[si] != '\0' && di < max - 6; si++) {
-    switch (src[si]) {
-    case '&':
-      memcpy(dst + di, "&amp;", 5);
-      di += 5;
-      break;
-    case '<':
-      memcpy(dst + di, "&lt;", 4);
-      di += 4;
-      break;
-    case '>':
-      memcpy(dst + di, "&gt;", 4);
-      di += 4;
-      break;
-    case '"':
-      memcpy(dst + di, "&quot;", 6);
-      di += 6;
-      break;
-    case '\'':
-      memcpy(dst + di, "&apos;", 6);
-      di += 6;
-      break;
-    default:
-      dst[di++] = src[si];
-      break;
+  /* Exec'd directly so no shell sees the object path */
+  argv[0] = (char *)"addr2line";
+  argv[1] = (char *)"-e";
+  argv[2] = (char *)sites[first].object;
+  argv[3] = NULL;
+  pid = fork();
+  if (pid == 0) {
+    int addrs = open(tmp, O_RDONLY);
+    if (addrs < 0 || dup2(addrs, 0) < 0 || dup2(pipefd[1], 1) < 0)
+      _exit(127);
+    close(addrs);
+    close(pipefd[0]);
+    close(pipefd[1]);
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  close(pipefd[1]);
+
+  if (pid > 0 && (in = fdopen(pipefd[0], "r"))) {
+    for (i = first; i < end && fgets(line, sizeof(line), in); i++) {
+      char *colon = strrchr(line, ':');
+      if (colon && strncmp(line, "??", 2) != 0)
+        sites[i].file =
+            tc__strings_intern(files, line, (size_t)(colon - line));
     }
+    fclose(in);
+  } else {
+    close(pipefd[0]);
   }
-  dst[di] = '\0';
+  if (pid > 0)
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+      ;
+  remove(tmp);
 }
 
-int tc_write_junit_xml(const char *filename, Suite **suites,
-                       RunSummary summary) {
-  FILE *f;
-  int i, j, suite_count;
-  int total_tests, total_failures, total_skipped;
-  char escaped[TC_MAX_MSG_LEN * 2];
+/* Map every recorded address to a source file id; sorted by addr */
+static tc__Site *tc__resolve_coverage(int *count, tc__Strings *files) {
+  void **addrs;
+  tc__Site *sites;
+  size_t total = 0, n = 0, i, j;
+  int first, k;
+
+  *count = 0;
+  for (k = 0; k < tc__coverage_count; k++)
+    total += tc__coverage[k].count;
+  addrs = (void **)malloc((total + 1) * sizeof(void *));
+  sites = (tc__Site *)malloc((total + 1) * sizeof(tc__Site));
+  if (!addrs || !sites) {
+    free(addrs);
+    free(sites);
+    return NULL;
+  }
+  for (k = 0; k < tc__coverage_count; k++)
+    for (j = 0; j < tc__coverage[k].count; j++)
+      addrs[n++] = tc__coverage[k].addrs[j];
+  qsort(addrs, n, sizeof(void *), tc__ptr_cmp);
+
+  for (i = 0, j = 0; i < n; i++) {
+    Dl_info info;
+    if ((i > 0 && addrs[i] == addrs[i - 1]) || !dladdr(addrs[i], &info) ||
+        !info.dli_fname)
+      continue;
+    sites[j].addr = addrs[i];
+    sites[j].object = *info.dli_fname ? info.dli_fname : "/proc/self/exe";
+    sites[j].base = (uintptr_t)info.dli_fbase;
+    sites[j].file = -1;
+    j++;
+  }
+  free(addrs);
 
-  f = fopen(filename, "w");
-  if (!f) {
-    fprintf(stderr, "Error: Cannot open file '%s' for writing\n", filename);
-    return -1;
+  qsort(sites, j, sizeof(tc__Site), tc__site_object_cmp);
+  for (first = 0, k = 1; k <= (int)j; k++) {
+    if (k == (int)j || strcmp(sites[k].object, sites[first].object) != 0) {
+      tc__resolve_object(sites, first, k, files);
+      first = k;
+    }
   }
+  qsort(sites, j, sizeof(tc__Site), tc__site_addr_cmp);
+  *count = (int)j;
+  return sites;
+}
 
-  total_tests = summary.passed + summary.failed + summary.skipped;
-  total_failures = summary.failed;
-  total_skipped = summary.skipped;
+/* Append the file ids recorded for owner that are not yet seen */
+static void tc__owner_files(tc__Buf *out, const void *owner,
+                            const tc__Site *sites, int site_count,
+                            unsigned char *seen, int *written) {
+  int first, end, k;
+  size_t j;
+  for (end = tc__coverage_range(owner, &first), k = first; k < end; k++) {
+    for (j = 0; j < tc__coverage[k].count; j++) {
+      tc__Site probe;
+      const tc__Site *site;
+      probe.addr = tc__coverage[k].addrs[j];
+      site = (const tc__Site *)bsearch(&probe, sites, (size_t)site_count,
+                                       sizeof(tc__Site), tc__site_addr_cmp);
+      if (!site || site->file < 0 || seen[site->file])
+        continue;
+      seen[site->file] = 1;
+      tc__buf_printf(out, (*written)++ ? " %d" : "%d", site->file);
+    }
+  }
+}
 
-  for (suite_count = 0; suites[suite_count] != NULL; suite_count++)
-    ;
+/* Entries of the tests recorded in this run */
+static void tc__impact_write_run(tc__Buf *out, Suite **run,
+                                 const tc__Site *sites, int site_count,
+                                 int file_count) {
+  unsigned char *seen = (unsigned char *)malloc((size_t)file_count + 1);
+  int i, j, first;
+  if (!seen)
+    return;
+  for (i = 0; run[i] != NULL; i++) {
+    for (j = 0; j < run[i]->test_count; j++) {
+      const Test *t = &run[i]->tests[j];
+      int written = 0;
+      if (tc__coverage_range(t, &first) == first)
+        continue;
+      memset(seen, 0, (size_t)file_count + 1);
+      tc__buf_printf(out, "T %s\t%s\t", run[i]->name, t->name);
+      tc__owner_files(out, t, sites, site_count, seen, &written);
+      tc__owner_files(out, run[i], sites, site_count, seen, &written);
+      tc__buf_puts(out, "\n");
+    }
+  }
+  free(seen);
+}
 
-  fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-  fprintf(f,
-          "<testsuites tests=\"%d\" failures=\"%d\" errors=\"0\" "
-          "skipped=\"%d\" time=\"%.3f\">\n",
-          total_tests, total_failures, total_skipped,
-          summary.total_ms / 1000.0);
+static int tc__key_cmp(const void *a, const void *b) {
+  unsigned long long x = *(const unsigned long long *)a;
+  unsigned long long y = *(const unsigned long long *)b;
+  return x < y ? -1 : x > y;
+}
 
-  for (i = 0; i < suite_count && suites[i] != NULL; i++) {
-    Suite *suite = suites[i];
-    int suite_passed = 0, suite_failed = 0, suite_skipped = 0;
-    double suite_time = 0;
+/* Sorted keys of the tests in suites; with `recorded`, only those */
+static unsigned long long *tc__suite_keys(Suite **suites, int recorded,
+                                          int *count) {
+  unsigned long long *keys;
+  int i, j, n = 0, first;
+  for (i = 0; suites[i] != NULL; i++)
+    n += suites[i]->test_count;
+  keys = (unsigned long long *)malloc(((size_t)n + 1) *
+                                      sizeof(unsigned long long));
+  *count = 0;
+  if (!keys)
+    return NULL;
+  for (i = 0; suites[i] != NULL; i++)
+    for (j = 0; j < suites[i]->test_count; j++)
+      if (!recorded ||
+          tc__coverage_range(&suites[i]->tests[j], &first) != first)
+        keys[(*count)++] =
+            tc__test_key(suites[i]->name, suites[i]->tests[j].name);
+  qsort(keys, (size_t)*count, sizeof(unsigned long long), tc__key_cmp);
+  return keys;
+}
 
-    for (j = 0; j < tc__result_counts[i]; j++) {
-      TestResult *r = &tc__results[i][j];
-      suite_time += r->elapsed_ms;
-      switch (r->tag) {
-      case TC_PASS:
-        suite_passed++;
-        break;
-      case TC_FAIL:
-        suite_failed++;
-        break;
-      case TC_SKIP:
-        suite_skipped++;
-        break;
-      }
+/* Entries of old kept as they were: still in `all`, not in `fresh` */
+static void tc__impact_write_kept(tc__Buf *out, const tc__ImpactMap *old,
+                                  tc__Strings *files, Suite **all,
+                                  Suite **run) {
+  int key_count, fresh_count, i, k;
+  unsigned long long *keys = tc__suite_keys(all, 0, &key_count);
+  unsigned long long *fresh = tc__suite_keys(run, 1, &fresh_count);
+  int *ids = (int *)malloc(((size_t)old->file_count + 1) * sizeof(int));
+
+  if (keys && fresh && ids) {
+    for (i = 0; i < old->file_count; i++)
+      ids[i] = tc__strings_intern(files, old->files[i], strlen(old->files[i]));
+    for (i = 0; i < old->test_count; i++) {
+      const tc__ImpactTest *t = &old->tests[i];
+      if (!bsearch(&t->key, keys, (size_t)key_count, sizeof(*keys),
+                   tc__key_cmp) ||
+          bsearch(&t->key, fresh, (size_t)fresh_count, sizeof(*fresh),
+                  tc__key_cmp))
+        continue;
+      tc__buf_printf(out, "T %s\t%s\t", t->suite, t->test);
+      for (k = 0; k < t->count; k++)
+        tc__buf_printf(out, k ? " %d" : "%d", ids[old->refs[t->first + k]]);
+      tc__buf_puts(out, "\n");
     }
+  }
+  free(keys);
+  free(fresh);
+  free(ids);
+}
 
-    tc__xml_escape(escaped, suite->name, sizeof(escaped));
-    fprintf(f,
-            "    <testsuite name=\"%s\" tests=\"%d\" failures=\"%d\" "
-            "errors=\"0\" skipped=\"%d\" time=\"%.3f\">\n",
-            escaped, suite_passed + suite_failed + suite_skipped, suite_failed,
-            suite_skipped, suite_time / 1000.0);
+/*
+ * Write the refreshed map: tests recorded in this run get their new
+ * files; other entries are kept if their test is still in `all`.
+ */
+static int tc__impact_save(const char *path, const tc__ImpactMap *old,
+                           Suite **all, Suite **run) {
+  tc__Strings files = {0};
+  tc__Buf tests = {0};
+  tc__Buf tmp_path = {0};
+  tc__Site *sites;
+  int site_count, i, ret = -1;
+  FILE *f = NULL;
+
+  if (tc__coverage_count > 0)
+    qsort(tc__coverage, (size_t)tc__coverage_count, sizeof(tc__Coverage),
+          tc__coverage_owner_cmp);
+  sites = tc__resolve_coverage(&site_count, &files);
+  if (sites) {
+    tc__impact_write_kept(&tests, old, &files, all, run);
+    tc__impact_write_run(&tests, run, sites, site_count, files.count);
+    tc__buf_printf(&tmp_path, "%s.tmp", path);
+    if (tc__buf_append(&tmp_path, "", 1) == 0)
+      f = fopen(tmp_path.data, "wb");
+  }
 
-    for (j = 0; j < tc__result_counts[i] && j < suite->test_count; j++) {
-      TestResult *r = &tc__results[i][j];
-      tc__xml_escape(escaped, suite->tests[j].name, sizeof(escaped));
+  /* Write beside the target, then rename over it */
+  if (f) {
+    fputs("testcracks-impact 1\n", f);
+    for (i = 0; i < files.count; i++)
+      fprintf(f, "F %s\n", tc__strings_at(&files, i));
+    if (tests.len)
+      fwrite(tests.data, 1, tests.len, f);
+    if (fclose(f) == 0 && rename(tmp_path.data, path) == 0)
+      ret = 0;
+    else
+      remove(tmp_path.data);
+  }
 
-      switch (r->tag) {
-      case TC_PASS:
-        fprintf(f, "        <testcase name=\"%s\" time=\"%.3f\"/>\n", escaped,
-                r->elapsed_ms / 1000.0);
-        break;
+  tc__buf_free(&tmp_path);
+  tc__buf_free(&tests);
+  tc__strings_free(&files);
+  free(sites);
+  return ret;
+}
 
-      case TC_FAIL:
-        fprintf(f, "        <testcase name=\"%s\" time=\"%.3f\">\n", escaped,
-                r->elapsed_ms / 1000.0);
-        if (r->error_count > 0) {
-          char msg_escaped[TC_MAX_MSG_LEN * 2];
-          char detail[TC_MAX_MSG_LEN * 4];
-          int k, pos = 0;
-
-          tc__xml_escape(msg_escaped, r->errors[0].message,
-                         sizeof(msg_escaped));
-
-          for (k = 0; k < r->error_count && pos < (int)sizeof(detail) - 100;
-               k++) {
-            tc__xml_escape(escaped, r->errors[k].message, sizeof(escaped));
-            pos +=
-                snprintf(detail + pos, sizeof(detail) - pos, "%s\n", escaped);
-            if (r->errors[k].expected[0] != '\0') {
-              tc__xml_escape(escaped, r->errors[k].expected, sizeof(escaped));
-              pos += snprintf(detail + pos, sizeof(detail) - pos,
-                              "  Expected: %s\n", escaped);
-              tc__xml_escape(escaped, r->errors[k].actual, sizeof(escaped));
-              pos += snprintf(detail + pos, sizeof(detail) - pos,
-                              "  Actual:   %s\n", escaped);
-            }
-          }
+static void tc__coverage_clear(void) {
+  int k;
+  for (k = 0; k < tc__coverage_count; k++)
+    free(tc__coverage[k].addrs);
+  free(tc__coverage);
+  tc__coverage = NULL;
+  tc__coverage_count = 0;
+  tc__coverage_cap = 0;
+}
 
-          fprintf(f,
-                  "            <failure message=\"%s\" "
-                  "type=\"AssertionError\">%s</failure>\n",
-                  msg_escaped, detail);
-        }
-        fprintf(f, "        </testcase>\n");
-        break;
+#endif /* TC__HAVE_IMPACT */
 
-      case TC_SKIP:
-        fprintf(f, "        <testcase name=\"%s\" time=\"0\">\n", escaped);
-        if (r->error_count > 0) {
-          tc__xml_escape(escaped, r->errors[0].message, sizeof(escaped));
-          fprintf(f, "            <skipped message=\"%s\"/>\n", escaped);
-        } else {
-          fprintf(f, "            <skipped/>\n");
-        }
-        fprintf(f, "        </testcase>\n");
-        break;
-      }
+/* ============================================================
+   RESULT CACHE
+   --cache DIR remembers which tests passed, in DIR/results. A pass
+   holds while the test binary (or the tc_set_build_id string) and the
+   contents of the test's declared inputs are unchanged; the first line
+   carries the binary hash, so a rebuild drops every entry at once.
+
+     testcracks-cache 1 <binary hash>
+     <test key> <inputs hash>       one line per cached pass
+   ============================================================ */
+
+static const char *tc__build_id;
+
+void tc_set_build_id(const char *id) { tc__build_id = id; }
+
+typedef struct {
+  unsigned long long key;
+  unsigned long long inputs;
+} tc__CacheEntry;
+
+typedef struct {
+  tc__Buf path; /* DIR/results, NUL-terminated */
+  unsigned long long binary;
+  tc__CacheEntry *old; /* loaded entries, sorted by key */
+  int old_count;
+  tc__CacheEntry *now; /* one per test in the run, in run order */
+} tc__Cache;
+
+static int tc__cache_entry_cmp(const void *a, const void *b) {
+  unsigned long long x = ((const tc__CacheEntry *)a)->key;
+  unsigned long long y = ((const tc__CacheEntry *)b)->key;
+  return x < y ? -1 : x > y;
+}
+
+/* Fold a file's contents into h; -1 if it cannot be read */
+static int tc__hash_file(unsigned long long *h, const char *path) {
+  unsigned char chunk[65536];
+  FILE *f = fopen(path, "rb");
+  size_t n, i;
+  if (!f)
+    return -1;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    for (i = 0; i < n; i++)
+      *h = tc__fnv(*h, chunk[i]);
+  fclose(f);
+  return 0;
+}
+
+/* The build id, else the running executable's bytes; 0 if unknown */
+static unsigned long long tc__binary_hash(const char *argv0) {
+  unsigned long long h = TC__FNV_OFFSET;
+#if defined(_WIN32)
+  char exe[MAX_PATH];
+  const char *path =
+      GetModuleFileNameA(NULL, exe, sizeof(exe)) > 0 ? exe : argv0;
+#elif defined(__linux__)
+  const char *path = "/proc/self/exe";
+  (void)argv0;
+#else
+  const char *path = argv0;
+#endif
+
+  if (tc__build_id)
+    return tc__fnv_str(tc__fnv(h, 0xfe), tc__build_id);
+  if (!path || tc__hash_file(&h, path) != 0)
+    return 0;
+  return h;
+}
+
+/* Names and contents of a test's inputs; a missing file hashes as such */
+static unsigned long long tc__inputs_hash(const Test *test) {
+  unsigned long long h = TC__FNV_OFFSET;
+  const char *p = test->inputs;
+  char path[4096];
+
+  while (p && *p) {
+    size_t len = strcspn(p, " ,");
+    if (len > 0 && len < sizeof(path)) {
+      memcpy(path, p, len);
+      path[len] = '\0';
+      h = tc__fnv(tc__fnv_str(h, path), 0xff);
+      if (tc__hash_file(&h, path) != 0)
+        h = tc__fnv(h, 0xfe);
     }
+    p += len;
+    p += strspn(p, " ,");
+  }
+  return h;
+}
+
+static void tc__cache_free(tc__Cache *c) {
+  tc__buf_free(&c->path);
+  free(c->old);
+  free(c->now);
+  free((void *)tc__cache_hits);
+  tc__cache_hits = NULL;
+  tc__cache_hit_count = 0;
+  memset(c, 0, sizeof(*c));
+}
+
+static void tc__cache_load(tc__Cache *c) {
+  FILE *f = fopen(c->path.data, "rb");
+  char *text = f ? tc__slurp(f) : NULL;
+  char **lines;
+  unsigned long long binary;
+  int count, i;
 
-    fprintf(f, "    </testsuite>\n");
+  if (f)
+    fclose(f);
+  if (!text)
+    return;
+  lines = tc__split_lines(text, &count);
+  if (count > 0 && sscanf(lines[0], "testcracks-cache 1 %llx", &binary) == 1 &&
+      binary == c->binary &&
+      (c->old = (tc__CacheEntry *)malloc((size_t)count *
+                                         sizeof(tc__CacheEntry))) != NULL) {
+    for (i = 1; i < count; i++) {
+      tc__CacheEntry *e = &c->old[c->old_count];
+      if (sscanf(lines[i], "%llx %llx", &e->key, &e->inputs) == 2)
+        c->old_count++;
+    }
+    qsort(c->old, (size_t)c->old_count, sizeof(tc__CacheEntry),
+          tc__cache_entry_cmp);
   }
+  free(lines);
+  free(text);
+}
 
-  fprintf(f, "</testsuites>\n");
-  fclose(f);
+/*
+ * Key every test of the run and, unless `use` is 0 (--no-cache), mark
+ * the ones whose cached pass still holds. 0 on success.
+ */
+static int tc__cache_open(tc__Cache *c, const char *dir, const char *argv0,
+                          int use, Suite **run) {
+  int total = 0, n = 0, i, j;
+
+  memset(c, 0, sizeof(*c));
+  c->binary = tc__binary_hash(argv0);
+  if (c->binary == 0) {
+    fprintf(stderr, "Error: Cannot hash the test binary for --cache; "
+                    "set a build id with tc_set_build_id\n");
+    return -1;
+  }
+#if defined(_WIN32)
+  CreateDirectoryA(dir, NULL);
+#else
+  mkdir(dir, 0777);
+#endif
+  tc__buf_printf(&c->path, "%s/results", dir);
+  if (tc__buf_append(&c->path, "", 1) != 0)
+    return -1;
+  tc__cache_load(c);
+
+  for (i = 0; run[i] != NULL; i++)
+    total += run[i]->test_count;
+  c->now = (tc__CacheEntry *)malloc(((size_t)total + 1) *
+                                    sizeof(tc__CacheEntry));
+  tc__cache_hits = (const Test **)malloc(((size_t)total + 1) *
+                                         sizeof(const Test *));
+  if (!c->now || !tc__cache_hits)
+    return -1;
 
+  for (i = 0; run[i] != NULL; i++) {
+    for (j = 0; j < run[i]->test_count; j++) {
+      const Test *t = &run[i]->tests[j];
+      tc__CacheEntry *e = &c->now[n++];
+      const tc__CacheEntry *hit;
+      e->key = tc__test_key(run[i]->name, t->name);
+      e->inputs = t->fn && !t->bench ? tc__inputs_hash(t) : 0;
+      if (!use || !t->fn || t->bench || c->old_count == 0)
+        continue;
+      hit = (const tc__CacheEntry *)bsearch(e, c->old, (size_t)c->old_count,
+                                            sizeof(tc__CacheEntry),
+                                            tc__cache_entry_cmp);
+      if (hit && hit->inputs == e->inputs)
+        tc__cache_hits[tc__cache_hit_count++] = t;
+    }
+  }
+  qsort((void *)tc__cache_hits, (size_t)tc__cache_hit_count,
+        sizeof(const Test *), tc__test_ptr_cmp);
   return 0;
 }
 
+/*
+ * Write the passes of this run, plus the old entries of tests it did
+ * not run: unselected, or not run after a cancel. Tests that failed or
+ * were skipped drop out.
+ */
+static int tc__cache_save(tc__Cache *c, Suite **run) {
+  tc__Buf out = {0};
+  tc__Buf tmp_path = {0};
+  tc__CacheEntry *ran;
+  int n = 0, ran_count = 0, i, j, ret = -1;
+  FILE *f;
+
+  for (i = 0; run[i] != NULL; i++)
+    n += run[i]->test_count;
+  ran = (tc__CacheEntry *)malloc(((size_t)n + 1) * sizeof(tc__CacheEntry));
+
+  tc__buf_printf(&out, "testcracks-cache 1 %016llx\n", c->binary);
+  for (i = 0, n = 0; run[i] != NULL; i++) {
+    const TestResult *results =
+        i < tc__record_count && tc__records[i].suite == run[i]
+            ? tc__records[i].results
+            : NULL;
+    for (j = 0; j < run[i]->test_count; j++, n++) {
+      const Test *t = &run[i]->tests[j];
+      if (!results || j >= tc__records[i].count ||
+          tc__is_not_run(&results[j]))
+        continue;
+      if (ran)
+        ran[ran_count++] = c->now[n];
+      if (t->fn && !t->bench && results[j].tag == TC_PASS)
+        tc__buf_printf(&out, "%016llx %016llx\n", c->now[n].key,
+                       c->now[n].inputs);
+    }
+  }
+
+  if (ran) {
+    n = ran_count;
+    qsort(ran, (size_t)n, sizeof(tc__CacheEntry), tc__cache_entry_cmp);
+    for (i = 0; i < c->old_count; i++)
+      if (!bsearch(&c->old[i], ran, (size_t)n, sizeof(tc__CacheEntry),
+                   tc__cache_entry_cmp))
+        tc__buf_printf(&out, "%016llx %016llx\n", c->old[i].key,
+                       c->old[i].inputs);
+    free(ran);
+  }
+
+  /* Write beside the target, then rename over it */
+  tc__buf_printf(&tmp_path, "%s.tmp", c->path.data);
+  if (tc__buf_append(&tmp_path, "", 1) == 0 &&
+      (f = fopen(tmp_path.data, "wb")) != NULL) {
+    int written = fwrite(out.data, 1, out.len, f) == out.len;
+    if (fclose(f) == 0 && written) {
+#if defined(_WIN32)
+      remove(c->path.data); /* rename does not replace there */
+#endif
+      ret = rename(tmp_path.data, c->path.data) == 0 ? 0 : -1;
+    }
+    if (ret != 0)
+      remove(tmp_path.data);
+  }
+  tc__buf_free(&tmp_path);
+  tc__buf_free(&out);
+  return ret;
+}
+
 /* ============================================================
    CLI
    ============================================================ */
@@ -845,7 +10295,66 @@ static void tc__print_help(const char *prog) {
   printf("  --suite \"name\"          Run specific suite\n");
   printf("  --test \"suite\" \"test\"   Run specific test\n");
   printf("  --match \"pattern\"       Run tests matching pattern\n");
+  printf("  --include \"glob\"        Run tests whose suite/test matches\n");
+  printf("  --exclude \"glob\"        Skip tests whose suite/test matches\n");
+  printf("  --tags \"expr\"           Run tests whose tags match, e.g. "
+         "\"fast & !net\"\n");
   printf("  --xml \"file\"            Output results as JUnit XML\n");
+  printf("  --ndjson \"file\"         Stream results as NDJSON (- = stdout)\n");
+  printf("  --tap \"file\"            Stream results as TAP 13 (- = stdout)\n");
+  printf("  --binary \"file\"         Stream compact binary records\n");
+  printf("  --trace \"file\"          Write the run as a Chrome trace timeline\n");
+  printf("  --jobs N, -j N          Run suites on N threads (0 = all CPUs)\n");
+  printf("  --quiet, -q             Print only the summary\n");
+  printf("  --failures-only         Print only failing tests\n");
+  printf("  --dots                  Print one character per test\n");
+  printf("  --fail-fast             Stop after the first failing test\n");
+  printf("  --max-failures N        Stop after N failing tests\n");
+  printf("  --timeout T             Fail tests running longer than T (e.g. 30,"
+         "\n                          500ms); a hang ends the run\n");
+  printf("  --seed N                Seed property tests (default: clock)\n");
+  printf("  --allocs                Report heap allocations of each test\n");
+  printf("  --perf-counters         Report CPU counters of each test (Linux)\n");
+  printf("  --isolate               Run tests in a child process (POSIX)\n");
+  printf("  --isolate-suite         Run each suite in one child process\n");
+  printf("  --bench                 Run only benchmarks\n");
+  printf("  --no-bench              Skip benchmarks\n");
+  printf("  --bench-json \"file\"     Write benchmark statistics as JSON\n");
+  printf("  --bench-save \"file\"     Save benchmarks as a baseline (JSON)\n");
+  printf("  --bench-compare \"file\"  Fail benchmarks slower than a baseline\n");
+  printf("  --threshold N%%          Allowed median slowdown (default 5%%)\n");
+  printf("  --budget-scale F        Multiply time budgets and limits by F\n");
+  printf("  --shard I/N             Run shard I (1-based) of N\n");
+  printf("  --shard-timings \"file\"  Balance shards by times in a JUnit file\n");
+  printf("  --impact \"file\"         Record which sources each test runs\n");
+  printf("  --changed-files \"file\"  With --impact, run tests affected by the\n"
+         "                          listed paths (- = stdin)\n");
+  printf("  --changed-since \"ref\"   With --impact, run tests affected by\n"
+         "                          git diff --name-only ref\n");
+  printf("  --cache \"dir\"           Skip tests that passed with this binary and"
+         "\n                          unchanged inputs\n");
+  printf("  --no-cache              Run every test; still refresh --cache\n");
+  printf("  --build-id \"id\"         Key --cache on id instead of the binary\n");
+}
+
+/* "1.5" or "1.5s" seconds, or with an ms, us or ns suffix; -1 if bad */
+static int tc__parse_duration(const char *text, uint64_t *ns) {
+  static const struct {
+    const char *suffix;
+    double scale;
+  } units[] = {{"", 1e9}, {"s", 1e9}, {"ms", 1e6}, {"us", 1e3}, {"ns", 1}};
+  char *end;
+  double v = strtod(text, &end);
+  size_t k;
+  if (end == text || v < 0)
+    return -1;
+  for (k = 0; k < sizeof(units) / sizeof(units[0]); k++) {
+    if (strcmp(end, units[k].suffix) == 0) {
+      *ns = (uint64_t)(v * units[k].scale);
+      return 0;
+    }
+  }
+  return -1;
 }
 
 static void tc__list_tests(Suite **suites) {
@@ -853,8 +10362,14 @@ static void tc__list_tests(Suite **suites) {
   for (i = 0; suites[i] != NULL; i++) {
     printf("%s:\n", suites[i]->name);
     for (j = 0; j < suites[i]->test_count; j++) {
-      const char *status = suites[i]->tests[j].fn ? "" : " [skip]";
-      printf("  - %s%s\n", suites[i]->tests[j].name, status);
+      const Test *t = &suites[i]->tests[j];
+      const char *status = t->bench ? " [bench]" : t->fn ? "" : " [skip]";
+      printf("  - %s%s", t->name, status);
+      if (t->tags || suites[i]->tags) {
+        printf(" {%s%s%s}", suites[i]->tags ? suites[i]->tags : "",
+               t->tags && suites[i]->tags ? " " : "", t->tags ? t->tags : "");
+      }
+      printf("\n");
     }
   }
 }
@@ -868,12 +10383,35 @@ int tc_main(int argc, char **argv, Suite **suites) {
   const char *test_filter = NULL;
   const char *match_filter = NULL;
   const char *xml_file = NULL;
+  const char *timing_file = NULL;
+  const char *bench_file = NULL;
+  const char *bench_save = NULL;
+  const char *bench_compare = NULL;
+  const char *trace_file = NULL;
+  const char *impact_file = NULL;
+  const char *changed_file = NULL;
+  const char *changed_since = NULL;
+  const char *cache_dir = NULL;
+  int use_cache = 1;
+  tc__Cache cache;
+  /* --ndjson, --tap, --binary */
+  const char *report_files[3] = {NULL, NULL, NULL};
+  int (*const report_open[3])(const char *) = {
+      tc_add_ndjson_reporter, tc_add_tap_reporter, tc_add_binary_reporter};
+  double threshold = 5.0;
+  int bench_mode = 0; /* 1: only benchmarks, -1: no benchmarks */
   int list_only = 0;
+  int jobs = 1;
+  int shard_index = 0, shard_count = 1;
   int i, j, count;
   RunSummary summary;
+  tc__Filter filter;
+  tc__Selection sel;
+  tc__ImpactMap impact = {0};
+  int have_impact = 0;
 
-  Suite *filtered[TC_MAX_SUITES + 1];
-  static Suite filtered_suites[TC_MAX_SUITES];
+  if (!suites)
+    suites = tc_registered_suites();
 
   for (i = 1; i < argc; i++) {
     if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
@@ -888,75 +10426,309 @@ int tc_main(int argc, char **argv, Suite **suites) {
       test_filter = argv[++i];
     } else if (strcmp(argv[i], "--match") == 0 && i + 1 < argc) {
       match_filter = argv[++i];
+    } else if ((strcmp(argv[i], "--include") == 0 ||
+                strcmp(argv[i], "--exclude") == 0 ||
+                strcmp(argv[i], "--tags") == 0) &&
+               i + 1 < argc) {
+      i++; /* compiled by tc__filter_compile */
     } else if (strcmp(argv[i], "--xml") == 0 && i + 1 < argc) {
       xml_file = argv[++i];
+    } else if (strcmp(argv[i], "--ndjson") == 0 && i + 1 < argc) {
+      report_files[0] = argv[++i];
+    } else if (strcmp(argv[i], "--tap") == 0 && i + 1 < argc) {
+      report_files[1] = argv[++i];
+    } else if (strcmp(argv[i], "--binary") == 0 && i + 1 < argc) {
+      report_files[2] = argv[++i];
+    } else if ((strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "-j") == 0) &&
+               i + 1 < argc) {
+      jobs = atoi(argv[++i]);
+      if (jobs <= 0)
+        jobs = tc__cpu_count();
+    } else if (strcmp(argv[i], "--quiet") == 0 || strcmp(argv[i], "-q") == 0) {
+      tc_set_output_mode(TC_OUTPUT_QUIET);
+    } else if (strcmp(argv[i], "--failures-only") == 0) {
+      tc_set_output_mode(TC_OUTPUT_FAILURES_ONLY);
+    } else if (strcmp(argv[i], "--dots") == 0) {
+      tc_set_output_mode(TC_OUTPUT_DOTS);
+    } else if (strcmp(argv[i], "--fail-fast") == 0) {
+      tc_set_max_failures(1);
+    } else if (strcmp(argv[i], "--max-failures") == 0 && i + 1 < argc) {
+      char *end;
+      long n = strtol(argv[++i], &end, 10);
+      if (end == argv[i] || *end != '\0' || n < 0 || n > 0x7fffffffL) {
+        fprintf(stderr, "Error: --max-failures expects a number\n");
+        return 1;
+      }
+      tc_set_max_failures((int)n);
+    } else if (strcmp(argv[i], "--allocs") == 0) {
+      tc_set_alloc_report(1);
+    } else if (strcmp(argv[i], "--perf-counters") == 0) {
+      if (tc_set_perf_counters(1) != 0)
+        fprintf(stderr, "Note: Hardware counters are unavailable (%s); "
+                        "--perf-counters is ignored\n",
+                tc__perf_why());
+    } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+      uint64_t ns;
+      if (tc__parse_duration(argv[++i], &ns) != 0) {
+        fprintf(stderr, "Error: --timeout expects a duration such as 30, 2.5s "
+                        "or 500ms\n");
+        return 1;
+      }
+      tc_set_timeout(ns);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      char *end;
+      unsigned long long seed = strtoull(argv[++i], &end, 0);
+      if (end == argv[i] || *end != '\0') {
+        fprintf(stderr, "Error: --seed expects a number\n");
+        return 1;
+      }
+      tc_set_seed((uint64_t)seed);
+    } else if (strcmp(argv[i], "--isolate") == 0) {
+      tc_set_isolation(TC_ISOLATE_TEST);
+    } else if (strcmp(argv[i], "--isolate-suite") == 0) {
+      tc_set_isolation(TC_ISOLATE_SUITE);
+    } else if (strcmp(argv[i], "--bench") == 0) {
+      bench_mode = 1;
+    } else if (strcmp(argv[i], "--no-bench") == 0) {
+      bench_mode = -1;
+    } else if (strcmp(argv[i], "--bench-json") == 0 && i + 1 < argc) {
+      bench_file = argv[++i];
+    } else if (strcmp(argv[i], "--bench-save") == 0 && i + 1 < argc) {
+      bench_save = argv[++i];
+    } else if (strcmp(argv[i], "--bench-compare") == 0 && i + 1 < argc) {
+      bench_compare = argv[++i];
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace_file = argv[++i];
+      tc_set_trace(1);
+    } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+      const char *text = argv[++i];
+      char *end;
+      threshold = strtod(text, &end); /* "5%" and "5" both mean 5 percent */
+      if (end != text && *end == '%')
+        end++;
+      if (end == text || *end != '\0' || !(threshold >= 0) ||
+          threshold > 1e6) {
+        fprintf(stderr, "Error: --threshold expects a percentage\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--budget-scale") == 0 && i + 1 < argc) {
+      tc_set_budget_scale(atof(argv[++i]));
+    } else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+      const char *text = argv[++i];
+      char *end = NULL;
+      long index = -1, count = -1;
+      /* Digits, '/', digits and nothing else: no signs, spaces or "2x" */
+      if (*text >= '0' && *text <= '9')
+        index = strtol(text, &end, 10);
+      if (index >= 0 && *end == '/' && end[1] >= '0' && end[1] <= '9')
+        count = strtol(end + 1, &end, 10);
+      if (count < 1 || *end != '\0' || count > 0x7fffffffL || index < 1 ||
+          index > count) {
+        fprintf(stderr, "Error: --shard expects I/N with 1 <= I <= N\n");
+        return 1;
+      }
+      shard_index = (int)index - 1;
+      shard_count = (int)count;
+    } else if (strcmp(argv[i], "--shard-timings") == 0 && i + 1 < argc) {
+      timing_file = argv[++i];
+    } else if (strcmp(argv[i], "--impact") == 0 && i + 1 < argc) {
+      impact_file = argv[++i];
+    } else if (strcmp(argv[i], "--changed-files") == 0 && i + 1 < argc) {
+      changed_file = argv[++i];
+    } else if (strcmp(argv[i], "--changed-since") == 0 && i + 1 < argc) {
+      changed_since = argv[++i];
+    } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+      cache_dir = argv[++i];
+    } else if (strcmp(argv[i], "--no-cache") == 0) {
+      use_cache = 0;
+    } else if (strcmp(argv[i], "--build-id") == 0 && i + 1 < argc) {
+      tc_set_build_id(argv[++i]);
     }
   }
 
-  if (xml_file) {
-    FILE *f = fopen(xml_file, "w");
-    if (!f) {
-      fprintf(stderr, "Error: Cannot create XML file '%s'\n", xml_file);
-      return 1;
-    }
-    fclose(f);
+  if ((changed_file || changed_since) && !impact_file) {
+    fprintf(stderr, "Error: --changed-files and --changed-since need "
+                    "--impact \"file\"\n");
+    return 1;
   }
 
-  if (list_only) {
-    tc__list_tests(suites);
-    return 0;
+  if (tc__filter_compile(&filter, argc, argv) != 0) {
+    tc__filter_free(&filter);
+    return 1;
+  }
+  if (tc__selection_init(&sel, suites, suite_filter) != 0) {
+    fprintf(stderr, "Error: Out of memory selecting tests\n");
+    tc__filter_free(&filter);
+    return 1;
   }
 
-  count = 0;
-  for (i = 0; suites[i] != NULL && count < TC_MAX_SUITES; i++) {
-    if (suite_filter && !tc__matches(suites[i]->name, suite_filter)) {
+  for (i = 0; i < sel.count; i++) {
+    tc__View *v = &sel.views[i];
+    uint64_t suite_tags = tc__tag_mask(&filter, v->suite->tags);
+    count = 0;
+    if (suite_filter && !tc__matches(v->suite->name, suite_filter)) {
+      v->count = 0;
       continue;
     }
 
-    if (test_filter || match_filter) {
-      Suite temp;
-      memset(&temp, 0, sizeof(temp));
-      temp.name = suites[i]->name;
-      temp.setup = suites[i]->setup;
-      temp.teardown = suites[i]->teardown;
-
-      for (j = 0; j < suites[i]->test_count; j++) {
-        int include = 0;
-        if (test_filter && tc__matches(suites[i]->tests[j].name, test_filter)) {
-          include = 1;
-        }
-        if (match_filter &&
-            tc__matches(suites[i]->tests[j].name, match_filter)) {
-          include = 1;
-        }
-        if (include) {
-          temp.tests[temp.test_count++] = suites[i]->tests[j];
-        }
+    for (j = 0; j < v->count; j++) {
+      const Test *t = &v->suite->tests[v->index[j]];
+      int include = !test_filter && !match_filter;
+      if (test_filter && tc__matches(t->name, test_filter)) {
+        include = 1;
       }
-
-      if (temp.test_count > 0) {
-        filtered_suites[count] = temp;
-        filtered[count] = &filtered_suites[count];
-        count++;
+      if (match_filter && tc__matches(t->name, match_filter)) {
+        include = 1;
+      }
+      if (bench_mode && (bench_mode > 0) != (t->bench != NULL)) {
+        include = 0;
+      }
+      if (include && tc__filter_test(&filter, v->suite, t, suite_tags)) {
+        v->index[count++] = v->index[j];
       }
-    } else {
-      filtered[count++] = suites[i];
     }
+    v->count = count;
   }
-  filtered[count] = NULL;
+  tc__filter_free(&filter);
 
-  if (count == 0) {
+  /* --list shows an empty selection as an empty list */
+  if (tc__selection_tests(&sel) == 0 && !list_only) {
     printf("No tests matched filters.\n");
+    tc__selection_free(&sel);
+    return 1;
+  }
+
+  if (impact_file) {
+    have_impact = tc__impact_load(&impact, impact_file) == 0;
+    if ((changed_file || changed_since) && !have_impact) {
+      fprintf(stderr, "Note: No impact map in '%s' yet; running all tests\n",
+              impact_file);
+    } else if (changed_file || changed_since) {
+      count = tc__impact_select(&sel, &impact, changed_file, changed_since);
+      if (count < 0) {
+        fprintf(stderr, "Error: Cannot read changed files from %s '%s'\n",
+                changed_file ? "file" : "git diff", changed_file ? changed_file
+                                                                : changed_since);
+        tc__impact_free(&impact);
+        tc__selection_free(&sel);
+        return 1;
+      }
+      if (count == 0) {
+        printf("No tests affected by the changes.\n");
+        tc__impact_free(&impact);
+        tc__selection_free(&sel);
+        return 0;
+      }
+    }
+#ifdef TC__HAVE_IMPACT
+    tc__impact_on = !list_only;
+#else
+    fprintf(stderr, "Warning: Built without TC_IMPACT; '%s' is not "
+                    "refreshed\n",
+            impact_file);
+#endif
+  }
+
+  if (shard_count > 1 &&
+      tc__shard_selection(&sel, shard_index, shard_count, timing_file) == 0) {
+    printf("No tests in shard %d/%d.\n", shard_index + 1, shard_count);
+    tc__impact_free(&impact);
+    tc__selection_free(&sel);
+    return 0;
+  }
+
+  if (tc__selection_build(&sel) < 0) {
+    fprintf(stderr, "Error: Out of memory selecting tests\n");
+    tc__impact_free(&impact);
+    tc__selection_free(&sel);
+    return 1;
+  }
+
+  if (list_only) {
+    tc__list_tests(sel.run);
+    tc__impact_free(&impact);
+    tc__selection_free(&sel);
+    return 0;
+  }
+
+  if (bench_compare && tc_set_bench_baseline(bench_compare, threshold) != 0) {
+    tc__impact_free(&impact);
+    tc__selection_free(&sel);
+    return 1;
+  }
+
+  memset(&cache, 0, sizeof(cache));
+  if (cache_dir &&
+      tc__cache_open(&cache, cache_dir, argv[0], use_cache, sel.run) != 0) {
+    fprintf(stderr, "Error: Cannot use cache directory '%s'\n", cache_dir);
+    tc__cache_free(&cache);
+    tc__impact_free(&impact);
+    tc__selection_free(&sel);
+    return 1;
+  }
+
+  for (i = 0; i < 3; i++) {
+    if (report_files[i] && report_open[i](report_files[i]) != 0) {
+      fprintf(stderr, "Error: Cannot create report file '%s'\n",
+              report_files[i]);
+      tc_clear_reporters();
+      tc__cache_free(&cache);
+      tc__impact_free(&impact);
+      tc__selection_free(&sel);
+      return 1;
+    }
+  }
+
+  if (xml_file && tc__junit_open(xml_file) != 0) {
+    fprintf(stderr, "Error: Cannot create XML file '%s'\n", xml_file);
+    tc_clear_reporters();
+    tc__cache_free(&cache);
+    tc__impact_free(&impact);
+    tc__selection_free(&sel);
     return 1;
   }
 
-  summary = tc__run_all_ex(filtered, 1);
+  /* The JUnit and stream reporters finish with the run */
+  summary = tc__run_all_ex(sel.run, jobs);
 
   if (xml_file) {
-    if (tc_write_junit_xml(xml_file, filtered, summary) == 0) {
-      printf("\nResults written to %s\n", xml_file);
+    fprintf(tc__console(), "\nResults written to %s\n", xml_file);
+  }
+
+  if (bench_file) {
+    if (tc_write_bench_json(bench_file, sel.run) == 0) {
+      fprintf(tc__console(), "\nBenchmarks written to %s\n", bench_file);
+    }
+  }
+
+  if (bench_save) {
+    if (tc_write_bench_json(bench_save, sel.run) == 0) {
+      fprintf(tc__console(), "\nBenchmark baseline saved to %s\n",
+              bench_save);
     }
   }
 
-  return tc_print_summary(summary);
+  if (trace_file && tc_write_trace(trace_file) == 0)
+    fprintf(tc__console(), "\nTrace written to %s\n", trace_file);
+
+  if (cache_dir && tc__cache_save(&cache, sel.run) != 0)
+    fprintf(stderr, "Error: Cannot write cache '%s'\n", cache.path.data);
+  tc__cache_free(&cache);
+
+#ifdef TC__HAVE_IMPACT
+  if (tc__impact_on) {
+    tc__impact_on = 0;
+    if (tc__impact_save(impact_file, &impact, sel.cases.suites, sel.run) == 0)
+      fprintf(tc__console(), "\nImpact map written to %s\n", impact_file);
+    else
+      fprintf(stderr, "Error: Cannot write impact map '%s'\n", impact_file);
+    tc__coverage_clear();
+  }
+#endif
+
+  i = tc_print_summary(summary);
+  tc_clear_reporters();
+  tc__impact_free(&impact);
+  tc__selection_free(&sel);
+  return i;
 }